@@ -291,6 +291,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(test_sim_dualq)
+        {
+            int ret = sim_dualq_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(cleartext_pn_enc)
         {
             int ret = cleartext_pn_enc_test();
@@ -312,6 +319,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(cid_steering)
+        {
+            int ret = cid_steering_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(retry_protection_vector)
         {
             int ret = retry_protection_vector_test();
@@ -351,6 +365,34 @@ namespace UnitTest1
         {
             int ret = pacing_test();
 
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(pacing_gap)
+        {
+            int ret = pacing_gap_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(pacing_coalescing)
+        {
+            int ret = pacing_coalescing_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(wake_coalescing)
+        {
+            int ret = wake_coalescing_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(wake_batch)
+        {
+            int ret = wake_batch_test();
+
             Assert::AreEqual(ret, 0);
         }
 
@@ -809,6 +851,13 @@ namespace UnitTest1
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(sockloop_busy_poll)
+        {
+            int ret = sockloop_busy_poll_test();
+
+            Assert::AreEqual(ret, 0);
+        }
         
         TEST_METHOD(ticket_store)
         {
@@ -845,6 +894,27 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(token_filter)
+        {
+            int ret = token_filter_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(ticket_table)
+        {
+            int ret = ticket_table_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(path_bdp_cache)
+        {
+            int ret = path_bdp_cache_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(test_session_resume)
         {
             int ret = session_resume_test();
@@ -929,6 +999,41 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(mtu_cache)
+        {
+            int ret = mtu_cache_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(mtu_black_hole)
+        {
+            int ret = mtu_black_hole_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(mtu_bisect)
+        {
+            int ret = mtu_bisect_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(mtu_cache_learn)
+        {
+            int ret = mtu_cache_learn_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(jumbo)
+        {
+            int ret = jumbo_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(mtu_drop)
         {
             int ret = mtu_drop_test();
@@ -1349,6 +1454,13 @@ namespace UnitTest1
 
             Assert::AreEqual(ret, 0);
         }
+
+        TEST_METHOD(key_rotation_precompute)
+        {
+            int ret = key_rotation_precompute_test();
+
+            Assert::AreEqual(ret, 0);
+        }
         
         TEST_METHOD(key_rotation_server)
         {
@@ -1371,6 +1483,41 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(key_rotation_aead_limit)
+        {
+            int ret = key_rotation_aead_limit_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(stage_stats)
+        {
+            int ret = stage_stats_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(null_aead)
+        {
+            int ret = null_aead_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(handshake_packing)
+        {
+            int ret = handshake_packing_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(early_data)
+        {
+            int ret = early_data_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(false_migration)
         {
             int ret = false_migration_test();
@@ -1434,6 +1581,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(qlog_trace_sync)
+        {
+            int ret = qlog_trace_sync_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(qlog_trace_ecn)
         {
             int ret = qlog_trace_ecn_test();
@@ -1441,6 +1595,13 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(binlog_replay)
+        {
+            int ret = binlog_replay_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(path_packet_queue)
         {
             int ret = path_packet_queue_test();
@@ -1664,6 +1825,83 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(l4s_dualq_prague)
+        {
+            int ret = l4s_dualq_prague_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(l4s_dualq_cubic)
+        {
+            int ret = l4s_dualq_cubic_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(l4s_dualq_bbr)
+        {
+            int ret = l4s_dualq_bbr_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(l4s_dualq_coexist)
+        {
+            int ret = l4s_dualq_coexist_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(l4s_dualq_coexist_bbr)
+        {
+            int ret = l4s_dualq_coexist_bbr_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(cc_telemetry)
+        {
+            int ret = cc_telemetry_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(cc_experiment)
+        {
+            int ret = cc_experiment_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(cc_hystart_pp)
+        {
+            int ret = cc_hystart_pp_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(cc_careful_resume)
+        {
+            int ret = cc_careful_resume_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(resume_first_mb)
+        {
+            int ret = resume_first_mb_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(path_bdp_upload)
+        {
+            int ret = path_bdp_upload_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(long_rtt)
         {
             int ret = long_rtt_test();
@@ -2244,6 +2482,24 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(h3zero_router) {
+            int ret = h3zero_router_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(h3zero_router_shared) {
+            int ret = h3zero_router_shared_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(h3zero_router_bench) {
+            int ret = h3zero_router_bench_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(h3zero_null_sni) {
             int ret = h3zero_null_sni_test();
 
@@ -2262,6 +2518,18 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(h3zero_capsule) {
+            int ret = h3zero_capsule_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(h3zero_wt_capsule) {
+            int ret = h3zero_wt_capsule_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(parse_demo_scenario) {
             int ret = parse_demo_scenario_test();
 
@@ -2394,6 +2662,54 @@ namespace UnitTest1
             Assert::AreEqual(ret, 0);
         }
 
+        TEST_METHOD(h3zero_pool) {
+            int ret = h3zero_pool_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(h3zero_pool_goaway) {
+            int ret = h3zero_pool_goaway_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(h3zero_pool_zero_rtt) {
+            int ret = h3zero_pool_zero_rtt_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(h3zero_pool_bench) {
+            int ret = h3zero_pool_bench_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(masque_udp) {
+            int ret = masque_udp_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(masque_udp_bench) {
+            int ret = masque_udp_bench_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(masque_udp_internal) {
+            int ret = masque_udp_internal_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
+        TEST_METHOD(h3zero_wt_sessions) {
+            int ret = h3zero_wt_sessions_test();
+
+            Assert::AreEqual(ret, 0);
+        }
+
         TEST_METHOD(http_drop) {
             int ret = http_drop_test();
 
@@ -230,7 +230,7 @@ int wt_baton_client(char const * server_name, int server_port, char const * path
                 printf("\n");
                 /* Perform the initialization, settings and QPACK streams
                  */
-                ret = h3zero_protocol_init(cnx);
+                ret = h3zero_protocol_init_ctx(cnx, h3_ctx);
             }
         }
     }
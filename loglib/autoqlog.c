@@ -21,66 +21,290 @@
 
 /*
 * Manage the qlog option, i.e. create a qlog upon completion of a binary log
+*
+* The conversion from binary log to qlog reads and parses the whole binary
+* log. Doing that synchronously when the connection is closed stalls the
+* network thread, which is a problem when many connections close at the
+* same time. By default, the conversion is queued to a background worker
+* thread. The connection only copies the parameters of the conversion
+* (connection ID, file names) in the queue, so the worker does not depend
+* on the connection context. The queue is drained and the worker is stopped
+* when the QUIC context is freed, so all qlog files are present after
+* `picoquic_free` returns.
 */
 
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #include "logreader.h"
 #include "bytestream.h"
 #include "qlog.h"
 #include "picoquic_internal.h"
 #include "picoquic_binlog.h"
 #include "picoquic.h"
+#include "picoquic_utils.h"
+#include "autoqlog.h"
 
-int autoqlog(picoquic_cnx_t* cnx)
+#define AUTOQLOG_IDLE_WAIT 100000 /* Worker polls the stop flag every 100 ms if no signal is received. */
+
+typedef struct st_autoqlog_job_t {
+    struct st_autoqlog_job_t* next;
+    picoquic_connection_id_t initial_cnxid;
+    char* binlog_file_name;
+    char* qlog_file_name;
+    char* qlog_dir;
+    int delete_binlog;
+} autoqlog_job_t;
+
+typedef struct st_autoqlog_ctx_t {
+    picoquic_thread_t thread;
+    picoquic_mutex_t mutex;
+    picoquic_event_t event;
+    picoquic_event_t done_event;
+    autoqlog_job_t* first;
+    autoqlog_job_t* last;
+    unsigned int is_thread_started : 1;
+    unsigned int should_stop : 1;
+    unsigned int is_thread_done : 1;
+} autoqlog_ctx_t;
+
+static int autoqlog_convert(const picoquic_connection_id_t* initial_cnxid, char const* binlog_file_name,
+    char const* qlog_file_name, char const* qlog_dir, int delete_binlog)
 {
     int ret = 0;
-    uint64_t log_time = cnx->start_time;
+    uint64_t log_time = 0;
     uint16_t flags = 0;
-    FILE* f_binlog = picoquic_open_cc_log_file_for_read(cnx->binlog_file_name, &flags, &log_time);
+    FILE* f_binlog = picoquic_open_cc_log_file_for_read(binlog_file_name, &flags, &log_time);
     if (f_binlog == NULL) {
-        DBG_PRINTF("Cannot open file %s for reading.\n", cnx->binlog_file_name);
+        DBG_PRINTF("Cannot open file %s for reading.\n", binlog_file_name);
+        ret = -1;
+    }
+    else {
+        ret = qlog_convert(initial_cnxid, f_binlog, binlog_file_name, qlog_file_name, qlog_dir, flags);
+        picoquic_file_close(f_binlog);
+        if (ret != 0) {
+            DBG_PRINTF("Cannot convert file %s to qlog, err = %d.\n", binlog_file_name, ret);
+        }
+        else if (delete_binlog) {
+            int last_err = 0;
+            if ((ret = picoquic_file_delete(binlog_file_name, &last_err)) != 0) {
+                DBG_PRINTF("Cannot delete file %s to qlog, err = %d.\n", binlog_file_name, last_err);
+            }
+        }
+    }
+
+    return ret;
+}
+
+static int autoqlog_file_name(picoquic_cnx_t* cnx, char* filename, size_t filename_max)
+{
+    int ret = 0;
+    char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
+
+    if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), &cnx->initial_cnxid) != 0) {
+        DBG_PRINTF("Cannot convert connection id for %s", cnx->binlog_file_name);
         ret = -1;
     }
     else {
-        char filename[512];
-        char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
+        if (cnx->quic->use_unique_log_names) {
+            ret = picoquic_sprintf(filename, filename_max, NULL, "%s%s%s.%x.%s.%s",
+                cnx->quic->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name, cnx->log_unique,
+                (cnx->client_mode) ? "client" : "server", "qlog");
+        }
+        else {
+            ret = picoquic_sprintf(filename, filename_max, NULL, "%s%s%s.%s.%s",
+                cnx->quic->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name,
+                (cnx->client_mode) ? "client" : "server", "qlog");
+        }
 
-        if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), &cnx->initial_cnxid) != 0) {
-            DBG_PRINTF("Cannot convert connection id for %s", cnx->binlog_file_name);
+        if (ret != 0) {
+            DBG_PRINTF("Cannot format file name for connection %s in file %s", cid_name, cnx->binlog_file_name);
             ret = -1;
         }
-        else
-        {
-            int sprintf_ret = -1;
-            if (cnx->quic->use_unique_log_names) {
-                sprintf_ret = picoquic_sprintf(filename, sizeof(filename), NULL, "%s%s%s.%x.%s.%s",
-                    cnx->quic->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name, cnx->log_unique,
-                    (cnx->client_mode) ? "client" : "server", "qlog");
-            }
-            else {
-                sprintf_ret = picoquic_sprintf(filename, sizeof(filename), NULL, "%s%s%s.%s.%s",
-                    cnx->quic->qlog_dir, PICOQUIC_FILE_SEPARATOR, cid_name,
-                    (cnx->client_mode) ? "client" : "server", "qlog");
+    }
+
+    return ret;
+}
+
+static void autoqlog_job_free(autoqlog_job_t* job)
+{
+    (void)picoquic_string_free(job->binlog_file_name);
+    (void)picoquic_string_free(job->qlog_file_name);
+    (void)picoquic_string_free(job->qlog_dir);
+    free(job);
+}
+
+static autoqlog_job_t* autoqlog_job_dequeue(autoqlog_ctx_t* ctx)
+{
+    autoqlog_job_t* job = ctx->first;
+
+    if (job != NULL) {
+        ctx->first = job->next;
+        if (ctx->first == NULL) {
+            ctx->last = NULL;
+        }
+        job->next = NULL;
+    }
+    return job;
+}
+
+static picoquic_thread_return_t autoqlog_worker(void* v_ctx)
+{
+    autoqlog_ctx_t* ctx = (autoqlog_ctx_t*)v_ctx;
+    int should_stop = 0;
+
+    while (!should_stop) {
+        autoqlog_job_t* job;
+
+        (void)picoquic_lock_mutex(&ctx->mutex);
+        job = autoqlog_job_dequeue(ctx);
+        should_stop = (job == NULL && ctx->should_stop);
+        (void)picoquic_unlock_mutex(&ctx->mutex);
+
+        if (job != NULL) {
+            (void)autoqlog_convert(&job->initial_cnxid, job->binlog_file_name, job->qlog_file_name,
+                job->qlog_dir, job->delete_binlog);
+            autoqlog_job_free(job);
+        }
+        else if (!should_stop) {
+            (void)picoquic_wait_for_event(&ctx->event, AUTOQLOG_IDLE_WAIT);
+        }
+    }
+
+    (void)picoquic_lock_mutex(&ctx->mutex);
+    ctx->is_thread_done = 1;
+    (void)picoquic_unlock_mutex(&ctx->mutex);
+    (void)picoquic_signal_event(&ctx->done_event);
+
+    picoquic_thread_do_return;
+}
+
+/* Drain the queue and stop the worker. This is called from picoquic_free,
+ * after all connections have been deleted. The worker signals when it is done,
+ * so we do not rely on the time out of picoquic_delete_thread, which would
+ * interrupt a long conversion on Windows.
+ */
+static void autoqlog_free(picoquic_quic_t* quic)
+{
+    autoqlog_ctx_t* ctx = (autoqlog_ctx_t*)quic->v_autoqlog_ctx;
+
+    if (ctx != NULL) {
+        autoqlog_job_t* job;
+
+        if (ctx->is_thread_started) {
+            int is_done = 0;
+
+            (void)picoquic_lock_mutex(&ctx->mutex);
+            ctx->should_stop = 1;
+            (void)picoquic_unlock_mutex(&ctx->mutex);
+            (void)picoquic_signal_event(&ctx->event);
+
+            while (!is_done) {
+                (void)picoquic_wait_for_event(&ctx->done_event, AUTOQLOG_IDLE_WAIT);
+                (void)picoquic_lock_mutex(&ctx->mutex);
+                is_done = ctx->is_thread_done;
+                (void)picoquic_unlock_mutex(&ctx->mutex);
             }
+            picoquic_delete_thread(&ctx->thread);
+        }
+        /* Conversions left in the queue if the thread could not run are done now. */
+        while ((job = autoqlog_job_dequeue(ctx)) != NULL) {
+            (void)autoqlog_convert(&job->initial_cnxid, job->binlog_file_name, job->qlog_file_name,
+                job->qlog_dir, job->delete_binlog);
+            autoqlog_job_free(job);
+        }
+        picoquic_delete_event(&ctx->done_event);
+        picoquic_delete_event(&ctx->event);
+        (void)picoquic_delete_mutex(&ctx->mutex);
+        free(ctx);
+        quic->v_autoqlog_ctx = NULL;
+    }
+    quic->autoqlog_free_fn = NULL;
+}
 
-            if (sprintf_ret != 0) {
-                DBG_PRINTF("Cannot format file name for connection %s in file %s", cid_name, cnx->binlog_file_name);
-                ret = -1;
+static autoqlog_ctx_t* autoqlog_ctx_create(picoquic_quic_t* quic)
+{
+    autoqlog_ctx_t* ctx = (autoqlog_ctx_t*)malloc(sizeof(autoqlog_ctx_t));
+
+    if (ctx != NULL) {
+        memset(ctx, 0, sizeof(autoqlog_ctx_t));
+        if (picoquic_create_mutex(&ctx->mutex) != 0) {
+            free(ctx);
+            ctx = NULL;
+        }
+        else if (picoquic_create_event(&ctx->event) != 0) {
+            (void)picoquic_delete_mutex(&ctx->mutex);
+            free(ctx);
+            ctx = NULL;
+        }
+        else if (picoquic_create_event(&ctx->done_event) != 0) {
+            picoquic_delete_event(&ctx->event);
+            (void)picoquic_delete_mutex(&ctx->mutex);
+            free(ctx);
+            ctx = NULL;
+        }
+        else {
+            quic->v_autoqlog_ctx = (void*)ctx;
+            quic->autoqlog_free_fn = autoqlog_free;
+        }
+    }
+
+    return ctx;
+}
+
+/* Queue the conversion to the background worker. The worker thread is created
+ * when the first conversion is queued, so contexts that never close a connection
+ * do not start a thread. Returns -1 if the conversion cannot be queued, in which
+ * case the caller falls back to synchronous conversion.
+ */
+static int autoqlog_queue(picoquic_cnx_t* cnx, char const* filename)
+{
+    int ret = 0;
+    autoqlog_ctx_t* ctx = (autoqlog_ctx_t*)cnx->quic->v_autoqlog_ctx;
+    autoqlog_job_t* job = NULL;
+
+    if (ctx == NULL && (ctx = autoqlog_ctx_create(cnx->quic)) == NULL) {
+        ret = -1;
+    }
+    else if ((job = (autoqlog_job_t*)malloc(sizeof(autoqlog_job_t))) == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(job, 0, sizeof(autoqlog_job_t));
+        job->initial_cnxid = cnx->initial_cnxid;
+        job->delete_binlog = (cnx->quic->binlog_dir == NULL);
+        if ((job->binlog_file_name = picoquic_string_duplicate(cnx->binlog_file_name)) == NULL ||
+            (job->qlog_file_name = picoquic_string_duplicate(filename)) == NULL ||
+            (job->qlog_dir = picoquic_string_duplicate(cnx->quic->qlog_dir)) == NULL) {
+            autoqlog_job_free(job);
+            ret = -1;
+        }
+        else {
+            (void)picoquic_lock_mutex(&ctx->mutex);
+            if (!ctx->is_thread_started) {
+                if (picoquic_create_thread(&ctx->thread, autoqlog_worker, ctx) == 0) {
+                    ctx->is_thread_started = 1;
+                }
             }
-            else {
-                ret = qlog_convert(&cnx->initial_cnxid, f_binlog, cnx->binlog_file_name, filename, cnx->quic->qlog_dir, flags);
-                picoquic_file_close(f_binlog);
-                if (ret != 0) {
-                    DBG_PRINTF("Cannot convert file %s to qlog, err = %d.\n", cnx->binlog_file_name, ret);
+            if (ctx->is_thread_started) {
+                if (ctx->last == NULL) {
+                    ctx->first = job;
                 }
                 else {
-                    if (cnx->quic->binlog_dir == NULL) {
-                        int last_err = 0;
-                        if ((ret = picoquic_file_delete(cnx->binlog_file_name, &last_err)) != 0) {
-                            DBG_PRINTF("Cannot delete file %s to qlog, err = %d.\n", cnx->binlog_file_name, last_err);
-                        }
-                    }
+                    ctx->last->next = job;
                 }
+                ctx->last = job;
+            }
+            else {
+                ret = -1;
+            }
+            (void)picoquic_unlock_mutex(&ctx->mutex);
+
+            if (ret == 0) {
+                (void)picoquic_signal_event(&ctx->event);
+            }
+            else {
+                autoqlog_job_free(job);
             }
         }
     }
@@ -88,6 +312,25 @@ int autoqlog(picoquic_cnx_t* cnx)
     return ret;
 }
 
+int autoqlog(picoquic_cnx_t* cnx)
+{
+    int ret = 0;
+    char filename[512];
+
+    if (autoqlog_file_name(cnx, filename, sizeof(filename)) != 0) {
+        ret = -1;
+    }
+    else if (!cnx->quic->is_qlog_background_disabled && autoqlog_queue(cnx, filename) == 0) {
+        ret = 0;
+    }
+    else {
+        ret = autoqlog_convert(&cnx->initial_cnxid, cnx->binlog_file_name, filename,
+            cnx->quic->qlog_dir, cnx->quic->binlog_dir == NULL);
+    }
+
+    return ret;
+}
+
 int picoquic_set_qlog(picoquic_quic_t* quic, char const* qlog_dir)
 {
     quic->autoqlog_fn = autoqlog; 
@@ -95,4 +338,9 @@ int picoquic_set_qlog(picoquic_quic_t* quic, char const* qlog_dir)
     quic->qlog_dir = picoquic_string_free(quic->qlog_dir);
     quic->qlog_dir = picoquic_string_duplicate(qlog_dir);
     return 0;
-}
\ No newline at end of file
+}
+
+void picoquic_set_qlog_background(picoquic_quic_t* quic, int background_enabled)
+{
+    quic->is_qlog_background_disabled = (background_enabled) ? 0 : 1;
+}
@@ -32,11 +32,17 @@ extern "C" {
     * the qlog folder during the connection, and then deleted after the connection
     * is closed and the binary trace has been converted to qlog.
     * This conversion from binary to qlog consumes resource and can affect performance.
-    * Applications that are concerned about the performance issues should not use this
-    * option, and should instead use binary logs, from which qlogs can be extracted
-    * using the picolog_t app.
+    * By default, it is performed by a background thread, and the pending conversions
+    * are completed when the quic context is freed. Applications that are concerned
+    * about the performance issues should not use this option, and should instead use
+    * binary logs, from which qlogs can be extracted using the picolog_t app.
     */
 int picoquic_set_qlog(picoquic_quic_t* quic, char const* qlog_dir);
+/* Enable or disable the background conversion of binary logs to qlog. If disabled,
+ * the conversion is performed synchronously when the connection is closed, as in
+ * previous versions. Background conversion is enabled by default.
+ */
+void picoquic_set_qlog_background(picoquic_quic_t* quic, int background_enabled);
 
 #ifdef __cplusplus
 }
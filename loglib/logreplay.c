@@ -0,0 +1,554 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "bytestream.h"
+#include "logreader.h"
+#include "logreplay.h"
+
+typedef struct st_replay_context_t {
+    picoquic_quic_t* quic;
+    picoquic_cnx_t* cnx;
+    uint64_t simulated_time;
+    picoquic_congestion_algorithm_t const* cc_alg;
+    picoquic_replay_stats_t* stats;
+    /* Packet being rebuilt from the log */
+    int rxtx;
+    int is_broken;
+    picoquic_packet_header ph;
+    uint64_t packet_time;
+    uint64_t packet_length;
+    size_t frames_length;
+    uint8_t frames[PICOQUIC_MAX_PACKET_SIZE];
+} replay_context_t;
+
+static int replay_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    /* The replayed connection accepts and discards all data */
+    return 0;
+}
+
+static void replay_set_time(replay_context_t* ctx, uint64_t time)
+{
+    if (time > ctx->simulated_time) {
+        ctx->simulated_time = time;
+    }
+}
+
+static int replay_connection_start(uint64_t time, const picoquic_connection_id_t* cid, int client_mode,
+    uint32_t proposed_version, const picoquic_connection_id_t* remote_cnxid, void* ptr)
+{
+    int ret = 0;
+    replay_context_t* ctx = (replay_context_t*)ptr;
+    picoquic_tp_t tp;
+    struct sockaddr_in addr;
+
+    if (ctx->cnx != NULL) {
+        /* Only replay the first instance of the connection */
+        return 0;
+    }
+
+    replay_set_time(ctx, time);
+
+    /* Accept all streams and data, since the log does not tell the actual limits */
+    picoquic_init_transport_parameters(&tp, client_mode);
+    tp.initial_max_stream_data_bidi_local = UINT32_MAX;
+    tp.initial_max_stream_data_bidi_remote = UINT32_MAX;
+    tp.initial_max_stream_data_uni = UINT32_MAX;
+    tp.initial_max_data = UINT32_MAX;
+    tp.initial_max_stream_id_bidir = 0x100000;
+    tp.initial_max_stream_id_unidir = 0x100000;
+    tp.max_datagram_frame_size = PICOQUIC_MAX_PACKET_SIZE;
+    tp.enable_time_stamp = 3;
+    ret = picoquic_set_default_tp(ctx->quic, &tp);
+
+    if (ret == 0) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+
+        ctx->cnx = picoquic_create_cnx(ctx->quic, *cid, *remote_cnxid, (struct sockaddr*)&addr,
+            ctx->simulated_time, proposed_version, NULL, NULL, (char)client_mode);
+        if (ctx->cnx == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            picoquic_set_callback(ctx->cnx, replay_callback, ctx);
+            if (ctx->cc_alg != NULL) {
+                picoquic_set_congestion_algorithm(ctx->cnx, ctx->cc_alg);
+            }
+            /* The handshake is not replayed */
+            ctx->cnx->cnx_state = picoquic_state_ready;
+        }
+    }
+
+    return ret;
+}
+
+static int replay_connection_end(uint64_t time, void* ptr)
+{
+    replay_set_time((replay_context_t*)ptr, time);
+    return 0;
+}
+
+static int replay_ignore_event(uint64_t time, bytestream* s, void* ptr)
+{
+    return 0;
+}
+
+static int replay_ignore_path_event(uint64_t time, uint64_t path_id, bytestream* s, void* ptr)
+{
+    return 0;
+}
+
+static int replay_pdu(uint64_t time, int rxtx, bytestream* s, void* ptr)
+{
+    return 0;
+}
+
+static int replay_param_update(uint64_t time, bytestream* s, void* ptr)
+{
+    int ret = 0;
+    replay_context_t* ctx = (replay_context_t*)ptr;
+    uint64_t is_local = 0;
+    size_t param_length = 0;
+
+    ret |= byteread_vint(s, &is_local);
+    ret |= byteread_vlen(s, &param_length);
+
+    if (ret == 0 && !is_local && ctx->cnx != NULL && param_length <= bytestream_remain(s)) {
+        picoquic_cnx_t* cnx = ctx->cnx;
+        picoquic_state_enum cnx_state = cnx->cnx_state;
+        size_t consumed = 0;
+
+        /* The peer parameters set the ACK delay exponent and the negotiated options.
+         * Connection ID checks may fail, since the handshake was not replayed. */
+        if (picoquic_receive_transport_extensions(cnx, (cnx->client_mode) ? 1 : 0,
+            (uint8_t*)bytestream_ptr(s), param_length, &consumed) != 0) {
+            cnx->cnx_state = cnx_state;
+            cnx->local_error = 0;
+            ctx->stats->nb_decode_errors++;
+        }
+    }
+
+    return ret;
+}
+
+/* Rebuild a stream or datagram frame, of which the log only contains the
+ * header and at most a few bytes of content. The content is padded with
+ * zeroes to the logged length.
+ */
+static uint8_t* replay_rebuild_data_frame(const uint8_t* bytes, size_t length, uint8_t* out, uint8_t* out_max)
+{
+    const uint8_t* bytes_max = bytes + length;
+    uint8_t ftype = bytes[0];
+    uint64_t stream_id = 0;
+    uint64_t offset = 0;
+    uint64_t data_length = 0;
+    int is_stream = PICOQUIC_IN_RANGE(ftype, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max);
+
+    bytes++;
+    if (is_stream) {
+        /* The log always includes the length, even if the frame did not */
+        if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &stream_id)) != NULL &&
+            (ftype & 4) != 0) {
+            bytes = picoquic_frames_varint_decode(bytes, bytes_max, &offset);
+        }
+        if (bytes != NULL) {
+            bytes = picoquic_frames_varint_decode(bytes, bytes_max, &data_length);
+        }
+        if (bytes != NULL &&
+            ((out = picoquic_frames_uint8_encode(out, out_max, ftype | 2)) == NULL ||
+            (out = picoquic_frames_varint_encode(out, out_max, stream_id)) == NULL ||
+            ((ftype & 4) != 0 && (out = picoquic_frames_varint_encode(out, out_max, offset)) == NULL))) {
+            bytes = NULL;
+        }
+    }
+    else {
+        /* Datagram frame. If the length was not logged, use an empty frame */
+        if ((ftype & 1) != 0) {
+            bytes = picoquic_frames_varint_decode(bytes, bytes_max, &data_length);
+        }
+        if (bytes != NULL && (out = picoquic_frames_uint8_encode(out, out_max, ftype | 1)) == NULL) {
+            bytes = NULL;
+        }
+    }
+
+    if (bytes != NULL && (out = picoquic_frames_varint_encode(out, out_max, data_length)) != NULL) {
+        size_t logged = bytes_max - bytes;
+
+        if (data_length > (uint64_t)(out_max - out)) {
+            out = NULL;
+        }
+        else {
+            if (logged > data_length) {
+                logged = (size_t)data_length;
+            }
+            memcpy(out, bytes, logged);
+            memset(out + logged, 0, (size_t)data_length - logged);
+            out += data_length;
+        }
+    }
+    else {
+        out = NULL;
+    }
+
+    return out;
+}
+
+static int replay_packet_start(uint64_t time, uint64_t path_id, uint64_t size, const picoquic_packet_header* ph, int rxtx, void* ptr)
+{
+    replay_context_t* ctx = (replay_context_t*)ptr;
+
+    ctx->rxtx = rxtx;
+    ctx->is_broken = 0;
+    ctx->ph = *ph;
+    ctx->packet_time = time;
+    ctx->packet_length = size;
+    ctx->frames_length = 0;
+
+    return 0;
+}
+
+static int replay_packet_frame(bytestream* s, void* ptr)
+{
+    replay_context_t* ctx = (replay_context_t*)ptr;
+    const uint8_t* bytes = bytestream_data(s);
+    size_t length = bytestream_size(s);
+    uint8_t* out = ctx->frames + ctx->frames_length;
+    uint8_t* out_max = ctx->frames + sizeof(ctx->frames);
+
+    if (length == 0 || ctx->is_broken) {
+        return 0;
+    }
+
+    if (PICOQUIC_IN_RANGE(bytes[0], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max) ||
+        bytes[0] == picoquic_frame_type_datagram || bytes[0] == picoquic_frame_type_datagram_l) {
+        out = replay_rebuild_data_frame(bytes, length, out, out_max);
+    }
+    else if (bytes[0] == picoquic_frame_type_crypto_hs) {
+        /* The content of crypto frames is not logged, and the TLS state is not replayed */
+        ctx->stats->nb_frames_skipped++;
+    }
+    else if (length <= (size_t)(out_max - out)) {
+        memcpy(out, bytes, length);
+        out += length;
+    }
+    else {
+        out = NULL;
+    }
+
+    if (out == NULL) {
+        /* Cannot rebuild this frame. Skip it, and the rest of the packet */
+        ctx->stats->nb_frames_skipped++;
+        ctx->is_broken = 1;
+    }
+    else {
+        ctx->frames_length = out - ctx->frames;
+    }
+
+    return 0;
+}
+
+static void replay_receive_packet(replay_context_t* ctx)
+{
+    picoquic_cnx_t* cnx = ctx->cnx;
+    picoquic_path_t* path_x = cnx->path[0];
+    picoquic_state_enum cnx_state = cnx->cnx_state;
+    int epoch = (ctx->ph.ptype == picoquic_packet_0rtt_protected) ? picoquic_epoch_0rtt : picoquic_epoch_1rtt;
+    uint64_t start_time;
+
+    (void)picoquic_record_pn_received(cnx, picoquic_packet_context_application, path_x->p_local_cnxid,
+        ctx->ph.pn64, ctx->simulated_time);
+    cnx->nb_packets_received++;
+    cnx->latest_receive_time = ctx->simulated_time;
+
+    start_time = picoquic_current_time();
+    if (picoquic_decode_frames(cnx, path_x, ctx->frames, ctx->frames_length, NULL, epoch,
+        (struct sockaddr*)&path_x->peer_addr, (struct sockaddr*)&path_x->local_addr,
+        ctx->ph.pn64, 0, ctx->simulated_time) != 0) {
+        ctx->stats->nb_decode_errors++;
+        if (cnx_state == picoquic_state_ready && cnx->cnx_state != picoquic_state_ready) {
+            /* Keep replaying after the error */
+            cnx->cnx_state = cnx_state;
+            cnx->local_error = 0;
+        }
+    }
+    ctx->stats->decode_time_total += picoquic_current_time() - start_time;
+    ctx->stats->nb_packets_received++;
+}
+
+static int replay_send_packet(replay_context_t* ctx)
+{
+    int ret = 0;
+    picoquic_cnx_t* cnx = ctx->cnx;
+    picoquic_path_t* path_x = cnx->path[0];
+    picoquic_packet_context_t* pkt_ctx = &cnx->pkt_ctx[picoquic_packet_context_application];
+    picoquic_packet_t* packet = picoquic_create_packet(ctx->quic);
+
+    if (packet == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        size_t length = (size_t)ctx->packet_length;
+        size_t byte_index = 0;
+        int is_pure_ack = 1;
+
+        if (length < ctx->frames_length) {
+            length = ctx->frames_length;
+        }
+        if (length > packet->bytes_size) {
+            length = packet->bytes_size;
+        }
+        memcpy(packet->bytes, ctx->frames, ctx->frames_length);
+
+        while (byte_index < ctx->frames_length) {
+            size_t consumed = 0;
+            int frame_is_pure_ack = 0;
+
+            if (picoquic_skip_frame(ctx->frames + byte_index, ctx->frames_length - byte_index,
+                &consumed, &frame_is_pure_ack) != 0) {
+                break;
+            }
+            is_pure_ack &= frame_is_pure_ack;
+            byte_index += consumed;
+        }
+
+        packet->ptype = ctx->ph.ptype;
+        packet->pc = picoquic_packet_context_application;
+        packet->offset = 0;
+        packet->length = length;
+        packet->sequence_number = ctx->ph.pn64;
+        packet->send_time = ctx->simulated_time;
+        packet->send_path = path_x;
+        packet->is_pure_ack = is_pure_ack;
+        packet->path_packet_number = path_x->path_packet_number++;
+        packet->delivered_prior = path_x->delivered_last;
+        packet->delivered_time_prior = path_x->delivered_time_last;
+        packet->delivered_sent_prior = path_x->delivered_sent_last;
+        packet->delivered_app_limited = (path_x->delivered_limited_index != 0);
+
+        if (ctx->ph.pn64 >= pkt_ctx->send_sequence) {
+            pkt_ctx->send_sequence = ctx->ph.pn64 + 1;
+        }
+        path_x->latest_sent_time = ctx->simulated_time;
+        path_x->last_sent_time = ctx->simulated_time;
+        path_x->bytes_sent += length;
+        cnx->nb_packets_sent++;
+
+        picoquic_queue_for_retransmit(cnx, path_x, packet, length, ctx->simulated_time);
+        ctx->stats->nb_packets_sent++;
+    }
+
+    return ret;
+}
+
+static int replay_packet_end(void* ptr)
+{
+    int ret = 0;
+    replay_context_t* ctx = (replay_context_t*)ptr;
+
+    if (ctx->cnx == NULL || (ctx->ph.ptype != picoquic_packet_1rtt_protected &&
+        ctx->ph.ptype != picoquic_packet_0rtt_protected)) {
+        ctx->stats->nb_packets_skipped++;
+    }
+    else {
+        replay_set_time(ctx, ctx->packet_time);
+        if (ctx->rxtx) {
+            replay_receive_packet(ctx);
+        }
+        else {
+            ret = replay_send_packet(ctx);
+        }
+    }
+
+    return ret;
+}
+
+static int replay_packet_lost(uint64_t time, uint64_t path_id, bytestream* s, void* ptr)
+{
+    int ret = 0;
+    replay_context_t* ctx = (replay_context_t*)ptr;
+    uint64_t ptype = 0;
+    uint64_t sequence = 0;
+    char trigger[64];
+
+    ret |= byteread_vint(s, &ptype);
+    ret |= byteread_vint(s, &sequence);
+    ret |= byteread_cstr(s, trigger, sizeof(trigger));
+
+    if (ret == 0 && ctx->cnx != NULL && ptype == picoquic_packet_1rtt_protected) {
+        picoquic_cnx_t* cnx = ctx->cnx;
+        picoquic_packet_context_t* pkt_ctx = &cnx->pkt_ctx[picoquic_packet_context_application];
+        picoquic_packet_t* packet = pkt_ctx->retransmit_oldest;
+
+        replay_set_time(ctx, time);
+
+        while (packet != NULL && packet->sequence_number != sequence) {
+            packet = packet->previous_packet;
+        }
+
+        if (packet != NULL) {
+            picoquic_path_t* old_path = packet->send_path;
+            int is_timer = (strcmp(trigger, "timer") == 0);
+            int is_pure_ack = packet->is_pure_ack;
+
+            (void)picoquic_dequeue_retransmit_packet(cnx, pkt_ctx, packet, is_pure_ack);
+            /* As in the sender, the loss of ACK only packets is not a congestion signal */
+            if (!is_pure_ack) {
+                cnx->nb_retransmission_total++;
+                old_path->nb_losses_found++;
+                old_path->total_bytes_lost += packet->length;
+                if (cnx->congestion_alg != NULL) {
+                    cnx->congestion_alg->alg_notify(cnx, old_path,
+                        (is_timer) ? picoquic_congestion_notification_timeout : picoquic_congestion_notification_repeat,
+                        0, 0, 0, sequence, ctx->simulated_time);
+                }
+            }
+            ctx->stats->nb_packets_lost++;
+        }
+    }
+
+    return ret;
+}
+
+static int replay_cc_update(uint64_t time, uint64_t path_id, bytestream* s, void* ptr)
+{
+    int ret = 0;
+    replay_context_t* ctx = (replay_context_t*)ptr;
+    uint64_t packet_rcvd = 0;
+    uint64_t cwin = 0;
+    uint64_t smoothed_rtt = 0;
+
+    ret |= byteread_skip_vint(s); /* sequence */
+    ret |= byteread_vint(s, &packet_rcvd);
+    if (packet_rcvd != 0) {
+        ret |= byteread_skip_vint(s); /* highest ack */
+        ret |= byteread_skip_vint(s); /* high ack time */
+        ret |= byteread_skip_vint(s); /* last time ack */
+    }
+    ret |= byteread_vint(s, &cwin);
+    ret |= byteread_skip_vint(s); /* one way delay */
+    ret |= byteread_skip_vint(s); /* rtt sample */
+    ret |= byteread_vint(s, &smoothed_rtt);
+
+    if (ret == 0 && ctx->cnx != NULL && path_id == 0) {
+        picoquic_path_t* path_x = ctx->cnx->path[0];
+        uint64_t cwin_delta = (path_x->cwin > cwin) ? path_x->cwin - cwin : cwin - path_x->cwin;
+        uint64_t rtt_delta = (path_x->smoothed_rtt > smoothed_rtt) ?
+            path_x->smoothed_rtt - smoothed_rtt : smoothed_rtt - path_x->smoothed_rtt;
+
+        ctx->stats->nb_cc_updates++;
+        if (cwin_delta > cwin / 8 || rtt_delta > smoothed_rtt / 8) {
+            if (ctx->stats->nb_cc_divergences == 0) {
+                ctx->stats->first_divergence_time = time;
+            }
+            ctx->stats->nb_cc_divergences++;
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_binlog_replay(FILE* f_binlog, const picoquic_connection_id_t* cid,
+    picoquic_congestion_algorithm_t const* cc_alg, picoquic_replay_stats_t* stats)
+{
+    int ret = 0;
+    replay_context_t* ctx = (replay_context_t*)malloc(sizeof(replay_context_t));
+
+    memset(stats, 0, sizeof(picoquic_replay_stats_t));
+
+    if (ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(ctx, 0, sizeof(replay_context_t));
+        ctx->cc_alg = cc_alg;
+        ctx->stats = stats;
+        ctx->quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+            ctx->simulated_time, &ctx->simulated_time, NULL, NULL, 0);
+        if (ctx->quic == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            binlog_convert_cb_t callbacks;
+
+            callbacks.connection_start = replay_connection_start;
+            callbacks.connection_end = replay_connection_end;
+            callbacks.alpn_update = replay_ignore_event;
+            callbacks.param_update = replay_param_update;
+            callbacks.pdu = replay_pdu;
+            callbacks.packet_start = replay_packet_start;
+            callbacks.packet_frame = replay_packet_frame;
+            callbacks.packet_end = replay_packet_end;
+            callbacks.packet_lost = replay_packet_lost;
+            callbacks.packet_dropped = replay_ignore_path_event;
+            callbacks.packet_buffered = replay_ignore_path_event;
+            callbacks.cc_update = replay_cc_update;
+            callbacks.info_message = replay_ignore_event;
+            callbacks.ptr = ctx;
+
+            ret = binlog_convert(f_binlog, cid, &callbacks);
+
+            for (int stage = 0; stage < picoquic_stage_max; stage++) {
+                (void)picoquic_get_stage_stats(ctx->quic, (picoquic_stage_enum)stage, &stats->stage_stats[stage]);
+            }
+
+            picoquic_free(ctx->quic);
+        }
+        free(ctx);
+    }
+
+    return ret;
+}
+
+void picoquic_replay_report(FILE* F, const picoquic_replay_stats_t* stats)
+{
+    fprintf(F, "Packets received: %" PRIu64 ", sent: %" PRIu64 ", lost: %" PRIu64 ", skipped: %" PRIu64 "\n",
+        stats->nb_packets_received, stats->nb_packets_sent, stats->nb_packets_lost, stats->nb_packets_skipped);
+    fprintf(F, "Frames skipped: %" PRIu64 ", decode errors: %" PRIu64 "\n",
+        stats->nb_frames_skipped, stats->nb_decode_errors);
+    fprintf(F, "CC updates: %" PRIu64 ", divergences: %" PRIu64,
+        stats->nb_cc_updates, stats->nb_cc_divergences);
+    if (stats->nb_cc_divergences > 0) {
+        fprintf(F, ", first at: %" PRIu64, stats->first_divergence_time);
+    }
+    fprintf(F, "\n");
+    if (stats->nb_packets_received > 0) {
+        fprintf(F, "Frame decode time: %" PRIu64 " us, %.3f us per packet\n", stats->decode_time_total,
+            ((double)stats->decode_time_total) / ((double)stats->nb_packets_received));
+    }
+    for (int stage = 0; stage < picoquic_stage_max; stage++) {
+        const picoquic_stage_stats_t* s = &stats->stage_stats[stage];
+
+        if (s->nb_calls > 0) {
+            fprintf(F, "Stage %s: %" PRIu64 " calls, %.1f cycles per call\n",
+                picoquic_stage_name((picoquic_stage_enum)stage), s->nb_calls,
+                ((double)s->nb_cycles) / ((double)s->nb_calls));
+        }
+    }
+}
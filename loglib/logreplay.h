@@ -0,0 +1,88 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef LOGREPLAY_H
+#define LOGREPLAY_H
+
+#include <stdio.h>
+#include "picoquic_internal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Replay of binary logs.
+ *
+ * The replay reads the binary log of one connection, and drives a fresh
+ * connection context with the packets recorded in the log, using the
+ * logged times as simulated time. The replayed connection plays the role
+ * of the side that produced the log:
+ *
+ * - received 1-RTT and 0-RTT packets are processed by the frame decoder,
+ * - sent packets are queued as if they had just been sent, so that the
+ *   ACK processing, RTT estimation and congestion control see the same
+ *   packets in flight as the original connection,
+ * - packets declared lost in the log are removed from the queue and
+ *   notified to the congestion control.
+ *
+ * The binary log does not contain the TLS handshake or the content of
+ * stream frames. Handshake packets are skipped, CRYPTO frames are dropped,
+ * and stream and datagram frames are rebuilt with their logged length
+ * and zero-filled content. Flow control limits are not enforced.
+ *
+ * At each congestion control update found in the log, the logged CWIN and
+ * smoothed RTT are compared with the replayed values. A difference of more
+ * than 1/8th of the logged value counts as a divergence. Divergences are
+ * expected: the RTT samples of the handshake are not replayed, the log does
+ * not tell when the sender was application limited, and timers and loss
+ * detection do not run, so losses only happen where the log says so.
+ */
+
+typedef struct st_picoquic_replay_stats_t {
+    uint64_t nb_packets_received; /* received packets processed by the frame decoder */
+    uint64_t nb_packets_sent; /* sent packets queued for ACK processing */
+    uint64_t nb_packets_lost; /* sent packets declared lost in the log */
+    uint64_t nb_packets_skipped; /* handshake packets, or packets received before the connection started */
+    uint64_t nb_frames_skipped; /* frames that could not be rebuilt from the log */
+    uint64_t nb_decode_errors; /* received packets rejected by the frame decoder */
+    uint64_t nb_cc_updates; /* congestion control updates found in the log */
+    uint64_t nb_cc_divergences; /* updates where the replayed state differs from the log */
+    uint64_t first_divergence_time; /* log time of the first divergence, if any */
+    uint64_t decode_time_total; /* wall time spent in the frame decoder, microseconds. Excludes packet parsing and decryption */
+    picoquic_stage_stats_t stage_stats[picoquic_stage_max]; /* if compiled with PICOQUIC_WITH_STAGE_CYCLES */
+} picoquic_replay_stats_t;
+
+/* Replay the connection identified by "cid" in the binary log file. If
+ * cc_alg is not NULL, the replayed connection uses that congestion control
+ * algorithm instead of the default.
+ */
+int picoquic_binlog_replay(FILE* f_binlog, const picoquic_connection_id_t* cid,
+    picoquic_congestion_algorithm_t const* cc_alg, picoquic_replay_stats_t* stats);
+
+/* Print a short report of the replay statistics */
+void picoquic_replay_report(FILE* F, const picoquic_replay_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOGREPLAY_H */
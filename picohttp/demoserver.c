@@ -69,6 +69,7 @@ static picoquic_h09_server_callback_ctx_t* first_server_callback_create_context(
             ctx->path_table = param->path_table;
             ctx->path_table_nb = param->path_table_nb;
             ctx->web_folder = param->web_folder;
+            (void)h3zero_callback_router_init(ctx, param);
         }
     }
 
@@ -334,7 +335,8 @@ int picoquic_h09_server_process_data(picoquic_cnx_t* cnx,
             size_t available = length - processed;
 
             if (stream_ctx->post_received == 0 && available > 0) {
-                int path_item = picohttp_find_path_item(stream_ctx->ps.hq.path, stream_ctx->ps.hq.path_length, app_ctx->path_table, app_ctx->path_table_nb);
+                int path_item = h3zero_callback_find_path_item(app_ctx, stream_ctx->ps.hq.path, stream_ctx->ps.hq.path_length,
+                    &stream_ctx->route_match);
                 if (path_item >= 0) {
                     stream_ctx->path_callback = app_ctx->path_table[path_item].path_callback;
                     stream_ctx->path_callback(cnx, (uint8_t*)stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, picohttp_callback_post, stream_ctx, 
@@ -385,7 +387,8 @@ int picoquic_h09_server_process_data(picoquic_cnx_t* cnx,
             }
             else if (stream_ctx->ps.hq.method == 1) {
                 if (stream_ctx->post_received == 0) {
-                    int path_item = picohttp_find_path_item(stream_ctx->ps.hq.path, stream_ctx->ps.hq.path_length, app_ctx->path_table, app_ctx->path_table_nb);
+                    int path_item = h3zero_callback_find_path_item(app_ctx, stream_ctx->ps.hq.path, stream_ctx->ps.hq.path_length,
+                        &stream_ctx->route_match);
                     if (path_item >= 0) {
                         /* TODO-POST: move this code to post-fin callback.*/
                         stream_ctx->path_callback = app_ctx->path_table[path_item].path_callback;
@@ -1080,14 +1080,6 @@ uint8_t * h3zero_parse_data_stream(uint8_t * bytes, uint8_t * bytes_max,
                     *error_found = H3ZERO_INTERNAL_ERROR;
                     bytes = NULL;
                 }
-                else {
-                    stream_state->current_frame = (uint8_t *)malloc((size_t)stream_state->current_frame_length);
-                    if (stream_state->current_frame == NULL) {
-                        /* error, internal error */
-                        *error_found = H3ZERO_INTERNAL_ERROR;
-                        bytes = NULL;
-                    }
-                }
             }
             else if (stream_state->current_frame_type == h3zero_frame_webtransport_stream) {
                 if (stream_state->header_found) {
@@ -1128,20 +1120,39 @@ uint8_t * h3zero_parse_data_stream(uint8_t * bytes, uint8_t * bytes_max,
             }
 
             if (stream_state->current_frame_type == h3zero_frame_header) {
-                memcpy(stream_state->current_frame + stream_state->current_frame_read, bytes, available);
+                uint8_t* frame = NULL;
+
+                if (stream_state->current_frame_read == 0 && available >= stream_state->current_frame_length) {
+                    /* The whole frame is in the input bytes, parse it in place */
+                    frame = bytes;
+                }
+                else {
+                    /* The frame is split across several chunks, accumulate it */
+                    if (stream_state->current_frame == NULL) {
+                        stream_state->current_frame = (uint8_t*)malloc((size_t)stream_state->current_frame_length);
+                        if (stream_state->current_frame == NULL) {
+                            /* error, internal error */
+                            *error_found = H3ZERO_INTERNAL_ERROR;
+                            return NULL;
+                        }
+                    }
+                    memcpy(stream_state->current_frame + stream_state->current_frame_read, bytes, available);
+                    if (stream_state->current_frame_read + available >= stream_state->current_frame_length) {
+                        frame = stream_state->current_frame;
+                    }
+                }
                 stream_state->current_frame_read += available;
                 bytes += available;
 
-                if (stream_state->current_frame_read >= stream_state->current_frame_length) {
+                if (frame != NULL) {
                     uint8_t* parsed;
                     h3zero_header_parts_t* parts = (stream_state->header_found) ?
                         &stream_state->trailer : &stream_state->header;
                     stream_state->trailer_found = stream_state->header_found;
                     stream_state->header_found = 1;
                     /* parse */
-                    parsed = h3zero_parse_qpack_header_frame(stream_state->current_frame,
-                        stream_state->current_frame + stream_state->current_frame_length, parts);
-                    if (parsed == NULL || (size_t)(parsed - stream_state->current_frame) != stream_state->current_frame_length) {
+                    parsed = h3zero_parse_qpack_header_frame(frame, frame + stream_state->current_frame_length, parts);
+                    if (parsed == NULL || (size_t)(parsed - frame) != stream_state->current_frame_length) {
                         /* protocol error */
                         *error_found = H3ZERO_FRAME_ERROR;
                         bytes = NULL;
@@ -1149,8 +1160,10 @@ uint8_t * h3zero_parse_data_stream(uint8_t * bytes, uint8_t * bytes_max,
                     /* free resource */
                     stream_state->frame_header_parsed = 0;
                     stream_state->frame_header_read = 0;
-                    free(stream_state->current_frame);
-                    stream_state->current_frame = NULL;
+                    if (stream_state->current_frame != NULL) {
+                        free(stream_state->current_frame);
+                        stream_state->current_frame = NULL;
+                    }
                 }
             }
             else if (stream_state->current_frame_type == h3zero_frame_data) {
@@ -33,6 +33,8 @@
 #include "tls_api.h"
 #include "h3zero.h"
 #include "h3zero_common.h"
+#include "h3zero_router.h"
+#include "h3zero_uri.h"
 
 
 
@@ -130,6 +132,7 @@ picohttp_server_stream_ctx_t * h3zero_find_or_create_stream(
 			memset(stream_ctx, 0, sizeof(picohttp_server_stream_ctx_t));
 			stream_ctx->stream_id = stream_id;
 			stream_ctx->control_stream_id = UINT64_MAX;
+			stream_ctx->route_match.path_item = -1;
 			stream_ctx->is_h3 = is_h3;
 			stream_ctx->cnx = cnx;
 			if (!IS_BIDIR_STREAM_ID(stream_id)) {
@@ -272,13 +275,18 @@ uint64_t h3zero_parse_stream_prefix(uint8_t* buffer_8, size_t* nb_in_buffer, uin
 	return prefix;
 }
 
-int h3zero_protocol_init(picoquic_cnx_t* cnx)
+int h3zero_protocol_init_ctx(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx)
 {
 	uint8_t decoder_stream_head = 0x03;
 	uint8_t encoder_stream_head = 0x02;
 	uint64_t settings_stream_id = picoquic_get_next_local_stream_id(cnx, 1);
 	int ret = picoquic_add_to_stream(cnx, settings_stream_id, h3zero_default_setting_frame, h3zero_default_setting_frame_size, 0);
 
+	if (ret == 0 && ctx != NULL) {
+		/* The settings are sent on the control stream */
+		ctx->local_control_stream_id = settings_stream_id;
+	}
+
 	if (ret == 0) {
 		/* set the settings stream the first stream to write! */
 		ret = picoquic_set_stream_priority(cnx, settings_stream_id, 0);
@@ -304,6 +312,11 @@ int h3zero_protocol_init(picoquic_cnx_t* cnx)
 	return ret;
 }
 
+int h3zero_protocol_init(picoquic_cnx_t* cnx)
+{
+	return h3zero_protocol_init_ctx(cnx, NULL);
+}
+
 /* Parse the first bytes of an unidir stream, and determine what to do with that stream.
  */
 uint8_t* h3zero_parse_incoming_remote_stream(
@@ -393,6 +406,61 @@ uint8_t* h3zero_parse_incoming_remote_stream(
 	return bytes;
 }
 
+/* Process the frames received on the peer's control stream.
+ * The only frame acted upon is GOAWAY, which tells the client that requests
+ * on streams with an ID greater or equal to the GOAWAY ID will not be
+ * processed. The other frames, including SETTINGS, are ignored for now.
+ */
+static int h3zero_process_control_stream(uint8_t* bytes, uint8_t* bytes_max, h3zero_callback_ctx_t* ctx)
+{
+	int ret = 0;
+
+	while (ret == 0 && bytes < bytes_max) {
+		bytes = (uint8_t*)h3zero_accumulate_capsule(bytes, bytes_max, &ctx->control_frame);
+		if (bytes == NULL) {
+			ret = -1;
+		}
+		else if (ctx->control_frame.is_stored) {
+			if (ctx->control_frame.capsule_type == h3zero_frame_goaway) {
+				uint64_t goaway_stream_id = 0;
+				if (picoquic_frames_varint_decode(ctx->control_frame.value,
+					ctx->control_frame.value + ctx->control_frame.capsule_length, &goaway_stream_id) == NULL) {
+					ret = -1;
+				}
+				else {
+					ctx->goaway_received = 1;
+					ctx->goaway_stream_id = goaway_stream_id;
+				}
+			}
+		}
+	}
+
+	return ret;
+}
+
+int h3zero_send_goaway(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx, uint64_t stream_id)
+{
+	uint8_t buffer[32];
+	uint8_t* bytes = buffer;
+	uint8_t* bytes_max = buffer + sizeof(buffer);
+	uint64_t control_stream_id = ctx->local_control_stream_id;
+	int ret = 0;
+
+	if (control_stream_id == UINT64_MAX) {
+		ret = -1;
+	}
+	else if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, h3zero_frame_goaway)) == NULL ||
+		(bytes = picoquic_frames_varint_encode(bytes, bytes_max, picoquic_frames_varint_encode_length(stream_id))) == NULL ||
+		(bytes = picoquic_frames_varint_encode(bytes, bytes_max, stream_id)) == NULL) {
+		ret = -1;
+	}
+	else {
+		ret = picoquic_add_to_stream(cnx, control_stream_id, buffer, bytes - buffer, 0);
+	}
+
+	return ret;
+}
+
 /*
 * HTTP 3.0 common call back.
 */
@@ -408,6 +476,7 @@ h3zero_callback_ctx_t* h3zero_callback_create_context(picohttp_server_parameters
 
 	if (ctx != NULL) {
 		memset(ctx, 0, sizeof(h3zero_callback_ctx_t));
+		ctx->local_control_stream_id = UINT64_MAX;
 
 		h3zero_init_stream_tree(&ctx->h3_stream_tree);
 
@@ -415,6 +484,7 @@ h3zero_callback_ctx_t* h3zero_callback_create_context(picohttp_server_parameters
 			ctx->path_table = param->path_table;
 			ctx->path_table_nb = param->path_table_nb;
 			ctx->web_folder = param->web_folder;
+			(void)h3zero_callback_router_init(ctx, param);
 		}
 	}
 
@@ -425,9 +495,40 @@ void h3zero_callback_delete_context(picoquic_cnx_t* cnx, h3zero_callback_ctx_t*
 {
 	h3zero_delete_all_stream_prefixes(cnx, ctx);
 	picosplay_empty_tree(&ctx->h3_stream_tree);
+	h3zero_release_capsule(&ctx->control_frame);
 	free(ctx);
 }
 
+/* Set the router used to find path items. The router is kept in the server
+* parameters, so the path table is only compiled for the first connection.
+* If that fails, the router is left NULL, and the lookup falls back to
+* scanning the path table.
+*/
+int h3zero_callback_router_init(h3zero_callback_ctx_t* ctx, picohttp_server_parameters_t* param)
+{
+	int ret = 0;
+
+	if (param->router == NULL && param->path_table_nb > 0) {
+		param->router = h3zero_router_create(param->path_table, param->path_table_nb);
+		param->is_router_compiled = (param->router != NULL);
+		if (param->router == NULL) {
+			ret = -1;
+		}
+	}
+	ctx->router = param->router;
+
+	return ret;
+}
+
+void h3zero_server_parameters_release(picohttp_server_parameters_t* param)
+{
+	if (param->is_router_compiled) {
+		h3zero_router_delete(param->router);
+		param->router = NULL;
+		param->is_router_compiled = 0;
+	}
+}
+
 /* The picoquic callback bundles DATA and FIN. 
 * We maintain this bundling, so the application has complete control on
 * the stream context.
@@ -474,6 +575,13 @@ int h3zero_process_remote_stream(picoquic_cnx_t* cnx,
 			picoquic_log_app_message(cnx, "Cannot parse incoming stream: %"PRIu64, stream_id);
 			ret = -1;
 		}
+		else if (!IS_BIDIR_STREAM_ID(stream_id) && stream_ctx->ps.stream_state.frame_header_parsed &&
+			stream_ctx->ps.stream_state.current_frame_type == h3zero_stream_type_control) {
+			if (h3zero_process_control_stream(bytes, bytes_max, ctx) != 0) {
+				picoquic_log_app_message(cnx, "Cannot parse control stream: %"PRIu64, stream_id);
+				ret = picoquic_close(cnx, H3ZERO_FRAME_ERROR);
+			}
+		}
 		else {
 			ret = h3zero_post_data_or_fin(cnx, bytes, bytes_max - bytes, fin_or_event, stream_ctx);
 		}
@@ -530,6 +638,40 @@ int h3zero_find_path_item(const uint8_t * path, size_t path_length, const picoht
 	return -1;
 }
 
+int h3zero_callback_find_path_item(h3zero_callback_ctx_t* ctx, const uint8_t* path, size_t path_length,
+	h3zero_route_match_t* match)
+{
+	int path_item;
+
+	if (ctx->router != NULL) {
+		path_item = h3zero_router_find(ctx->router, path, path_length, match);
+	}
+	else {
+		path_item = h3zero_find_path_item(path, path_length, ctx->path_table, ctx->path_table_nb);
+		if (match != NULL) {
+			match->path_item = path_item;
+			match->path_length = h3zero_pathabempty_length(path, path_length);
+			match->query_offset = h3zero_query_offset(path, path_length);
+			match->nb_params = 0;
+		}
+	}
+	return path_item;
+}
+
+int h3zero_stream_route_param(picohttp_server_stream_ctx_t* stream_ctx, size_t rank,
+	const uint8_t** value, size_t* value_length)
+{
+	const uint8_t* path = (stream_ctx->is_h3) ? stream_ctx->ps.stream_state.header.path : stream_ctx->ps.hq.path;
+
+	if (path == NULL || stream_ctx->route_match.path_item < 0 || rank >= stream_ctx->route_match.nb_params) {
+		return -1;
+	}
+	*value = path + stream_ctx->route_match.params[rank].offset;
+	*value_length = stream_ctx->route_match.params[rank].length;
+
+	return 0;
+}
+
 
 /* Processing of the request frame.
 * This function is called after the client's stream is closed,
@@ -575,7 +717,8 @@ int h3zero_process_request_frame(
 	else if (stream_ctx->ps.stream_state.header.method == h3zero_method_post) {
 		/* Manage Post. */
 		if (stream_ctx->path_callback == NULL && stream_ctx->post_received == 0) {
-			int path_item = h3zero_find_path_item(stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, app_ctx->path_table, app_ctx->path_table_nb);
+			int path_item = h3zero_callback_find_path_item(app_ctx, stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length,
+				&stream_ctx->route_match);
 			if (path_item >= 0) {
 				/* TODO-POST: move this code to post-fin callback.*/
 				stream_ctx->path_callback = app_ctx->path_table[path_item].path_callback;
@@ -604,7 +747,8 @@ int h3zero_process_request_frame(
 		/* The connect handling depends on the requested protocol */
 
 		if (stream_ctx->path_callback == NULL) {
-			int path_item = h3zero_find_path_item(stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, app_ctx->path_table, app_ctx->path_table_nb);
+			int path_item = h3zero_callback_find_path_item(app_ctx, stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length,
+				&stream_ctx->route_match);
 			if (path_item >= 0) {
 				stream_ctx->path_callback = app_ctx->path_table[path_item].path_callback;
 				if (stream_ctx->path_callback(cnx, (uint8_t*)stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, picohttp_callback_connect,
@@ -764,7 +908,8 @@ int h3zero_callback_server_data(
 								}
 							}
 						} else if (stream_ctx->ps.stream_state.header_found && stream_ctx->post_received == 0) {
-							int path_item = h3zero_find_path_item(stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, ctx->path_table, ctx->path_table_nb);
+							int path_item = h3zero_callback_find_path_item(ctx, stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length,
+								&stream_ctx->route_match);
 							if (path_item >= 0) {
 								stream_ctx->path_callback = ctx->path_table[path_item].path_callback;
 								stream_ctx->path_callback(cnx, (uint8_t*)stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, picohttp_callback_post,
@@ -940,7 +1085,12 @@ int h3zero_callback_client_data(picoquic_cnx_t* cnx,
 									ret = picoquic_open_flow_control(cnx, stream_id, stream_ctx->ps.stream_state.current_frame_length);
 								}
 							}
-							if (ret == 0 && ctx->no_disk == 0) {
+							if (ret == 0 && stream_ctx->path_callback != NULL && !stream_ctx->ps.stream_state.is_upgrade_requested) {
+								/* Response to a request managed by the application, e.g., the client pool */
+								ret = stream_ctx->path_callback(cnx, bytes, available_data, picohttp_callback_post_data,
+									stream_ctx, stream_ctx->path_callback_ctx);
+							}
+							else if (ret == 0 && ctx->no_disk == 0) {
 								ret = (fwrite(bytes, 1, available_data, stream_ctx->F) > 0) ? 0 : -1;
 								if (ret != 0) {
 									picoquic_log_app_message(cnx,
@@ -1120,7 +1270,7 @@ int h3zero_callback_datagram(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
 		/* find the control stream context, using the full stream ID */
 		h3zero_stream_prefix_t* prefix_ctx = h3zero_find_stream_prefix(h3_ctx, quarter_stream_id*4);
 
-		if (prefix_ctx->function_call == NULL) {
+		if (prefix_ctx == NULL || prefix_ctx->function_call == NULL) {
 			/* Should signal the error HTTP_DATAGRAM_ERROR */
 		} else {
 			picohttp_server_stream_ctx_t* stream_ctx = h3zero_find_stream(h3_ctx, prefix_ctx->prefix);
@@ -1161,6 +1311,11 @@ uint8_t* h3zero_provide_datagram_buffer(void* context, size_t length, int ready_
 	return ret_buffer;
 }
 
+size_t h3zero_get_provided_datagram_length(void* context)
+{
+	return ((h3zero_prepare_datagram_ctx_t*)context)->application_length;
+}
+
 static int h3zero_callback_prepare_datagram_in_context(picoquic_cnx_t* cnx, void* context, size_t space, h3zero_callback_ctx_t* h3_ctx, h3zero_stream_prefix_t* prefix_ctx)
 {
 	/* Poll this prefix. Intercept the data writing callback so the quarter stream ID can be inserted.
@@ -1284,7 +1439,7 @@ int h3zero_callback(picoquic_cnx_t* cnx,
 		}
 		else {
 			picoquic_set_callback(cnx, h3zero_callback, ctx);
-			ret = h3zero_protocol_init(cnx);
+			ret = h3zero_protocol_init_ctx(cnx, ctx);
 		}
 	} else{
 		ctx = (h3zero_callback_ctx_t*)callback_ctx;
@@ -1499,6 +1654,10 @@ const uint8_t* h3zero_settings_decode(const uint8_t* bytes, const uint8_t* bytes
 
 /* TLV buffer accumulator.
 * This is commonly used when parsing data streams.
+* If the value of the capsule is entirely contained in the input bytes, it is
+* not copied: the value pointer is set to the input bytes. The value is only
+* copied to the scratch buffer if it is split across several chunks. The scratch
+* buffer is kept between capsules, and only freed when the capsule is released.
 */
 
 void h3zero_release_capsule(h3zero_capsule_t* capsule)
@@ -1517,6 +1676,9 @@ const uint8_t* h3zero_accumulate_capsule(const uint8_t* bytes, const uint8_t* by
 		capsule->header_read = 0;
 		capsule->capsule_type = 0;
 		capsule->capsule_length = 0;
+		capsule->value_read = 0;
+		capsule->value = NULL;
+		capsule->is_length_known = 0;
 		capsule->is_stored = 0;
 	}
 	if (!capsule->is_length_known) {
@@ -1567,7 +1729,20 @@ const uint8_t* h3zero_accumulate_capsule(const uint8_t* bytes, const uint8_t* by
 			}
 		}
 	}
-	if (capsule->is_length_known) {
+	if (capsule->is_length_known && capsule->capsule_length == 0) {
+		/* Empty capsule, there is no value to accumulate */
+		capsule->value = bytes;
+		capsule->is_stored = 1;
+	}
+	else if (capsule->is_length_known && capsule->value_read == 0 &&
+		bytes != NULL && (size_t)(bytes_max - bytes) >= capsule->capsule_length) {
+		/* Whole value available in the input, no copy needed */
+		capsule->value = bytes;
+		capsule->value_read = capsule->capsule_length;
+		bytes += capsule->capsule_length;
+		capsule->is_stored = 1;
+	}
+	else if (capsule->is_length_known) {
 		if (capsule->capsule_buffer_size < capsule->capsule_length) {
 			uint8_t* capsule_buffer = (uint8_t*)malloc(capsule->capsule_length);
 			if (capsule_buffer != NULL && capsule->value_read > 0) {
@@ -1592,6 +1767,7 @@ const uint8_t* h3zero_accumulate_capsule(const uint8_t* bytes, const uint8_t* by
 			bytes += available;
 			capsule->value_read += available;
 			if (capsule->value_read >= capsule->capsule_length) {
+				capsule->value = capsule->capsule;
 				capsule->is_stored = 1;
 			}
 		}
@@ -65,6 +65,23 @@ extern "C" {
         void* path_app_ctx;
     } picohttp_server_path_item_t;
 
+    /* Result of the path lookup. The offsets of the parameter segments
+     * and of the query are relative to the start of the request path. */
+#define H3ZERO_ROUTER_MAX_PARAMS 8
+
+    typedef struct st_h3zero_route_param_t {
+        size_t offset;
+        size_t length;
+    } h3zero_route_param_t;
+
+    typedef struct st_h3zero_route_match_t {
+        int path_item; /* Index of the item in the path table, -1 if no match */
+        size_t path_length; /* Length of the path before the query string */
+        size_t query_offset; /* Offset of the query after the '?', or path_length if no query */
+        size_t nb_params;
+        h3zero_route_param_t params[H3ZERO_ROUTER_MAX_PARAMS];
+    } h3zero_route_match_t;
+
     /* Define stream context common to http 3 and http 09 callbacks
     */
 #define PICOHTTP_SERVER_FRAME_MAX 1024
@@ -117,6 +134,8 @@ extern "C" {
         uint64_t control_stream_id;
         picohttp_post_data_cb_fn path_callback;
         void* path_callback_ctx;
+        /* Path item and parameters found for the request */
+        h3zero_route_match_t route_match;
     } picohttp_server_stream_ctx_t;
 
     void* picohttp_stream_node_value(picosplay_node_t* node);
@@ -132,6 +151,11 @@ extern "C" {
         size_t capsule_buffer_size;
         uint64_t capsule_type;
         size_t capsule_length;
+        /* Value of the stored capsule. Points directly into the input bytes if the
+         * capsule was received in a single chunk, and is only valid until these bytes
+         * are released. Otherwise, points to the scratch buffer. */
+        const uint8_t* value;
+        /* Scratch buffer for capsules split across chunks, reused across capsules */
         uint8_t* capsule;
         unsigned int is_length_known:1;
         unsigned int is_stored;
@@ -168,17 +192,36 @@ extern "C" {
     int h3zero_client_create_stream_request(
         uint8_t * buffer, size_t max_bytes, uint8_t const * path, size_t path_len, uint64_t post_size, const char * host, size_t * consumed);
 
-    /* Common callback definitions */
+    /* Common callback definitions.
+     * The path table is compiled in a router once per server parameters,
+     * when the first connection is created, and the router is shared by
+     * all connections. The application may also compile the router itself
+     * with h3zero_router_create and set it in the parameters. A router
+     * compiled by h3zero is deleted by h3zero_server_parameters_release,
+     * after the last connection using the parameters is deleted. */
+    struct st_h3zero_router_t;
+
     typedef struct st_picohttp_server_parameters_t {
         char const* web_folder;
         picohttp_server_path_item_t* path_table;
         size_t path_table_nb;
+        struct st_h3zero_router_t* router;
+        unsigned int is_router_compiled : 1;
     } picohttp_server_parameters_t;
 
+    void h3zero_server_parameters_release(picohttp_server_parameters_t* param);
+
     typedef struct st_h3zero_callback_ctx_t {
         picosplay_tree_t h3_stream_tree;
         picohttp_server_path_item_t * path_table;
         size_t path_table_nb;
+        struct st_h3zero_router_t* router;
+        /* Frames received on the peer's control stream */
+        h3zero_capsule_t control_frame;
+        uint64_t goaway_stream_id;
+        unsigned int goaway_received : 1;
+        /* Local control stream, opened by h3zero_protocol_init_ctx */
+        uint64_t local_control_stream_id;
         char const* web_folder;
         /* connection wide tracking of stream prefixes */
         h3zero_stream_prefixes_t stream_prefixes;
@@ -193,7 +236,18 @@ extern "C" {
     } h3zero_callback_ctx_t;
 
     h3zero_callback_ctx_t* h3zero_callback_create_context(picohttp_server_parameters_t* param);
+    /* Same as h3zero_protocol_init, and record the local control stream in the context */
+    int h3zero_protocol_init_ctx(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx);
     void h3zero_callback_delete_context(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx);
+    int h3zero_callback_router_init(h3zero_callback_ctx_t* ctx, picohttp_server_parameters_t* param);
+    int h3zero_find_path_item(const uint8_t* path, size_t path_length, const picohttp_server_path_item_t* path_table, size_t path_table_nb);
+    /* Find the path item for the request path. If match is not NULL, it receives
+     * the path item, the query offset, and the parameter segments of the route. */
+    int h3zero_callback_find_path_item(h3zero_callback_ctx_t* ctx, const uint8_t* path, size_t path_length,
+        h3zero_route_match_t* match);
+    /* Get the value of a parameter segment of the route found for the stream request */
+    int h3zero_stream_route_param(picohttp_server_stream_ctx_t* stream_ctx, size_t rank,
+        const uint8_t** value, size_t* value_length);
 
     int h3zero_post_data_or_fin(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length, picoquic_call_back_event_t fin_or_event, picohttp_server_stream_ctx_t* stream_ctx);
 
@@ -216,8 +270,17 @@ extern "C" {
 
     void h3zero_forget_stream(picoquic_cnx_t* cnx, picohttp_server_stream_ctx_t* stream_ctx);
 
+    int h3zero_client_close_stream(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx, picohttp_server_stream_ctx_t* stream_ctx);
+
+    /* Send a GOAWAY frame on the local control stream. The peer should not
+     * send requests on streams with an ID greater or equal to stream_id.
+     * Fails if the control stream was not opened with h3zero_protocol_init_ctx. */
+    int h3zero_send_goaway(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* ctx, uint64_t stream_id);
+
     int h3zero_set_datagram_ready(picoquic_cnx_t* cnx, uint64_t stream_id);
     uint8_t* h3zero_provide_datagram_buffer(void* context, size_t length, int ready_to_send);
+    /* Length requested by the last call to h3zero_provide_datagram_buffer in this context */
+    size_t h3zero_get_provided_datagram_length(void* context);
 
     int h3zero_callback(picoquic_cnx_t* cnx,
         uint64_t stream_id, uint8_t* bytes, size_t length,
@@ -0,0 +1,703 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* HTTP/3 client connection pool.
+ *
+ * Requests are queued per origin until a connection has stream credit.
+ * The pool tracks for each connection the list of requests in progress,
+ * so they can be queued again if the server sends GOAWAY, or if the
+ * connection breaks before the response header was received.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "h3zero.h"
+#include "h3zero_common.h"
+#include "h3zero_pool.h"
+
+typedef struct st_h3zero_pool_request_t {
+    struct st_h3zero_pool_request_t* next;
+    struct st_h3zero_pool_request_t* previous;
+    struct st_h3zero_pool_origin_t* origin;
+    struct st_h3zero_pool_cnx_t* pool_cnx;
+    picohttp_server_stream_ctx_t* stream_ctx;
+    uint64_t request_id;
+    uint64_t stream_id;
+    char* path;
+    size_t path_length;
+    h3zero_pool_response_fn response_fn;
+    void* request_ctx;
+    int status;
+    int nb_retries;
+} h3zero_pool_request_t;
+
+typedef struct st_h3zero_pool_request_list_t {
+    h3zero_pool_request_t* first;
+    h3zero_pool_request_t* last;
+} h3zero_pool_request_list_t;
+
+typedef struct st_h3zero_pool_cnx_t {
+    struct st_h3zero_pool_cnx_t* next;
+    struct st_h3zero_pool_cnx_t* previous;
+    struct st_h3zero_pool_origin_t* origin;
+    picoquic_cnx_t* cnx;
+    h3zero_callback_ctx_t* h3_ctx;
+    h3zero_pool_request_list_t active;
+    size_t nb_active;
+    uint64_t last_activity;
+    unsigned int was_ready : 1;
+    unsigned int is_draining : 1;
+    unsigned int is_closing : 1;
+} h3zero_pool_cnx_t;
+
+typedef struct st_h3zero_pool_origin_t {
+    struct st_h3zero_pool_origin_t* next;
+    h3zero_pool_t* pool;
+    struct sockaddr_storage addr;
+    char* sni;
+    h3zero_pool_request_list_t pending;
+    h3zero_pool_cnx_t* first_cnx;
+    h3zero_pool_cnx_t* last_cnx;
+    size_t nb_cnx;
+} h3zero_pool_origin_t;
+
+struct st_h3zero_pool_t {
+    picoquic_quic_t* quic;
+    size_t max_cnx_per_origin;
+    size_t max_requests_per_cnx;
+    uint64_t idle_timeout;
+    h3zero_pool_origin_t* first_origin;
+    uint64_t next_request_id;
+    size_t nb_pending;
+    size_t nb_active;
+    size_t nb_cnx;
+    h3zero_pool_stats_t stats;
+};
+
+static void h3zero_pool_list_append(h3zero_pool_request_list_t* list, h3zero_pool_request_t* request)
+{
+    request->next = NULL;
+    request->previous = list->last;
+    if (list->last == NULL) {
+        list->first = request;
+    }
+    else {
+        list->last->next = request;
+    }
+    list->last = request;
+}
+
+static void h3zero_pool_list_remove(h3zero_pool_request_list_t* list, h3zero_pool_request_t* request)
+{
+    if (request->previous == NULL) {
+        list->first = request->next;
+    }
+    else {
+        request->previous->next = request->next;
+    }
+    if (request->next == NULL) {
+        list->last = request->previous;
+    }
+    else {
+        request->next->previous = request->previous;
+    }
+    request->next = NULL;
+    request->previous = NULL;
+}
+
+static void h3zero_pool_notify(h3zero_pool_t* pool, h3zero_pool_request_t* request,
+    h3zero_pool_event_enum event, const uint8_t* bytes, size_t length)
+{
+    if (request->response_fn != NULL) {
+        request->response_fn(pool, request->request_id, event, request->status, bytes, length, request->request_ctx);
+    }
+}
+
+/* Remove the request from the active list of its connection, and remove
+ * the reference from the stream context. The stream context itself is
+ * managed by the caller. */
+static void h3zero_pool_request_detach(h3zero_pool_t* pool, h3zero_pool_request_t* request)
+{
+    if (request->pool_cnx != NULL) {
+        h3zero_pool_list_remove(&request->pool_cnx->active, request);
+        request->pool_cnx->nb_active--;
+        request->pool_cnx = NULL;
+        pool->nb_active--;
+    }
+    if (request->stream_ctx != NULL) {
+        request->stream_ctx->path_callback = NULL;
+        request->stream_ctx->path_callback_ctx = NULL;
+        request->stream_ctx = NULL;
+    }
+}
+
+static void h3zero_pool_request_finish(h3zero_pool_t* pool, h3zero_pool_request_t* request, h3zero_pool_event_enum event)
+{
+    h3zero_pool_request_detach(pool, request);
+    if (event == h3zero_pool_event_complete) {
+        pool->stats.nb_completed++;
+    }
+    else {
+        pool->stats.nb_failed++;
+    }
+    h3zero_pool_notify(pool, request, event, NULL, 0);
+    free(request->path);
+    free(request);
+}
+
+static void h3zero_pool_request_requeue(h3zero_pool_t* pool, h3zero_pool_request_t* request)
+{
+    h3zero_pool_request_detach(pool, request);
+    request->nb_retries++;
+    request->status = 0;
+    request->stream_id = UINT64_MAX;
+    h3zero_pool_list_append(&request->origin->pending, request);
+    pool->nb_pending++;
+    pool->stats.nb_retried++;
+}
+
+/* Release the stream context of a request on a connection that remains open.
+ * If the stream is not finished, it is reset and the peer is asked to
+ * stop sending. */
+static void h3zero_pool_release_stream(h3zero_pool_cnx_t* pool_cnx, picohttp_server_stream_ctx_t* stream_ctx, int is_cancelled)
+{
+    if (is_cancelled) {
+        (void)picoquic_reset_stream(pool_cnx->cnx, stream_ctx->stream_id, H3ZERO_REQUEST_CANCELLED);
+        (void)picoquic_stop_sending(pool_cnx->cnx, stream_ctx->stream_id, H3ZERO_REQUEST_CANCELLED);
+    }
+    (void)h3zero_client_close_stream(pool_cnx->cnx, pool_cnx->h3_ctx, stream_ctx);
+    h3zero_delete_stream(pool_cnx->cnx, pool_cnx->h3_ctx, stream_ctx);
+}
+
+/* Callback from the h3zero stream processing, for streams created by the pool. */
+static int h3zero_pool_stream_callback(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t event, picohttp_server_stream_ctx_t* stream_ctx, void* path_app_ctx)
+{
+    h3zero_pool_request_t* request = (h3zero_pool_request_t*)path_app_ctx;
+    h3zero_pool_t* pool;
+    h3zero_pool_cnx_t* pool_cnx;
+
+    if (request == NULL) {
+        return 0;
+    }
+    pool = request->origin->pool;
+    pool_cnx = request->pool_cnx;
+    if (pool_cnx != NULL) {
+        pool_cnx->last_activity = picoquic_get_quic_time(pool->quic);
+    }
+
+    switch (event) {
+    case picohttp_callback_connect_accepted:
+    case picohttp_callback_connect_refused:
+        request->status = stream_ctx->ps.stream_state.header.status;
+        h3zero_pool_notify(pool, request, h3zero_pool_event_header, NULL, 0);
+        break;
+    case picohttp_callback_post_data:
+        h3zero_pool_notify(pool, request, h3zero_pool_event_data, bytes, length);
+        break;
+    case picohttp_callback_post_fin:
+        h3zero_pool_request_finish(pool, request, h3zero_pool_event_complete);
+        if (pool_cnx != NULL && cnx != NULL) {
+            h3zero_pool_release_stream(pool_cnx, stream_ctx, 0);
+        }
+        break;
+    case picohttp_callback_reset:
+        /* The stream context is released by the h3zero code after this call */
+        h3zero_pool_request_finish(pool, request, h3zero_pool_event_failed);
+        break;
+    case picohttp_callback_free:
+        /* The stream context is being deleted, e.g., when the pool is deleted */
+        request->stream_ctx = NULL;
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static int h3zero_pool_cnx_has_credit(h3zero_pool_t* pool, h3zero_pool_cnx_t* pool_cnx)
+{
+    int has_credit = 0;
+
+    if (!pool_cnx->is_draining && !pool_cnx->is_closing && !pool_cnx->h3_ctx->connection_closed &&
+        (pool->max_requests_per_cnx == 0 || pool_cnx->nb_active < pool->max_requests_per_cnx)) {
+        picoquic_state_enum cnx_state = picoquic_get_cnx_state(pool_cnx->cnx);
+
+        if (cnx_state < picoquic_state_client_ready_start) {
+            has_credit = picoquic_is_0rtt_available(pool_cnx->cnx) != 0 &&
+                cnx_state != picoquic_state_handshake_failure &&
+                cnx_state != picoquic_state_handshake_failure_resend;
+        }
+        else {
+            has_credit = cnx_state <= picoquic_state_ready;
+        }
+        if (has_credit) {
+            uint64_t next_stream_id = picoquic_get_next_local_stream_id(pool_cnx->cnx, 0);
+            has_credit = STREAM_RANK_FROM_ID(next_stream_id) <= STREAM_RANK_FROM_ID(pool_cnx->cnx->max_stream_id_bidir_remote);
+        }
+    }
+
+    return has_credit;
+}
+
+/* Select the least loaded connection that can accept a new request */
+static h3zero_pool_cnx_t* h3zero_pool_select_cnx(h3zero_pool_t* pool, h3zero_pool_origin_t* origin)
+{
+    h3zero_pool_cnx_t* selected = NULL;
+    h3zero_pool_cnx_t* pool_cnx = origin->first_cnx;
+
+    while (pool_cnx != NULL) {
+        if ((selected == NULL || pool_cnx->nb_active < selected->nb_active) &&
+            h3zero_pool_cnx_has_credit(pool, pool_cnx)) {
+            selected = pool_cnx;
+        }
+        pool_cnx = pool_cnx->next;
+    }
+
+    return selected;
+}
+
+static int h3zero_pool_origin_in_handshake(h3zero_pool_origin_t* origin)
+{
+    h3zero_pool_cnx_t* pool_cnx = origin->first_cnx;
+
+    while (pool_cnx != NULL) {
+        if (!pool_cnx->is_closing && !pool_cnx->h3_ctx->connection_closed &&
+            picoquic_get_cnx_state(pool_cnx->cnx) < picoquic_state_client_ready_start) {
+            return 1;
+        }
+        pool_cnx = pool_cnx->next;
+    }
+
+    return 0;
+}
+
+static h3zero_pool_cnx_t* h3zero_pool_cnx_create(h3zero_pool_t* pool, h3zero_pool_origin_t* origin, uint64_t current_time)
+{
+    h3zero_pool_cnx_t* pool_cnx = (h3zero_pool_cnx_t*)malloc(sizeof(h3zero_pool_cnx_t));
+
+    if (pool_cnx != NULL) {
+        memset(pool_cnx, 0, sizeof(h3zero_pool_cnx_t));
+        pool_cnx->origin = origin;
+        pool_cnx->last_activity = current_time;
+        pool_cnx->h3_ctx = h3zero_callback_create_context(NULL);
+        if (pool_cnx->h3_ctx == NULL) {
+            free(pool_cnx);
+            pool_cnx = NULL;
+        }
+        else {
+            pool_cnx->h3_ctx->no_disk = 1;
+            pool_cnx->h3_ctx->no_print = 1;
+            pool_cnx->cnx = picoquic_create_cnx(pool->quic, picoquic_null_connection_id, picoquic_null_connection_id,
+                (struct sockaddr*)&origin->addr, current_time, 0, origin->sni, H3ZERO_POOL_ALPN, 1);
+            if (pool_cnx->cnx == NULL) {
+                h3zero_callback_delete_context(NULL, pool_cnx->h3_ctx);
+                free(pool_cnx);
+                pool_cnx = NULL;
+            }
+            else {
+                picoquic_set_callback(pool_cnx->cnx, h3zero_callback, pool_cnx->h3_ctx);
+                if (picoquic_start_client_cnx(pool_cnx->cnx) != 0 ||
+                    h3zero_protocol_init_ctx(pool_cnx->cnx, pool_cnx->h3_ctx) != 0) {
+                    picoquic_set_callback(pool_cnx->cnx, NULL, NULL);
+                    picoquic_delete_cnx(pool_cnx->cnx);
+                    h3zero_callback_delete_context(NULL, pool_cnx->h3_ctx);
+                    free(pool_cnx);
+                    pool_cnx = NULL;
+                }
+                else {
+                    pool_cnx->previous = origin->last_cnx;
+                    if (origin->last_cnx == NULL) {
+                        origin->first_cnx = pool_cnx;
+                    }
+                    else {
+                        origin->last_cnx->next = pool_cnx;
+                    }
+                    origin->last_cnx = pool_cnx;
+                    origin->nb_cnx++;
+                    pool->nb_cnx++;
+                    pool->stats.nb_cnx_created++;
+                    if (picoquic_is_0rtt_available(pool_cnx->cnx)) {
+                        pool->stats.nb_cnx_zero_rtt++;
+                    }
+                }
+            }
+        }
+    }
+
+    return pool_cnx;
+}
+
+static void h3zero_pool_cnx_delete(h3zero_pool_t* pool, h3zero_pool_cnx_t* pool_cnx)
+{
+    h3zero_pool_origin_t* origin = pool_cnx->origin;
+
+    if (pool_cnx->previous == NULL) {
+        origin->first_cnx = pool_cnx->next;
+    }
+    else {
+        pool_cnx->previous->next = pool_cnx->next;
+    }
+    if (pool_cnx->next == NULL) {
+        origin->last_cnx = pool_cnx->previous;
+    }
+    else {
+        pool_cnx->next->previous = pool_cnx->previous;
+    }
+    origin->nb_cnx--;
+    pool->nb_cnx--;
+
+    /* Requests should have been dispatched before this call. If some remain,
+     * e.g. when the pool is deleted, they are detached from the streams before
+     * the stream contexts are released. */
+    while (pool_cnx->active.first != NULL) {
+        h3zero_pool_request_finish(pool, pool_cnx->active.first, h3zero_pool_event_failed);
+    }
+    h3zero_callback_delete_context(pool_cnx->cnx, pool_cnx->h3_ctx);
+    picoquic_set_callback(pool_cnx->cnx, NULL, NULL);
+    picoquic_delete_cnx(pool_cnx->cnx);
+    free(pool_cnx);
+}
+
+static int h3zero_pool_request_start(h3zero_pool_t* pool, h3zero_pool_cnx_t* pool_cnx, h3zero_pool_request_t* request, uint64_t current_time)
+{
+    int ret = 0;
+    uint8_t buffer[1024];
+    size_t consumed = 0;
+    uint64_t stream_id = picoquic_get_next_local_stream_id(pool_cnx->cnx, 0);
+    picohttp_server_stream_ctx_t* stream_ctx = h3zero_find_or_create_stream(pool_cnx->cnx, stream_id, pool_cnx->h3_ctx, 1, 1);
+
+    if (stream_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        ret = h3zero_client_create_stream_request(buffer, sizeof(buffer), (uint8_t const*)request->path, request->path_length,
+            0, request->origin->sni, &consumed);
+        if (ret == 0) {
+            stream_ctx->is_open = 1;
+            pool_cnx->h3_ctx->nb_open_streams++;
+            ret = picoquic_add_to_stream_with_ctx(pool_cnx->cnx, stream_id, buffer, consumed, 1, stream_ctx);
+        }
+        if (ret == 0) {
+            stream_ctx->path_callback = h3zero_pool_stream_callback;
+            stream_ctx->path_callback_ctx = request;
+            request->stream_ctx = stream_ctx;
+            request->stream_id = stream_id;
+            request->pool_cnx = pool_cnx;
+            h3zero_pool_list_append(&pool_cnx->active, request);
+            pool_cnx->nb_active++;
+            pool_cnx->last_activity = current_time;
+            pool->nb_active++;
+        }
+        else {
+            h3zero_pool_release_stream(pool_cnx, stream_ctx, 0);
+        }
+    }
+
+    return ret;
+}
+
+/* Dispatch the pending requests of an origin on the available connections,
+ * creating new connections if needed and allowed. */
+static int h3zero_pool_dispatch(h3zero_pool_t* pool, h3zero_pool_origin_t* origin, uint64_t current_time)
+{
+    int ret = 0;
+
+    while (ret == 0 && origin->pending.first != NULL) {
+        h3zero_pool_request_t* request;
+        h3zero_pool_cnx_t* pool_cnx = h3zero_pool_select_cnx(pool, origin);
+
+        if (pool_cnx == NULL) {
+            if (origin->nb_cnx < pool->max_cnx_per_origin && !h3zero_pool_origin_in_handshake(origin)) {
+                if (h3zero_pool_cnx_create(pool, origin, current_time) == NULL) {
+                    ret = PICOQUIC_ERROR_MEMORY;
+                }
+                continue;
+            }
+            break;
+        }
+        request = origin->pending.first;
+        h3zero_pool_list_remove(&origin->pending, request);
+        pool->nb_pending--;
+        if (h3zero_pool_request_start(pool, pool_cnx, request, current_time) != 0) {
+            h3zero_pool_request_finish(pool, request, h3zero_pool_event_failed);
+        }
+    }
+
+    return ret;
+}
+
+/* Manage the connection state. Returns 1 if the connection was deleted. */
+static int h3zero_pool_cnx_check(h3zero_pool_t* pool, h3zero_pool_cnx_t* pool_cnx, uint64_t current_time)
+{
+    picoquic_state_enum cnx_state = picoquic_get_cnx_state(pool_cnx->cnx);
+
+    if (cnx_state >= picoquic_state_client_ready_start && cnx_state <= picoquic_state_ready) {
+        pool_cnx->was_ready = 1;
+    }
+
+    if (cnx_state == picoquic_state_disconnected || pool_cnx->h3_ctx->connection_closed) {
+        h3zero_pool_origin_t* origin = pool_cnx->origin;
+        h3zero_pool_request_t* request;
+
+        /* Requests that did not receive a response can be tried again */
+        while ((request = pool_cnx->active.first) != NULL) {
+            if (request->status == 0 && request->nb_retries < H3ZERO_POOL_MAX_RETRIES) {
+                h3zero_pool_request_requeue(pool, request);
+            }
+            else {
+                h3zero_pool_request_finish(pool, request, h3zero_pool_event_failed);
+            }
+        }
+        if (!pool_cnx->was_ready) {
+            /* The handshake failed. Count that as an attempt for the pending
+             * requests, so the pool does not retry an unreachable origin forever. */
+            h3zero_pool_request_t* next = origin->pending.first;
+            while ((request = next) != NULL) {
+                next = request->next;
+                if (request->nb_retries >= H3ZERO_POOL_MAX_RETRIES) {
+                    h3zero_pool_list_remove(&origin->pending, request);
+                    pool->nb_pending--;
+                    h3zero_pool_request_finish(pool, request, h3zero_pool_event_failed);
+                }
+                else {
+                    request->nb_retries++;
+                }
+            }
+        }
+        h3zero_pool_cnx_delete(pool, pool_cnx);
+        return 1;
+    }
+
+    if (pool_cnx->h3_ctx->goaway_received && !pool_cnx->is_draining) {
+        h3zero_pool_request_t* next = pool_cnx->active.first;
+        h3zero_pool_request_t* request;
+
+        pool_cnx->is_draining = 1;
+        pool->stats.nb_cnx_goaway++;
+        /* The server will not process the requests at or above the GOAWAY ID */
+        while ((request = next) != NULL) {
+            next = request->next;
+            if (request->stream_id >= pool_cnx->h3_ctx->goaway_stream_id) {
+                picohttp_server_stream_ctx_t* stream_ctx = request->stream_ctx;
+                h3zero_pool_request_requeue(pool, request);
+                if (stream_ctx != NULL) {
+                    h3zero_pool_release_stream(pool_cnx, stream_ctx, 1);
+                }
+            }
+        }
+    }
+
+    if (!pool_cnx->is_closing && pool_cnx->nb_active == 0) {
+        if (pool_cnx->is_draining) {
+            pool_cnx->is_closing = 1;
+            (void)picoquic_close(pool_cnx->cnx, H3ZERO_NO_ERROR);
+        }
+        else if (pool->idle_timeout > 0 && current_time >= pool_cnx->last_activity + pool->idle_timeout &&
+            pool_cnx->origin->pending.first == NULL) {
+            pool_cnx->is_closing = 1;
+            pool->stats.nb_cnx_closed_idle++;
+            (void)picoquic_close(pool_cnx->cnx, H3ZERO_NO_ERROR);
+        }
+    }
+
+    return 0;
+}
+
+int h3zero_pool_check(h3zero_pool_t* pool, uint64_t current_time)
+{
+    int ret = 0;
+    h3zero_pool_origin_t* origin = pool->first_origin;
+
+    while (origin != NULL) {
+        h3zero_pool_cnx_t* next = origin->first_cnx;
+        h3zero_pool_cnx_t* pool_cnx;
+
+        while ((pool_cnx = next) != NULL) {
+            next = pool_cnx->next;
+            (void)h3zero_pool_cnx_check(pool, pool_cnx, current_time);
+        }
+        if (ret == 0) {
+            ret = h3zero_pool_dispatch(pool, origin, current_time);
+        }
+        origin = origin->next;
+    }
+
+    return ret;
+}
+
+uint64_t h3zero_pool_next_wake_time(h3zero_pool_t* pool)
+{
+    uint64_t wake_time = UINT64_MAX;
+    h3zero_pool_origin_t* origin = pool->first_origin;
+
+    if (pool->idle_timeout > 0) {
+        while (origin != NULL) {
+            h3zero_pool_cnx_t* pool_cnx = origin->first_cnx;
+
+            while (pool_cnx != NULL) {
+                if (!pool_cnx->is_closing && pool_cnx->nb_active == 0 &&
+                    pool_cnx->last_activity + pool->idle_timeout < wake_time) {
+                    wake_time = pool_cnx->last_activity + pool->idle_timeout;
+                }
+                pool_cnx = pool_cnx->next;
+            }
+            origin = origin->next;
+        }
+    }
+
+    return wake_time;
+}
+
+static h3zero_pool_origin_t* h3zero_pool_find_origin(h3zero_pool_t* pool, const struct sockaddr* addr, const char* sni, int should_create)
+{
+    h3zero_pool_origin_t* origin = pool->first_origin;
+
+    while (origin != NULL) {
+        if (picoquic_compare_addr((struct sockaddr*)&origin->addr, addr) == 0 && strcmp(origin->sni, sni) == 0) {
+            break;
+        }
+        origin = origin->next;
+    }
+
+    if (origin == NULL && should_create) {
+        origin = (h3zero_pool_origin_t*)malloc(sizeof(h3zero_pool_origin_t));
+        if (origin != NULL) {
+            memset(origin, 0, sizeof(h3zero_pool_origin_t));
+            origin->pool = pool;
+            picoquic_store_addr(&origin->addr, addr);
+            origin->sni = picoquic_string_duplicate(sni);
+            if (origin->sni == NULL) {
+                free(origin);
+                origin = NULL;
+            }
+            else {
+                origin->next = pool->first_origin;
+                pool->first_origin = origin;
+            }
+        }
+    }
+
+    return origin;
+}
+
+int h3zero_pool_request(h3zero_pool_t* pool, const struct sockaddr* addr, const char* sni, const char* path,
+    h3zero_pool_response_fn response_fn, void* request_ctx, uint64_t current_time, uint64_t* request_id)
+{
+    int ret = 0;
+    h3zero_pool_origin_t* origin;
+    h3zero_pool_request_t* request = NULL;
+
+    if (addr == NULL || sni == NULL || path == NULL || path[0] != '/') {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else if ((origin = h3zero_pool_find_origin(pool, addr, sni, 1)) == NULL ||
+        (request = (h3zero_pool_request_t*)malloc(sizeof(h3zero_pool_request_t))) == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(request, 0, sizeof(h3zero_pool_request_t));
+        request->path = picoquic_string_duplicate(path);
+        if (request->path == NULL) {
+            free(request);
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            request->origin = origin;
+            request->request_id = pool->next_request_id++;
+            request->stream_id = UINT64_MAX;
+            request->path_length = strlen(path);
+            request->response_fn = response_fn;
+            request->request_ctx = request_ctx;
+            h3zero_pool_list_append(&origin->pending, request);
+            pool->nb_pending++;
+            pool->stats.nb_requests++;
+            if (request_id != NULL) {
+                *request_id = request->request_id;
+            }
+            ret = h3zero_pool_dispatch(pool, origin, current_time);
+        }
+    }
+
+    return ret;
+}
+
+h3zero_pool_t* h3zero_pool_create(picoquic_quic_t* quic, size_t max_cnx_per_origin,
+    size_t max_requests_per_cnx, uint64_t idle_timeout)
+{
+    h3zero_pool_t* pool = (h3zero_pool_t*)malloc(sizeof(h3zero_pool_t));
+
+    if (pool != NULL) {
+        memset(pool, 0, sizeof(h3zero_pool_t));
+        pool->quic = quic;
+        pool->max_cnx_per_origin = (max_cnx_per_origin == 0) ? H3ZERO_POOL_MAX_CNX_PER_ORIGIN_DEFAULT : max_cnx_per_origin;
+        pool->max_requests_per_cnx = max_requests_per_cnx;
+        pool->idle_timeout = idle_timeout;
+    }
+
+    return pool;
+}
+
+void h3zero_pool_delete(h3zero_pool_t* pool)
+{
+    h3zero_pool_origin_t* origin;
+
+    while ((origin = pool->first_origin) != NULL) {
+        pool->first_origin = origin->next;
+        while (origin->first_cnx != NULL) {
+            h3zero_pool_cnx_delete(pool, origin->first_cnx);
+        }
+        while (origin->pending.first != NULL) {
+            h3zero_pool_request_t* request = origin->pending.first;
+            h3zero_pool_list_remove(&origin->pending, request);
+            pool->nb_pending--;
+            h3zero_pool_request_finish(pool, request, h3zero_pool_event_failed);
+        }
+        free(origin->sni);
+        free(origin);
+    }
+    free(pool);
+}
+
+size_t h3zero_pool_nb_pending(h3zero_pool_t* pool)
+{
+    return pool->nb_pending;
+}
+
+size_t h3zero_pool_nb_active(h3zero_pool_t* pool)
+{
+    return pool->nb_active;
+}
+
+size_t h3zero_pool_nb_connections(h3zero_pool_t* pool)
+{
+    return pool->nb_cnx;
+}
+
+void h3zero_pool_get_stats(h3zero_pool_t* pool, h3zero_pool_stats_t* stats)
+{
+    *stats = pool->stats;
+}
@@ -0,0 +1,113 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef H3ZERO_POOL_H
+#define H3ZERO_POOL_H
+/* HTTP/3 client connection pool.
+ *
+ * The pool keeps a set of connections per origin, identified by the server
+ * address and SNI, and multiplexes requests over them. Each request is sent
+ * on a new bidir stream of the least loaded connection that has stream
+ * credit, per the peer's MAX_STREAMS limit and the optional per connection
+ * limit. If no connection has credit, the pool creates a new connection,
+ * up to the maximum per origin, or queues the request until credit becomes
+ * available.
+ *
+ * New connections use the session tickets stored in the QUIC context. If
+ * 0-RTT is available, requests are sent immediately, without waiting for
+ * the end of the handshake.
+ *
+ * Connections are drained when the server sends GOAWAY: no new request is
+ * sent on them, and the requests that the server will not process are
+ * queued again. Connections without activity for the idle timeout are
+ * closed.
+ *
+ * The API is asynchronous. The application runs the QUIC context, for
+ * example using the packet loop, and calls h3zero_pool_check after
+ * processing packets or when the pool wake time is reached. Responses are
+ * delivered through the response callback of each request.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include "picoquic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define H3ZERO_POOL_MAX_CNX_PER_ORIGIN_DEFAULT 2
+#define H3ZERO_POOL_IDLE_TIMEOUT_DEFAULT 30000000ull
+#define H3ZERO_POOL_MAX_RETRIES 1
+#define H3ZERO_POOL_ALPN "h3"
+
+typedef enum {
+    h3zero_pool_event_header = 0, /* Response header received, status is set */
+    h3zero_pool_event_data, /* Response data received */
+    h3zero_pool_event_complete, /* Response complete, request is released after the callback */
+    h3zero_pool_event_failed /* Request failed, request is released after the callback */
+} h3zero_pool_event_enum;
+
+typedef struct st_h3zero_pool_t h3zero_pool_t;
+
+typedef void (*h3zero_pool_response_fn)(h3zero_pool_t* pool, uint64_t request_id, h3zero_pool_event_enum event,
+    int status, const uint8_t* bytes, size_t length, void* request_ctx);
+
+typedef struct st_h3zero_pool_stats_t {
+    uint64_t nb_requests;
+    uint64_t nb_completed;
+    uint64_t nb_failed;
+    uint64_t nb_retried;
+    uint64_t nb_cnx_created;
+    uint64_t nb_cnx_zero_rtt;
+    uint64_t nb_cnx_closed_idle;
+    uint64_t nb_cnx_goaway;
+} h3zero_pool_stats_t;
+
+/* Create a pool using the client QUIC context. If max_requests_per_cnx is
+ * zero, the number of requests per connection is only limited by the
+ * peer's stream limit. */
+h3zero_pool_t* h3zero_pool_create(picoquic_quic_t* quic, size_t max_cnx_per_origin,
+    size_t max_requests_per_cnx, uint64_t idle_timeout);
+void h3zero_pool_delete(h3zero_pool_t* pool);
+
+/* Queue a GET request for the path at the origin. The request ID is
+ * returned in *request_id, and passed to the response callback. */
+int h3zero_pool_request(h3zero_pool_t* pool, const struct sockaddr* addr, const char* sni, const char* path,
+    h3zero_pool_response_fn response_fn, void* request_ctx, uint64_t current_time, uint64_t* request_id);
+
+/* Dispatch the queued requests, and manage the connections: release the
+ * connections that are disconnected, drain the connections that received
+ * GOAWAY, and close the idle connections. */
+int h3zero_pool_check(h3zero_pool_t* pool, uint64_t current_time);
+
+/* Time at which h3zero_pool_check should be called next, if no packet
+ * is received before that. */
+uint64_t h3zero_pool_next_wake_time(h3zero_pool_t* pool);
+
+size_t h3zero_pool_nb_pending(h3zero_pool_t* pool);
+size_t h3zero_pool_nb_active(h3zero_pool_t* pool);
+size_t h3zero_pool_nb_connections(h3zero_pool_t* pool);
+void h3zero_pool_get_stats(h3zero_pool_t* pool, h3zero_pool_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* H3ZERO_POOL_H */
@@ -0,0 +1,322 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Compiled request router.
+ *
+ * Each node of the tree corresponds to a path segment. The literal children
+ * of a node are kept in an array sorted by segment value, so that the
+ * next node can be found by binary search. Parameter segments are all
+ * represented by a single child per node, since the parameter names do
+ * not affect the matching. The node also records the index of the item
+ * ending exactly at that node, and the index of the prefix item ending
+ * with a "*" segment after that node.
+ *
+ * The lookup cost is proportional to the number of segments in the
+ * request path, times the log of the number of literal children at each
+ * level, instead of the number of items in the table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic.h"
+#include "h3zero_uri.h"
+#include "h3zero_router.h"
+
+typedef struct st_h3zero_router_node_t {
+    struct st_h3zero_router_node_t** children;
+    size_t nb_children;
+    size_t nb_children_max;
+    struct st_h3zero_router_node_t* param_child;
+    int exact_item;
+    int prefix_item;
+    size_t segment_length;
+    uint8_t* segment;
+} h3zero_router_node_t;
+
+struct st_h3zero_router_t {
+    h3zero_router_node_t* root;
+    size_t nb_nodes;
+};
+
+static h3zero_router_node_t* h3zero_router_node_create(const uint8_t* segment, size_t segment_length)
+{
+    h3zero_router_node_t* node = (h3zero_router_node_t*)malloc(sizeof(h3zero_router_node_t) + segment_length);
+
+    if (node != NULL) {
+        memset(node, 0, sizeof(h3zero_router_node_t));
+        node->exact_item = -1;
+        node->prefix_item = -1;
+        node->segment = ((uint8_t*)node) + sizeof(h3zero_router_node_t);
+        node->segment_length = segment_length;
+        if (segment_length > 0) {
+            memcpy(node->segment, segment, segment_length);
+        }
+    }
+
+    return node;
+}
+
+static void h3zero_router_node_delete(h3zero_router_node_t* node)
+{
+    if (node->children != NULL) {
+        for (size_t i = 0; i < node->nb_children; i++) {
+            h3zero_router_node_delete(node->children[i]);
+        }
+        free(node->children);
+    }
+    if (node->param_child != NULL) {
+        h3zero_router_node_delete(node->param_child);
+    }
+    free(node);
+}
+
+static int h3zero_router_segment_compare(const uint8_t* segment, size_t segment_length, const h3zero_router_node_t* node)
+{
+    size_t l = (segment_length < node->segment_length) ? segment_length : node->segment_length;
+    int r = (l > 0) ? memcmp(segment, node->segment, l) : 0;
+
+    if (r == 0 && segment_length != node->segment_length) {
+        r = (segment_length < node->segment_length) ? -1 : 1;
+    }
+
+    return r;
+}
+
+/* Binary search of the literal child. Returns the child if found, or NULL.
+ * The position at which the child should be inserted is set in *rank. */
+static h3zero_router_node_t* h3zero_router_find_child(const h3zero_router_node_t* node,
+    const uint8_t* segment, size_t segment_length, size_t* rank)
+{
+    size_t low = 0;
+    size_t high = node->nb_children;
+    h3zero_router_node_t* child = NULL;
+
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        int r = h3zero_router_segment_compare(segment, segment_length, node->children[middle]);
+
+        if (r == 0) {
+            child = node->children[middle];
+            low = middle;
+            break;
+        }
+        else if (r < 0) {
+            high = middle;
+        }
+        else {
+            low = middle + 1;
+        }
+    }
+    if (rank != NULL) {
+        *rank = low;
+    }
+
+    return child;
+}
+
+static h3zero_router_node_t* h3zero_router_add_child(h3zero_router_t* router, h3zero_router_node_t* node,
+    const uint8_t* segment, size_t segment_length)
+{
+    size_t rank = 0;
+    h3zero_router_node_t* child = h3zero_router_find_child(node, segment, segment_length, &rank);
+
+    if (child == NULL) {
+        if (node->nb_children >= node->nb_children_max) {
+            size_t new_max = (node->nb_children_max == 0) ? 4 : 2 * node->nb_children_max;
+            h3zero_router_node_t** new_children = (h3zero_router_node_t**)realloc(node->children,
+                new_max * sizeof(h3zero_router_node_t*));
+            if (new_children == NULL) {
+                return NULL;
+            }
+            node->children = new_children;
+            node->nb_children_max = new_max;
+        }
+        child = h3zero_router_node_create(segment, segment_length);
+        if (child != NULL) {
+            if (rank < node->nb_children) {
+                memmove(&node->children[rank + 1], &node->children[rank],
+                    (node->nb_children - rank) * sizeof(h3zero_router_node_t*));
+            }
+            node->children[rank] = child;
+            node->nb_children++;
+            router->nb_nodes++;
+        }
+    }
+
+    return child;
+}
+
+static int h3zero_router_is_param_segment(const uint8_t* segment, size_t segment_length)
+{
+    return ((segment_length >= 2 && segment[0] == (uint8_t)'{' && segment[segment_length - 1] == (uint8_t)'}') ||
+        (segment_length >= 1 && segment[0] == (uint8_t)':'));
+}
+
+static int h3zero_router_add_item(h3zero_router_t* router, const uint8_t* path, size_t path_length, int item)
+{
+    int ret = 0;
+    h3zero_router_node_t* node = router->root;
+    size_t offset = (path_length > 0 && path[0] == (uint8_t)'/') ? 1 : 0;
+
+    while (ret == 0) {
+        size_t segment_end = offset;
+        size_t segment_length;
+
+        while (segment_end < path_length && path[segment_end] != (uint8_t)'/') {
+            segment_end++;
+        }
+        segment_length = segment_end - offset;
+
+        if (segment_end == path_length && segment_length == 1 && path[offset] == (uint8_t)'*') {
+            if (node->prefix_item < 0) {
+                node->prefix_item = item;
+            }
+            break;
+        }
+        else if (h3zero_router_is_param_segment(path + offset, segment_length)) {
+            if (node->param_child == NULL) {
+                node->param_child = h3zero_router_node_create(NULL, 0);
+                if (node->param_child == NULL) {
+                    ret = -1;
+                    break;
+                }
+                router->nb_nodes++;
+            }
+            node = node->param_child;
+        }
+        else if ((node = h3zero_router_add_child(router, node, path + offset, segment_length)) == NULL) {
+            ret = -1;
+            break;
+        }
+
+        if (segment_end >= path_length) {
+            if (node->exact_item < 0) {
+                node->exact_item = item;
+            }
+            break;
+        }
+        offset = segment_end + 1;
+    }
+
+    return ret;
+}
+
+h3zero_router_t* h3zero_router_create(const picohttp_server_path_item_t* path_table, size_t path_table_nb)
+{
+    h3zero_router_t* router = (h3zero_router_t*)malloc(sizeof(h3zero_router_t));
+
+    if (router != NULL) {
+        memset(router, 0, sizeof(h3zero_router_t));
+        router->root = h3zero_router_node_create(NULL, 0);
+        if (router->root == NULL) {
+            free(router);
+            router = NULL;
+        }
+        else {
+            router->nb_nodes = 1;
+            for (size_t i = 0; i < path_table_nb; i++) {
+                if (h3zero_router_add_item(router, (const uint8_t*)path_table[i].path, path_table[i].path_length, (int)i) != 0) {
+                    h3zero_router_delete(router);
+                    router = NULL;
+                    break;
+                }
+            }
+        }
+    }
+
+    return router;
+}
+
+void h3zero_router_delete(h3zero_router_t* router)
+{
+    if (router != NULL) {
+        if (router->root != NULL) {
+            h3zero_router_node_delete(router->root);
+        }
+        free(router);
+    }
+}
+
+/* Match the segment starting at offset. Literal children are tried first,
+ * then the parameter child, then the prefix item of the node. The search
+ * backtracks if a branch does not lead to a match. */
+static int h3zero_router_match(const h3zero_router_node_t* node, const uint8_t* path, size_t offset,
+    size_t path_length, h3zero_route_match_t* match)
+{
+    int item = -1;
+    size_t segment_end = offset;
+    h3zero_router_node_t* child;
+
+    while (segment_end < path_length && path[segment_end] != (uint8_t)'/') {
+        segment_end++;
+    }
+
+    if ((child = h3zero_router_find_child(node, path + offset, segment_end - offset, NULL)) != NULL) {
+        item = (segment_end >= path_length) ? child->exact_item :
+            h3zero_router_match(child, path, segment_end + 1, path_length, match);
+        if (item < 0 && segment_end >= path_length) {
+            item = child->prefix_item;
+        }
+    }
+
+    if (item < 0 && node->param_child != NULL && segment_end > offset) {
+        size_t nb_params = match->nb_params;
+
+        if (nb_params < H3ZERO_ROUTER_MAX_PARAMS) {
+            match->params[nb_params].offset = offset;
+            match->params[nb_params].length = segment_end - offset;
+            match->nb_params++;
+        }
+        item = (segment_end >= path_length) ? node->param_child->exact_item :
+            h3zero_router_match(node->param_child, path, segment_end + 1, path_length, match);
+        if (item < 0 && segment_end >= path_length) {
+            item = node->param_child->prefix_item;
+        }
+        if (item < 0) {
+            match->nb_params = nb_params;
+        }
+    }
+
+    if (item < 0) {
+        item = node->prefix_item;
+    }
+
+    return item;
+}
+
+int h3zero_router_find(const h3zero_router_t* router, const uint8_t* path, size_t path_length, h3zero_route_match_t* match)
+{
+    h3zero_route_match_t local_match;
+    size_t offset;
+
+    if (match == NULL) {
+        match = &local_match;
+    }
+    match->nb_params = 0;
+    match->path_length = h3zero_pathabempty_length(path, path_length);
+    match->query_offset = h3zero_query_offset(path, path_length);
+    offset = (match->path_length > 0 && path[0] == (uint8_t)'/') ? 1 : 0;
+    match->path_item = (router == NULL || router->root == NULL) ? -1 :
+        h3zero_router_match(router->root, path, offset, match->path_length, match);
+
+    return match->path_item;
+}
@@ -0,0 +1,71 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef H3ZERO_ROUTER_H
+#define H3ZERO_ROUTER_H
+/* Compiled request router.
+ *
+ * The router is built from a table of path items, and replaces the linear
+ * scan of the table by a walk through a tree of path segments. Each item
+ * path is split into segments at the '/' characters. Three kinds of
+ * segments are supported:
+ *
+ * - literal segments, such as "/api" or "/static", which must match exactly,
+ * - parameter segments, written as "{name}" or ":name", which match any
+ *   non empty segment; the position of the matching segment in the
+ *   request path is reported in the match parameters,
+ * - a final "*" segment, which matches any path that starts with the
+ *   preceding segments, for example all the files under "/static".
+ *
+ * A path without parameter or "*" segments matches exactly, or if followed
+ * by a query string, which is the same behavior as h3zero_find_path_item.
+ * When several items match, literal segments are preferred to parameters,
+ * and parameters to prefixes. If two items have the same path, the first
+ * one in the table is used.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include "h3zero_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The match result, h3zero_route_match_t, is defined in h3zero_common.h,
+ * since it is kept in the stream context. */
+typedef struct st_h3zero_router_t h3zero_router_t;
+
+/* Compile the path table. The path strings are copied, but the table
+ * itself must stay valid for as long as the returned indices are used.
+ * Returns NULL if memory cannot be allocated. */
+h3zero_router_t* h3zero_router_create(const picohttp_server_path_item_t* path_table, size_t path_table_nb);
+void h3zero_router_delete(h3zero_router_t* router);
+
+/* Find the path item matching the request path. Returns the index of the
+ * item in the path table, or -1 if there is no match. If match is not NULL,
+ * it is filled with the position of the query string and of the parameter
+ * segments. */
+int h3zero_router_find(const h3zero_router_t* router, const uint8_t* path, size_t path_length, h3zero_route_match_t* match);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* H3ZERO_ROUTER_H */
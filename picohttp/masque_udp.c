@@ -0,0 +1,822 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* MASQUE CONNECT-UDP proxy and client.
+ *
+ * Each tunnel is registered as a stream prefix, so the HTTP datagrams
+ * carrying its quarter stream ID are delivered to the tunnel callback,
+ * and the h3zero datagram scheduler polls the tunnels that have data
+ * ready in round robin.
+ *
+ * A tunnel is freed when its stream prefix is deregistered, or when
+ * its stream context is freed, whichever comes first.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include "picosocks.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#ifndef _WINDOWS
+#include <fcntl.h>
+#endif
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "h3zero.h"
+#include "h3zero_common.h"
+#include "masque_udp.h"
+
+#if defined(__linux__)
+#define MASQUE_UDP_USE_MMSG
+#endif
+
+#define MASQUE_UDP_MAX_DEFERRED 4
+
+typedef struct st_masque_udp_ring_t {
+    uint8_t* buffer;
+    size_t* length;
+    size_t slot_size;
+    size_t nb_slots;
+    size_t first;
+    size_t count;
+} masque_udp_ring_t;
+
+struct st_masque_udp_tunnel_t {
+    struct st_masque_udp_tunnel_t* next;
+    struct st_masque_udp_tunnel_t* previous;
+    masque_udp_proxy_t* proxy; /* NULL on the client */
+    picoquic_cnx_t* cnx;
+    h3zero_callback_ctx_t* h3_ctx;
+    picohttp_server_stream_ctx_t* stream_ctx;
+    uint64_t stream_id;
+    SOCKET_TYPE fd;
+    struct sockaddr_storage target;
+    masque_udp_ring_t ring;
+    size_t max_payload;
+    int nb_deferred;
+    masque_udp_client_fn client_fn;
+    void* app_ctx;
+    masque_udp_stats_t stats;
+    unsigned int is_registered : 1;
+    unsigned int is_ready : 1;
+    unsigned int is_closed : 1;
+};
+
+struct st_masque_udp_proxy_t {
+    masque_udp_tunnel_t* first_tunnel;
+    size_t nb_tunnels;
+    size_t ring_size;
+    size_t max_payload;
+    masque_udp_stats_t stats;
+    int allow_internal_targets;
+};
+
+static int masque_udp_tunnel_callback(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t event, picohttp_server_stream_ctx_t* stream_ctx, void* path_app_ctx);
+
+/* Ring of payload buffers */
+static int masque_udp_ring_init(masque_udp_ring_t* ring, size_t nb_slots, size_t slot_size)
+{
+    memset(ring, 0, sizeof(masque_udp_ring_t));
+    ring->buffer = (uint8_t*)malloc(nb_slots * slot_size);
+    ring->length = (size_t*)malloc(nb_slots * sizeof(size_t));
+    if (ring->buffer == NULL || ring->length == NULL) {
+        return -1;
+    }
+    ring->nb_slots = nb_slots;
+    ring->slot_size = slot_size;
+    return 0;
+}
+
+static void masque_udp_ring_release(masque_udp_ring_t* ring)
+{
+    if (ring->buffer != NULL) {
+        free(ring->buffer);
+    }
+    if (ring->length != NULL) {
+        free(ring->length);
+    }
+    memset(ring, 0, sizeof(masque_udp_ring_t));
+}
+
+static uint8_t* masque_udp_ring_slot(masque_udp_ring_t* ring, size_t index)
+{
+    return ring->buffer + (index % ring->nb_slots) * ring->slot_size;
+}
+
+static void masque_udp_ring_pop(masque_udp_ring_t* ring)
+{
+    ring->first = (ring->first + 1) % ring->nb_slots;
+    ring->count--;
+}
+
+/* Parsing and formatting of the target in the request path.
+ * The expected format is "/.well-known/masque/udp/{host}/{port}/".
+ */
+static int masque_udp_hex_value(uint8_t c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static int masque_udp_parse_path(const uint8_t* path, size_t path_length, struct sockaddr_storage* target)
+{
+    const size_t prefix_length = sizeof(MASQUE_UDP_PATH_TEMPLATE) - 1;
+    char host[64];
+    size_t host_length = 0;
+    uint32_t port = 0;
+    size_t i;
+
+    if (path_length <= prefix_length || memcmp(path, MASQUE_UDP_PATH_TEMPLATE, prefix_length) != 0) {
+        return -1;
+    }
+    for (i = prefix_length; i < path_length && path[i] != '/'; i++) {
+        uint8_t c = path[i];
+        if (c == '%') {
+            int h1 = (i + 2 < path_length) ? masque_udp_hex_value(path[i + 1]) : -1;
+            int h2 = (h1 >= 0) ? masque_udp_hex_value(path[i + 2]) : -1;
+            if (h2 < 0) {
+                return -1;
+            }
+            c = (uint8_t)(h1 * 16 + h2);
+            i += 2;
+        }
+        if (host_length + 1 >= sizeof(host)) {
+            return -1;
+        }
+        host[host_length++] = (char)c;
+    }
+    host[host_length] = 0;
+    if (host_length == 0 || i >= path_length) {
+        return -1;
+    }
+    for (i++; i < path_length && path[i] != '/'; i++) {
+        if (path[i] < '0' || path[i] > '9' || port > 65535) {
+            return -1;
+        }
+        port = 10 * port + (path[i] - '0');
+    }
+    if (port == 0 || port > 65535 || (i < path_length && i + 1 != path_length)) {
+        return -1;
+    }
+
+    return picoquic_store_text_addr(target, host, (uint16_t)port);
+}
+
+static int masque_udp_format_path(char* path, size_t path_max, const char* host, uint16_t port)
+{
+    size_t length = sizeof(MASQUE_UDP_PATH_TEMPLATE) - 1;
+    size_t nb_written = 0;
+
+    if (path_max <= length) {
+        return -1;
+    }
+    memcpy(path, MASQUE_UDP_PATH_TEMPLATE, length);
+    for (const char* c = host; *c != 0; c++) {
+        if (length + 4 >= path_max) {
+            return -1;
+        }
+        if (*c == ':') {
+            memcpy(path + length, "%3A", 3);
+            length += 3;
+        }
+        else {
+            path[length++] = *c;
+        }
+    }
+    if (picoquic_sprintf(path + length, path_max - length, &nb_written, "/%u/", (unsigned int)port) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Check whether an IPv4 address, in network order, is not globally routable:
+ * "this network", private, shared (CGNAT), loopback, link-local, IETF
+ * protocol assignments, multicast, reserved or broadcast.
+ */
+static int masque_udp_is_internal_ipv4(const uint8_t* b)
+{
+    uint32_t a = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+
+    return ((a >> 24) == 0 || (a >> 24) == 10 || (a >> 24) == 127 ||
+        (a & 0xFFC00000) == 0x64400000 ||
+        (a & 0xFFFF0000) == 0xA9FE0000 ||
+        (a & 0xFFF00000) == 0xAC100000 ||
+        (a & 0xFFFFFF00) == 0xC0000000 ||
+        (a & 0xFFFF0000) == 0xC0A80000 ||
+        (a >> 28) >= 0xE);
+}
+
+int masque_udp_is_internal_target(const struct sockaddr* addr)
+{
+    int is_internal = 1;
+
+    if (addr->sa_family == AF_INET) {
+        const uint8_t* b = (const uint8_t*)&((const struct sockaddr_in*)addr)->sin_addr;
+        is_internal = masque_udp_is_internal_ipv4(b);
+    }
+    else if (addr->sa_family == AF_INET6) {
+        const uint8_t* b = (const uint8_t*)&((const struct sockaddr_in6*)addr)->sin6_addr;
+        static const uint8_t v4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+        static const uint8_t nat64[12] = { 0, 0x64, 0xff, 0x9b, 0, 0, 0, 0, 0, 0, 0, 0 };
+        static const uint8_t zero[12] = { 0 };
+
+        if (memcmp(b, v4_mapped, 12) == 0 || memcmp(b, nat64, 12) == 0) {
+            /* Embedded IPv4 address */
+            is_internal = masque_udp_is_internal_ipv4(b + 12);
+        }
+        else {
+            /* Unspecified, loopback or IPv4 compatible, unique local,
+             * link-local, site-local, or multicast */
+            is_internal = (memcmp(b, zero, 12) == 0 ||
+                (b[0] & 0xFE) == 0xFC ||
+                (b[0] == 0xFE && (b[1] & 0x80) == 0x80) ||
+                b[0] == 0xFF);
+        }
+    }
+
+    return is_internal;
+}
+
+static SOCKET_TYPE masque_udp_open_socket(struct sockaddr_storage* target)
+{
+    SOCKET_TYPE fd = socket(target->ss_family, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (fd != INVALID_SOCKET) {
+        socklen_t addr_length = (target->ss_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+        int ret = connect(fd, (struct sockaddr*)target, addr_length);
+        if (ret == 0) {
+#ifdef _WINDOWS
+            u_long non_blocking = 1;
+            ret = ioctlsocket(fd, FIONBIO, &non_blocking);
+#else
+            int flags = fcntl(fd, F_GETFL, 0);
+            ret = (flags < 0) ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#endif
+        }
+        if (ret != 0) {
+            SOCKET_CLOSE(fd);
+            fd = INVALID_SOCKET;
+        }
+    }
+
+    return fd;
+}
+
+/* Tunnel management */
+static masque_udp_tunnel_t* masque_udp_tunnel_create(masque_udp_proxy_t* proxy, picoquic_cnx_t* cnx,
+    h3zero_callback_ctx_t* h3_ctx, picohttp_server_stream_ctx_t* stream_ctx, size_t ring_size, size_t max_payload)
+{
+    masque_udp_tunnel_t* tunnel = (masque_udp_tunnel_t*)malloc(sizeof(masque_udp_tunnel_t));
+
+    if (tunnel != NULL) {
+        memset(tunnel, 0, sizeof(masque_udp_tunnel_t));
+        tunnel->fd = INVALID_SOCKET;
+        tunnel->cnx = cnx;
+        tunnel->h3_ctx = h3_ctx;
+        tunnel->stream_ctx = stream_ctx;
+        tunnel->stream_id = stream_ctx->stream_id;
+        tunnel->max_payload = max_payload;
+        /* One extra byte per slot, so oversized payloads are detected as truncated */
+        if (masque_udp_ring_init(&tunnel->ring, ring_size, max_payload + 1) != 0 ||
+            h3zero_declare_stream_prefix(h3_ctx, stream_ctx->stream_id, masque_udp_tunnel_callback, tunnel) != 0) {
+            masque_udp_ring_release(&tunnel->ring);
+            free(tunnel);
+            tunnel = NULL;
+        }
+        else {
+            tunnel->is_registered = 1;
+            stream_ctx->path_callback_ctx = tunnel;
+            if (proxy != NULL) {
+                tunnel->proxy = proxy;
+                tunnel->next = proxy->first_tunnel;
+                if (proxy->first_tunnel != NULL) {
+                    proxy->first_tunnel->previous = tunnel;
+                }
+                proxy->first_tunnel = tunnel;
+                proxy->nb_tunnels++;
+            }
+        }
+    }
+
+    return tunnel;
+}
+
+static void masque_udp_tunnel_delete(masque_udp_tunnel_t* tunnel)
+{
+    if (tunnel->stream_ctx != NULL) {
+        tunnel->stream_ctx->path_callback_ctx = NULL;
+        tunnel->stream_ctx = NULL;
+    }
+    if (tunnel->is_registered) {
+        /* The deregister callback is ignored, since is_registered is now zero */
+        tunnel->is_registered = 0;
+        h3zero_delete_stream_prefix(tunnel->cnx, tunnel->h3_ctx, tunnel->stream_id);
+    }
+    if (tunnel->client_fn != NULL) {
+        tunnel->client_fn(tunnel, masque_udp_event_closed, NULL, 0, tunnel->app_ctx);
+    }
+    if (tunnel->fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(tunnel->fd);
+    }
+    if (tunnel->proxy != NULL) {
+        if (tunnel->previous == NULL) {
+            tunnel->proxy->first_tunnel = tunnel->next;
+        }
+        else {
+            tunnel->previous->next = tunnel->next;
+        }
+        if (tunnel->next != NULL) {
+            tunnel->next->previous = tunnel->previous;
+        }
+        tunnel->proxy->nb_tunnels--;
+    }
+    masque_udp_ring_release(&tunnel->ring);
+    free(tunnel);
+}
+
+void masque_udp_tunnel_close(masque_udp_tunnel_t* tunnel)
+{
+    if (!tunnel->is_closed) {
+        tunnel->is_closed = 1;
+        if (tunnel->stream_ctx != NULL && !tunnel->stream_ctx->ps.stream_state.is_fin_sent) {
+            tunnel->stream_ctx->ps.stream_state.is_fin_sent = 1;
+            (void)picoquic_add_to_stream(tunnel->cnx, tunnel->stream_id, NULL, 0, 1);
+        }
+    }
+    masque_udp_tunnel_delete(tunnel);
+}
+
+int masque_udp_tunnel_is_ready(masque_udp_tunnel_t* tunnel)
+{
+    return tunnel->is_ready && !tunnel->is_closed;
+}
+
+void masque_udp_tunnel_get_stats(masque_udp_tunnel_t* tunnel, masque_udp_stats_t* stats)
+{
+    *stats = tunnel->stats;
+}
+
+/* Datagram forwarding.
+ * The HTTP datagram payload starts with the context ID. Only context ID 0,
+ * UDP payload, is supported; other datagrams are dropped.
+ */
+static int masque_udp_receive_datagram(masque_udp_tunnel_t* tunnel, const uint8_t* bytes, size_t length)
+{
+    const uint8_t* bytes_max = bytes + length;
+    uint64_t context_id = UINT64_MAX;
+
+    if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &context_id)) == NULL || context_id != 0 ||
+        tunnel->is_closed) {
+        tunnel->stats.nb_dropped++;
+    }
+    else if (tunnel->proxy == NULL) {
+        tunnel->stats.nb_datagrams_to_client++;
+        tunnel->stats.bytes_to_client += bytes_max - bytes;
+        if (tunnel->client_fn != NULL) {
+            tunnel->client_fn(tunnel, masque_udp_event_datagram, bytes, bytes_max - bytes, tunnel->app_ctx);
+        }
+    }
+    else if (tunnel->fd == INVALID_SOCKET || (size_t)(bytes_max - bytes) > tunnel->max_payload ||
+        send(tunnel->fd, (const char*)bytes, (int)(bytes_max - bytes), 0) < 0) {
+        /* UDP semantics: if the socket cannot accept the payload, it is lost */
+        tunnel->proxy->stats.nb_dropped++;
+    }
+    else {
+        tunnel->proxy->stats.nb_datagrams_to_target++;
+        tunnel->proxy->stats.bytes_to_target += bytes_max - bytes;
+    }
+
+    return 0;
+}
+
+static int masque_udp_provide_datagram(masque_udp_tunnel_t* tunnel, void* context, size_t space)
+{
+    int ret = 0;
+
+    if (tunnel->ring.count > 0 && !tunnel->is_closed) {
+        size_t length = tunnel->ring.length[tunnel->ring.first];
+
+        if (length + 1 > space) {
+            if (++tunnel->nb_deferred > MASQUE_UDP_MAX_DEFERRED) {
+                /* This payload does not fit in packets, drop it. */
+                masque_udp_ring_pop(&tunnel->ring);
+                tunnel->nb_deferred = 0;
+                if (tunnel->proxy != NULL) {
+                    tunnel->proxy->stats.nb_dropped++;
+                }
+                else {
+                    tunnel->stats.nb_dropped++;
+                }
+            }
+            /* Wait for the next packet */
+            (void)h3zero_provide_datagram_buffer(context, 0, tunnel->ring.count > 0);
+        }
+        else {
+            uint8_t* buffer = h3zero_provide_datagram_buffer(context, length + 1, tunnel->ring.count > 1);
+
+            if (buffer == NULL) {
+                ret = -1;
+            }
+            else {
+                /* Context ID 0, then the payload copied from the ring into the packet */
+                buffer[0] = 0;
+                memcpy(buffer + 1, masque_udp_ring_slot(&tunnel->ring, tunnel->ring.first), length);
+                masque_udp_ring_pop(&tunnel->ring);
+                tunnel->nb_deferred = 0;
+                if (tunnel->proxy != NULL) {
+                    tunnel->proxy->stats.nb_datagrams_to_client++;
+                    tunnel->proxy->stats.bytes_to_client += length;
+                }
+                else {
+                    tunnel->stats.nb_datagrams_to_target++;
+                    tunnel->stats.bytes_to_target += length;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Read the payloads received from the target directly in the ring slots.
+ * Payloads larger than the maximum are dropped, and the following ones
+ * moved to fill the gap. */
+static size_t masque_udp_tunnel_receive(masque_udp_tunnel_t* tunnel)
+{
+    masque_udp_ring_t* ring = &tunnel->ring;
+    size_t nb_received = 0;
+    int is_done = 0;
+
+    while (!is_done && ring->count < ring->nb_slots) {
+        size_t tail = (ring->first + ring->count) % ring->nb_slots;
+        size_t nb_batch = ring->nb_slots - ring->count;
+        size_t nb_read = 0;
+
+        if (nb_batch > ring->nb_slots - tail) {
+            nb_batch = ring->nb_slots - tail;
+        }
+        if (nb_batch > MASQUE_UDP_RECV_BATCH) {
+            nb_batch = MASQUE_UDP_RECV_BATCH;
+        }
+#ifdef MASQUE_UDP_USE_MMSG
+        {
+            struct mmsghdr msgs[MASQUE_UDP_RECV_BATCH];
+            struct iovec iov[MASQUE_UDP_RECV_BATCH];
+            int nb_msg;
+
+            memset(msgs, 0, nb_batch * sizeof(struct mmsghdr));
+            for (size_t i = 0; i < nb_batch; i++) {
+                iov[i].iov_base = masque_udp_ring_slot(ring, tail + i);
+                iov[i].iov_len = ring->slot_size;
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            nb_msg = recvmmsg(tunnel->fd, msgs, (unsigned int)nb_batch, MSG_DONTWAIT, NULL);
+            tunnel->proxy->stats.nb_recv_calls++;
+            if (nb_msg > 0) {
+                nb_read = (size_t)nb_msg;
+                for (size_t i = 0; i < nb_read; i++) {
+                    ring->length[(tail + i) % ring->nb_slots] = msgs[i].msg_len;
+                }
+            }
+        }
+#else
+        while (nb_read < nb_batch) {
+            int bytes_recv = recv(tunnel->fd, (char*)masque_udp_ring_slot(ring, tail + nb_read), (int)ring->slot_size, 0);
+            tunnel->proxy->stats.nb_recv_calls++;
+            if (bytes_recv < 0) {
+                break;
+            }
+            ring->length[(tail + nb_read) % ring->nb_slots] = (size_t)bytes_recv;
+            nb_read++;
+        }
+#endif
+        if (nb_read < nb_batch) {
+            is_done = 1;
+        }
+        /* Commit the valid payloads */
+        for (size_t i = 0; i < nb_read; i++) {
+            size_t length = ring->length[(tail + i) % ring->nb_slots];
+
+            if (length > tunnel->max_payload) {
+                tunnel->proxy->stats.nb_dropped++;
+            }
+            else {
+                size_t target = (ring->first + ring->count) % ring->nb_slots;
+                if (target != (tail + i) % ring->nb_slots) {
+                    memmove(masque_udp_ring_slot(ring, target), masque_udp_ring_slot(ring, tail + i), length);
+                    ring->length[target] = length;
+                }
+                ring->count++;
+                nb_received++;
+            }
+        }
+    }
+
+    return nb_received;
+}
+
+/* Common callback for the tunnel streams and stream prefixes */
+static int masque_udp_tunnel_callback(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t event, picohttp_server_stream_ctx_t* stream_ctx, void* path_app_ctx)
+{
+    int ret = 0;
+    masque_udp_tunnel_t* tunnel = (masque_udp_tunnel_t*)path_app_ctx;
+
+    if (tunnel == NULL) {
+        return 0;
+    }
+
+    switch (event) {
+    case picohttp_callback_connect_accepted:
+        tunnel->is_ready = 1;
+        if (stream_ctx != NULL) {
+            stream_ctx->is_upgraded = 1;
+        }
+        if (tunnel->client_fn != NULL) {
+            tunnel->client_fn(tunnel, masque_udp_event_ready, NULL, 0, tunnel->app_ctx);
+        }
+        if (tunnel->ring.count > 0) {
+            ret = h3zero_set_datagram_ready(tunnel->cnx, tunnel->stream_id);
+        }
+        break;
+    case picohttp_callback_connect_refused:
+        if (tunnel->client_fn != NULL) {
+            tunnel->client_fn(tunnel, masque_udp_event_refused, NULL, 0, tunnel->app_ctx);
+        }
+        masque_udp_tunnel_close(tunnel);
+        break;
+    case picohttp_callback_post_data:
+        /* Capsules are not used by this implementation, and are ignored. */
+        break;
+    case picohttp_callback_post_fin:
+        /* The peer closed the request stream: close the tunnel */
+        masque_udp_tunnel_close(tunnel);
+        break;
+    case picohttp_callback_reset:
+        /* The stream was reset, there is no point sending a FIN */
+        tunnel->is_closed = 1;
+        masque_udp_tunnel_delete(tunnel);
+        break;
+    case picohttp_callback_post_datagram:
+        ret = masque_udp_receive_datagram(tunnel, bytes, length);
+        break;
+    case picohttp_callback_provide_datagram:
+        ret = masque_udp_provide_datagram(tunnel, bytes, length);
+        break;
+    case picohttp_callback_deregister:
+        if (tunnel->is_registered) {
+            tunnel->is_registered = 0;
+            masque_udp_tunnel_delete(tunnel);
+        }
+        break;
+    case picohttp_callback_free:
+        tunnel->stream_ctx = NULL;
+        masque_udp_tunnel_delete(tunnel);
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+/* Proxy side */
+static int masque_udp_proxy_accept(picoquic_cnx_t* cnx, uint8_t* path, size_t path_length,
+    picohttp_server_stream_ctx_t* stream_ctx, masque_udp_proxy_t* proxy)
+{
+    int ret = 0;
+    struct sockaddr_storage target;
+    h3zero_callback_ctx_t* h3_ctx = (h3zero_callback_ctx_t*)picoquic_get_callback_context(cnx);
+    masque_udp_tunnel_t* tunnel = NULL;
+
+    if (proxy == NULL || h3_ctx == NULL || stream_ctx == NULL ||
+        stream_ctx->ps.stream_state.header.protocol_length != sizeof(MASQUE_UDP_PROTOCOL) - 1 ||
+        memcmp(stream_ctx->ps.stream_state.header.protocol, MASQUE_UDP_PROTOCOL, sizeof(MASQUE_UDP_PROTOCOL) - 1) != 0 ||
+        masque_udp_parse_path(path, path_length, &target) != 0) {
+        ret = -1;
+    }
+    else if (!proxy->allow_internal_targets && masque_udp_is_internal_target((struct sockaddr*)&target)) {
+        /* Do not let clients reach the proxy's own host or network */
+        ret = -1;
+    }
+    else if ((tunnel = masque_udp_tunnel_create(proxy, cnx, h3_ctx, stream_ctx, proxy->ring_size, proxy->max_payload)) == NULL) {
+        ret = -1;
+    }
+    else {
+        tunnel->target = target;
+        tunnel->fd = masque_udp_open_socket(&target);
+        if (tunnel->fd == INVALID_SOCKET) {
+            masque_udp_tunnel_delete(tunnel);
+            ret = -1;
+        }
+        else {
+            tunnel->is_ready = 1;
+            proxy->stats.nb_tunnels++;
+        }
+    }
+    if (ret != 0 && proxy != NULL) {
+        proxy->stats.nb_tunnels_refused++;
+        picoquic_log_app_message(cnx, "Refusing CONNECT-UDP on stream %" PRIu64, (stream_ctx == NULL) ? UINT64_MAX : stream_ctx->stream_id);
+    }
+
+    return ret;
+}
+
+int masque_udp_proxy_callback(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t event, picohttp_server_stream_ctx_t* stream_ctx, void* path_app_ctx)
+{
+    int ret = 0;
+
+    if (event == picohttp_callback_connect) {
+        /* On connect, the context is the proxy. On the other events, it is the tunnel */
+        ret = masque_udp_proxy_accept(cnx, bytes, length, stream_ctx, (masque_udp_proxy_t*)path_app_ctx);
+    }
+    else {
+        ret = masque_udp_tunnel_callback(cnx, bytes, length, event, stream_ctx, path_app_ctx);
+    }
+
+    return ret;
+}
+
+size_t masque_udp_proxy_poll(masque_udp_proxy_t* proxy)
+{
+    size_t nb_received = 0;
+    masque_udp_tunnel_t* tunnel = proxy->first_tunnel;
+
+    while (tunnel != NULL) {
+        if (tunnel->is_ready && !tunnel->is_closed && tunnel->fd != INVALID_SOCKET) {
+            size_t nb_tunnel = masque_udp_tunnel_receive(tunnel);
+            if (nb_tunnel > 0) {
+                nb_received += nb_tunnel;
+                (void)h3zero_set_datagram_ready(tunnel->cnx, tunnel->stream_id);
+            }
+        }
+        tunnel = tunnel->next;
+    }
+
+    return nb_received;
+}
+
+masque_udp_proxy_t* masque_udp_proxy_create(size_t ring_size, size_t max_payload)
+{
+    masque_udp_proxy_t* proxy = (masque_udp_proxy_t*)malloc(sizeof(masque_udp_proxy_t));
+
+    if (proxy != NULL) {
+        memset(proxy, 0, sizeof(masque_udp_proxy_t));
+        proxy->ring_size = (ring_size == 0) ? MASQUE_UDP_RING_SIZE_DEFAULT : ring_size;
+        proxy->max_payload = (max_payload == 0) ? MASQUE_UDP_MAX_PAYLOAD_DEFAULT : max_payload;
+    }
+
+    return proxy;
+}
+
+/* The proxy should be deleted after the connections that use it. Remaining
+ * tunnels are detached from their streams and freed. */
+void masque_udp_proxy_delete(masque_udp_proxy_t* proxy)
+{
+    while (proxy->first_tunnel != NULL) {
+        masque_udp_tunnel_t* tunnel = proxy->first_tunnel;
+        tunnel->is_registered = 0;
+        tunnel->stream_ctx = NULL;
+        masque_udp_tunnel_delete(tunnel);
+    }
+    free(proxy);
+}
+
+void masque_udp_proxy_allow_internal_targets(masque_udp_proxy_t* proxy, int allow)
+{
+    proxy->allow_internal_targets = allow;
+}
+
+size_t masque_udp_proxy_nb_tunnels(masque_udp_proxy_t* proxy)
+{
+    return proxy->nb_tunnels;
+}
+
+void masque_udp_proxy_get_stats(masque_udp_proxy_t* proxy, masque_udp_stats_t* stats)
+{
+    *stats = proxy->stats;
+}
+
+/* Client side */
+void masque_udp_set_transport_parameters(picoquic_cnx_t* cnx)
+{
+    picoquic_tp_t tp;
+
+    memcpy(&tp, picoquic_get_transport_parameters(cnx, 1), sizeof(picoquic_tp_t));
+    if (tp.max_datagram_frame_size == 0) {
+        tp.max_datagram_frame_size = PICOQUIC_MAX_PACKET_SIZE;
+        picoquic_set_transport_parameters(cnx, &tp);
+    }
+}
+
+int masque_udp_client_connect(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* h3_ctx,
+    const char* target_host, uint16_t target_port, masque_udp_client_fn client_fn, void* app_ctx,
+    masque_udp_tunnel_t** p_tunnel)
+{
+    int ret = 0;
+    char path[256];
+    uint8_t buffer[1024];
+    uint8_t* bytes = buffer;
+    uint8_t* bytes_max = buffer + sizeof(buffer);
+    uint64_t stream_id = picoquic_get_next_local_stream_id(cnx, 0);
+    picohttp_server_stream_ctx_t* stream_ctx = NULL;
+    masque_udp_tunnel_t* tunnel = NULL;
+
+    *p_tunnel = NULL;
+
+    if (masque_udp_format_path(path, sizeof(path), target_host, target_port) != 0) {
+        ret = -1;
+    }
+    else if ((stream_ctx = h3zero_find_or_create_stream(cnx, stream_id, h3_ctx, 1, 1)) == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else if ((tunnel = masque_udp_tunnel_create(NULL, cnx, h3_ctx, stream_ctx, MASQUE_UDP_RING_SIZE_DEFAULT,
+        MASQUE_UDP_MAX_PAYLOAD_DEFAULT)) == NULL) {
+        h3zero_delete_stream(cnx, h3_ctx, stream_ctx);
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        tunnel->client_fn = client_fn;
+        tunnel->app_ctx = app_ctx;
+        stream_ctx->is_open = 1;
+        h3_ctx->nb_open_streams++;
+        stream_ctx->path_callback = masque_udp_tunnel_callback;
+        stream_ctx->ps.stream_state.is_upgrade_requested = 1;
+
+        /* Format the extended CONNECT request, with a two bytes frame length */
+        *bytes++ = h3zero_frame_header;
+        bytes += 2;
+        bytes = h3zero_create_connect_header_frame(bytes, bytes_max, (const uint8_t*)path, strlen(path),
+            MASQUE_UDP_PROTOCOL, NULL, H3ZERO_USER_AGENT_STRING);
+        if (bytes == NULL) {
+            ret = -1;
+        }
+        else {
+            size_t header_length = bytes - &buffer[3];
+            buffer[1] = (uint8_t)((header_length >> 8) | 0x40);
+            buffer[2] = (uint8_t)(header_length & 0xFF);
+            ret = picoquic_add_to_stream_with_ctx(cnx, stream_id, buffer, bytes - buffer, 0, stream_ctx);
+        }
+        if (ret != 0) {
+            tunnel->client_fn = NULL;
+            masque_udp_tunnel_delete(tunnel);
+        }
+        else {
+            *p_tunnel = tunnel;
+        }
+    }
+
+    return ret;
+}
+
+int masque_udp_tunnel_send(masque_udp_tunnel_t* tunnel, const uint8_t* payload, size_t length)
+{
+    int ret = 0;
+
+    if (tunnel->is_closed || length > tunnel->max_payload || tunnel->ring.count >= tunnel->ring.nb_slots) {
+        ret = -1;
+    }
+    else {
+        size_t tail = (tunnel->ring.first + tunnel->ring.count) % tunnel->ring.nb_slots;
+        memcpy(masque_udp_ring_slot(&tunnel->ring, tail), payload, length);
+        tunnel->ring.length[tail] = length;
+        tunnel->ring.count++;
+        if (tunnel->is_ready) {
+            ret = h3zero_set_datagram_ready(tunnel->cnx, tunnel->stream_id);
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,140 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* MASQUE CONNECT-UDP, per RFC 9298.
+ *
+ * The client sends an extended CONNECT request with the protocol
+ * "connect-udp" and the path "/.well-known/masque/udp/{host}/{port}/".
+ * If the proxy accepts, UDP payloads are exchanged as HTTP datagrams,
+ * associated with the request stream, with a context ID of zero.
+ *
+ * The proxy side is a path callback: the application adds an entry
+ * for MASQUE_UDP_PATH_PREFIX to the server path table, with the proxy
+ * context as path application context. For each accepted request, the
+ * proxy opens a UDP socket connected to the target and creates a tunnel.
+ *
+ * Payloads received from the client are sent on the tunnel socket
+ * directly from the decrypted QUIC packet, without intermediate copy.
+ * Payloads received from the target are read in batches, with recvmmsg
+ * when available, directly into a ring of buffers owned by the tunnel.
+ * Each tunnel has its own ring, so a busy target cannot use the buffers
+ * of other tunnels, and the h3zero datagram scheduler serves the tunnels
+ * in round robin. When the ring is full, the socket is not read and the
+ * kernel drops the excess packets.
+ *
+ * The proxy does not run its own event loop. The application calls
+ * masque_udp_proxy_poll from its packet loop, for example after
+ * receiving or sending packets, to read the tunnel sockets.
+ *
+ * Only IP address literals are accepted as target host. IPv6 addresses
+ * are written with the ':' characters percent-encoded as "%3A". By default,
+ * the proxy refuses targets that are not globally routable, such as
+ * loopback, link-local, private or multicast addresses, so that clients
+ * cannot use it to reach the proxy host or its internal network.
+ */
+#ifndef MASQUE_UDP_H
+#define MASQUE_UDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "h3zero.h"
+#include "h3zero_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MASQUE_UDP_PROTOCOL "connect-udp"
+#define MASQUE_UDP_PATH_TEMPLATE "/.well-known/masque/udp/"
+/* Path table entry for the router, matching all CONNECT-UDP targets */
+#define MASQUE_UDP_PATH_PREFIX "/.well-known/masque/udp/*"
+#define MASQUE_UDP_RING_SIZE_DEFAULT 64
+#define MASQUE_UDP_MAX_PAYLOAD_DEFAULT 1200
+#define MASQUE_UDP_RECV_BATCH 32
+
+typedef struct st_masque_udp_proxy_t masque_udp_proxy_t;
+typedef struct st_masque_udp_tunnel_t masque_udp_tunnel_t;
+
+typedef enum {
+    masque_udp_event_ready = 0, /* The proxy accepted the tunnel */
+    masque_udp_event_refused, /* The proxy refused the tunnel */
+    masque_udp_event_datagram, /* A UDP payload was received from the target */
+    masque_udp_event_closed /* The tunnel is closed and will be freed after the callback */
+} masque_udp_event_enum;
+
+typedef void (*masque_udp_client_fn)(masque_udp_tunnel_t* tunnel, masque_udp_event_enum event,
+    const uint8_t* bytes, size_t length, void* app_ctx);
+
+typedef struct st_masque_udp_stats_t {
+    uint64_t nb_tunnels;
+    uint64_t nb_tunnels_refused;
+    uint64_t nb_datagrams_to_target;
+    uint64_t bytes_to_target;
+    uint64_t nb_datagrams_to_client;
+    uint64_t bytes_to_client;
+    uint64_t nb_dropped;
+    uint64_t nb_recv_calls;
+} masque_udp_stats_t;
+
+/* Set the transport parameters required for HTTP datagrams, on the client
+ * connection. The server mirrors the client's support of datagrams. */
+void masque_udp_set_transport_parameters(picoquic_cnx_t* cnx);
+
+/* Proxy side.
+ * ring_size is the number of buffers per tunnel, max_payload the largest
+ * UDP payload forwarded; larger payloads are dropped. Zero selects the
+ * defaults. */
+masque_udp_proxy_t* masque_udp_proxy_create(size_t ring_size, size_t max_payload);
+void masque_udp_proxy_delete(masque_udp_proxy_t* proxy);
+int masque_udp_proxy_callback(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t event, picohttp_server_stream_ctx_t* stream_ctx, void* path_app_ctx);
+/* Read the tunnel sockets, and mark the tunnels that received data as
+ * ready to send datagrams. Returns the number of payloads received. */
+size_t masque_udp_proxy_poll(masque_udp_proxy_t* proxy);
+/* Allow tunnels to internal targets, e.g., for tests on the loopback
+ * address. Refused by default. */
+void masque_udp_proxy_allow_internal_targets(masque_udp_proxy_t* proxy, int allow);
+/* Returns 1 if the address is loopback, unspecified, private, shared,
+ * link-local, site-local, multicast or reserved, including IPv4 addresses
+ * embedded in IPv4-mapped or NAT64 IPv6 addresses. */
+int masque_udp_is_internal_target(const struct sockaddr* addr);
+size_t masque_udp_proxy_nb_tunnels(masque_udp_proxy_t* proxy);
+void masque_udp_proxy_get_stats(masque_udp_proxy_t* proxy, masque_udp_stats_t* stats);
+
+/* Client side.
+ * Open a tunnel to the target on an H3 connection. The callback is called
+ * when the proxy responds, when payloads are received, and when the tunnel
+ * is closed. */
+int masque_udp_client_connect(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* h3_ctx,
+    const char* target_host, uint16_t target_port, masque_udp_client_fn client_fn, void* app_ctx,
+    masque_udp_tunnel_t** p_tunnel);
+/* Queue a payload for sending to the target. Returns -1 if the tunnel is
+ * not open, or if its ring is full. */
+int masque_udp_tunnel_send(masque_udp_tunnel_t* tunnel, const uint8_t* payload, size_t length);
+/* Close the tunnel: the request stream is closed, and the tunnel is freed. */
+void masque_udp_tunnel_close(masque_udp_tunnel_t* tunnel);
+int masque_udp_tunnel_is_ready(masque_udp_tunnel_t* tunnel);
+void masque_udp_tunnel_get_stats(masque_udp_tunnel_t* tunnel, masque_udp_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* MASQUE_UDP_H */
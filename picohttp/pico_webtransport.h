@@ -47,12 +47,89 @@ extern "C" {
     typedef struct st_picowt_capsule_t {
         h3zero_capsule_t h3_capsule;
         uint32_t error_code;
-        const uint8_t* error_msg;
+        const uint8_t* error_msg; /* copy owned by the capsule, valid until the next capsule or release */
         size_t error_msg_len;
+        uint8_t* error_msg_buffer;
+        size_t error_msg_buffer_size;
     } picowt_capsule_t;
 
     int picowt_receive_capsule(picoquic_cnx_t *cnx, const uint8_t* bytes, const uint8_t* bytes_max, picowt_capsule_t* capsule);
     void picowt_release_capsule(picowt_capsule_t* capsule);
+
+    /* Web transport sessions with per session flow control and scheduling.
+     *
+     * By default, all the sessions on a connection share the QUIC stream
+     * scheduler, and a session sending bulk data on many streams can starve
+     * the small messages of another session. The session API queues the
+     * outgoing data per session, and only lets "max_active" streams of each
+     * session compete in the connection scheduler at any time. Streams of the
+     * same session take turns after sending "quantum" bytes. All the streams
+     * of a session use the session priority. With the default, even priority,
+     * the QUIC scheduler serves the active streams in round robin, which
+     * amounts to round robin between sessions. Datagrams are already served
+     * in round robin between sessions by the h3zero datagram scheduler.
+     *
+     * The session also enforces limits on the number of open streams and on
+     * the number of bytes queued but not yet sent. Incoming streams beyond
+     * the limit are refused.
+     *
+     * The session sits between h3zero and the application callback: the
+     * application receives the usual web transport events, with its own
+     * context as path_app_ctx. The session deletes the stream contexts when
+     * both directions are closed. The session is freed after the
+     * "picohttp_callback_deregister" event is passed to the application.
+     */
+#define PICOWT_SESSION_PRIORITY_DEFAULT 8
+#define PICOWT_SESSION_MAX_STREAMS_DEFAULT 64
+#define PICOWT_SESSION_MAX_BUFFERED_DEFAULT 0x100000
+#define PICOWT_SESSION_MAX_ACTIVE_DEFAULT 1
+#define PICOWT_SESSION_QUANTUM_DEFAULT 0x4000
+
+    typedef struct st_picowt_session_limits_t {
+        uint8_t priority; /* QUIC stream priority of the session streams */
+        size_t max_streams; /* max number of open streams, local and remote */
+        size_t max_buffered; /* max number of bytes queued and not yet sent */
+        size_t max_active; /* max number of streams active in the scheduler, 0 if no limit */
+        size_t quantum; /* bytes sent on a stream before yielding, 0 if no limit */
+    } picowt_session_limits_t;
+
+    typedef struct st_picowt_session_stats_t {
+        uint64_t nb_streams_local;
+        uint64_t nb_streams_remote;
+        uint64_t nb_streams_refused;
+        uint64_t bytes_sent;
+        uint64_t bytes_received;
+        uint64_t nb_datagrams_sent;
+        uint64_t nb_datagrams_received;
+        uint64_t datagram_bytes_sent;
+        uint64_t datagram_bytes_received;
+        size_t nb_streams_open;
+        size_t bytes_buffered;
+        size_t max_bytes_buffered;
+    } picowt_session_stats_t;
+
+    typedef struct st_picowt_session_t picowt_session_t;
+
+    void picowt_session_limits_init(picowt_session_limits_t* limits);
+    /* Server side: create a session when processing the "picohttp_callback_connect"
+     * event on the control stream. */
+    picowt_session_t* picowt_session_accept(picoquic_cnx_t* cnx, picohttp_server_stream_ctx_t* control_stream_ctx,
+        const picowt_session_limits_t* limits, picohttp_post_data_cb_fn wt_callback, void* wt_ctx);
+    /* Client side: create a session and send the CONNECT request. */
+    int picowt_session_connect(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* h3_ctx, const char* path,
+        const picowt_session_limits_t* limits, picohttp_post_data_cb_fn wt_callback, void* wt_ctx,
+        picowt_session_t** p_session);
+    /* Create a local stream, and queue the web transport stream header.
+     * Returns NULL if the session stream limit is reached. */
+    picohttp_server_stream_ctx_t* picowt_session_create_stream(picowt_session_t* session, int is_bidir);
+    /* Queue data on a session stream. Returns -1 if the buffer limit would be exceeded */
+    int picowt_session_send(picowt_session_t* session, picohttp_server_stream_ctx_t* stream_ctx,
+        const uint8_t* bytes, size_t length, int is_fin);
+    size_t picowt_session_available(picowt_session_t* session);
+    int picowt_session_set_priority(picowt_session_t* session, uint8_t priority);
+    int picowt_session_close(picowt_session_t* session, uint32_t picowt_err, const char* err_msg);
+    uint64_t picowt_session_id(picowt_session_t* session);
+    void picowt_session_get_stats(picowt_session_t* session, picowt_session_stats_t* stats);
 #ifdef __cplusplus
 }
 #endif
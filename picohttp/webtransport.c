@@ -245,10 +245,34 @@ int picowt_receive_capsule(picoquic_cnx_t *cnx, const uint8_t* bytes, const uint
             ret = -1;
         }
         else {
-            capsule->error_msg = picoquic_frames_uint32_decode(
-                capsule->h3_capsule.capsule, capsule->h3_capsule.capsule + capsule->h3_capsule.capsule_length,
+            /* The capsule value may point into the input bytes, which the caller
+             * reuses after this call. Copy the message into the capsule. */
+            const uint8_t* msg = picoquic_frames_uint32_decode(
+                capsule->h3_capsule.value, capsule->h3_capsule.value + capsule->h3_capsule.capsule_length,
                 &capsule->error_code);
-            capsule->error_msg_len = capsule->h3_capsule.capsule_length - 4;
+            size_t msg_len = capsule->h3_capsule.capsule_length - 4;
+
+            if (msg_len > capsule->error_msg_buffer_size) {
+                uint8_t* buffer = (uint8_t*)malloc(msg_len);
+                if (buffer == NULL) {
+                    picoquic_log_app_message(cnx, "Cannot allocate %zu bytes for web transport close message", msg_len);
+                    ret = -1;
+                }
+                else {
+                    if (capsule->error_msg_buffer != NULL) {
+                        free(capsule->error_msg_buffer);
+                    }
+                    capsule->error_msg_buffer = buffer;
+                    capsule->error_msg_buffer_size = msg_len;
+                }
+            }
+            if (ret == 0) {
+                if (msg_len > 0) {
+                    memcpy(capsule->error_msg_buffer, msg, msg_len);
+                }
+                capsule->error_msg = capsule->error_msg_buffer;
+                capsule->error_msg_len = msg_len;
+            }
         }
     }
     return ret;
@@ -257,4 +281,647 @@ int picowt_receive_capsule(picoquic_cnx_t *cnx, const uint8_t* bytes, const uint
 void picowt_release_capsule(picowt_capsule_t* capsule)
 {
     h3zero_release_capsule(&capsule->h3_capsule);
-}
\ No newline at end of file
+    if (capsule->error_msg_buffer != NULL) {
+        free(capsule->error_msg_buffer);
+    }
+    capsule->error_msg_buffer = NULL;
+    capsule->error_msg_buffer_size = 0;
+    capsule->error_msg = NULL;
+    capsule->error_msg_len = 0;
+}
+/* Web transport sessions.
+ * Outgoing data is queued in a list of chunks per stream. Streams that have
+ * data to send are placed in the session ready queue, and at most
+ * "max_active" of them are marked active in the QUIC scheduler. When an
+ * active stream has sent its quantum, or has nothing left to send, it
+ * yields its slot to the next stream in the ready queue.
+ */
+typedef struct st_picowt_chunk_t {
+    struct st_picowt_chunk_t* next;
+    size_t length;
+    size_t offset;
+} picowt_chunk_t;
+
+typedef struct st_picowt_session_stream_t {
+    struct st_picowt_session_stream_t* next;
+    struct st_picowt_session_stream_t* previous;
+    struct st_picowt_session_stream_t* next_ready;
+    picohttp_server_stream_ctx_t* stream_ctx;
+    picowt_chunk_t* first_chunk;
+    picowt_chunk_t* last_chunk;
+    size_t quantum_sent;
+    unsigned int is_fin_queued : 1;
+    unsigned int is_ready : 1;
+    unsigned int is_active : 1;
+} picowt_session_stream_t;
+
+struct st_picowt_session_t {
+    picoquic_cnx_t* cnx;
+    h3zero_callback_ctx_t* h3_ctx;
+    picohttp_server_stream_ctx_t* control_stream_ctx;
+    uint64_t session_id;
+    picowt_session_limits_t limits;
+    picohttp_post_data_cb_fn wt_callback;
+    void* wt_ctx;
+    picowt_session_stream_t* first_stream;
+    picowt_session_stream_t* first_ready;
+    picowt_session_stream_t* last_ready;
+    size_t nb_active;
+    picowt_session_stats_t stats;
+    unsigned int is_registered : 1;
+};
+
+static int picowt_session_callback(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t wt_event, picohttp_server_stream_ctx_t* stream_ctx, void* path_app_ctx);
+
+void picowt_session_limits_init(picowt_session_limits_t* limits)
+{
+    limits->priority = PICOWT_SESSION_PRIORITY_DEFAULT;
+    limits->max_streams = PICOWT_SESSION_MAX_STREAMS_DEFAULT;
+    limits->max_buffered = PICOWT_SESSION_MAX_BUFFERED_DEFAULT;
+    limits->max_active = PICOWT_SESSION_MAX_ACTIVE_DEFAULT;
+    limits->quantum = PICOWT_SESSION_QUANTUM_DEFAULT;
+}
+
+/* Streams refused because of the session limit are attached to this
+ * callback, so their data is ignored. */
+static int picowt_session_refused_callback(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t wt_event, picohttp_server_stream_ctx_t* stream_ctx, void* path_app_ctx)
+{
+    if (wt_event == picohttp_callback_provide_data) {
+        (void)picoquic_provide_stream_data_buffer(bytes, 0, 0, 0);
+    }
+    return 0;
+}
+
+static picowt_session_stream_t* picowt_session_find_stream(picowt_session_t* session, picohttp_server_stream_ctx_t* stream_ctx)
+{
+    picowt_session_stream_t* wt_stream = session->first_stream;
+
+    while (wt_stream != NULL && wt_stream->stream_ctx != stream_ctx) {
+        wt_stream = wt_stream->next;
+    }
+
+    return wt_stream;
+}
+
+static picowt_session_stream_t* picowt_session_add_stream(picowt_session_t* session, picohttp_server_stream_ctx_t* stream_ctx)
+{
+    picowt_session_stream_t* wt_stream = (picowt_session_stream_t*)malloc(sizeof(picowt_session_stream_t));
+
+    if (wt_stream != NULL) {
+        memset(wt_stream, 0, sizeof(picowt_session_stream_t));
+        wt_stream->stream_ctx = stream_ctx;
+        wt_stream->next = session->first_stream;
+        if (session->first_stream != NULL) {
+            session->first_stream->previous = wt_stream;
+        }
+        session->first_stream = wt_stream;
+        session->stats.nb_streams_open++;
+        stream_ctx->control_stream_id = session->session_id;
+        stream_ctx->path_callback = picowt_session_callback;
+        stream_ctx->path_callback_ctx = session;
+        /* Streams that may carry data from this side use the session priority */
+        if (!stream_ctx->ps.stream_state.is_fin_sent) {
+            (void)picoquic_set_stream_priority(session->cnx, stream_ctx->stream_id, session->limits.priority);
+        }
+    }
+
+    return wt_stream;
+}
+
+static void picowt_session_remove_ready(picowt_session_t* session, picowt_session_stream_t* wt_stream)
+{
+    picowt_session_stream_t* previous = NULL;
+    picowt_session_stream_t* next = session->first_ready;
+
+    while (next != NULL && next != wt_stream) {
+        previous = next;
+        next = next->next_ready;
+    }
+    if (next != NULL) {
+        if (previous == NULL) {
+            session->first_ready = wt_stream->next_ready;
+        }
+        else {
+            previous->next_ready = wt_stream->next_ready;
+        }
+        if (session->last_ready == wt_stream) {
+            session->last_ready = previous;
+        }
+    }
+    wt_stream->next_ready = NULL;
+    wt_stream->is_ready = 0;
+}
+
+static void picowt_session_remove_stream(picowt_session_t* session, picowt_session_stream_t* wt_stream)
+{
+    if (wt_stream->is_ready) {
+        picowt_session_remove_ready(session, wt_stream);
+    }
+    if (wt_stream->is_active) {
+        session->nb_active--;
+    }
+    while (wt_stream->first_chunk != NULL) {
+        picowt_chunk_t* chunk = wt_stream->first_chunk;
+        wt_stream->first_chunk = chunk->next;
+        session->stats.bytes_buffered -= chunk->length - chunk->offset;
+        free(chunk);
+    }
+    if (wt_stream->previous == NULL) {
+        session->first_stream = wt_stream->next;
+    }
+    else {
+        wt_stream->previous->next = wt_stream->next;
+    }
+    if (wt_stream->next != NULL) {
+        wt_stream->next->previous = wt_stream->previous;
+    }
+    session->stats.nb_streams_open--;
+    free(wt_stream);
+}
+
+/* Give the free scheduler slots to the streams waiting in the ready queue. */
+static int picowt_session_activate(picowt_session_t* session)
+{
+    int ret = 0;
+
+    while (ret == 0 && session->first_ready != NULL &&
+        (session->limits.max_active == 0 || session->nb_active < session->limits.max_active)) {
+        picowt_session_stream_t* wt_stream = session->first_ready;
+
+        session->first_ready = wt_stream->next_ready;
+        if (session->first_ready == NULL) {
+            session->last_ready = NULL;
+        }
+        wt_stream->next_ready = NULL;
+        wt_stream->is_ready = 0;
+        wt_stream->is_active = 1;
+        wt_stream->quantum_sent = 0;
+        session->nb_active++;
+        ret = picoquic_mark_active_stream(session->cnx, wt_stream->stream_ctx->stream_id, 1, wt_stream->stream_ctx);
+    }
+
+    return ret;
+}
+
+static int picowt_session_schedule(picowt_session_t* session, picowt_session_stream_t* wt_stream)
+{
+    if (!wt_stream->is_active && !wt_stream->is_ready) {
+        wt_stream->is_ready = 1;
+        if (session->last_ready == NULL) {
+            session->first_ready = wt_stream;
+        }
+        else {
+            session->last_ready->next_ready = wt_stream;
+        }
+        session->last_ready = wt_stream;
+    }
+    return picowt_session_activate(session);
+}
+
+/* Delete the stream context once both directions are closed */
+static void picowt_session_check_stream_done(picowt_session_t* session, picohttp_server_stream_ctx_t* stream_ctx)
+{
+    if (stream_ctx->ps.stream_state.is_fin_sent && stream_ctx->ps.stream_state.is_fin_received) {
+        h3zero_delete_stream(session->cnx, session->h3_ctx, stream_ctx);
+    }
+}
+
+static int picowt_session_provide_data(picowt_session_t* session, picowt_session_stream_t* wt_stream, void* context, size_t space)
+{
+    int ret = 0;
+    size_t available = 0;
+    size_t length;
+    int is_fin = 0;
+    int is_still_active = 0;
+    uint8_t* buffer;
+
+    for (picowt_chunk_t* chunk = wt_stream->first_chunk; chunk != NULL && available < space; chunk = chunk->next) {
+        available += chunk->length - chunk->offset;
+    }
+    length = (available > space) ? space : available;
+    if (length == available && wt_stream->is_fin_queued) {
+        is_fin = 1;
+    }
+    else if (length < available) {
+        /* Yield if the quantum is used and other streams of the session are waiting */
+        is_still_active = (session->limits.quantum == 0 || session->first_ready == NULL ||
+            wt_stream->quantum_sent + length < session->limits.quantum);
+    }
+
+    buffer = (uint8_t*)picoquic_provide_stream_data_buffer(context, length, is_fin, is_still_active);
+    if (buffer == NULL) {
+        ret = -1;
+    }
+    else {
+        size_t copied = 0;
+
+        while (copied < length) {
+            picowt_chunk_t* chunk = wt_stream->first_chunk;
+            size_t chunk_length = chunk->length - chunk->offset;
+
+            if (chunk_length > length - copied) {
+                chunk_length = length - copied;
+            }
+            memcpy(buffer + copied, ((uint8_t*)(chunk + 1)) + chunk->offset, chunk_length);
+            copied += chunk_length;
+            chunk->offset += chunk_length;
+            if (chunk->offset >= chunk->length) {
+                wt_stream->first_chunk = chunk->next;
+                if (wt_stream->first_chunk == NULL) {
+                    wt_stream->last_chunk = NULL;
+                }
+                free(chunk);
+            }
+        }
+        session->stats.bytes_buffered -= length;
+        session->stats.bytes_sent += length;
+        wt_stream->quantum_sent += length;
+    }
+
+    if (ret == 0 && !is_still_active) {
+        picohttp_server_stream_ctx_t* stream_ctx = wt_stream->stream_ctx;
+
+        wt_stream->is_active = 0;
+        session->nb_active--;
+        if (is_fin) {
+            stream_ctx->ps.stream_state.is_fin_sent = 1;
+        }
+        else if (wt_stream->first_chunk != NULL) {
+            /* Back to the end of the ready queue */
+            ret = picowt_session_schedule(session, wt_stream);
+        }
+        if (ret == 0) {
+            ret = picowt_session_activate(session);
+        }
+        if (is_fin) {
+            picowt_session_check_stream_done(session, stream_ctx);
+        }
+    }
+
+    return ret;
+}
+
+/* Free the session, after notifying the application. */
+static void picowt_session_delete(picowt_session_t* session)
+{
+    if (session->is_registered) {
+        /* The deregister event is ignored, since is_registered is now zero */
+        session->is_registered = 0;
+        h3zero_delete_stream_prefix(session->cnx, session->h3_ctx, session->session_id);
+    }
+    if (session->wt_callback != NULL) {
+        (void)session->wt_callback(session->cnx, NULL, 0, picohttp_callback_deregister, session->control_stream_ctx, session->wt_ctx);
+    }
+    while (session->first_stream != NULL) {
+        /* Detach the remaining streams, so they ignore further events */
+        picohttp_server_stream_ctx_t* stream_ctx = session->first_stream->stream_ctx;
+        if (session->first_stream->is_active) {
+            (void)picoquic_mark_active_stream(session->cnx, stream_ctx->stream_id, 0, stream_ctx);
+        }
+        stream_ctx->path_callback = picowt_session_refused_callback;
+        stream_ctx->path_callback_ctx = NULL;
+        picowt_session_remove_stream(session, session->first_stream);
+    }
+    if (session->control_stream_ctx != NULL && session->control_stream_ctx->path_callback_ctx == session) {
+        session->control_stream_ctx->path_callback = NULL;
+        session->control_stream_ctx->path_callback_ctx = NULL;
+    }
+    free(session);
+}
+
+static int picowt_session_stream_data(picowt_session_t* session, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t wt_event, picohttp_server_stream_ctx_t* stream_ctx)
+{
+    int ret = 0;
+    picowt_session_stream_t* wt_stream = picowt_session_find_stream(session, stream_ctx);
+
+    if (wt_stream == NULL) {
+        /* First data on a stream opened by the peer */
+        if (session->stats.nb_streams_open >= session->limits.max_streams ||
+            (wt_stream = picowt_session_add_stream(session, stream_ctx)) == NULL) {
+            session->stats.nb_streams_refused++;
+            stream_ctx->path_callback = picowt_session_refused_callback;
+            stream_ctx->path_callback_ctx = NULL;
+            ret = picoquic_stop_sending(session->cnx, stream_ctx->stream_id, H3ZERO_REQUEST_REJECTED);
+            if (ret == 0 && PICOQUIC_IS_BIDIR_STREAM_ID(stream_ctx->stream_id)) {
+                stream_ctx->ps.stream_state.is_fin_sent = 1;
+                ret = picoquic_reset_stream(session->cnx, stream_ctx->stream_id, H3ZERO_REQUEST_REJECTED);
+            }
+            return ret;
+        }
+        session->stats.nb_streams_remote++;
+    }
+    session->stats.bytes_received += length;
+    ret = session->wt_callback(session->cnx, bytes, length, wt_event, stream_ctx, session->wt_ctx);
+    if (wt_event == picohttp_callback_post_fin) {
+        stream_ctx->ps.stream_state.is_fin_received = 1;
+        picowt_session_check_stream_done(session, stream_ctx);
+    }
+
+    return ret;
+}
+
+static int picowt_session_callback(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t wt_event, picohttp_server_stream_ctx_t* stream_ctx, void* path_app_ctx)
+{
+    int ret = 0;
+    picowt_session_t* session = (picowt_session_t*)path_app_ctx;
+    int is_control;
+    picowt_session_stream_t* wt_stream;
+
+    if (session == NULL) {
+        return picowt_session_refused_callback(cnx, bytes, length, wt_event, stream_ctx, path_app_ctx);
+    }
+    is_control = (stream_ctx != NULL && stream_ctx->stream_id == session->session_id);
+
+    switch (wt_event) {
+    case picohttp_callback_connect_accepted:
+        stream_ctx->is_upgraded = 1;
+        ret = session->wt_callback(cnx, bytes, length, wt_event, stream_ctx, session->wt_ctx);
+        break;
+    case picohttp_callback_connect_refused:
+        ret = session->wt_callback(cnx, bytes, length, wt_event, stream_ctx, session->wt_ctx);
+        picowt_session_delete(session);
+        break;
+    case picohttp_callback_post_data:
+    case picohttp_callback_post_fin:
+        if (!is_control) {
+            ret = picowt_session_stream_data(session, bytes, length, wt_event, stream_ctx);
+        }
+        else {
+            ret = session->wt_callback(cnx, bytes, length, wt_event, stream_ctx, session->wt_ctx);
+            if (wt_event == picohttp_callback_post_fin) {
+                /* The peer closed the session. Close the control stream and release the session */
+                if (!stream_ctx->ps.stream_state.is_fin_sent) {
+                    stream_ctx->ps.stream_state.is_fin_sent = 1;
+                    (void)picoquic_add_to_stream(session->cnx, session->session_id, NULL, 0, 1);
+                }
+                picowt_session_delete(session);
+            }
+        }
+        break;
+    case picohttp_callback_provide_data:
+        if ((wt_stream = picowt_session_find_stream(session, stream_ctx)) != NULL) {
+            ret = picowt_session_provide_data(session, wt_stream, bytes, length);
+        }
+        else if (is_control) {
+            ret = session->wt_callback(cnx, bytes, length, wt_event, stream_ctx, session->wt_ctx);
+        }
+        else {
+            (void)picoquic_provide_stream_data_buffer(bytes, 0, 0, 0);
+        }
+        break;
+    case picohttp_callback_post_datagram:
+        session->stats.nb_datagrams_received++;
+        session->stats.datagram_bytes_received += length;
+        ret = session->wt_callback(cnx, bytes, length, wt_event, stream_ctx, session->wt_ctx);
+        break;
+    case picohttp_callback_provide_datagram:
+        ret = session->wt_callback(cnx, bytes, length, wt_event, stream_ctx, session->wt_ctx);
+        if (h3zero_get_provided_datagram_length(bytes) > 0) {
+            session->stats.nb_datagrams_sent++;
+            session->stats.datagram_bytes_sent += h3zero_get_provided_datagram_length(bytes);
+        }
+        break;
+    case picohttp_callback_reset:
+        /* The cnx parameter is NULL for this event */
+        ret = session->wt_callback(cnx, bytes, length, wt_event, stream_ctx, session->wt_ctx);
+        if (is_control) {
+            picowt_session_delete(session);
+        }
+        else if ((wt_stream = picowt_session_find_stream(session, stream_ctx)) != NULL) {
+            /* The stream context is kept by h3zero, but the session forgets it */
+            picowt_session_remove_stream(session, wt_stream);
+            stream_ctx->path_callback = picowt_session_refused_callback;
+            stream_ctx->path_callback_ctx = NULL;
+            ret = picowt_session_activate(session);
+        }
+        break;
+    case picohttp_callback_deregister:
+        if (session->is_registered) {
+            session->is_registered = 0;
+            picowt_session_delete(session);
+        }
+        break;
+    case picohttp_callback_free:
+        if (is_control) {
+            picowt_session_delete(session);
+        }
+        else {
+            if ((wt_stream = picowt_session_find_stream(session, stream_ctx)) != NULL) {
+                picowt_session_remove_stream(session, wt_stream);
+                (void)picowt_session_activate(session);
+            }
+            ret = session->wt_callback(cnx, bytes, length, wt_event, stream_ctx, session->wt_ctx);
+        }
+        break;
+    default:
+        ret = session->wt_callback(cnx, bytes, length, wt_event, stream_ctx, session->wt_ctx);
+        break;
+    }
+
+    return ret;
+}
+
+static picowt_session_t* picowt_session_create(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* h3_ctx,
+    picohttp_server_stream_ctx_t* control_stream_ctx, const picowt_session_limits_t* limits,
+    picohttp_post_data_cb_fn wt_callback, void* wt_ctx)
+{
+    picowt_session_t* session = (picowt_session_t*)malloc(sizeof(picowt_session_t));
+
+    if (session != NULL) {
+        memset(session, 0, sizeof(picowt_session_t));
+        session->cnx = cnx;
+        session->h3_ctx = h3_ctx;
+        session->control_stream_ctx = control_stream_ctx;
+        session->session_id = control_stream_ctx->stream_id;
+        if (limits == NULL) {
+            picowt_session_limits_init(&session->limits);
+        }
+        else {
+            session->limits = *limits;
+        }
+        session->wt_callback = wt_callback;
+        session->wt_ctx = wt_ctx;
+        control_stream_ctx->path_callback = picowt_session_callback;
+        control_stream_ctx->path_callback_ctx = session;
+    }
+
+    return session;
+}
+
+picowt_session_t* picowt_session_accept(picoquic_cnx_t* cnx, picohttp_server_stream_ctx_t* control_stream_ctx,
+    const picowt_session_limits_t* limits, picohttp_post_data_cb_fn wt_callback, void* wt_ctx)
+{
+    h3zero_callback_ctx_t* h3_ctx = (h3zero_callback_ctx_t*)picoquic_get_callback_context(cnx);
+    picowt_session_t* session = picowt_session_create(cnx, h3_ctx, control_stream_ctx, limits, wt_callback, wt_ctx);
+
+    if (session != NULL) {
+        if (h3zero_declare_stream_prefix(h3_ctx, session->session_id, picowt_session_callback, session) != 0) {
+            control_stream_ctx->path_callback = NULL;
+            control_stream_ctx->path_callback_ctx = NULL;
+            free(session);
+            session = NULL;
+        }
+        else {
+            session->is_registered = 1;
+            control_stream_ctx->ps.stream_state.is_web_transport = 1;
+        }
+    }
+
+    return session;
+}
+
+int picowt_session_connect(picoquic_cnx_t* cnx, h3zero_callback_ctx_t* h3_ctx, const char* path,
+    const picowt_session_limits_t* limits, picohttp_post_data_cb_fn wt_callback, void* wt_ctx,
+    picowt_session_t** p_session)
+{
+    int ret = 0;
+    uint64_t stream_id = picoquic_get_next_local_stream_id(cnx, 0);
+    picohttp_server_stream_ctx_t* stream_ctx = h3zero_find_or_create_stream(cnx, stream_id, h3_ctx, 1, 1);
+    picowt_session_t* session = NULL;
+
+    *p_session = NULL;
+    if (stream_ctx == NULL ||
+        (session = picowt_session_create(cnx, h3_ctx, stream_ctx, limits, wt_callback, wt_ctx)) == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        stream_ctx->is_open = 1;
+        h3_ctx->nb_open_streams++;
+        if ((ret = picowt_connect(cnx, h3_ctx, stream_ctx, path, picowt_session_callback, session)) == 0) {
+            session->is_registered = 1;
+            *p_session = session;
+        }
+        else {
+            stream_ctx->path_callback = NULL;
+            stream_ctx->path_callback_ctx = NULL;
+            free(session);
+        }
+    }
+
+    return ret;
+}
+
+picohttp_server_stream_ctx_t* picowt_session_create_stream(picowt_session_t* session, int is_bidir)
+{
+    picohttp_server_stream_ctx_t* stream_ctx = NULL;
+
+    if (session->stats.nb_streams_open < session->limits.max_streams) {
+        uint64_t stream_id = picoquic_get_next_local_stream_id(session->cnx, !is_bidir);
+
+        stream_ctx = h3zero_find_or_create_stream(session->cnx, stream_id, session->h3_ctx, 1, 1);
+        if (stream_ctx != NULL) {
+            uint8_t header[16];
+            uint8_t* bytes = header;
+
+            if (picowt_session_add_stream(session, stream_ctx) == NULL) {
+                h3zero_delete_stream(session->cnx, session->h3_ctx, stream_ctx);
+                stream_ctx = NULL;
+            }
+            else {
+                (void)picoquic_set_app_stream_ctx(session->cnx, stream_id, stream_ctx);
+                session->stats.nb_streams_local++;
+                /* Queue the stream header: stream type or frame type, then session ID */
+                bytes = picoquic_frames_varint_encode(bytes, header + sizeof(header),
+                    (is_bidir) ? h3zero_frame_webtransport_stream : h3zero_stream_type_webtransport);
+                bytes = picoquic_frames_varint_encode(bytes, header + sizeof(header), session->session_id);
+                if (bytes == NULL || picowt_session_send(session, stream_ctx, header, bytes - header, 0) != 0) {
+                    h3zero_delete_stream(session->cnx, session->h3_ctx, stream_ctx);
+                    stream_ctx = NULL;
+                }
+            }
+        }
+    }
+
+    return stream_ctx;
+}
+
+int picowt_session_send(picowt_session_t* session, picohttp_server_stream_ctx_t* stream_ctx,
+    const uint8_t* bytes, size_t length, int is_fin)
+{
+    int ret = 0;
+    picowt_session_stream_t* wt_stream = picowt_session_find_stream(session, stream_ctx);
+
+    if (wt_stream == NULL || wt_stream->is_fin_queued || stream_ctx->ps.stream_state.is_fin_sent ||
+        session->stats.bytes_buffered + length > session->limits.max_buffered) {
+        ret = -1;
+    }
+    else {
+        if (length > 0) {
+            picowt_chunk_t* chunk = (picowt_chunk_t*)malloc(sizeof(picowt_chunk_t) + length);
+
+            if (chunk == NULL) {
+                ret = PICOQUIC_ERROR_MEMORY;
+            }
+            else {
+                chunk->next = NULL;
+                chunk->length = length;
+                chunk->offset = 0;
+                memcpy(chunk + 1, bytes, length);
+                if (wt_stream->last_chunk == NULL) {
+                    wt_stream->first_chunk = chunk;
+                }
+                else {
+                    wt_stream->last_chunk->next = chunk;
+                }
+                wt_stream->last_chunk = chunk;
+                session->stats.bytes_buffered += length;
+                if (session->stats.bytes_buffered > session->stats.max_bytes_buffered) {
+                    session->stats.max_bytes_buffered = session->stats.bytes_buffered;
+                }
+            }
+        }
+        if (ret == 0) {
+            wt_stream->is_fin_queued |= (is_fin != 0);
+            ret = picowt_session_schedule(session, wt_stream);
+        }
+    }
+
+    return ret;
+}
+
+size_t picowt_session_available(picowt_session_t* session)
+{
+    return (session->stats.bytes_buffered >= session->limits.max_buffered) ? 0 :
+        session->limits.max_buffered - session->stats.bytes_buffered;
+}
+
+int picowt_session_set_priority(picowt_session_t* session, uint8_t priority)
+{
+    int ret = 0;
+
+    session->limits.priority = priority;
+    for (picowt_session_stream_t* wt_stream = session->first_stream; ret == 0 && wt_stream != NULL; wt_stream = wt_stream->next) {
+        if (!wt_stream->stream_ctx->ps.stream_state.is_fin_sent) {
+            ret = picoquic_set_stream_priority(session->cnx, wt_stream->stream_ctx->stream_id, priority);
+        }
+    }
+
+    return ret;
+}
+
+/* Send the close session capsule. The session is released when the peer
+ * closes its side of the control stream. */
+int picowt_session_close(picowt_session_t* session, uint32_t picowt_err, const char* err_msg)
+{
+    int ret = -1;
+
+    if (session->control_stream_ctx != NULL) {
+        ret = picowt_send_close_session_message(session->cnx, session->control_stream_ctx, picowt_err, err_msg);
+    }
+
+    return ret;
+}
+
+uint64_t picowt_session_id(picowt_session_t* session)
+{
+    return session->session_id;
+}
+
+void picowt_session_get_stats(picowt_session_t* session, picowt_session_stats_t* stats)
+{
+    *stats = session->stats;
+}
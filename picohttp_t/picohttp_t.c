@@ -52,9 +52,14 @@ static const picoquic_test_def_t test_table[] = {
     { "h3zero_prepare_qpack", h3zero_prepare_qpack_test },
     { "h3zero_user_agent", h3zero_user_agent_test },
     { "h3zero_uri", h3zero_uri_test },
+    { "h3zero_router", h3zero_router_test },
+    { "h3zero_router_shared", h3zero_router_shared_test },
+    { "h3zero_router_bench", h3zero_router_bench_test },
     { "h3zero_null_sni", h3zero_null_sni_test },
     { "h3zero_qpack_fuzz", h3zero_qpack_fuzz_test },
     { "h3zero_stream_test", h3zero_stream_test },
+    { "h3zero_capsule", h3zero_capsule_test },
+    { "h3zero_wt_capsule", h3zero_wt_capsule_test },
     { "parse_demo_scenario", parse_demo_scenario_test },
     { "h3zero_server", h3zero_server_test },
     { "h09_server", h09_server_test },
@@ -77,6 +82,14 @@ static const picoquic_test_def_t test_table[] = {
     { "h09_multi_file_loss", h09_multi_file_loss_test },
     { "h09_multi_file_preemptive", h09_multi_file_preemptive_test },
     { "h3zero_settings", h3zero_settings_test },
+    { "h3zero_pool", h3zero_pool_test },
+    { "h3zero_pool_goaway", h3zero_pool_goaway_test },
+    { "h3zero_pool_zero_rtt", h3zero_pool_zero_rtt_test },
+    { "h3zero_pool_bench", h3zero_pool_bench_test },
+    { "masque_udp", masque_udp_test },
+    { "masque_udp_bench", masque_udp_bench_test },
+    { "masque_udp_internal", masque_udp_internal_test },
+    { "h3zero_wt_sessions", h3zero_wt_sessions_test },
     { "http_stress", http_stress_test },
     { "http_corrupt", http_corrupt_test},
     { "http_corrupt_rdpn", http_corrupt_rdpn_test},
@@ -31,6 +31,7 @@
 #include "qlog.h"
 #include "cidset.h"
 #include "logreader.h"
+#include "logreplay.h"
 #ifdef _WINDOWS
 #include "../picoquicfirst/getopt.h"
 #endif
@@ -53,6 +54,7 @@ typedef struct app_conversion_context_st
 int convert_csv(const picoquic_connection_id_t * cid, void * ptr);
 int convert_svg(const picoquic_connection_id_t * cid, void * ptr);
 int convert_qlog(const picoquic_connection_id_t * cid, void * ptr);
+int convert_replay(const picoquic_connection_id_t * cid, void * ptr);
 int filedump_binlog(FILE* bin_log, FILE* bin_dump);
 
 int usage();
@@ -197,6 +199,9 @@ int main(int argc, char ** argv)
                 else if (strcmp(appctx.out_format, "qlog") == 0) {
                     ret = cidset_iterate(cids, convert_qlog, &appctx);
                 }
+                else if (strcmp(appctx.out_format, "replay") == 0) {
+                    ret = cidset_iterate(cids, convert_replay, &appctx);
+                }
                 else {
                     fprintf(stderr, "Invalid output format '%s'. Valid formats are\n\n", appctx.out_format);
                     usage_formats();
@@ -240,6 +245,9 @@ void usage_formats()
     fprintf(stderr, "                        -f svg  : generate svg packet flow diagram.\n");
     fprintf(stderr, "                                  requires a template specified by -t\n");
     fprintf(stderr, "                        -f qlog : generate IETF QLOG file\n");
+    fprintf(stderr, "                        -f replay : replay the log through the frame\n");
+    fprintf(stderr, "                                  decoder, report decode time per packet\n");
+    fprintf(stderr, "                                  and divergences from the logged state\n");
 }
 
 int convert_csv(const picoquic_connection_id_t * cid, void * ptr)
@@ -273,6 +281,38 @@ int convert_qlog(const picoquic_connection_id_t * cid, void * ptr)
     return qlog_convert(cid, appctx->f_binlog, appctx->binlog_name, NULL, appctx->out_dir, appctx->flags);
 }
 
+int convert_replay(const picoquic_connection_id_t * cid, void * ptr)
+{
+    const app_conversion_context_t* appctx = (const app_conversion_context_t*)ptr;
+    picoquic_replay_stats_t stats;
+    FILE* F = NULL;
+    int ret = 0;
+
+    char cid_name[2 * PICOQUIC_CONNECTION_ID_MAX_SIZE + 1];
+    if (picoquic_print_connection_id_hexa(cid_name, sizeof(cid_name), cid) != 0) {
+        DBG_PRINTF("Cannot convert connection id for %s", appctx->binlog_name);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = picoquic_binlog_replay(appctx->f_binlog, cid, NULL, &stats);
+    }
+
+    if (ret == 0 && (F = open_outfile(cid_name, appctx->binlog_name, appctx->out_dir, "replay.txt")) == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        fprintf(F, "Replay of connection %s\n", cid_name);
+        picoquic_replay_report(F, &stats);
+        if (F != stdout) {
+            (void)picoquic_file_close(F);
+        }
+    }
+
+    return ret;
+}
+
 int filedump_binlog(FILE* bin_log, FILE* bin_dump)
 {
     int ret = 0;
@@ -237,6 +237,7 @@ typedef struct st_picoquic_bbr_state_t {
     uint64_t bytes_delivered; /* Number of bytes signalled in ACK notify, but not processed yet */
     uint64_t send_quantum;
     picoquic_min_max_rtt_t rtt_filter;
+    picoquic_cc_slow_start_t slow_start;
     uint64_t target_cwnd;
     double pacing_gain;
     double cwnd_gain;
@@ -338,6 +339,7 @@ void BBRUpdateTargetCwnd(picoquic_bbr_state_t* bbr_state)
 static void picoquic_bbr_reset(picoquic_bbr_state_t* bbr_state, picoquic_path_t* path_x, uint64_t current_time)
 {
     memset(bbr_state, 0, sizeof(picoquic_bbr_state_t));
+    picoquic_cc_slow_start_reset(&bbr_state->slow_start);
     path_x->cwin = PICOQUIC_CWIN_INITIAL;
     bbr_state->rt_prop = UINT64_MAX;
 
@@ -1028,6 +1030,26 @@ void picoquic_bbr_notify_congestion(
 }
 
 
+/* Safe retreat if a window seeded by careful resume proved too large.
+ * The congestion notification is not filtered by the loss rate in that case.
+ */
+static void picoquic_bbr_careful_retreat(
+    picoquic_bbr_state_t* bbr_state,
+    picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x,
+    uint64_t lost_packet_number,
+    uint64_t current_time)
+{
+    uint64_t retreat_cwin;
+
+    if (picoquic_cc_careful_resume_retreat(&bbr_state->slow_start, cnx, path_x, lost_packet_number, current_time, &retreat_cwin)) {
+        picoquic_bbr_notify_congestion(bbr_state, cnx, path_x, current_time, 0);
+        if (retreat_cwin < path_x->cwin) {
+            path_x->cwin = retreat_cwin;
+        }
+    }
+}
+
 /*
  * In order to implement BBR, we map generic congestion notification
  * signals to the corresponding BBR actions.
@@ -1059,6 +1081,7 @@ static void picoquic_bbr_notify(
             if (lost_packet_number >= bbr_state->congestion_sequence) {
                 picoquic_bbr_notify_congestion(bbr_state, cnx, path_x, current_time, 0);
             }
+            picoquic_bbr_careful_retreat(bbr_state, cnx, path_x, lost_packet_number, current_time);
             break;
         case picoquic_congestion_notification_repeat:
         case picoquic_congestion_notification_timeout:
@@ -1068,6 +1091,7 @@ static void picoquic_bbr_notify(
                 picoquic_bbr_notify_congestion(bbr_state, cnx, path_x, current_time,
                     (notification == picoquic_congestion_notification_timeout) ? 1 : 0);
             }
+            picoquic_bbr_careful_retreat(bbr_state, cnx, path_x, lost_packet_number, current_time);
             break;
         case picoquic_congestion_notification_spurious_repeat:
             break;
@@ -1076,8 +1100,8 @@ static void picoquic_bbr_notify(
                 BBREnterStartupLongRTT(bbr_state, path_x);
             }
             if (bbr_state->state == picoquic_bbr_alg_startup_long_rtt) {
-                if (picoquic_hystart_test(&bbr_state->rtt_filter, (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement,
-                    cnx->path[0]->pacing_packet_time_microsec, current_time, cnx->is_time_stamp_enabled)) {
+                if (picoquic_cc_slow_start_test(&bbr_state->slow_start, &bbr_state->rtt_filter, cnx, path_x,
+                    rtt_measurement, one_way_delay, current_time)) {
                     BBRExitStartupLongRtt(bbr_state, path_x, current_time);
                 }
             }
@@ -1094,7 +1118,7 @@ static void picoquic_bbr_notify(
                     bbr_state->rt_prop_stamp = current_time;
                 }
                 if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
-                    picoquic_hystart_increase(path_x, &bbr_state->rtt_filter, bbr_state->bytes_delivered);
+                    picoquic_cc_slow_start_increase(&bbr_state->slow_start, path_x, bbr_state->bytes_delivered);
                 }
                 bbr_state->bytes_delivered = 0;
 
@@ -1130,6 +1154,10 @@ static void picoquic_bbr_notify(
             picoquic_bbr_reset(bbr_state, path_x, current_time);
             break;
         case picoquic_congestion_notification_seed_cwin:
+            /* Record the seed for careful resume. BBR applies the seed to its own estimates */
+            if (bbr_state->state == picoquic_bbr_alg_startup_long_rtt || bbr_state->state == picoquic_bbr_alg_startup) {
+                (void)picoquic_cc_careful_resume_seed(&bbr_state->slow_start, cnx, path_x, nb_bytes_acknowledged, current_time);
+            }
             if (bbr_state->state == picoquic_bbr_alg_startup_long_rtt) {
                 BBRExitStartupSeedBDP(bbr_state, path_x, nb_bytes_acknowledged, current_time);
                 picoquic_update_pacing_data(cnx, path_x, 1);
@@ -145,6 +145,174 @@ void picoquic_hystart_increase(picoquic_path_t * path_x, picoquic_min_max_rtt_t*
     path_x->cwin += nb_delivered;
 }
 
+/* Shared slow start management: HyStart++ and careful resume.
+ */
+void picoquic_cc_slow_start_reset(picoquic_cc_slow_start_t* slow_start)
+{
+    memset(slow_start, 0, sizeof(picoquic_cc_slow_start_t));
+    slow_start->hpp_state = picoquic_hystart_pp_slow_start;
+    slow_start->last_round_min_rtt = UINT64_MAX;
+    slow_start->current_round_min_rtt = UINT64_MAX;
+    slow_start->cr_state = picoquic_careful_resume_none;
+}
+
+/* HyStart++, per RFC 9406. Rounds are delimited by path packet numbers:
+ * a round ends when a packet sent after the start of the round is acked.
+ * Returns 1 if the sender shall exit slow start.
+ */
+static int picoquic_hystart_pp_test(picoquic_cc_slow_start_t* slow_start, picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x, uint64_t rtt)
+{
+    int ret = 0;
+
+    if (slow_start->hpp_state == picoquic_hystart_pp_done) {
+        return 0;
+    }
+
+    if (picoquic_cc_get_ack_number(cnx, path_x) >= slow_start->round_end_sequence) {
+        /* Start of a new round */
+        slow_start->last_round_min_rtt = slow_start->current_round_min_rtt;
+        slow_start->current_round_min_rtt = UINT64_MAX;
+        slow_start->nb_rtt_samples = 0;
+        slow_start->round_end_sequence = picoquic_cc_get_sequence_number(cnx, path_x);
+        if (slow_start->hpp_state == picoquic_hystart_pp_css) {
+            slow_start->css_rounds++;
+            if (slow_start->css_rounds >= PICOQUIC_HYSTART_PP_CSS_ROUNDS) {
+                slow_start->hpp_state = picoquic_hystart_pp_done;
+                return 1;
+            }
+        }
+    }
+
+    if (rtt < slow_start->current_round_min_rtt) {
+        slow_start->current_round_min_rtt = rtt;
+    }
+    slow_start->nb_rtt_samples++;
+
+    if (slow_start->nb_rtt_samples >= PICOQUIC_HYSTART_PP_N_RTT_SAMPLE) {
+        if (slow_start->hpp_state == picoquic_hystart_pp_slow_start) {
+            if (slow_start->last_round_min_rtt != UINT64_MAX &&
+                slow_start->current_round_min_rtt != UINT64_MAX) {
+                uint64_t rtt_thresh = slow_start->last_round_min_rtt / PICOQUIC_HYSTART_PP_MIN_RTT_DIVISOR;
+                if (rtt_thresh < PICOQUIC_HYSTART_PP_MIN_RTT_THRESH) {
+                    rtt_thresh = PICOQUIC_HYSTART_PP_MIN_RTT_THRESH;
+                }
+                else if (rtt_thresh > PICOQUIC_HYSTART_PP_MAX_RTT_THRESH) {
+                    rtt_thresh = PICOQUIC_HYSTART_PP_MAX_RTT_THRESH;
+                }
+                if (slow_start->current_round_min_rtt >= slow_start->last_round_min_rtt + rtt_thresh) {
+                    /* Delay increase, enter conservative slow start */
+                    slow_start->css_baseline_min_rtt = slow_start->current_round_min_rtt;
+                    slow_start->css_rounds = 0;
+                    slow_start->css_residual = 0;
+                    slow_start->hpp_state = picoquic_hystart_pp_css;
+                }
+            }
+        }
+        else if (slow_start->current_round_min_rtt < slow_start->css_baseline_min_rtt) {
+            /* The delay increase was spurious, resume slow start */
+            slow_start->css_baseline_min_rtt = UINT64_MAX;
+            slow_start->hpp_state = picoquic_hystart_pp_slow_start;
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_cc_slow_start_test(picoquic_cc_slow_start_t* slow_start, picoquic_min_max_rtt_t* rtt_filter,
+    picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t rtt_measurement, uint64_t one_way_delay, uint64_t current_time)
+{
+    int ret;
+    uint64_t rtt = (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement;
+
+    if (cnx->is_hystart_pp_enabled) {
+        ret = picoquic_hystart_pp_test(slow_start, cnx, path_x, rtt);
+    }
+    else {
+        ret = picoquic_hystart_test(rtt_filter, rtt, cnx->path[0]->pacing_packet_time_microsec,
+            current_time, cnx->is_time_stamp_enabled);
+    }
+
+    return ret;
+}
+
+/* Compute the window increase in slow start. In conservative slow start,
+ * the increase is divided by the CSS growth divisor, carrying the residual
+ * over to the next acknowledgement.
+ */
+uint64_t picoquic_cc_slow_start_increment(picoquic_cc_slow_start_t* slow_start, uint64_t nb_delivered)
+{
+    uint64_t increment = nb_delivered;
+
+    if (slow_start->hpp_state == picoquic_hystart_pp_css) {
+        uint64_t total = nb_delivered + slow_start->css_residual;
+        increment = total / PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR;
+        slow_start->css_residual = total - increment * PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR;
+    }
+
+    return increment;
+}
+
+void picoquic_cc_slow_start_increase(picoquic_cc_slow_start_t* slow_start, picoquic_path_t* path_x, uint64_t nb_delivered)
+{
+    path_x->cwin += picoquic_cc_slow_start_increment(slow_start, nb_delivered);
+}
+
+/* Careful resume. The seed is only applied once per connection, after
+ * the BDP seed has been validated by picoquic_validate_bdp_seed. Returns
+ * the window that the congestion controller shall use.
+ */
+uint64_t picoquic_cc_careful_resume_seed(picoquic_cc_slow_start_t* slow_start, picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x, uint64_t seed_cwin, uint64_t current_time)
+{
+    uint64_t cwin = path_x->cwin;
+
+    if (slow_start->cr_state == picoquic_careful_resume_none && seed_cwin > cwin) {
+        cwin = seed_cwin;
+        slow_start->cr_state = picoquic_careful_resume_unvalidated;
+        slow_start->cr_jump_sequence = picoquic_cc_get_sequence_number(cnx, path_x);
+        slow_start->cr_jump_time = current_time;
+        slow_start->cr_jump_rtt = path_x->smoothed_rtt;
+        slow_start->cr_delivered_at_jump = path_x->delivered;
+    }
+
+    return cwin;
+}
+
+/* Check whether a loss or ECN mark requires a safe retreat. Returns 1
+ * if that is the case, with the retreat window set to half the data
+ * delivered since the jump.
+ */
+int picoquic_cc_careful_resume_retreat(picoquic_cc_slow_start_t* slow_start, picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x, uint64_t lost_packet_number, uint64_t current_time, uint64_t* retreat_cwin)
+{
+    int ret = 0;
+
+    if (slow_start->cr_state == picoquic_careful_resume_unvalidated ||
+        slow_start->cr_state == picoquic_careful_resume_validating) {
+        if (current_time > slow_start->cr_jump_time + 2 * slow_start->cr_jump_rtt) {
+            slow_start->cr_state = picoquic_careful_resume_normal;
+        }
+        else {
+            if (current_time > slow_start->cr_jump_time + slow_start->cr_jump_rtt) {
+                slow_start->cr_state = picoquic_careful_resume_validating;
+            }
+            if (lost_packet_number >= slow_start->cr_jump_sequence) {
+                uint64_t pipe_size = path_x->delivered - slow_start->cr_delivered_at_jump;
+
+                *retreat_cwin = pipe_size / 2;
+                if (*retreat_cwin < PICOQUIC_CWIN_MINIMUM) {
+                    *retreat_cwin = PICOQUIC_CWIN_MINIMUM;
+                }
+                slow_start->cr_state = picoquic_careful_resume_normal;
+                ret = 1;
+            }
+        }
+    }
+
+    return ret;
+}
+
 uint64_t picoquic_cc_increased_window(picoquic_cnx_t* cnx, uint64_t previous_window)
 {
     uint64_t new_window;
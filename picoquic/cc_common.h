@@ -58,6 +58,76 @@ int picoquic_hystart_test(picoquic_min_max_rtt_t* rtt_track, uint64_t rtt_measur
 
 void picoquic_hystart_increase(picoquic_path_t* path_x, picoquic_min_max_rtt_t* rtt_filter, uint64_t nb_delivered);
 
+/* Shared slow start management, used by all congestion control algorithms.
+ *
+ * The exit from slow start is tested either with the classic delay test
+ * of picoquic_hystart_test, or with HyStart++ (RFC 9406) if enabled for
+ * the connection. HyStart++ tracks the minimum RTT per round trip, and
+ * enters "conservative slow start" (CSS) if the RTT increases by more
+ * than a threshold. In CSS, the window grows 4 times slower than in
+ * slow start. Slow start resumes if the RTT decreases again, or exits
+ * after CSS_ROUNDS rounds.
+ *
+ * Careful resume manages the congestion window seeded from a previous
+ * session, using the RTT and CWIN stored in the ticket. The seeded
+ * window is "unvalidated" during the first RTT after the jump, then
+ * "validating" during the next RTT, by which time the packets sent with
+ * the jumped window should be acked. If packets sent after the jump are
+ * lost or marked before that, the sender performs a safe retreat to half
+ * the amount of data actually delivered since the jump, instead of the
+ * normal congestion response.
+ */
+#define PICOQUIC_HYSTART_PP_MIN_RTT_THRESH 4000
+#define PICOQUIC_HYSTART_PP_MAX_RTT_THRESH 16000
+#define PICOQUIC_HYSTART_PP_MIN_RTT_DIVISOR 8
+#define PICOQUIC_HYSTART_PP_N_RTT_SAMPLE 8
+#define PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR 4
+#define PICOQUIC_HYSTART_PP_CSS_ROUNDS 5
+
+typedef enum {
+    picoquic_hystart_pp_slow_start = 0,
+    picoquic_hystart_pp_css,
+    picoquic_hystart_pp_done
+} picoquic_hystart_pp_state_t;
+
+typedef enum {
+    picoquic_careful_resume_none = 0,
+    picoquic_careful_resume_unvalidated,
+    picoquic_careful_resume_validating,
+    picoquic_careful_resume_normal
+} picoquic_careful_resume_state_t;
+
+typedef struct st_picoquic_cc_slow_start_t {
+    picoquic_hystart_pp_state_t hpp_state;
+    uint64_t round_end_sequence;
+    uint64_t last_round_min_rtt;
+    uint64_t current_round_min_rtt;
+    uint64_t nb_rtt_samples;
+    uint64_t css_baseline_min_rtt;
+    uint64_t css_residual;
+    int css_rounds;
+    picoquic_careful_resume_state_t cr_state;
+    uint64_t cr_jump_sequence;
+    uint64_t cr_jump_time;
+    uint64_t cr_jump_rtt;
+    uint64_t cr_delivered_at_jump;
+} picoquic_cc_slow_start_t;
+
+void picoquic_cc_slow_start_reset(picoquic_cc_slow_start_t* slow_start);
+
+int picoquic_cc_slow_start_test(picoquic_cc_slow_start_t* slow_start, picoquic_min_max_rtt_t* rtt_filter,
+    picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t rtt_measurement, uint64_t one_way_delay, uint64_t current_time);
+
+uint64_t picoquic_cc_slow_start_increment(picoquic_cc_slow_start_t* slow_start, uint64_t nb_delivered);
+
+void picoquic_cc_slow_start_increase(picoquic_cc_slow_start_t* slow_start, picoquic_path_t* path_x, uint64_t nb_delivered);
+
+uint64_t picoquic_cc_careful_resume_seed(picoquic_cc_slow_start_t* slow_start, picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x, uint64_t seed_cwin, uint64_t current_time);
+
+int picoquic_cc_careful_resume_retreat(picoquic_cc_slow_start_t* slow_start, picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x, uint64_t lost_packet_number, uint64_t current_time, uint64_t* retreat_cwin);
+
 /* Many congestion control algorithms run a parallel version of new reno in order
  * to provide a lower bound estimate of either the congestion window or the
  * the minimal bandwidth. This implementation of new reno does not directly
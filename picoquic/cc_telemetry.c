@@ -0,0 +1,305 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Congestion control telemetry and experiments.
+ *
+ * The telemetry ring is allocated per connection when telemetry is enabled.
+ * It is a simple circular buffer of fixed size: new events overwrite the
+ * oldest ones when the buffer is full. The record function is called after
+ * congestion control notifications that are either rare (losses, ECN,
+ * spurious repeats) or happen at most once per ACK (bandwidth measurements),
+ * and returns immediately if telemetry is not enabled.
+ *
+ * Experiments assign connections to arms, each arm using a different
+ * congestion control algorithm. The assignment is based on the hash of
+ * the initial connection ID, and the statistics of each connection are
+ * aggregated in the arm statistics when the connection is deleted.
+ */
+
+#include "picoquic_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_utils.h"
+
+typedef struct st_picoquic_cc_telemetry_t {
+    uint64_t sample_interval;
+    uint64_t nb_lost;
+    size_t ring_size;
+    size_t first_event;
+    size_t nb_events;
+    picoquic_cc_event_t* events;
+} picoquic_cc_telemetry_t;
+
+typedef struct st_picoquic_cc_experiment_t {
+    size_t nb_arms;
+    picoquic_congestion_algorithm_t const* arm_alg[PICOQUIC_CC_EXPERIMENT_MAX_ARMS];
+    picoquic_cc_arm_stats_t arm_stats[PICOQUIC_CC_EXPERIMENT_MAX_ARMS];
+} picoquic_cc_experiment_t;
+
+void picoquic_cc_telemetry_free(picoquic_cnx_t* cnx)
+{
+    if (cnx->cc_telemetry != NULL) {
+        if (cnx->cc_telemetry->events != NULL) {
+            free(cnx->cc_telemetry->events);
+        }
+        free(cnx->cc_telemetry);
+        cnx->cc_telemetry = NULL;
+    }
+}
+
+int picoquic_set_cc_telemetry(picoquic_cnx_t* cnx, size_t ring_size, uint64_t sample_interval)
+{
+    int ret = 0;
+
+    picoquic_cc_telemetry_free(cnx);
+
+    if (ring_size > 0) {
+        picoquic_cc_telemetry_t* telemetry = (picoquic_cc_telemetry_t*)malloc(sizeof(picoquic_cc_telemetry_t));
+        if (telemetry == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else {
+            memset(telemetry, 0, sizeof(picoquic_cc_telemetry_t));
+            telemetry->events = (picoquic_cc_event_t*)malloc(ring_size * sizeof(picoquic_cc_event_t));
+            if (telemetry->events == NULL) {
+                free(telemetry);
+                ret = PICOQUIC_ERROR_MEMORY;
+            }
+            else {
+                telemetry->ring_size = ring_size;
+                telemetry->sample_interval = sample_interval;
+                cnx->cc_telemetry = telemetry;
+                for (int i = 0; i < cnx->nb_paths; i++) {
+                    cnx->path[i]->cc_telemetry_next_sample = 0;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_set_default_cc_telemetry(picoquic_quic_t* quic, size_t ring_size, uint64_t sample_interval)
+{
+    quic->cc_telemetry_ring_size = ring_size;
+    quic->cc_telemetry_interval = sample_interval;
+}
+
+void picoquic_cc_telemetry_record(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification, uint64_t current_time)
+{
+    picoquic_cc_telemetry_t* telemetry = cnx->cc_telemetry;
+    picoquic_cc_event_enum event_type;
+    picoquic_cc_event_t* event;
+    uint64_t cc_state = 0;
+    uint64_t cc_param = 0;
+    size_t index;
+
+    if (telemetry == NULL) {
+        return;
+    }
+
+    if (cnx->congestion_alg != NULL && cnx->congestion_alg->alg_observe != NULL) {
+        cnx->congestion_alg->alg_observe(path_x, &cc_state, &cc_param);
+    }
+
+    switch (notification) {
+    case picoquic_congestion_notification_repeat:
+        event_type = picoquic_cc_event_loss;
+        break;
+    case picoquic_congestion_notification_timeout:
+        event_type = picoquic_cc_event_timeout;
+        break;
+    case picoquic_congestion_notification_spurious_repeat:
+        event_type = picoquic_cc_event_spurious;
+        break;
+    case picoquic_congestion_notification_ecn_ec:
+        event_type = picoquic_cc_event_ecn;
+        break;
+    default:
+        if (cc_state != path_x->cc_telemetry_state) {
+            event_type = picoquic_cc_event_state_change;
+        }
+        else if (current_time >= path_x->cc_telemetry_next_sample) {
+            event_type = picoquic_cc_event_sample;
+        }
+        else {
+            return;
+        }
+        break;
+    }
+
+    path_x->cc_telemetry_state = cc_state;
+    path_x->cc_telemetry_next_sample = current_time + telemetry->sample_interval;
+
+    if (telemetry->nb_events >= telemetry->ring_size) {
+        /* Ring is full, overwrite the oldest event */
+        telemetry->first_event++;
+        if (telemetry->first_event >= telemetry->ring_size) {
+            telemetry->first_event = 0;
+        }
+        telemetry->nb_events--;
+        telemetry->nb_lost++;
+    }
+
+    index = telemetry->first_event + telemetry->nb_events;
+    if (index >= telemetry->ring_size) {
+        index -= telemetry->ring_size;
+    }
+    event = &telemetry->events[index];
+    event->event_time = current_time;
+    event->unique_path_id = path_x->unique_path_id;
+    event->event_type = event_type;
+    event->cc_state = cc_state;
+    event->cc_param = cc_param;
+    event->cwin = path_x->cwin;
+    event->pacing_rate = path_x->pacing_rate;
+    event->smoothed_rtt = path_x->smoothed_rtt;
+    event->bytes_in_transit = path_x->bytes_in_transit;
+    telemetry->nb_events++;
+}
+
+size_t picoquic_get_cc_events(picoquic_cnx_t* cnx, picoquic_cc_event_t* events, size_t events_max, uint64_t* nb_lost)
+{
+    picoquic_cc_telemetry_t* telemetry = cnx->cc_telemetry;
+    size_t nb_copied = 0;
+
+    if (telemetry != NULL) {
+        while (nb_copied < events_max && telemetry->nb_events > 0) {
+            events[nb_copied] = telemetry->events[telemetry->first_event];
+            nb_copied++;
+            telemetry->first_event++;
+            if (telemetry->first_event >= telemetry->ring_size) {
+                telemetry->first_event = 0;
+            }
+            telemetry->nb_events--;
+        }
+        if (nb_lost != NULL) {
+            *nb_lost = telemetry->nb_lost;
+        }
+    }
+    else if (nb_lost != NULL) {
+        *nb_lost = 0;
+    }
+
+    return nb_copied;
+}
+
+int picoquic_set_cc_experiment(picoquic_quic_t* quic, picoquic_congestion_algorithm_t const** arm_algs, size_t nb_arms)
+{
+    int ret = 0;
+
+    if (nb_arms > PICOQUIC_CC_EXPERIMENT_MAX_ARMS || (nb_arms > 0 && arm_algs == NULL)) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else {
+        picoquic_cc_experiment_free(quic);
+        if (nb_arms > 0) {
+            quic->cc_experiment = (picoquic_cc_experiment_t*)malloc(sizeof(picoquic_cc_experiment_t));
+            if (quic->cc_experiment == NULL) {
+                ret = PICOQUIC_ERROR_MEMORY;
+            }
+            else {
+                memset(quic->cc_experiment, 0, sizeof(picoquic_cc_experiment_t));
+                quic->cc_experiment->nb_arms = nb_arms;
+                for (size_t i = 0; i < nb_arms; i++) {
+                    quic->cc_experiment->arm_alg[i] = arm_algs[i];
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_cc_experiment_free(picoquic_quic_t* quic)
+{
+    if (quic->cc_experiment != NULL) {
+        free(quic->cc_experiment);
+        quic->cc_experiment = NULL;
+    }
+}
+
+/* Assign a new connection to an experiment arm, and select the corresponding
+ * congestion algorithm. This is called when the connection is created, after
+ * the default algorithm has been set and before it is initialized. */
+void picoquic_cc_experiment_assign(picoquic_cnx_t* cnx)
+{
+    picoquic_cc_experiment_t* experiment = cnx->quic->cc_experiment;
+
+    cnx->cc_experiment_arm = -1;
+
+    if (experiment != NULL && experiment->nb_arms > 0) {
+        uint64_t cid_hash = picoquic_connection_id_hash(&cnx->initial_cnxid);
+        int arm = (int)(cid_hash % experiment->nb_arms);
+
+        cnx->cc_experiment_arm = arm;
+        if (experiment->arm_alg[arm] != NULL) {
+            cnx->congestion_alg = experiment->arm_alg[arm];
+        }
+    }
+}
+
+int picoquic_get_cc_experiment_arm(picoquic_cnx_t* cnx)
+{
+    return cnx->cc_experiment_arm;
+}
+
+/* Aggregate the connection statistics in the arm statistics. This is
+ * called when the connection is deleted. */
+void picoquic_cc_experiment_aggregate(picoquic_cnx_t* cnx)
+{
+    picoquic_cc_experiment_t* experiment = cnx->quic->cc_experiment;
+
+    if (experiment != NULL && cnx->cc_experiment_arm >= 0 &&
+        (size_t)cnx->cc_experiment_arm < experiment->nb_arms) {
+        picoquic_cc_arm_stats_t* stats = &experiment->arm_stats[cnx->cc_experiment_arm];
+        uint64_t current_time = picoquic_get_quic_time(cnx->quic);
+
+        stats->nb_connections++;
+        stats->data_sent += cnx->data_sent;
+        stats->data_received += cnx->data_received;
+        if (current_time > cnx->start_time) {
+            stats->duration += current_time - cnx->start_time;
+        }
+        if (cnx->path[0] != NULL) {
+            stats->smoothed_rtt_sum += cnx->path[0]->smoothed_rtt;
+            stats->rtt_min_sum += cnx->path[0]->rtt_min;
+        }
+        stats->nb_packets_sent += cnx->nb_packets_sent;
+        stats->nb_retransmissions += cnx->nb_retransmission_total;
+        stats->nb_spurious += cnx->nb_spurious;
+    }
+}
+
+int picoquic_get_cc_experiment_stats(picoquic_quic_t* quic, size_t arm, picoquic_cc_arm_stats_t* stats)
+{
+    int ret = 0;
+
+    if (quic->cc_experiment == NULL || arm >= quic->cc_experiment->nb_arms) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    }
+    else {
+        *stats = quic->cc_experiment->arm_stats[arm];
+    }
+
+    return ret;
+}
@@ -428,7 +428,7 @@ static int config_set_option(option_table_line_t* option_desc, option_param_t* p
         break;
     case picoquic_option_MTU_MAX:
         config->mtu_max = config_atoi(params, nb_params, 0, &ret);
-        if (config->mtu_max <= 0 || config->mtu_max > PICOQUIC_MAX_PACKET_SIZE) {
+        if (config->mtu_max <= 0 || config->mtu_max > PICOQUIC_MAX_JUMBO_PACKET_SIZE) {
             fprintf(stderr, "Invalid max mtu: %s\n", config_optval_param_string(opval_buffer, 256, params, nb_params, 0));
             ret = -1;
         }
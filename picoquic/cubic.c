@@ -43,11 +43,13 @@ typedef struct st_picoquic_cubic_state_t {
     double W_reno;
     uint64_t ssthresh;
     picoquic_min_max_rtt_t rtt_filter;
+    picoquic_cc_slow_start_t slow_start;
 } picoquic_cubic_state_t;
 
 static void picoquic_cubic_reset(picoquic_cubic_state_t* cubic_state, picoquic_path_t* path_x, uint64_t current_time) {
     memset(&cubic_state->rtt_filter, 0, sizeof(picoquic_min_max_rtt_t));
     memset(cubic_state, 0, sizeof(picoquic_cubic_state_t));
+    picoquic_cc_slow_start_reset(&cubic_state->slow_start);
     cubic_state->alg_state = picoquic_cubic_alg_slow_start;
     cubic_state->ssthresh = UINT64_MAX;
     cubic_state->W_last_max = (double)cubic_state->ssthresh / (double)path_x->send_mtu;
@@ -201,6 +203,27 @@ static void picoquic_cubic_correct_spurious(picoquic_path_t* path_x,
     }
 }
 
+/* Safe retreat if a window seeded by careful resume proved too large.
+ * The new window becomes the reference for the cubic curve.
+ */
+static void picoquic_cubic_careful_retreat(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_cubic_state_t* cubic_state, uint64_t lost_packet_number, uint64_t current_time)
+{
+    uint64_t retreat_cwin;
+
+    if (picoquic_cc_careful_resume_retreat(&cubic_state->slow_start, cnx, path_x, lost_packet_number, current_time, &retreat_cwin) &&
+        retreat_cwin < path_x->cwin) {
+        path_x->cwin = retreat_cwin;
+        path_x->is_ssthresh_initialized = 1;
+        cubic_state->ssthresh = retreat_cwin;
+        cubic_state->W_max = (double)retreat_cwin / (double)path_x->send_mtu;
+        cubic_state->W_last_max = cubic_state->W_max;
+        cubic_state->W_reno = (double)retreat_cwin;
+        cubic_state->recovery_sequence = picoquic_cc_get_sequence_number(cnx, path_x);
+        picoquic_cubic_enter_avoidance(cubic_state, current_time);
+    }
+}
+
 /*
  * Properly implementing Cubic requires managing a number of
  * signals, such as packet losses or acknowledgements. We attempt
@@ -223,12 +246,17 @@ static void picoquic_cubic_notify(
     path_x->is_cc_data_updated = 1;
 
     if (cubic_state != NULL) {
+        if (notification == picoquic_congestion_notification_repeat ||
+            notification == picoquic_congestion_notification_ecn_ec ||
+            notification == picoquic_congestion_notification_timeout) {
+            picoquic_cubic_careful_retreat(cnx, path_x, cubic_state, lost_packet_number, current_time);
+        }
         switch (cubic_state->alg_state) {
         case picoquic_cubic_alg_slow_start:
             switch (notification) {
             case picoquic_congestion_notification_acknowledgement:
                 if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
-                    picoquic_hystart_increase(path_x, &cubic_state->rtt_filter, nb_bytes_acknowledged);
+                    picoquic_cc_slow_start_increase(&cubic_state->slow_start, path_x, nb_bytes_acknowledged);
                     /* if cnx->cwin exceeds SSTHRESH, exit and go to CA */
                     if (path_x->cwin >= cubic_state->ssthresh) {
                         cubic_state->W_reno = ((double)path_x->cwin) / 2.0;
@@ -258,8 +286,8 @@ static void picoquic_cubic_notify(
             case picoquic_congestion_notification_rtt_measurement:
                 /* Using RTT increases as signal to get out of initial slow start */
                 if (cubic_state->ssthresh == UINT64_MAX &&
-                    picoquic_hystart_test(&cubic_state->rtt_filter, (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement,
-                        cnx->path[0]->pacing_packet_time_microsec, current_time, cnx->is_time_stamp_enabled)) {
+                    picoquic_cc_slow_start_test(&cubic_state->slow_start, &cubic_state->rtt_filter, cnx, path_x,
+                        rtt_measurement, one_way_delay, current_time)) {
                     /* RTT increased too much, get out of slow start! */
                     if (cubic_state->rtt_filter.rtt_filtered_min > PICOQUIC_TARGET_RENO_RTT){
                         double correction;
@@ -307,9 +335,8 @@ static void picoquic_cubic_notify(
                 break;
             case picoquic_congestion_notification_seed_cwin:
                 if (cubic_state->ssthresh == UINT64_MAX) {
-                    if (path_x->cwin < nb_bytes_acknowledged) {
-                        path_x->cwin = nb_bytes_acknowledged;
-                    }
+                    path_x->cwin = picoquic_cc_careful_resume_seed(&cubic_state->slow_start, cnx, path_x,
+                        nb_bytes_acknowledged, current_time);
                     cubic_state->ssthresh = nb_bytes_acknowledged;
                     path_x->is_ssthresh_initialized = 1;
                     picoquic_cubic_enter_avoidance(cubic_state, current_time);
@@ -475,13 +502,17 @@ static void picoquic_dcubic_notify(
     picoquic_cubic_state_t* cubic_state = (picoquic_cubic_state_t*)path_x->congestion_alg_state;
     path_x->is_cc_data_updated = 1;
     if (cubic_state != NULL) {
+        if (notification == picoquic_congestion_notification_repeat ||
+            notification == picoquic_congestion_notification_timeout) {
+            picoquic_cubic_careful_retreat(cnx, path_x, cubic_state, lost_packet_number, current_time);
+        }
         switch (cubic_state->alg_state) {
         case picoquic_cubic_alg_slow_start:
             switch (notification) {
             case picoquic_congestion_notification_acknowledgement:
                 /* Same as Cubic */
                 if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
-                    picoquic_hystart_increase(path_x, &cubic_state->rtt_filter, nb_bytes_acknowledged);
+                    picoquic_cc_slow_start_increase(&cubic_state->slow_start, path_x, nb_bytes_acknowledged);
                     /* if cnx->cwin exceeds SSTHRESH, exit and go to CA */
                     if (path_x->cwin >= cubic_state->ssthresh) {
                         cubic_state->W_reno = ((double)path_x->cwin) / 2.0;
@@ -522,8 +553,8 @@ static void picoquic_dcubic_notify(
                 /* Using RTT increases as congestion signal. This is used
                  * for getting out of slow start, but also for ending a cycle
                  * during congestion avoidance */
-                if (picoquic_hystart_test(&cubic_state->rtt_filter, (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement,
-                    cnx->path[0]->pacing_packet_time_microsec, current_time, cnx->is_time_stamp_enabled)) {
+                if (picoquic_cc_slow_start_test(&cubic_state->slow_start, &cubic_state->rtt_filter, cnx, path_x,
+                    rtt_measurement, one_way_delay, current_time)) {
                     dcubic_exit_slow_start(cnx, path_x, notification, cubic_state, current_time);
                 }
                 break;
@@ -534,9 +565,8 @@ static void picoquic_dcubic_notify(
                 break;
             case picoquic_congestion_notification_seed_cwin:
                 if (cubic_state->ssthresh == UINT64_MAX) {
-                    if (path_x->cwin < nb_bytes_acknowledged) {
-                        path_x->cwin = nb_bytes_acknowledged;
-                    }
+                    path_x->cwin = picoquic_cc_careful_resume_seed(&cubic_state->slow_start, cnx, path_x,
+                        nb_bytes_acknowledged, current_time);
                 }
                 break;
             default:
@@ -60,6 +60,7 @@ typedef struct st_picoquic_fastcc_state_t {
     unsigned int last_freeze_was_not_delay : 1;
     unsigned int rtt_min_is_trusted : 1;
     picoquic_min_max_rtt_t rtt_filter;
+    picoquic_cc_slow_start_t slow_start;
 } picoquic_fastcc_state_t;
 
 uint64_t picoquic_fastcc_delay_threshold(uint64_t rtt_min)
@@ -74,6 +75,7 @@ uint64_t picoquic_fastcc_delay_threshold(uint64_t rtt_min)
 void picoquic_fastcc_reset(picoquic_fastcc_state_t* fastcc_state, picoquic_path_t* path_x, uint64_t current_time)
 {
     memset(fastcc_state, 0, sizeof(picoquic_fastcc_state_t));
+    picoquic_cc_slow_start_reset(&fastcc_state->slow_start);
     fastcc_state->alg_state = picoquic_fastcc_initial;
     fastcc_state->rtt_min = path_x->smoothed_rtt;
     fastcc_state->rolling_rtt_min = fastcc_state->rtt_min;
@@ -82,12 +84,11 @@ void picoquic_fastcc_reset(picoquic_fastcc_state_t* fastcc_state, picoquic_path_
     path_x->cwin = PICOQUIC_CWIN_INITIAL;
 }
 
-void picoquic_fastcc_seed_cwin(picoquic_fastcc_state_t* fastcc_state, picoquic_path_t* path_x, uint64_t bytes_in_flight)
+void picoquic_fastcc_seed_cwin(picoquic_fastcc_state_t* fastcc_state, picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    uint64_t bytes_in_flight, uint64_t current_time)
 {
     if (fastcc_state->alg_state == picoquic_fastcc_initial) {
-        if (path_x->cwin < bytes_in_flight) {
-            path_x->cwin = bytes_in_flight;
-        }
+        path_x->cwin = picoquic_cc_careful_resume_seed(&fastcc_state->slow_start, cnx, path_x, bytes_in_flight, current_time);
     }
 }
 
@@ -102,6 +103,7 @@ void picoquic_fastcc_init(picoquic_path_t* path_x, uint64_t current_time)
     
     if (fastcc_state != NULL) {
         memset(fastcc_state, 0, sizeof(picoquic_fastcc_state_t));
+        picoquic_cc_slow_start_reset(&fastcc_state->slow_start);
         fastcc_state->alg_state = picoquic_fastcc_initial;
         fastcc_state->rtt_min = path_x->smoothed_rtt;
         fastcc_state->rolling_rtt_min = fastcc_state->rtt_min;
@@ -156,6 +158,25 @@ static void fastcc_notify_congestion(
     path_x->is_ssthresh_initialized = 1;
 }
 
+/* Safe retreat if a window seeded by careful resume proved too large
+ */
+static void fastcc_careful_retreat(
+    picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x,
+    picoquic_fastcc_state_t* fastcc_state,
+    uint64_t lost_packet_number,
+    uint64_t current_time)
+{
+    uint64_t retreat_cwin;
+
+    if (picoquic_cc_careful_resume_retreat(&fastcc_state->slow_start, cnx, path_x, lost_packet_number, current_time, &retreat_cwin) &&
+        retreat_cwin < path_x->cwin) {
+        path_x->cwin = retreat_cwin;
+        picoquic_update_pacing_data(cnx, path_x, 0);
+        path_x->is_ssthresh_initialized = 1;
+    }
+}
+
 /*
  * Properly implementing fastcc requires managing a number of
  * signals, such as packet losses or acknowledgements. We attempt
@@ -206,6 +227,7 @@ void picoquic_fastcc_notify(
 
         case picoquic_congestion_notification_ecn_ec:
             fastcc_notify_congestion(cnx, path_x, fastcc_state, current_time, 0, 0);
+            fastcc_careful_retreat(cnx, path_x, fastcc_state, lost_packet_number, current_time);
             break;
         case picoquic_congestion_notification_repeat:
         case picoquic_congestion_notification_timeout:
@@ -213,6 +235,7 @@ void picoquic_fastcc_notify(
                 fastcc_notify_congestion(cnx, path_x, fastcc_state, current_time, 0,
                     (notification == picoquic_congestion_notification_timeout) ? 1 : 0);
             }
+            fastcc_careful_retreat(cnx, path_x, fastcc_state, lost_packet_number, current_time);
             break;
         case picoquic_congestion_notification_spurious_repeat:
             if (fastcc_state->nb_cc_events > 0) {
@@ -299,7 +322,7 @@ void picoquic_fastcc_notify(
             picoquic_fastcc_reset(fastcc_state, path_x, current_time);
             break;
         case picoquic_congestion_notification_seed_cwin:
-            picoquic_fastcc_seed_cwin(fastcc_state, path_x, nb_bytes_acknowledged);
+            picoquic_fastcc_seed_cwin(fastcc_state, cnx, path_x, nb_bytes_acknowledged, current_time);
             break;
         default:
             /* ignore */
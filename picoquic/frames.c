@@ -1120,7 +1120,7 @@ picoquic_stream_head_t* picoquic_find_ready_stream_path(picoquic_cnx_t* cnx, pic
     picoquic_stream_head_t* first_stream = cnx->first_output_stream;
     picoquic_stream_head_t* stream = first_stream;
     picoquic_stream_head_t* found_stream = NULL;
-
+    PICOQUIC_STAGE_BEGIN(cnx->quic, picoquic_stage_stream_select, select_start);
 
     /* Look for a ready stream */
     while (stream != NULL) {
@@ -1139,6 +1139,11 @@ picoquic_stream_head_t* picoquic_find_ready_stream_path(picoquic_cnx_t* cnx, pic
             /* Only consider the streams that meet path affinity requirements */
             has_data = 0;
         }
+        if (has_data && cnx->is_early_data_selective && !stream->is_early_data &&
+            cnx->client_mode && cnx->cnx_state < picoquic_state_client_ready_start) {
+            /* Before the handshake completes, only send the streams marked as early data */
+            has_data = 0;
+        }
         if ((stream->reset_requested && !stream->reset_sent) ||
             (stream->stop_sending_requested && !stream->stop_sending_sent)) {
             /* urgent action is needed, this takes precedence over FIFO vs round-robin processing */
@@ -1185,6 +1190,7 @@ picoquic_stream_head_t* picoquic_find_ready_stream_path(picoquic_cnx_t* cnx, pic
         }
         stream = next_stream;
     }
+    PICOQUIC_STAGE_END(cnx->quic, picoquic_stage_stream_select, select_start);
 
     return found_stream;
 }
@@ -2051,6 +2057,8 @@ picoquic_packet_t* picoquic_check_spurious_retransmission(picoquic_cnx_t* cnx,
                         old_path->send_mtu_max_tried = old_path->send_mtu;
                     }
                     old_path->mtu_probe_sent = 0; 
+                    picoquic_update_cached_mtu(cnx->quic, (struct sockaddr*)&old_path->peer_addr,
+                        old_path->send_mtu, current_time);
                 }
 
                 if (max_spurious_rtt > old_path->max_spurious_rtt) {
@@ -2080,6 +2088,7 @@ picoquic_packet_t* picoquic_check_spurious_retransmission(picoquic_cnx_t* cnx,
                     cnx->congestion_alg->alg_notify(cnx, old_path, picoquic_congestion_notification_spurious_repeat,
                         0, 0, 0, p->sequence_number, current_time);
                 }
+                picoquic_cc_telemetry_record(cnx, old_path, picoquic_congestion_notification_spurious_repeat, current_time);
             }
 
             cnx->nb_spurious++;
@@ -2423,6 +2432,11 @@ void picoquic_record_ack_packet_data(picoquic_packet_data_t* packet_data, picoqu
 /* The BDP seed is validated upon receiving the first RTT measurement */
 void picoquic_validate_bdp_seed(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t rtt_sample, uint64_t current_time)
 {
+    if (cnx->client_mode && path_x == cnx->path[0] && cnx->seed_cwin == 0 &&
+        !cnx->is_path_bdp_checked && cnx->quic->table_path_bdp != NULL) {
+        /* No seed from the session ticket, try the estimates for the network path */
+        picoquic_seed_from_path_bdp(cnx, path_x, current_time);
+    }
     if (path_x == cnx->path[0] && cnx->seed_cwin != 0 &&
         !cnx->cwin_notified_from_seed &&
         cnx->seed_rtt_min <= rtt_sample &&
@@ -2657,12 +2671,16 @@ void process_decoded_packet_data(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
             current_time);
 
         if (cnx->congestion_alg != NULL && packet_data->path_ack[i].acked_path->rtt_sample > 0) {
+            PICOQUIC_STAGE_BEGIN(cnx->quic, picoquic_stage_cc_notify, notify_start);
             cnx->congestion_alg->alg_notify(cnx, packet_data->path_ack[i].acked_path,
                 picoquic_congestion_notification_bw_measurement,
                 packet_data->path_ack[i].acked_path->rtt_sample,
                 packet_data->path_ack[i].acked_path->one_way_delay_sample,
                 0, 0, current_time);
+            PICOQUIC_STAGE_END(cnx->quic, picoquic_stage_cc_notify, notify_start);
         }
+        picoquic_cc_telemetry_record(cnx, packet_data->path_ack[i].acked_path,
+            picoquic_congestion_notification_bw_measurement, current_time);
     }
 
     if (cnx->path[0]->is_ssthresh_initialized && !cnx->path[0]->is_ticket_seeded) {
@@ -3275,6 +3293,8 @@ static int picoquic_process_ack_range(
                     } else if ((p->length + p->checksum_overhead) > old_path->send_mtu) {
                         old_path->send_mtu = p->length + p->checksum_overhead;
                         old_path->mtu_probe_sent = 0;
+                        picoquic_update_cached_mtu(cnx->quic, (struct sockaddr*)&old_path->peer_addr,
+                            old_path->send_mtu, current_time);
                     }
                 }
 
@@ -3318,6 +3338,7 @@ const uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, const uint8_t* byt
     picoquic_packet_context_t* pkt_ctx = &cnx->pkt_ctx[pc];
     uint64_t largest_in_path = 0;
     picoquic_path_t * ack_path = cnx->path[0];
+    PICOQUIC_STAGE_BEGIN(cnx->quic, picoquic_stage_ack_process, ack_start);
 
     if (picoquic_parse_ack_header(bytes, bytes_max-bytes, &num_block,
         (has_path_id)?&path_id:NULL,
@@ -3333,6 +3354,7 @@ const uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, const uint8_t* byt
             if (r_cid == NULL) {
                 /* No such path ID. Ignore frame. TODO: error if never seen? */
                 bytes = picoquic_skip_ack_frame_maybe_ecn(bytes, bytes_max, is_ecn, has_path_id);
+                PICOQUIC_STAGE_END(cnx->quic, picoquic_stage_ack_process, ack_start);
                 return bytes;
             }
             else {
@@ -3439,12 +3461,17 @@ const uint8_t* picoquic_decode_ack_frame(picoquic_cnx_t* cnx, const uint8_t* byt
             pkt_ctx->ecn_ect1_total_remote = ecnx3[1];
         }
         if (ecnx3[2] > pkt_ctx->ecn_ce_total_remote) {
+            /* Pass the number of newly reported CE marks, so the congestion
+             * controller can estimate the fraction of marked packets per ACK */
+            uint64_t nb_ce_new = ecnx3[2] - pkt_ctx->ecn_ce_total_remote;
             pkt_ctx->ecn_ce_total_remote = ecnx3[2];
             cnx->congestion_alg->alg_notify(cnx, ack_path,
                 picoquic_congestion_notification_ecn_ec,
-                0, 0, 0, largest_in_path, current_time);
+                0, 0, nb_ce_new, largest_in_path, current_time);
+            picoquic_cc_telemetry_record(cnx, ack_path, picoquic_congestion_notification_ecn_ec, current_time);
         }
     }
+    PICOQUIC_STAGE_END(cnx->quic, picoquic_stage_ack_process, ack_start);
 
     return bytes;
 }
@@ -4569,7 +4596,10 @@ int picoquic_queue_datagram_frame(picoquic_cnx_t * cnx, size_t length, const uin
     }
     else {
         size_t consumed = 0;
-        uint8_t frame_buffer[PICOQUIC_MAX_PACKET_SIZE];
+        /* Frame type and varint length, followed by at most PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH bytes.
+         * Larger datagrams, e.g., on jumbo packet paths, are sent with picoquic_callback_prepare_datagram,
+         * which sizes them to the space available in the packet. */
+        uint8_t frame_buffer[PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH + 16];
         int more_data = 0;
         int is_pure_ack = 1;
         uint8_t* bytes_next = picoquic_format_datagram_frame(frame_buffer, frame_buffer + sizeof(frame_buffer), &more_data, &is_pure_ack, length, src);
@@ -5202,17 +5232,17 @@ uint8_t* picoquic_format_bdp_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t*
     uint64_t recon_min_rtt = 0;
     uint8_t* ip_addr = NULL;
     uint8_t ip_addr_length = 0;
+    picoquic_issued_ticket_t server_ticket;
 
     /* Server sends bdp reflecting current path caracteristics */
     if (!cnx->client_mode) {
         if (path_x->is_ticket_seeded && !path_x->is_bdp_sent) {
-            picoquic_issued_ticket_t* server_ticket;
-            server_ticket = picoquic_retrieve_issued_ticket(cnx->quic, cnx->issued_ticket_id);
-            if (server_ticket != NULL && server_ticket->cwin > 0) {
-                recon_bytes_in_flight =  server_ticket->cwin;
-                recon_min_rtt = server_ticket->rtt;
-                ip_addr = server_ticket->ip_addr;
-                ip_addr_length = server_ticket->ip_addr_length;
+            if (picoquic_retrieve_issued_ticket(cnx->quic, cnx->issued_ticket_id, &server_ticket) == 0 &&
+                server_ticket.cwin > 0) {
+                recon_bytes_in_flight =  server_ticket.cwin;
+                recon_min_rtt = server_ticket.rtt;
+                ip_addr = server_ticket.ip_addr;
+                ip_addr_length = server_ticket.ip_addr_length;
             }
         }
     }
@@ -5228,6 +5258,21 @@ uint8_t* picoquic_format_bdp_frame(picoquic_cnx_t* cnx, uint8_t* bytes, uint8_t*
             ip_addr = stored_ticket->ip_addr_client;
             ip_addr_length = stored_ticket->ip_addr_client_length;
         }
+        else if (cnx->quic->table_path_bdp != NULL) {
+            /* No ticket, use the values received from the same server on the same path, if any */
+            picoquic_path_bdp_entry_t* path_bdp = picoquic_get_path_bdp(cnx->quic, path_x, current_time);
+            uint8_t* peer_ip;
+            uint8_t peer_ip_length;
+
+            picoquic_get_ip_addr((struct sockaddr*)&path_x->peer_addr, &peer_ip, &peer_ip_length);
+            if (path_bdp != NULL && peer_ip_length == path_bdp->ip_addr_length &&
+                memcmp(peer_ip, path_bdp->ip_addr, peer_ip_length) == 0) {
+                recon_bytes_in_flight = path_bdp->cwin_remote;
+                recon_min_rtt = path_bdp->rtt_min_remote;
+                ip_addr = path_bdp->ip_client_remote;
+                ip_addr_length = path_bdp->ip_client_remote_length;
+            }
+        }
     }
 
     if (recon_bytes_in_flight == 0 ||
@@ -5266,6 +5311,7 @@ int picoquic_decode_frames(picoquic_cnx_t* cnx, picoquic_path_t * path_x, const
     int is_path_validating_packet = 1; /* Will be set to zero if non validating frame received */
     picoquic_packet_context_enum pc = picoquic_context_from_epoch(epoch);
     picoquic_packet_data_t packet_data;
+    PICOQUIC_STAGE_BEGIN(cnx->quic, picoquic_stage_frame_decode, decode_start);
 
     memset(&packet_data, 0, sizeof(packet_data));
 
@@ -5511,6 +5557,7 @@ int picoquic_decode_frames(picoquic_cnx_t* cnx, picoquic_path_t * path_x, const
             path_x->last_non_validating_pn = pn64;
         }
     }
+    PICOQUIC_STAGE_END(cnx->quic, picoquic_stage_frame_decode, decode_start);
 
     return bytes != NULL ? 0 : PICOQUIC_ERROR_DETECTED;
 }
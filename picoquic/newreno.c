@@ -174,12 +174,14 @@ void picoquic_newreno_sim_notify(
 typedef struct st_picoquic_newreno_state_t {
     picoquic_newreno_sim_state_t nrss;
     picoquic_min_max_rtt_t rtt_filter;
+    picoquic_cc_slow_start_t slow_start;
 } picoquic_newreno_state_t;
 
 static void picoquic_newreno_reset(picoquic_newreno_state_t* nr_state, picoquic_path_t* path_x)
 {
     memset(nr_state, 0, sizeof(picoquic_newreno_state_t));
     picoquic_newreno_sim_reset(&nr_state->nrss);
+    picoquic_cc_slow_start_reset(&nr_state->slow_start);
     path_x->cwin = nr_state->nrss.cwin;
 }
 
@@ -227,17 +229,36 @@ static void picoquic_newreno_notify(
         switch (notification) {
         case picoquic_congestion_notification_acknowledgement:
             if (path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
-                picoquic_newreno_sim_notify(&nr_state->nrss, cnx, path_x, notification, nb_bytes_acknowledged, lost_packet_number, current_time);
+                uint64_t nb_bytes_increase = nb_bytes_acknowledged;
+                if (nr_state->nrss.alg_state == picoquic_newreno_alg_slow_start) {
+                    nb_bytes_increase = picoquic_cc_slow_start_increment(&nr_state->slow_start, nb_bytes_acknowledged);
+                }
+                picoquic_newreno_sim_notify(&nr_state->nrss, cnx, path_x, notification, nb_bytes_increase, lost_packet_number, current_time);
                 path_x->cwin = nr_state->nrss.cwin;
             }
             break;
         case picoquic_congestion_notification_seed_cwin:
+            if (nr_state->nrss.alg_state == picoquic_newreno_alg_slow_start &&
+                nr_state->nrss.ssthresh == UINT64_MAX) {
+                (void)picoquic_cc_careful_resume_seed(&nr_state->slow_start, cnx, path_x, nb_bytes_acknowledged, current_time);
+            }
+            picoquic_newreno_sim_notify(&nr_state->nrss, cnx, path_x, notification, nb_bytes_acknowledged, lost_packet_number, current_time);
+            path_x->cwin = nr_state->nrss.cwin;
+            break;
         case picoquic_congestion_notification_ecn_ec:
         case picoquic_congestion_notification_repeat:
-        case picoquic_congestion_notification_timeout:
+        case picoquic_congestion_notification_timeout: {
+            uint64_t retreat_cwin;
             picoquic_newreno_sim_notify(&nr_state->nrss, cnx, path_x, notification, nb_bytes_acknowledged, lost_packet_number, current_time);
+            if (picoquic_cc_careful_resume_retreat(&nr_state->slow_start, cnx, path_x, lost_packet_number, current_time, &retreat_cwin) &&
+                retreat_cwin < nr_state->nrss.cwin) {
+                /* Safe retreat after a seeded window proved too large */
+                nr_state->nrss.cwin = retreat_cwin;
+                nr_state->nrss.ssthresh = retreat_cwin;
+            }
             path_x->cwin = nr_state->nrss.cwin;
             break;
+        }
         case picoquic_congestion_notification_spurious_repeat:
             picoquic_newreno_sim_notify(&nr_state->nrss, cnx, path_x, notification, nb_bytes_acknowledged, lost_packet_number, current_time);
             path_x->cwin = nr_state->nrss.cwin;
@@ -264,9 +285,8 @@ static void picoquic_newreno_notify(
                     }
                 }
 
-                if (picoquic_hystart_test(&nr_state->rtt_filter, (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement,
-                    cnx->path[0]->pacing_packet_time_microsec, current_time,
-                    cnx->is_time_stamp_enabled)) {
+                if (picoquic_cc_slow_start_test(&nr_state->slow_start, &nr_state->rtt_filter, cnx, path_x,
+                    rtt_measurement, one_way_delay, current_time)) {
                     /* RTT increased too much, get out of slow start! */
                     nr_state->nrss.ssthresh = nr_state->nrss.cwin;
                     nr_state->nrss.alg_state = picoquic_newreno_alg_congestion_avoidance;
@@ -708,12 +708,16 @@ int picoquic_parse_header_and_decrypt(
     /* Parse the clear text header. Ret == 0 means an incorrect packet that could not be parsed */
     int already_received = 0;
     size_t decoded_length = 0;
-    int ret = picoquic_parse_packet_header(quic, bytes, length, addr_from, ph, pcnx, 1);
+    int ret;
+    PICOQUIC_STAGE_BEGIN(quic, picoquic_stage_receive_parse, parse_start);
+
+    ret = picoquic_parse_packet_header(quic, bytes, length, addr_from, ph, pcnx, 1);
+    PICOQUIC_STAGE_END(quic, picoquic_stage_receive_parse, parse_start);
 
     *new_ctx_created = 0;
 
     if (ret == 0 ) {
-        if (ph->offset + ph->payload_length > PICOQUIC_MAX_PACKET_SIZE) {
+        if (ph->offset + ph->payload_length > quic->packet_buffer_size) {
             ret = PICOQUIC_ERROR_PACKET_TOO_LONG;
             if (*new_ctx_created) {
                 picoquic_delete_cnx(*pcnx);
@@ -774,6 +778,7 @@ int picoquic_parse_header_and_decrypt(
                         }
                     }
 
+                    PICOQUIC_STAGE_BEGIN(quic, picoquic_stage_decrypt, decrypt_start);
                     if (ret == 0) {
                         /* Remove header protection at this point -- values of bytes will change */
                         ret = picoquic_remove_header_protection(*pcnx, (uint8_t*)bytes, decrypted_data->data, ph);
@@ -786,6 +791,7 @@ int picoquic_parse_header_and_decrypt(
                     else {
                         decoded_length = ph->payload_length + 1;
                     }
+                    PICOQUIC_STAGE_END(quic, picoquic_stage_decrypt, decrypt_start);
 
                     if (decoded_length > (length - ph->offset)) {
                         if (ph->ptype == picoquic_packet_1rtt_protected &&
@@ -1106,7 +1112,7 @@ void picoquic_queue_stateless_retry(picoquic_cnx_t* cnx,
         if (integrity_aead == NULL) {
             bytes[byte_index++] = cnx->initial_cnxid.id_len;
             byte_index += picoquic_format_connection_id(bytes + byte_index,
-                PICOQUIC_MAX_PACKET_SIZE - byte_index - checksum_length, cnx->initial_cnxid);
+                sp->bytes_size - byte_index - checksum_length, cnx->initial_cnxid);
         }
 
         /* Add the token */
@@ -1114,7 +1120,7 @@ void picoquic_queue_stateless_retry(picoquic_cnx_t* cnx,
         byte_index += token_length;
 
         /* Encode the retry integrity protection if required. */
-        byte_index = picoquic_encode_retry_protection(integrity_aead, bytes, PICOQUIC_MAX_PACKET_SIZE, byte_index, &cnx->initial_cnxid);
+        byte_index = picoquic_encode_retry_protection(integrity_aead, bytes, sp->bytes_size, byte_index, &cnx->initial_cnxid);
 
         sp->length = byte_index;
 
@@ -1141,7 +1147,7 @@ void picoquic_queue_immediate_close(picoquic_cnx_t* cnx, uint64_t current_time)
     picoquic_stateless_packet_t* sp = picoquic_create_stateless_packet(cnx->quic);
 
     if (sp != NULL) {
-        int ret = picoquic_prepare_packet_ex(cnx, current_time, sp->bytes, PICOQUIC_MAX_PACKET_SIZE,
+        int ret = picoquic_prepare_packet_ex(cnx, current_time, sp->bytes, sp->bytes_size,
             &sp->length, &sp->addr_to, &sp->addr_local, &sp->if_index_local, NULL);
         if (ret == 0 && sp->length > 0) {
             picoquic_queue_stateless_packet(cnx->quic, sp);
@@ -1935,6 +1941,13 @@ int picoquic_find_incoming_path(picoquic_cnx_t* cnx, picoquic_packet_header* ph,
 
 /*
  * ECN Accounting. This is only called if the packet was processed successfully.
+ *
+ * The ECN counts in ACK frames are cumulative, so the peer can only tell
+ * which packets were CE marked if the ACKs are sent when the marking changes.
+ * As in DCTCP and accurate ECN, an immediate ACK is requested each time the
+ * CE state of the received ECN capable packets changes. This is only done
+ * if the peer uses the L4S identifier ECT(1): classic ECN senders react to
+ * CE once per RTT, and keep the normal ACK frequency.
  */
 void picoquic_ecn_accounting(picoquic_cnx_t* cnx,
     unsigned char received_ecn, picoquic_packet_context_enum pc, picoquic_local_cnxid_t * l_cid)
@@ -1958,6 +1971,15 @@ void picoquic_ecn_accounting(picoquic_cnx_t* cnx,
         ack_ctx->sending_ecn_ack |= 1;
         break;
     }
+
+    if ((received_ecn & 0x03) != 0 && ack_ctx->ecn_ect1_total_local > 0) {
+        unsigned int is_ce = ((received_ecn & 0x03) == 0x03);
+
+        if (is_ce != ack_ctx->is_ce_last_received) {
+            ack_ctx->is_ce_last_received = is_ce;
+            ack_ctx->act[0].is_immediate_ack_required = 1;
+        }
+    }
 }
 
 /*
@@ -2096,7 +2118,7 @@ int  picoquic_incoming_not_decrypted(
                 picoquic_update_path_rtt(cnx, cnx->path[0], cnx->path[0], cnx->start_time, current_time, 0, 0);
             }
 
-            if (length <= PICOQUIC_MAX_PACKET_SIZE &&
+            if (length <= cnx->quic->packet_buffer_size &&
                 ((ph->ptype == picoquic_packet_handshake && cnx->client_mode) || ph->ptype == picoquic_packet_1rtt_protected)) {
                 /* stash a copy of the incoming message for processing once the keys are available */
                 picoquic_stateless_packet_t* packet = picoquic_create_stateless_packet(cnx->quic);
@@ -0,0 +1,460 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Client side cache of network path estimates.
+ *
+ * Session tickets let a client seed a resumed connection with the RTT and
+ * congestion window of the previous connection to the same server, but
+ * connections to a new server always start from the initial window, even
+ * if they use a known network path. The path cache remembers the minimum
+ * RTT, the congestion window, the path MTU and the values reported by the
+ * server in BDP frames, keyed by local interface and destination prefix.
+ * The prefix is the /24 for IPv4 and the /48 for IPv6, so that servers in
+ * the same data center or CDN point of presence share the estimates.
+ *
+ * The cache is used on new connections that do not have a ticket seed.
+ * When the first RTT sample is obtained, the cached values are used as a
+ * BDP seed, and the usual rules apply: the seed is only notified to the
+ * congestion controller if the RTT sample is close to the cached RTT, and
+ * the careful resume logic retreats if the jump causes losses. If the
+ * server differs from the one that produced the estimates, only half of
+ * the cached window is used, since the bottleneck may be closer to the
+ * other server.
+ *
+ * The entries are organized in a hash table and an LRU list, like the
+ * MTU cache. They are saved in the ticket file with the session tickets,
+ * as records flagged with PICOQUIC_PATH_BDP_RECORD_FLAG.
+ */
+
+#include "picoquic_internal.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "picoquic_utils.h"
+
+#define PICOQUIC_PATH_BDP_RECORD_SIZE 89
+
+static void picoquic_path_bdp_key(picoquic_path_bdp_entry_t* key, unsigned long if_index, const struct sockaddr* peer_addr)
+{
+    uint8_t* ip_addr;
+    uint8_t ip_addr_length;
+
+    memset(key, 0, sizeof(picoquic_path_bdp_entry_t));
+    key->if_index = (uint32_t)if_index;
+    picoquic_get_ip_addr((struct sockaddr*)peer_addr, &ip_addr, &ip_addr_length);
+    if (ip_addr != NULL) {
+        key->prefix_length = (ip_addr_length == 4) ? 3 : 6;
+        memcpy(key->prefix, ip_addr, key->prefix_length);
+    }
+}
+
+static uint64_t picoquic_path_bdp_hash(const void* key)
+{
+    const picoquic_path_bdp_entry_t* entry = (const picoquic_path_bdp_entry_t*)key;
+    uint64_t h = entry->if_index;
+
+    for (int i = 0; i < entry->prefix_length; i++) {
+        h = (h * 0x100000001b3ull) ^ entry->prefix[i];
+    }
+    h = (h * 0x100000001b3ull) ^ entry->prefix_length;
+
+    return h;
+}
+
+static int picoquic_path_bdp_compare(const void* key1, const void* key2)
+{
+    const picoquic_path_bdp_entry_t* entry1 = (const picoquic_path_bdp_entry_t*)key1;
+    const picoquic_path_bdp_entry_t* entry2 = (const picoquic_path_bdp_entry_t*)key2;
+
+    return (entry1->if_index == entry2->if_index && entry1->prefix_length == entry2->prefix_length &&
+        memcmp(entry1->prefix, entry2->prefix, entry1->prefix_length) == 0) ? 0 : -1;
+}
+
+static picoquic_path_bdp_entry_t* picoquic_retrieve_path_bdp(picoquic_quic_t* quic, picoquic_path_bdp_entry_t* key)
+{
+    picoquic_path_bdp_entry_t* ret = NULL;
+
+    if (quic->table_path_bdp != NULL && key->prefix_length != 0) {
+        picohash_item* item = picohash_retrieve(quic->table_path_bdp, key);
+
+        if (item != NULL) {
+            ret = (picoquic_path_bdp_entry_t*)item->key;
+        }
+    }
+
+    return ret;
+}
+
+static void picoquic_delete_path_bdp(picoquic_quic_t* quic, picoquic_path_bdp_entry_t* entry)
+{
+    if (entry->next_entry == NULL) {
+        quic->path_bdp_last = entry->previous_entry;
+    }
+    else {
+        entry->next_entry->previous_entry = entry->previous_entry;
+    }
+
+    if (entry->previous_entry == NULL) {
+        quic->path_bdp_first = entry->next_entry;
+    }
+    else {
+        entry->previous_entry->next_entry = entry->next_entry;
+    }
+
+    picohash_delete_key(quic->table_path_bdp, entry, 1);
+
+    if (quic->path_bdp_nb > 0) {
+        quic->path_bdp_nb--;
+    }
+}
+
+/* Insert an entry at the head of the LRU list. The entry is freed on failure. */
+static int picoquic_insert_path_bdp(picoquic_quic_t* quic, picoquic_path_bdp_entry_t* entry)
+{
+    int ret = 0;
+
+    while (quic->path_bdp_nb >= quic->max_number_connections && quic->path_bdp_last != NULL) {
+        picoquic_delete_path_bdp(quic, quic->path_bdp_last);
+    }
+
+    entry->previous_entry = NULL;
+    entry->next_entry = quic->path_bdp_first;
+    if (picohash_insert(quic->table_path_bdp, entry) != 0) {
+        free(entry);
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        quic->path_bdp_first = entry;
+        if (entry->next_entry == NULL) {
+            quic->path_bdp_last = entry;
+        }
+        else {
+            entry->next_entry->previous_entry = entry;
+        }
+        quic->path_bdp_nb++;
+    }
+
+    return ret;
+}
+
+/* Find the entry for the path, removing it if expired. */
+picoquic_path_bdp_entry_t* picoquic_get_path_bdp(picoquic_quic_t* quic, picoquic_path_t* path_x, uint64_t current_time)
+{
+    picoquic_path_bdp_entry_t key;
+    picoquic_path_bdp_entry_t* entry;
+
+    picoquic_path_bdp_key(&key, path_x->if_index_dest, (struct sockaddr*)&path_x->peer_addr);
+    entry = picoquic_retrieve_path_bdp(quic, &key);
+    if (entry != NULL && entry->expiry_time <= current_time) {
+        picoquic_delete_path_bdp(quic, entry);
+        entry = NULL;
+    }
+
+    return entry;
+}
+
+/* Update the cache with the current estimates of the path. This is called
+ * on clients when the ticket is seeded, i.e., when the connection exits slow
+ * start or receives a BDP frame from the server, and again when the
+ * connection is deleted, so the entry reflects the window reached after
+ * slow start rather than the window at the exit.
+ */
+void picoquic_update_path_bdp(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time)
+{
+    picoquic_quic_t* quic = cnx->quic;
+    picoquic_path_bdp_entry_t* entry;
+    uint8_t* ip_addr;
+    uint8_t ip_addr_length;
+
+    if (quic->table_path_bdp == NULL || !cnx->client_mode || path_x->rtt_min == 0) {
+        return;
+    }
+
+    entry = (picoquic_path_bdp_entry_t*)malloc(sizeof(picoquic_path_bdp_entry_t));
+    if (entry != NULL) {
+        picoquic_path_bdp_entry_t* old_entry;
+
+        picoquic_path_bdp_key(entry, path_x->if_index_dest, (struct sockaddr*)&path_x->peer_addr);
+        if (entry->prefix_length == 0) {
+            free(entry);
+            return;
+        }
+        old_entry = picoquic_retrieve_path_bdp(quic, entry);
+        if (old_entry != NULL) {
+            /* Keep the remote values if the server did not send new ones */
+            entry->rtt_min_remote = old_entry->rtt_min_remote;
+            entry->cwin_remote = old_entry->cwin_remote;
+            entry->ip_client_remote_length = old_entry->ip_client_remote_length;
+            memcpy(entry->ip_client_remote, old_entry->ip_client_remote, old_entry->ip_client_remote_length);
+            picoquic_delete_path_bdp(quic, old_entry);
+        }
+        entry->expiry_time = current_time + quic->path_bdp_lifetime;
+        entry->rtt_min = path_x->rtt_min;
+        entry->cwin = path_x->cwin;
+        if (path_x->bandwidth_estimate_max > 0) {
+            entry->cwin = (path_x->bandwidth_estimate_max * path_x->rtt_min) / 1000000ull;
+        }
+        entry->send_mtu = path_x->send_mtu;
+        picoquic_get_ip_addr((struct sockaddr*)&path_x->peer_addr, &ip_addr, &ip_addr_length);
+        entry->ip_addr_length = ip_addr_length;
+        memcpy(entry->ip_addr, ip_addr, ip_addr_length);
+        if (path_x->cwin_remote > 0) {
+            entry->rtt_min_remote = path_x->rtt_min_remote;
+            entry->cwin_remote = path_x->cwin_remote;
+            entry->ip_client_remote_length = path_x->ip_client_remote_length;
+            memcpy(entry->ip_client_remote, path_x->ip_client_remote, path_x->ip_client_remote_length);
+        }
+        (void)picoquic_insert_path_bdp(quic, entry);
+    }
+}
+
+/* Seed a new client connection from the cache, if it was not seeded from
+ * a ticket. This is called when the first RTT sample is available, at which
+ * point the local interface is known. The seed is then validated by the
+ * caller, as seeds obtained from tickets.
+ */
+void picoquic_seed_from_path_bdp(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time)
+{
+    picoquic_path_bdp_entry_t* entry;
+
+    cnx->is_path_bdp_checked = 1;
+    if ((entry = picoquic_get_path_bdp(cnx->quic, path_x, current_time)) != NULL && entry->cwin > 0) {
+        uint8_t* ip_addr;
+        uint8_t ip_addr_length;
+        uint64_t seed_cwin = entry->cwin;
+
+        picoquic_get_ip_addr((struct sockaddr*)&path_x->peer_addr, &ip_addr, &ip_addr_length);
+        if (ip_addr_length != entry->ip_addr_length || memcmp(ip_addr, entry->ip_addr, ip_addr_length) != 0) {
+            seed_cwin /= 2;
+        }
+        picoquic_seed_bandwidth(cnx, entry->rtt_min, seed_cwin, ip_addr, ip_addr_length);
+        picoquic_log_app_message(cnx, "Seeding from path cache, rtt: %" PRIu64 ", cwin: %" PRIu64,
+            entry->rtt_min, seed_cwin);
+    }
+}
+
+size_t picoquic_get_path_bdp_mtu(picoquic_quic_t* quic, picoquic_path_t* path_x, uint64_t current_time)
+{
+    picoquic_path_bdp_entry_t* entry = picoquic_get_path_bdp(quic, path_x, current_time);
+
+    return (entry == NULL) ? 0 : entry->send_mtu;
+}
+
+void picoquic_path_bdp_free(picoquic_quic_t* quic)
+{
+    while (quic->path_bdp_first != NULL) {
+        picoquic_delete_path_bdp(quic, quic->path_bdp_first);
+    }
+    if (quic->table_path_bdp != NULL) {
+        picohash_delete(quic->table_path_bdp, 1);
+        quic->table_path_bdp = NULL;
+    }
+}
+
+int picoquic_set_path_bdp_cache(picoquic_quic_t* quic, uint64_t lifetime_microsec)
+{
+    int ret = 0;
+
+    if (lifetime_microsec == 0) {
+        picoquic_path_bdp_free(quic);
+    }
+    else if (quic->table_path_bdp == NULL) {
+        quic->table_path_bdp = picohash_create((size_t)quic->max_number_connections,
+            picoquic_path_bdp_hash, picoquic_path_bdp_compare);
+        if (quic->table_path_bdp == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        }
+        else if (quic->ticket_file_name != NULL) {
+            int load_ret = picoquic_load_path_bdp(quic, picoquic_get_quic_time(quic), quic->ticket_file_name);
+
+            if (load_ret != 0 && load_ret != PICOQUIC_ERROR_NO_SUCH_FILE) {
+                DBG_PRINTF("Cannot load path estimates from <%s>\n", quic->ticket_file_name);
+            }
+        }
+    }
+    quic->path_bdp_lifetime = lifetime_microsec;
+
+    return ret;
+}
+
+/* Serialization of the path records in the ticket file */
+static void picoquic_serialize_path_bdp(const picoquic_path_bdp_entry_t* entry, uint8_t* bytes)
+{
+    picoformat_32(bytes, entry->if_index);
+    bytes += 4;
+    *bytes++ = entry->prefix_length;
+    memcpy(bytes, entry->prefix, PICOQUIC_PATH_BDP_PREFIX_MAX);
+    bytes += PICOQUIC_PATH_BDP_PREFIX_MAX;
+    picoformat_64(bytes, entry->expiry_time);
+    bytes += 8;
+    picoformat_64(bytes, entry->rtt_min);
+    bytes += 8;
+    picoformat_64(bytes, entry->cwin);
+    bytes += 8;
+    picoformat_64(bytes, entry->rtt_min_remote);
+    bytes += 8;
+    picoformat_64(bytes, entry->cwin_remote);
+    bytes += 8;
+    picoformat_32(bytes, (uint32_t)entry->send_mtu);
+    bytes += 4;
+    *bytes++ = entry->ip_addr_length;
+    memcpy(bytes, entry->ip_addr, PICOQUIC_STORED_IP_MAX);
+    bytes += PICOQUIC_STORED_IP_MAX;
+    *bytes++ = entry->ip_client_remote_length;
+    memcpy(bytes, entry->ip_client_remote, PICOQUIC_STORED_IP_MAX);
+}
+
+static int picoquic_deserialize_path_bdp(picoquic_path_bdp_entry_t* entry, const uint8_t* bytes)
+{
+    int ret = 0;
+
+    memset(entry, 0, sizeof(picoquic_path_bdp_entry_t));
+    entry->if_index = PICOPARSE_32(bytes);
+    bytes += 4;
+    entry->prefix_length = *bytes++;
+    memcpy(entry->prefix, bytes, PICOQUIC_PATH_BDP_PREFIX_MAX);
+    bytes += PICOQUIC_PATH_BDP_PREFIX_MAX;
+    entry->expiry_time = PICOPARSE_64(bytes);
+    bytes += 8;
+    entry->rtt_min = PICOPARSE_64(bytes);
+    bytes += 8;
+    entry->cwin = PICOPARSE_64(bytes);
+    bytes += 8;
+    entry->rtt_min_remote = PICOPARSE_64(bytes);
+    bytes += 8;
+    entry->cwin_remote = PICOPARSE_64(bytes);
+    bytes += 8;
+    entry->send_mtu = PICOPARSE_32(bytes);
+    bytes += 4;
+    entry->ip_addr_length = *bytes++;
+    memcpy(entry->ip_addr, bytes, PICOQUIC_STORED_IP_MAX);
+    bytes += PICOQUIC_STORED_IP_MAX;
+    entry->ip_client_remote_length = *bytes++;
+    memcpy(entry->ip_client_remote, bytes, PICOQUIC_STORED_IP_MAX);
+
+    if ((entry->prefix_length != 3 && entry->prefix_length != 6) ||
+        entry->ip_addr_length > PICOQUIC_STORED_IP_MAX ||
+        entry->ip_client_remote_length > PICOQUIC_STORED_IP_MAX) {
+        ret = PICOQUIC_ERROR_INVALID_FILE;
+    }
+
+    return ret;
+}
+
+/* Append the path records to the ticket file, after the tickets. */
+int picoquic_save_path_bdp(picoquic_quic_t* quic, uint64_t current_time, char const* ticket_file_name)
+{
+    int ret = 0;
+    FILE* F = NULL;
+    picoquic_path_bdp_entry_t* next = quic->path_bdp_first;
+
+    if ((F = picoquic_file_open(ticket_file_name, "ab")) == NULL) {
+        ret = -1;
+    }
+    else {
+        while (ret == 0 && next != NULL) {
+            if (next->expiry_time > current_time) {
+                uint8_t buffer[PICOQUIC_PATH_BDP_RECORD_SIZE];
+                uint32_t record_header = PICOQUIC_PATH_BDP_RECORD_FLAG | PICOQUIC_PATH_BDP_RECORD_SIZE;
+
+                picoquic_serialize_path_bdp(next, buffer);
+                if (fwrite(&record_header, 4, 1, F) != 1 || fwrite(buffer, 1, sizeof(buffer), F) != sizeof(buffer)) {
+                    ret = PICOQUIC_ERROR_INVALID_FILE;
+                }
+            }
+            next = next->next_entry;
+        }
+        (void)picoquic_file_close(F);
+    }
+
+    return ret;
+}
+
+/* Load the path records from the ticket file, skipping the tickets. */
+int picoquic_load_path_bdp(picoquic_quic_t* quic, uint64_t current_time, char const* ticket_file_name)
+{
+    int ret = 0;
+    int file_err = 0;
+    FILE* F = NULL;
+    uint32_t storage_size;
+
+    if ((F = picoquic_file_open_ex(ticket_file_name, "rb", &file_err)) == NULL) {
+        ret = (file_err == ENOENT) ? PICOQUIC_ERROR_NO_SUCH_FILE : -1;
+    }
+
+    while (ret == 0) {
+        if (fread(&storage_size, 4, 1, F) != 1) {
+            /* end of file */
+            break;
+        }
+        else if ((storage_size & PICOQUIC_PATH_BDP_RECORD_FLAG) == 0) {
+            if (storage_size > 2048 || fseek(F, (long)storage_size, SEEK_CUR) != 0) {
+                ret = PICOQUIC_ERROR_INVALID_FILE;
+            }
+        }
+        else if ((storage_size & ~PICOQUIC_PATH_BDP_RECORD_FLAG) != PICOQUIC_PATH_BDP_RECORD_SIZE) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        }
+        else {
+            uint8_t buffer[PICOQUIC_PATH_BDP_RECORD_SIZE];
+            picoquic_path_bdp_entry_t* entry;
+
+            if (fread(buffer, 1, sizeof(buffer), F) != sizeof(buffer)) {
+                ret = PICOQUIC_ERROR_INVALID_FILE;
+            }
+            else if ((entry = (picoquic_path_bdp_entry_t*)malloc(sizeof(picoquic_path_bdp_entry_t))) == NULL) {
+                ret = PICOQUIC_ERROR_MEMORY;
+            }
+            else if ((ret = picoquic_deserialize_path_bdp(entry, buffer)) != 0 ||
+                entry->expiry_time <= current_time || picoquic_retrieve_path_bdp(quic, entry) != NULL) {
+                free(entry);
+            }
+            else {
+                /* Records were saved most recent first. Keep that order in the LRU list */
+                if (quic->path_bdp_last != NULL) {
+                    picoquic_path_bdp_entry_t* last = quic->path_bdp_last;
+                    entry->previous_entry = last;
+                    entry->next_entry = NULL;
+                    if (quic->path_bdp_nb < quic->max_number_connections &&
+                        picohash_insert(quic->table_path_bdp, entry) == 0) {
+                        last->next_entry = entry;
+                        quic->path_bdp_last = entry;
+                        quic->path_bdp_nb++;
+                    }
+                    else {
+                        free(entry);
+                    }
+                }
+                else {
+                    ret = picoquic_insert_path_bdp(quic, entry);
+                }
+            }
+        }
+    }
+
+    if (F != NULL) {
+        (void)picoquic_file_close(F);
+    }
+
+    return ret;
+}
@@ -127,6 +127,7 @@ extern "C" {
 #define PICOQUIC_TRANSPORT_VERSION_NEGOTIATION_ERROR (0x11)
 
 #define PICOQUIC_MAX_PACKET_SIZE 1536
+#define PICOQUIC_MAX_JUMBO_PACKET_SIZE 9216
 #define PICOQUIC_INITIAL_MTU_IPV4 1252
 #define PICOQUIC_INITIAL_MTU_IPV6 1232
 #define PICOQUIC_RESET_SECRET_SIZE 16
@@ -424,6 +425,35 @@ void picoquic_set_random_initial(picoquic_quic_t* quic, int random_initial);
 /* Set the "packet train" mode for pacing */
 void picoquic_set_packet_train_mode(picoquic_quic_t* quic, int train_mode);
 
+/* Timer coalescing and busy polling, both expressed in microseconds.
+ * When the coalescing slack is set, a single wakeup services all the
+ * connections due within the slack of the earliest one, and pacing lets
+ * these connections send up to that much ahead of their due time. The
+ * average pacing rate is unchanged, but the number of timer wakeups is
+ * much lower at high data rates.
+ * When the busy poll threshold is set, the packet loop polls the sockets
+ * instead of sleeping when the next wake time is less than the threshold
+ * away, which avoids the overshoot of short select() timeouts.
+ * If either is set, pacing wait times are rounded to the first microsecond
+ * at which the next packet can be sent, instead of being padded by one
+ * microsecond, which matters at rates of 10 Gbps and above.
+ * Both are disabled by default, and pacing is then unchanged.
+ */
+void picoquic_set_wake_coalescing_slack(picoquic_quic_t* quic, uint64_t slack_microsec);
+void picoquic_set_busy_poll_threshold(picoquic_quic_t* quic, uint64_t threshold_microsec);
+uint64_t picoquic_get_busy_poll_threshold(picoquic_quic_t* quic);
+
+/* Batched wakeups. When a budget is set, picoquic_prepare_next_packet_ex
+ * takes all the connections due at the start of a wakeup out of the wake
+ * tree, and serves them in round robin order, one call per datagram or GSO
+ * train. The batch ends when no connection is due anymore or when the
+ * bytes or packets budget is spent; the connections are then reinserted
+ * in the wake tree, and the call returns a zero length so the packet loop
+ * can read the sockets before the next batch. A value of 0 means no limit
+ * for that budget; setting both to 0 (the default) disables batching.
+ */
+void picoquic_set_wake_batch_budget(picoquic_quic_t* quic, size_t max_bytes, size_t max_packets);
+
 /* set the padding policy.
  * The padding policy is parameterized by two variables:
  * - packets shorter than padding_min_size will be padded to that size.
@@ -506,6 +536,16 @@ void picoquic_free(picoquic_quic_t* quic);
  * which is a bit faster but requires an additional 7KB of data per connection */
 int picoquic_set_low_memory_mode(picoquic_quic_t* quic, int low_memory_mode);
 
+/* Null AEAD, for simulations only.
+ * When set, the packet protection and header protection keys of new connections
+ * are replaced by null keys: the payload is sent in clear text, followed by a
+ * fake 16 bytes tag, and the header is not masked. Packet sizes and transport
+ * behavior are the same as with real keys, but simulations run much faster.
+ * The setting must be the same on both ends of the simulated connection,
+ * and must be applied before creating the connections.
+ * THIS PROVIDES NO SECURITY. Never use it outside of tests. */
+void picoquic_set_null_aead(picoquic_quic_t* quic, int use_null_aead);
+
 /* management of retry policy.
  * The cookie mode can be used to force the following behavior:
  * - if cookie_mode&1, check the token and force a retry for each incoming connection.
@@ -579,6 +619,14 @@ void picoquic_enforce_client_only(picoquic_quic_t* quic, int do_enforce);
 /* Set default padding policy for the context */
 void picoquic_set_default_padding(picoquic_quic_t* quic, uint32_t padding_multiple, uint32_t padding_minsize);
 
+/* Handshake packing. Datagrams that carry Initial packets must be padded to
+ * at least 1200 bytes. By default, picoquic pads them to the full path MTU.
+ * When packing is enabled, the padding stops at 1200 bytes, and the client
+ * defers the acknowledgement of the server's Handshake packets for a fraction
+ * of the RTT, so the ACK is sent with the client Finished message instead of
+ * in separate datagrams. Off by default. */
+void picoquic_set_handshake_packing(picoquic_quic_t* quic, int enable);
+
 /* Set default spin bit policy for the context */
 void picoquic_set_default_spinbit_policy(picoquic_quic_t * quic, picoquic_spinbit_version_enum default_spinbit_policy);
 
@@ -633,9 +681,122 @@ uint64_t picoquic_get_default_connection_id_ttl(picoquic_quic_t* quic);
  * from the "mtu_max" parameter the estimated IP and UDP over, which depends
  * on the IP address used for the connection and is computed using the
  * macro "PICOQUIC_MTU_OVERHEAD".
+ *
+ * Values larger than PICOQUIC_MAX_PACKET_SIZE enable jumbo packets, e.g., for
+ * data center links with a 9000 bytes MTU. The packet buffers allocated by the
+ * QUIC context are then sized to hold up to mtu_max bytes, with a maximum
+ * of PICOQUIC_MAX_JUMBO_PACKET_SIZE. The value of mtu_max should be set before
+ * creating connections. Applications that provide their own send and
+ * receive buffers should size them with picoquic_get_max_packet_size.
  */
 #define PICOQUIC_MTU_OVERHEAD(p_s_addr) (((p_s_addr)->sa_family==AF_INET6)?48:28)
 void picoquic_set_mtu_max(picoquic_quic_t* quic, uint32_t mtu_max);
+size_t picoquic_get_max_packet_size(picoquic_quic_t* quic);
+
+/* Enable the per destination path MTU cache. When PMTU discovery validates
+ * an MTU larger than the initial value, the value is kept in the cache for
+ * "lifetime" microseconds, and new connections to the same peer address start
+ * with the cached MTU. The entry is removed if repeated losses of full size
+ * packets indicate a black hole. A lifetime of 0 disables the cache. The
+ * cache is disabled by default; RFC 8899 suggests a lifetime of 10 minutes.
+ */
+#define PICOQUIC_MTU_CACHE_LIFETIME_DEFAULT 600000000ull
+int picoquic_set_mtu_cache(picoquic_quic_t* quic, uint64_t lifetime_microsec);
+
+/* Enable the client side cache of path estimates. When a client connection
+ * exits slow start, its RTT, congestion window and MTU are remembered for
+ * "lifetime" microseconds, keyed by local interface and destination prefix
+ * (/24 for IPv4, /48 for IPv6), and refreshed when the connection is deleted.
+ * New connections that cannot be seeded from a session ticket are seeded from
+ * the cache, subject to the same validation and careful resume rules; only
+ * half of the window is used if the server address differs. The seed only
+ * sets the client's own congestion window, i.e., it speeds up uploads. The
+ * download direction only benefits if the server supports the BDP frame: the
+ * estimates received from the server are sent back only when the server
+ * address matches the cached one. If a ticket file was set, the estimates are
+ * loaded from and saved to that file. A lifetime of 0 disables the cache,
+ * which is the default.
+ */
+#define PICOQUIC_PATH_BDP_CACHE_LIFETIME_DEFAULT 600000000ull
+int picoquic_set_path_bdp_cache(picoquic_quic_t* quic, uint64_t lifetime_microsec);
+
+/* Replace the token reuse register by a fixed memory filter.
+ * By default, the server remembers each token or ticket presented by clients
+ * in a tree, whose size grows with the number of connections. The filter
+ * uses generations of Bloom filters rotated every "lifetime" microseconds,
+ * sized for up to nb_tokens_max tokens per generation with the specified
+ * false positive rate. The lifetime should not be shorter than the validity
+ * of the tokens issued by the server; tokens expiring further in the future
+ * are refused. A lifetime of 0 selects the default validity of tokens.
+ *
+ * The filter memory does not contain pointers. To share it between threads
+ * or processes, allocate picoquic_token_filter_memory_size() bytes, for
+ * example in shared memory, initialize it once with picoquic_token_filter_init,
+ * and attach it to each QUIC context with picoquic_set_shared_token_filter.
+ * The shared memory is not freed by picoquic.
+ */
+size_t picoquic_token_filter_memory_size(size_t nb_tokens_max, double false_positive_rate);
+int picoquic_token_filter_init(void* memory, size_t memory_size, size_t nb_tokens_max,
+    double false_positive_rate, uint64_t lifetime);
+int picoquic_set_token_filter(picoquic_quic_t* quic, size_t nb_tokens_max, double false_positive_rate, uint64_t lifetime);
+void picoquic_set_shared_token_filter(picoquic_quic_t* quic, void* memory);
+
+/* Table of the tickets issued by the server.
+ * The server remembers the RTT, congestion window and client address of the
+ * connections for which it issued session tickets, and uses them to seed
+ * the congestion control when the tickets are used for resumption. The
+ * records are kept in a fixed memory table. When the table is full, old
+ * records that were not used recently are replaced. By default, the table
+ * is sized for the maximum number of connections; picoquic_set_ticket_table
+ * replaces it by a table using at most memory_max bytes.
+ *
+ * The table memory does not contain pointers. To share it between threads
+ * or processes, so that resumed connections find the ticket records even if
+ * they land on a different worker, allocate the memory, for example in
+ * shared memory, initialize it once with picoquic_ticket_table_init, and
+ * attach it to each QUIC context with picoquic_set_shared_ticket_table.
+ * The shared memory is not freed by picoquic.
+ */
+size_t picoquic_ticket_table_memory_size(size_t nb_tickets_max);
+int picoquic_ticket_table_init(void* memory, size_t memory_size);
+int picoquic_set_ticket_table(picoquic_quic_t* quic, size_t memory_max);
+void picoquic_set_shared_ticket_table(picoquic_quic_t* quic, void* memory);
+
+/* Per stage cost accounting on the packet path.
+ * When the library is compiled with PICOQUIC_WITH_STAGE_CYCLES, the processing
+ * stages listed below are timed with the CPU cycle counter (or in microseconds
+ * on platforms without an accessible counter), and the number of calls and
+ * cycles is aggregated per QUIC context. When compiled with PICOQUIC_WITH_USDT,
+ * each stage also fires the static tracepoints "picoquic:stage_begin" and
+ * "picoquic:stage_end", with the QUIC context and the stage as arguments.
+ *
+ * Stages can be nested: frame decoding includes ACK processing and congestion
+ * control notifications, and packet formatting includes stream selection and
+ * encryption. Socket send is only measured when using the socket loop.
+ *
+ * picoquic_get_stage_stats returns -1 if the counters are not compiled in.
+ */
+typedef enum {
+    picoquic_stage_receive_parse = 0,
+    picoquic_stage_decrypt,
+    picoquic_stage_frame_decode,
+    picoquic_stage_ack_process,
+    picoquic_stage_cc_notify,
+    picoquic_stage_stream_select,
+    picoquic_stage_packet_format,
+    picoquic_stage_encrypt,
+    picoquic_stage_socket_send,
+    picoquic_stage_max
+} picoquic_stage_enum;
+
+typedef struct st_picoquic_stage_stats_t {
+    uint64_t nb_calls;
+    uint64_t nb_cycles;
+} picoquic_stage_stats_t;
+
+int picoquic_get_stage_stats(picoquic_quic_t* quic, picoquic_stage_enum stage, picoquic_stage_stats_t* stats);
+void picoquic_reset_stage_stats(picoquic_quic_t* quic);
+const char* picoquic_stage_name(picoquic_stage_enum stage);
 
 
 /* Set the ALPN function used to verify incoming ALPN */
@@ -889,6 +1050,31 @@ picoquic_connection_id_t picoquic_get_logging_cnxid(picoquic_cnx_t* cnx);
 uint64_t picoquic_get_cnx_start_time(picoquic_cnx_t* cnx);
 uint64_t picoquic_is_0rtt_available(picoquic_cnx_t* cnx);
 
+/* Early data management, on the client side.
+ * By default, any stream data queued before the handshake completes may be
+ * sent as 0-RTT, within the limit of the server's max_early_data. Once
+ * a stream is marked with `picoquic_set_stream_early_data`, only the marked
+ * streams are sent as 0-RTT, and the other streams wait for 1-RTT keys.
+ * `picoquic_set_early_data_budget` sets the maximum number of stream bytes
+ * sent as 0-RTT; the effective budget is the smaller of that value and the
+ * max_early_data of the ticket. If the server rejects 0-RTT, the frames
+ * of the rejected packets are copied as is in 1-RTT packets. These copies
+ * are not counted as losses, and do not affect congestion control.
+ */
+typedef struct st_picoquic_early_data_stats_t {
+    uint64_t budget; /* effective budget, in bytes of stream data */
+    uint64_t data_sent; /* stream bytes sent as 0-RTT */
+    uint64_t data_replayed; /* bytes of rejected packets replayed as 1-RTT */
+    uint32_t nb_packets_sent;
+    uint32_t nb_packets_acked;
+    uint32_t nb_packets_rejected;
+    int is_accepted;
+} picoquic_early_data_stats_t;
+
+int picoquic_set_stream_early_data(picoquic_cnx_t* cnx, uint64_t stream_id, int is_early_data);
+void picoquic_set_early_data_budget(picoquic_cnx_t* cnx, uint64_t budget);
+void picoquic_get_early_data_stats(picoquic_cnx_t* cnx, picoquic_early_data_stats_t* stats);
+
 int picoquic_is_cnx_backlog_empty(picoquic_cnx_t* cnx);
 
 void picoquic_set_callback(picoquic_cnx_t* cnx,
@@ -1282,7 +1468,7 @@ typedef enum {
     picoquic_congestion_notification_spurious_repeat,
     picoquic_congestion_notification_rtt_measurement,
     picoquic_congestion_notification_bw_measurement,
-    picoquic_congestion_notification_ecn_ec,
+    picoquic_congestion_notification_ecn_ec, /* nb_bytes_acknowledged carries the number of new CE marks */
     picoquic_congestion_notification_cwin_blocked,
     picoquic_congestion_notification_seed_cwin,
     picoquic_congestion_notification_reset
@@ -1328,6 +1514,14 @@ void picoquic_set_default_congestion_algorithm_by_name(picoquic_quic_t* quic, ch
 
 void picoquic_set_congestion_algorithm(picoquic_cnx_t* cnx, picoquic_congestion_algorithm_t const* algo);
 
+/* Enable or disable HyStart++ (RFC 9406) for exiting slow start. By default,
+ * congestion control algorithms exit slow start using a simple delay test.
+ * When HyStart++ is enabled, they will first enter a "conservative slow start"
+ * phase when the RTT increases, and only exit after several rounds.
+ */
+void picoquic_set_default_hystart_pp(picoquic_quic_t* quic, int enable);
+void picoquic_set_hystart_pp(picoquic_cnx_t* cnx, int enable);
+
 /* Bandwidth update and congestion control parameters value.
  * Congestion control in picoquic is characterized by three values:
  * - pacing rate, expressed in bytes per second (for example, 10Mbps would be noted as 1250000)
@@ -1355,6 +1549,70 @@ uint64_t picoquic_get_pacing_rate(picoquic_cnx_t* cnx);
 uint64_t picoquic_get_cwin(picoquic_cnx_t* cnx);
 uint64_t picoquic_get_rtt(picoquic_cnx_t* cnx);
 
+/* Congestion control telemetry.
+ * When telemetry is enabled, the stack records congestion control events
+ * in a per connection ring of fixed size:
+ * - changes in the state reported by the "alg_observe" function of the CC algorithm,
+ * - periodic samples of cwin, pacing rate and RTT, at most once per sample interval,
+ * - losses, timer based losses, spurious retransmissions and ECN congestion marks.
+ * Applications drain the ring with picoquic_get_cc_events. If the ring is
+ * full, the oldest events are overwritten, and counted in "nb_lost".
+ * Telemetry is disabled by default. The default for new connections is set
+ * per QUIC context; setting a ring size of 0 disables telemetry.
+ */
+typedef enum {
+    picoquic_cc_event_sample = 0,
+    picoquic_cc_event_state_change,
+    picoquic_cc_event_loss,
+    picoquic_cc_event_timeout,
+    picoquic_cc_event_spurious,
+    picoquic_cc_event_ecn
+} picoquic_cc_event_enum;
+
+typedef struct st_picoquic_cc_event_t {
+    uint64_t event_time;
+    uint64_t unique_path_id;
+    picoquic_cc_event_enum event_type;
+    uint64_t cc_state;
+    uint64_t cc_param;
+    uint64_t cwin;
+    uint64_t pacing_rate;
+    uint64_t smoothed_rtt;
+    uint64_t bytes_in_transit;
+} picoquic_cc_event_t;
+
+void picoquic_set_default_cc_telemetry(picoquic_quic_t* quic, size_t ring_size, uint64_t sample_interval);
+int picoquic_set_cc_telemetry(picoquic_cnx_t* cnx, size_t ring_size, uint64_t sample_interval);
+size_t picoquic_get_cc_events(picoquic_cnx_t* cnx, picoquic_cc_event_t* events, size_t events_max, uint64_t* nb_lost);
+
+/* Congestion control experiments.
+ * An experiment defines a set of "arms", each using a different congestion
+ * control algorithm. New connections are assigned to an arm based on a hash
+ * of the initial connection ID, so both client and server assign the same
+ * connection to the same arm. When connections are deleted, their statistics
+ * are added to the arm statistics, from which applications can compare
+ * goodput (data sent or received over duration) and latency (sum of
+ * smoothed RTT over number of connections).
+ * Setting nb_arms to 0 terminates the experiment.
+ */
+#define PICOQUIC_CC_EXPERIMENT_MAX_ARMS 8
+
+typedef struct st_picoquic_cc_arm_stats_t {
+    uint64_t nb_connections;
+    uint64_t data_sent;
+    uint64_t data_received;
+    uint64_t duration;
+    uint64_t smoothed_rtt_sum;
+    uint64_t rtt_min_sum;
+    uint64_t nb_packets_sent;
+    uint64_t nb_retransmissions;
+    uint64_t nb_spurious;
+} picoquic_cc_arm_stats_t;
+
+int picoquic_set_cc_experiment(picoquic_quic_t* quic, picoquic_congestion_algorithm_t const** arm_algs, size_t nb_arms);
+int picoquic_get_cc_experiment_arm(picoquic_cnx_t* cnx);
+int picoquic_get_cc_experiment_stats(picoquic_quic_t* quic, size_t arm, picoquic_cc_arm_stats_t* stats);
+
 /* List of ALPN types used in session negotiation */
 
 typedef enum {
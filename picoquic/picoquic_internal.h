@@ -39,6 +39,7 @@ extern "C" {
 #define PICOQUIC_MAX_PACKET_SIZE 1536
 #endif
 #define PICOQUIC_MIN_SEGMENT_SIZE 256
+#define PICOQUIC_EARLY_DATA_MIN_FRAME 17 /* Largest stream frame header, smaller early data budgets are not used */
 #define PICOQUIC_ENFORCED_INITIAL_MTU 1200
 #define PICOQUIC_ENFORCED_INITIAL_CID_LENGTH 8
 #define PICOQUIC_PRACTICAL_MAX_MTU 1440
@@ -67,6 +68,7 @@ extern "C" {
 #define PICOQUIC_TOKEN_DELAY_SHORT (2*60*1000000ull) /* 2 minutes */
 #define PICOQUIC_CID_REFRESH_DELAY (5*1000000ull) /* if idle for 5 seconds, refresh the CID */
 #define PICOQUIC_MTU_LOSS_THRESHOLD 10 /* if threshold of full MTU packetlost, reset MTU */
+#define PICOQUIC_MTU_SEARCH_GRANULARITY 32 /* stop the PMTU binary search when the interval is smaller */
 
 #define PICOQUIC_BANDWIDTH_ESTIMATE_MAX 10000000000ull /* 10 GB per second */
 #define PICOQUIC_BANDWIDTH_TIME_INTERVAL_MIN 1000
@@ -336,8 +338,9 @@ typedef struct st_picoquic_stateless_packet_t {
     uint64_t cnxid_log64;
     picoquic_connection_id_t initial_cid;
     picoquic_packet_type_enum ptype;
+    size_t bytes_size; /* Allocated size of "bytes", at least PICOQUIC_MAX_PACKET_SIZE */
 
-    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE]; /* Must be last, extended for jumbo packets */
 } picoquic_stateless_packet_t;
 
 /* Handling of stateless packets */
@@ -346,6 +349,13 @@ void picoquic_queue_stateless_packet(picoquic_quic_t* quic, picoquic_stateless_p
 picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t* quic);
 void picoquic_delete_stateless_packet(picoquic_stateless_packet_t* sp);
 
+/* Size of the allocation for packet or data node structures whose last member
+ * is a byte array of PICOQUIC_MAX_PACKET_SIZE bytes, extended to hold
+ * "buffer_size" bytes when jumbo packets are enabled.
+ */
+#define PICOQUIC_PACKET_ALLOC_SIZE(struct_size, buffer_size) ((struct_size) + \
+    (((buffer_size) > PICOQUIC_MAX_PACKET_SIZE) ? ((buffer_size) - PICOQUIC_MAX_PACKET_SIZE) : 0))
+
 /* Data structure used to hold chunk of stream data before in sequence delivery */
 typedef struct st_picoquic_stream_data_node_t {
     picosplay_node_t stream_data_node;
@@ -354,7 +364,8 @@ typedef struct st_picoquic_stream_data_node_t {
     uint64_t offset;  /* Stream offset of the first octet in "bytes" */
     size_t length;    /* Number of octets in "bytes" */
     const uint8_t* bytes;
-    uint8_t data[PICOQUIC_MAX_PACKET_SIZE];
+    size_t data_size; /* Allocated size of "data", at least PICOQUIC_MAX_PACKET_SIZE */
+    uint8_t data[PICOQUIC_MAX_PACKET_SIZE]; /* Must be last, extended for jumbo packets */
 } picoquic_stream_data_node_t;
 
 /* Data structure used to hold chunk of stream data queued by application */
@@ -400,8 +411,9 @@ typedef struct st_picoquic_packet_t {
     unsigned int was_preemptively_repeated : 1;
     unsigned int is_queued_to_path : 1;
     unsigned int is_queued_for_retransmit : 1;
+    size_t bytes_size; /* Allocated size of "bytes", at least PICOQUIC_MAX_PACKET_SIZE */
 
-    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE]; /* Must be last, extended for jumbo packets */
 } picoquic_packet_t;
 
 picoquic_packet_t* picoquic_create_packet(picoquic_quic_t* quic);
@@ -514,15 +526,13 @@ int picoquic_load_tokens(picoquic_stored_token_t** pp_first_token,
 void picoquic_free_tokens(picoquic_stored_token_t** pp_first_token);
 
 /* Remember the tickets issued by a server, and the last
- * congestion control parameters for the corresponding connection
+ * congestion control parameters for the corresponding connection.
+ * The tickets are kept in a fixed memory table, see ticket_table.c.
+ * Retrieving a ticket copies the stored values.
  */
 
-
 typedef struct st_picoquic_issued_ticket_t {
-    struct st_picoquic_issued_ticket_t* next_ticket;
-    struct st_picoquic_issued_ticket_t* previous_ticket;
     uint64_t ticket_id;
-    uint64_t creation_time;
     uint64_t rtt;
     uint64_t cwin;
     uint8_t ip_addr[16];
@@ -536,8 +546,59 @@ int picoquic_remember_issued_ticket(picoquic_quic_t* quic,
     const uint8_t* ip_addr,
     uint8_t ip_addr_length);
 
-picoquic_issued_ticket_t* picoquic_retrieve_issued_ticket(picoquic_quic_t* quic,
-    uint64_t ticket_id);
+int picoquic_retrieve_issued_ticket(picoquic_quic_t* quic,
+    uint64_t ticket_id, picoquic_issued_ticket_t* ticket);
+void picoquic_ticket_table_free(picoquic_quic_t* quic);
+
+/* Per destination cache of path MTU. Entries are keyed by the peer address,
+ * and organized as an LRU list with a max number set to the number of connections.
+ */
+typedef struct st_picoquic_mtu_cache_entry_t {
+    struct st_picoquic_mtu_cache_entry_t* next_entry;
+    struct st_picoquic_mtu_cache_entry_t* previous_entry;
+    struct sockaddr_storage peer_addr;
+    size_t send_mtu;
+    uint64_t expiry_time;
+} picoquic_mtu_cache_entry_t;
+
+void picoquic_update_cached_mtu(picoquic_quic_t* quic, const struct sockaddr* peer_addr,
+    size_t send_mtu, uint64_t current_time);
+size_t picoquic_get_cached_mtu(picoquic_quic_t* quic, const struct sockaddr* peer_addr, uint64_t current_time);
+void picoquic_remove_cached_mtu(picoquic_quic_t* quic, const struct sockaddr* peer_addr);
+
+/* Client side cache of path estimates, keyed by local interface and
+ * destination prefix (/24 for IPv4, /48 for IPv6). Entries are organized
+ * as an LRU list, like the MTU cache, and saved in the ticket file as
+ * records flagged with PICOQUIC_PATH_BDP_RECORD_FLAG.
+ */
+#define PICOQUIC_PATH_BDP_PREFIX_MAX 6
+#define PICOQUIC_PATH_BDP_RECORD_FLAG 0x80000000u
+
+typedef struct st_picoquic_path_bdp_entry_t {
+    struct st_picoquic_path_bdp_entry_t* next_entry;
+    struct st_picoquic_path_bdp_entry_t* previous_entry;
+    uint32_t if_index;
+    uint8_t prefix_length;
+    uint8_t prefix[PICOQUIC_PATH_BDP_PREFIX_MAX];
+    uint64_t expiry_time;
+    uint64_t rtt_min;
+    uint64_t cwin;
+    uint64_t rtt_min_remote;
+    uint64_t cwin_remote;
+    size_t send_mtu;
+    uint8_t ip_addr[PICOQUIC_STORED_IP_MAX];
+    uint8_t ip_addr_length;
+    uint8_t ip_client_remote[PICOQUIC_STORED_IP_MAX];
+    uint8_t ip_client_remote_length;
+} picoquic_path_bdp_entry_t;
+
+picoquic_path_bdp_entry_t* picoquic_get_path_bdp(picoquic_quic_t* quic, picoquic_path_t* path_x, uint64_t current_time);
+void picoquic_update_path_bdp(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time);
+void picoquic_seed_from_path_bdp(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time);
+size_t picoquic_get_path_bdp_mtu(picoquic_quic_t* quic, picoquic_path_t* path_x, uint64_t current_time);
+int picoquic_save_path_bdp(picoquic_quic_t* quic, uint64_t current_time, char const* ticket_file_name);
+int picoquic_load_path_bdp(picoquic_quic_t* quic, uint64_t current_time, char const* ticket_file_name);
+void picoquic_path_bdp_free(picoquic_quic_t* quic);
 
 /*
  * Transport parameters, as defined by the QUIC transport specification.
@@ -582,6 +643,9 @@ typedef uint64_t picoquic_tp_enum;
  * API.
  */
 typedef int (*picoquic_autoqlog_fn)(picoquic_cnx_t * cnx);
+/* Callback used to complete pending qlog conversions and release the
+ * autoqlog context when the quic context is freed. */
+typedef void (*picoquic_autoqlog_free_fn)(picoquic_quic_t* quic);
 
 /* Callback used for the performance log
  */
@@ -604,6 +668,7 @@ typedef struct st_picoquic_quic_t {
     picoquic_stored_ticket_t * p_first_ticket;
     picoquic_stored_token_t * p_first_token;
     picosplay_tree_t token_reuse_tree; /* detection of token reuse */
+    struct st_picoquic_token_filter_t* token_filter; /* fixed memory alternative to token_reuse_tree */
     uint8_t local_cnxid_length;
     uint8_t default_stream_priority;
     uint64_t local_cnxid_ttl; /* Max time to live of Connection ID in microsec, init to "forever" */
@@ -638,6 +703,7 @@ typedef struct st_picoquic_quic_t {
     unsigned int use_long_log : 1;
     unsigned int should_close_log : 1;
     unsigned int use_unique_log_names : 1; /* Add 64 bit random number to log names for uniqueness */
+    unsigned int is_qlog_background_disabled : 1; /* Convert binlog to qlog synchronously when connection closes */
     unsigned int dont_coalesce_init : 1; /* test option to turn of packet coalescing on server */
     unsigned int one_way_grease_quic_bit : 1; /* Grease of QUIC bit, but do not announce support */
     unsigned int log_pn_dec : 1; /* Log key hashes on key changes to debug crypto */
@@ -649,13 +715,25 @@ typedef struct st_picoquic_quic_t {
     unsigned int default_send_receive_bdp_frame : 1; /* enable sending and receiving BDP frame */
     unsigned int enforce_client_only : 1; /* Do not authorize incoming connections */
     unsigned int is_flow_control_limited : 1; /* Enforce flow control limit for tests */
+    unsigned int is_hystart_pp_enabled : 1; /* Use HyStart++ on new connections */
     unsigned int test_large_server_flight : 1; /* Use TP to ensure server flight is at least 8K */
     unsigned int is_port_blocking_disabled : 1; /* Do not check client port on incoming connections */
     unsigned int are_path_callbacks_enabled : 1; /* Enable path specific callbacks by default */
+    unsigned int is_token_filter_owned : 1; /* Token filter allocated by picoquic, not shared */
+    unsigned int is_ticket_table_owned : 1; /* Ticket table allocated by picoquic, not shared */
+    unsigned int use_null_aead : 1; /* Test only: use null packet protection to speed up simulations */
+    unsigned int is_handshake_packing_enabled : 1; /* Minimize padding and ACK-only datagrams during handshake */
+    unsigned int is_wake_batch_enabled : 1; /* Serve due connections in budgeted batches */
 
     picoquic_stateless_packet_t* pending_stateless_packet;
 
     picoquic_congestion_algorithm_t const* default_congestion_alg;
+    /* Congestion control telemetry defaults, and optional CC experiment */
+    size_t cc_telemetry_ring_size;
+    uint64_t cc_telemetry_interval;
+    struct st_picoquic_cc_experiment_t* cc_experiment;
+    /* Per stage cycle counters, only updated with PICOQUIC_WITH_STAGE_CYCLES */
+    picoquic_stage_stats_t stage_stats[picoquic_stage_max];
 
     struct st_picoquic_cnx_t* cnx_list;
     struct st_picoquic_cnx_t* cnx_last;
@@ -668,11 +746,21 @@ typedef struct st_picoquic_quic_t {
     picohash_table* table_cnx_by_icid;
     picohash_table* table_cnx_by_secret;
 
-    picohash_table* table_issued_tickets;
-    picoquic_issued_ticket_t* table_issued_tickets_first;
-    picoquic_issued_ticket_t* table_issued_tickets_last;
-    size_t table_issued_tickets_nb;
+    struct st_picoquic_ticket_table_t* ticket_table; /* issued tickets, fixed memory */
+
+    picohash_table* table_mtu_cache;
+    picoquic_mtu_cache_entry_t* mtu_cache_first;
+    picoquic_mtu_cache_entry_t* mtu_cache_last;
+    size_t mtu_cache_nb;
+    uint64_t mtu_cache_lifetime;
+
+    picohash_table* table_path_bdp;
+    picoquic_path_bdp_entry_t* path_bdp_first;
+    picoquic_path_bdp_entry_t* path_bdp_last;
+    size_t path_bdp_nb;
+    uint64_t path_bdp_lifetime;
 
+    size_t packet_buffer_size; /* Size of packet buffers, larger than PICOQUIC_MAX_PACKET_SIZE if jumbo */
     picoquic_packet_t * p_first_packet;
     int nb_packets_in_pool;
     int nb_packets_allocated;
@@ -704,11 +792,31 @@ typedef struct st_picoquic_quic_t {
     uint64_t rtt_update_delta;
     uint64_t pacing_rate_update_delta;
 
+    /* Timer coalescing. Connections due within the slack of the earliest
+     * wake time are serviced in the same wakeup, and pacing lets them send
+     * that much ahead of time. Wait times shorter than the busy poll
+     * threshold are handled by polling the sockets instead of sleeping.
+     * Both values are in microseconds, 0 if not used. */
+    uint64_t wake_coalescing_slack;
+    uint64_t busy_poll_threshold;
+    /* Batched wakeups. If a budget is set, the connections due at the start
+     * of a wakeup are taken out of the wake tree, served in round robin
+     * order until the budget is spent or none is due, then reinserted. */
+    size_t wake_batch_max_bytes;
+    size_t wake_batch_max_packets;
+    size_t wake_batch_bytes;
+    size_t wake_batch_packets;
+    struct st_picoquic_cnx_t* wake_batch_first;
+    struct st_picoquic_cnx_t* wake_batch_last;
+    struct st_picoquic_cnx_t* wake_batch_done;
+
     /* Logging APIS */
     void* F_log;
     char* binlog_dir;
     char* qlog_dir;
     picoquic_autoqlog_fn autoqlog_fn;
+    picoquic_autoqlog_free_fn autoqlog_free_fn;
+    void* v_autoqlog_ctx;
     struct st_picoquic_unified_logging_t* text_log_fns;
     struct st_picoquic_unified_logging_t* bin_log_fns;
     struct st_picoquic_unified_logging_t* qlog_fns;
@@ -722,6 +830,10 @@ int picoquic_registered_token_check_reuse(picoquic_quic_t* quic, const uint8_t*
 
 void picoquic_registered_token_clear(picoquic_quic_t* quic, uint64_t expiry_time_max);
 
+int picoquic_token_filter_check_reuse(struct st_picoquic_token_filter_t* filter, uint64_t token_hash,
+    uint64_t expiry_time, uint64_t current_time);
+void picoquic_token_filter_free(picoquic_quic_t* quic);
+
 /*
  * SACK dashboard item, part of connection context. Each item
  * holds a range of packet numbers that have been received.
@@ -816,6 +928,7 @@ typedef struct st_picoquic_stream_head_t {
     unsigned int is_output_stream : 1; /* If stream is listed in the output list */
     unsigned int is_closed : 1; /* Stream is closed, closure is accouted for */
     unsigned int is_discarded : 1; /* There should be no more callback for that stream, the application has discarded it */
+    unsigned int is_early_data : 1; /* Data on this stream may be sent as 0-RTT */
 } picoquic_stream_head_t;
 
 #define IS_CLIENT_STREAM_ID(id) (unsigned int)(((id) & 1) == 0)
@@ -904,6 +1017,7 @@ typedef struct st_picoquic_ack_context_t {
     uint64_t ecn_ce_total_local; /* picoquic_format_ack_frame */
     /* Flags */
     unsigned int sending_ecn_ack : 1; /* picoquic_format_ack_frame, picoquic_ecn_accounting */
+    unsigned int is_ce_last_received : 1; /* picoquic_ecn_accounting: last ECN packet was CE */
 } picoquic_ack_context_t;
 
 /* Local CID.
@@ -995,6 +1109,7 @@ typedef struct st_picoquic_path_t {
     /* Last 1-RTT "non path validating" packet received on this path */
     /* flags */
     unsigned int mtu_probe_sent : 1;
+    unsigned int is_mtu_cache_checked : 1;
     unsigned int path_is_published : 1;
     unsigned int challenge_required : 1;
     unsigned int challenge_verified : 1;
@@ -1089,6 +1204,9 @@ typedef struct st_picoquic_path_t {
     uint64_t last_sender_limited_time;
     uint64_t last_time_acked_data_frame_sent;
     void* congestion_alg_state;
+    /* Congestion control telemetry: last observed state, next sample time */
+    uint64_t cc_telemetry_state;
+    uint64_t cc_telemetry_next_sample;
 
     /*
     * Pacing uses a set of per path variables:
@@ -1098,6 +1216,8 @@ typedef struct st_picoquic_path_t {
     * - pacing_bucket_max: maximum value (capacity) of the leaky bucket.
     * - pacing_packet_time_nanosec: number of nanoseconds required to send a full size packet.
     * - pacing_packet_time_microsec: max of (packet_time_nano_sec/1024, 1) microsec.
+    * - pacing_slack_nanosec: timer coalescing slack. Packets may be sent that much
+    *   ahead of time, so the bucket may be in debt by that much more.
     */
 
     uint64_t pacing_rate;
@@ -1106,6 +1226,7 @@ typedef struct st_picoquic_path_t {
     int64_t pacing_bucket_max;
     int64_t pacing_packet_time_nanosec;
     uint64_t pacing_packet_time_microsec;
+    int64_t pacing_slack_nanosec;
     uint64_t pacing_quantum_max;
     uint64_t pacing_rate_max;
     int pacing_bandwidth_pause;
@@ -1228,11 +1349,15 @@ typedef struct st_picoquic_cnx_t {
     unsigned int are_path_callbacks_enabled : 1; /* Enable path specific callbacks */
     unsigned int is_sending_large_buffer : 1; /* Buffer provided by application is sufficient for PMTUD */
     unsigned int is_preemptive_repeat_enabled : 1; /* Preemptive repat of packets to reduce transaction latency */
+    unsigned int is_hystart_pp_enabled : 1; /* Use HyStart++ to exit slow start */
     unsigned int do_version_negotiation : 1; /* Whether compatible version negotiation is activated */
     unsigned int send_receive_bdp_frame : 1; /* enable sending and receiving BDP frame */
     unsigned int cwin_notified_from_seed : 1; /* cwin was reset from a seeded value */
+    unsigned int is_path_bdp_checked : 1; /* path cache was checked for a seed */
     unsigned int is_datagram_ready : 1; /* Active polling for datagrams */
     unsigned int is_immediate_ack_required : 1; /* Should send an ACK asap */
+    unsigned int is_early_data_selective : 1; /* Only streams marked as early data are sent as 0-RTT */
+    unsigned int is_in_wake_batch : 1; /* Taken out of the wake tree by the current wake batch */
 
     /* PMTUD policy */
     picoquic_pmtud_policy_enum pmtud_policy;
@@ -1265,6 +1390,9 @@ typedef struct st_picoquic_cnx_t {
     char const* alpn;
     /* On clients, receives the maximum 0RTT size accepted by server */
     size_t max_early_data_size;
+    /* On clients, application limit and accounting of 0-RTT stream data */
+    uint64_t early_data_budget;
+    uint64_t early_data_sent;
     /* Call back function and context */
     picoquic_stream_data_cb_fn callback_fn;
     void* callback_ctx;
@@ -1289,12 +1417,15 @@ typedef struct st_picoquic_cnx_t {
     /* Next time sending data is expected */
     uint64_t next_wake_time;
     picosplay_node_t cnx_wake_node;
+    struct st_picoquic_cnx_t* next_in_wake_batch;
 
     /* TLS context, TLS Send Buffer, streams, epochs */
     void* tls_ctx;
     uint64_t crypto_epoch_length_max;
     uint64_t crypto_epoch_sequence;
     uint64_t crypto_rotation_time_guard;
+    uint64_t crypto_key_packets_enc; /* Number of packets protected with the current 1-RTT key */
+    uint64_t crypto_key_confidentiality_limit; /* Confidentiality limit of the 1-RTT AEAD */
     struct st_ptls_buffer_t* tls_sendbuf;
     uint16_t psk_cipher_suite_id;
 
@@ -1318,6 +1449,8 @@ typedef struct st_picoquic_cnx_t {
     uint32_t nb_zero_rtt_sent;
     uint32_t nb_zero_rtt_acked;
     uint32_t nb_zero_rtt_received;
+    uint32_t nb_zero_rtt_rejected;
+    uint64_t early_data_replayed;
     size_t max_mtu_sent;
     size_t max_mtu_received;
     uint64_t nb_packets_received;
@@ -1327,6 +1460,9 @@ typedef struct st_picoquic_cnx_t {
     uint64_t nb_trains_blocked_pacing;
     uint64_t nb_trains_blocked_others;
     uint64_t nb_packets_sent;
+    uint64_t nb_handshake_datagrams_sent; /* datagrams carrying Initial or Handshake packets */
+    uint64_t nb_handshake_bytes_sent;
+    uint64_t nb_handshake_padding_bytes; /* padding added to datagrams carrying Initial packets */
     uint64_t nb_packets_logged;
     uint64_t nb_retransmission_total;
     uint64_t nb_preemptive_repeat;
@@ -1344,6 +1480,9 @@ typedef struct st_picoquic_cnx_t {
     unsigned int stream_blocked : 1;
     /* Congestion algorithm */
     picoquic_congestion_algorithm_t const* congestion_alg;
+    /* Congestion control telemetry ring and experiment arm, if any */
+    struct st_picoquic_cc_telemetry_t* cc_telemetry;
+    int cc_experiment_arm;
     /* Management of quality signalling updates */
     uint64_t rtt_update_delta;
     uint64_t pacing_rate_update_delta;
@@ -1545,10 +1684,22 @@ void picoquic_update_pacing_rate(picoquic_cnx_t* cnx, picoquic_path_t* path_x, d
 /* Manage path quality updates */
 void picoquic_refresh_path_quality_thresholds(picoquic_path_t* path_x);
 int picoquic_issue_path_quality_update(picoquic_cnx_t* cnx, picoquic_path_t* path_x);
+/* Congestion control telemetry and experiments.
+ * The record function is called after congestion control notifications.
+ * It returns immediately if telemetry is not enabled for the connection. */
+void picoquic_cc_telemetry_record(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification, uint64_t current_time);
+void picoquic_cc_telemetry_free(picoquic_cnx_t* cnx);
+void picoquic_cc_experiment_assign(picoquic_cnx_t* cnx);
+void picoquic_cc_experiment_aggregate(picoquic_cnx_t* cnx);
+void picoquic_cc_experiment_free(picoquic_quic_t* quic);
 
 /* Next time is used to order the list of available connections,
         * so ready connections are polled first */
 void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t next_time);
+picoquic_cnx_t* picoquic_wake_batch_next(picoquic_quic_t* quic, uint64_t max_wake_time);
+void picoquic_wake_batch_done(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t max_wake_time,
+    size_t send_length, size_t send_msg_size);
 
 /* Integer parsing macros */
 #define PICOPARSE_16(b) ((((uint16_t)(b)[0]) << 8) | (uint16_t)((b)[1]))
@@ -1850,6 +2001,7 @@ int picoquic_decode_closing_frames(picoquic_cnx_t* cnx, uint8_t* bytes, size_t b
 
 void picoquic_process_sooner_packets(picoquic_cnx_t* cnx, uint64_t current_time);
 void picoquic_delete_sooner_packets(picoquic_cnx_t* cnx);
+void picoquic_check_aead_limits(picoquic_cnx_t* cnx, uint64_t current_time);
 
 /* handling of transport extensions.
  */
@@ -1880,6 +2032,21 @@ picoquic_misc_frame_header_t* picoquic_create_misc_frame(const uint8_t* bytes, s
  */
 int picoquic_process_version_upgrade(picoquic_cnx_t* cnx, int old_version_index, int new_version_index);
 
+/* Stage instrumentation. PICOQUIC_STAGE_BEGIN declares a local variable
+ * holding the start cycle count, and must be matched by PICOQUIC_STAGE_END
+ * in the same scope. Both expand to nothing unless the library is compiled
+ * with PICOQUIC_WITH_STAGE_CYCLES or PICOQUIC_WITH_USDT.
+ */
+#if defined(PICOQUIC_WITH_STAGE_CYCLES) || defined(PICOQUIC_WITH_USDT)
+uint64_t picoquic_stage_begin(picoquic_quic_t* quic, picoquic_stage_enum stage);
+void picoquic_stage_end(picoquic_quic_t* quic, picoquic_stage_enum stage, uint64_t start_cycles);
+#define PICOQUIC_STAGE_BEGIN(quic, stage, v) uint64_t v = picoquic_stage_begin(quic, stage)
+#define PICOQUIC_STAGE_END(quic, stage, v) picoquic_stage_end(quic, stage, v)
+#else
+#define PICOQUIC_STAGE_BEGIN(quic, stage, v)
+#define PICOQUIC_STAGE_END(quic, stage, v)
+#endif
+
 #ifdef __cplusplus
 }
 #endif
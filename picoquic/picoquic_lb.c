@@ -29,6 +29,15 @@
 #include "picoquic_utils.h"
 #include "tls_api.h"
 #include "picoquic_lb.h"
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#ifndef SO_ATTACH_REUSEPORT_EBPF
+#define SO_ATTACH_REUSEPORT_EBPF 52
+#endif
+#endif
 
 /* Load balancer support is defined in https://datatracker.ietf.org/doc/draft-ietf-quic-load-balancers/
  * The draft defines methods for encoding a server ID in a connection identifier, and optionally
@@ -512,4 +521,189 @@ void picoquic_lb_compat_cid_config_free(picoquic_quic_t* quic)
         quic->cnx_id_callback_fn = NULL;
         quic->cnx_id_callback_ctx = NULL;
     }
-}
\ No newline at end of file
+}
+
+/* Worker steering.
+ * When a server runs one socket per core with SO_REUSEPORT, the kernel
+ * selects the socket by hashing the 4-tuple. After NAT rebinding or
+ * migration, packets of a connection would land on a different core.
+ * Worker steering encodes the index of the worker in one byte of the
+ * locally issued CIDs, and a reuseport program reads that byte in the
+ * short header packets to select the socket of that worker. Long header
+ * packets, whose CID may be chosen by the client, are left to the kernel
+ * hash, which is stable during the handshake.
+ * The worker byte is sent in clear, and so is the same for all the CIDs
+ * issued by a worker.
+ */
+int picoquic_cid_steering_config(picoquic_quic_t* quic, uint8_t connection_id_length,
+    uint8_t worker_byte_offset, uint8_t worker_id, uint8_t nb_workers)
+{
+    int ret = 0;
+
+    if (quic->cnx_list != NULL && quic->local_cnxid_length != connection_id_length) {
+        /* Error. Changing the CID length now will break existing connections */
+        ret = -1;
+    }
+    else if (quic->cnx_id_callback_fn != NULL && quic->cnx_id_callback_ctx != NULL) {
+        /* Error. Some other CID generation is configured, cannot be changed */
+        ret = -1;
+    }
+    else if (connection_id_length > PICOQUIC_CONNECTION_ID_MAX_SIZE ||
+        worker_byte_offset >= connection_id_length || worker_id >= nb_workers) {
+        ret = -1;
+    }
+    else {
+        picoquic_cid_steering_ctx_t* steering_ctx = (picoquic_cid_steering_ctx_t*)malloc(sizeof(picoquic_cid_steering_ctx_t));
+
+        if (steering_ctx == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(steering_ctx, 0, sizeof(picoquic_cid_steering_ctx_t));
+            steering_ctx->connection_id_length = connection_id_length;
+            steering_ctx->worker_byte_offset = worker_byte_offset;
+            steering_ctx->worker_id = worker_id;
+            steering_ctx->nb_workers = nb_workers;
+            quic->local_cnxid_length = connection_id_length;
+            quic->cnx_id_callback_fn = picoquic_cid_steering_generate;
+            quic->cnx_id_callback_ctx = (void*)steering_ctx;
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_cid_steering_config_free(picoquic_quic_t* quic)
+{
+    if (quic->cnx_id_callback_fn == picoquic_cid_steering_generate &&
+        quic->cnx_id_callback_ctx != NULL) {
+        free(quic->cnx_id_callback_ctx);
+        quic->cnx_id_callback_fn = NULL;
+        quic->cnx_id_callback_ctx = NULL;
+    }
+}
+
+/* The CID is pre-filled with random bytes, only the worker byte is set */
+void picoquic_cid_steering_generate(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id_local,
+    picoquic_connection_id_t cnx_id_remote, void* cnx_id_cb_data, picoquic_connection_id_t* cnx_id_returned)
+{
+    picoquic_cid_steering_ctx_t* steering_ctx = (picoquic_cid_steering_ctx_t*)cnx_id_cb_data;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(quic);
+    UNREFERENCED_PARAMETER(cnx_id_local);
+    UNREFERENCED_PARAMETER(cnx_id_remote);
+#endif
+    if (steering_ctx->worker_byte_offset < cnx_id_returned->id_len) {
+        cnx_id_returned->id[steering_ctx->worker_byte_offset] = steering_ctx->worker_id;
+    }
+}
+
+int picoquic_cid_steering_worker(picoquic_connection_id_t const* cnx_id, uint8_t worker_byte_offset, uint8_t nb_workers)
+{
+    int worker_id = -1;
+
+    if (worker_byte_offset < cnx_id->id_len && cnx_id->id[worker_byte_offset] < nb_workers) {
+        worker_id = cnx_id->id[worker_byte_offset];
+    }
+
+    return worker_id;
+}
+
+/* Reuseport program generator. The program is an eBPF socket filter,
+ * which sees the UDP payload and returns the index of the socket in the
+ * reuseport group. Indices out of range let the kernel fall back to the
+ * 4-tuple hash. The program is:
+ *
+ *     r6 = r1                     ; ctx, required by the LD_ABS instructions
+ *     r0 = packet[0]
+ *     if r0 & 0x80 goto hash      ; long header
+ *     r0 = packet[1 + offset]     ; worker byte of the destination CID
+ *     if r0 >= nb_workers goto hash
+ *     exit
+ * hash:
+ *     r0 = 0xFFFFFFFF
+ *     exit
+ */
+#define PICOQUIC_BPF_LD_ABS_B 0x30
+#define PICOQUIC_BPF_MOV64_X 0xbf
+#define PICOQUIC_BPF_MOV64_K 0xb7
+#define PICOQUIC_BPF_JSET_K 0x45
+#define PICOQUIC_BPF_JGE_K 0x35
+#define PICOQUIC_BPF_EXIT 0x95
+
+static void picoquic_bpf_set_insn(picoquic_bpf_insn_t* insn, uint8_t code, uint8_t dst_reg, uint8_t src_reg, int16_t off, int32_t imm)
+{
+    insn->code = code;
+    insn->dst_reg = dst_reg;
+    insn->src_reg = src_reg;
+    insn->off = off;
+    insn->imm = imm;
+}
+
+size_t picoquic_cid_steering_bpf_generate(uint8_t worker_byte_offset, uint8_t nb_workers,
+    picoquic_bpf_insn_t* insns, size_t insns_max)
+{
+    size_t nb_insns = 0;
+
+    if (insns_max >= PICOQUIC_CID_STEERING_BPF_MAX_INSNS) {
+        picoquic_bpf_set_insn(&insns[nb_insns++], PICOQUIC_BPF_MOV64_X, 6, 1, 0, 0);
+        picoquic_bpf_set_insn(&insns[nb_insns++], PICOQUIC_BPF_LD_ABS_B, 0, 0, 0, 0);
+        picoquic_bpf_set_insn(&insns[nb_insns++], PICOQUIC_BPF_JSET_K, 0, 0, 3, 0x80);
+        picoquic_bpf_set_insn(&insns[nb_insns++], PICOQUIC_BPF_LD_ABS_B, 0, 0, 0, 1 + (int32_t)worker_byte_offset);
+        picoquic_bpf_set_insn(&insns[nb_insns++], PICOQUIC_BPF_JGE_K, 0, 0, 1, nb_workers);
+        picoquic_bpf_set_insn(&insns[nb_insns++], PICOQUIC_BPF_EXIT, 0, 0, 0, 0);
+        picoquic_bpf_set_insn(&insns[nb_insns++], PICOQUIC_BPF_MOV64_K, 0, 0, 0, -1);
+        picoquic_bpf_set_insn(&insns[nb_insns++], PICOQUIC_BPF_EXIT, 0, 0, 0, 0);
+    }
+
+    return nb_insns;
+}
+
+/* Load the program and attach it to the reuseport group of the socket.
+ * This is only supported on Linux, and requires the privileges needed
+ * to load BPF programs. Call once, on any socket of the group, after
+ * all the sockets are bound: the socket index is the order of binding,
+ * so worker N must bind the N-th socket.
+ */
+int picoquic_cid_steering_bpf_attach(int fd, uint8_t worker_byte_offset, uint8_t nb_workers)
+{
+    int ret = -1;
+#ifdef __linux__
+    picoquic_bpf_insn_t prog[PICOQUIC_CID_STEERING_BPF_MAX_INSNS];
+    struct bpf_insn insns[PICOQUIC_CID_STEERING_BPF_MAX_INSNS];
+    size_t nb_insns = picoquic_cid_steering_bpf_generate(worker_byte_offset, nb_workers, prog, PICOQUIC_CID_STEERING_BPF_MAX_INSNS);
+    char const* license = "Dual BSD/GPL";
+    union bpf_attr attr;
+    int prog_fd;
+
+    memset(insns, 0, sizeof(insns));
+    for (size_t i = 0; i < nb_insns; i++) {
+        insns[i].code = prog[i].code;
+        insns[i].dst_reg = prog[i].dst_reg;
+        insns[i].src_reg = prog[i].src_reg;
+        insns[i].off = prog[i].off;
+        insns[i].imm = prog[i].imm;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+    attr.insns = (uint64_t)(uintptr_t)insns;
+    attr.insn_cnt = (uint32_t)nb_insns;
+    attr.license = (uint64_t)(uintptr_t)license;
+
+    prog_fd = (int)syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+    if (prog_fd >= 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_EBPF, &prog_fd, sizeof(prog_fd)) == 0) {
+            ret = 0;
+        }
+        /* The socket keeps a reference to the program */
+        close(prog_fd);
+    }
+#else
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(fd);
+    UNREFERENCED_PARAMETER(worker_byte_offset);
+    UNREFERENCED_PARAMETER(nb_workers);
+#endif
+#endif
+    return ret;
+}
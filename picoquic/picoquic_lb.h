@@ -75,6 +75,45 @@ typedef struct st_picoquic_load_balancer_cid_context_t {
 
 void picoquic_lb_compat_cid_generate(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id_local, picoquic_connection_id_t cnx_id_remote, void* cnx_id_cb_data, picoquic_connection_id_t* cnx_id_returned);
 uint64_t picoquic_lb_compat_cid_verify(picoquic_quic_t* quic, void* cnx_id_cb_data, picoquic_connection_id_t const* cnx_id);
+
+/* Worker steering, for servers running one socket per core with SO_REUSEPORT.
+ * Each worker has its own QUIC context, configured with its worker ID. The
+ * locally issued CIDs carry the worker ID in clear at the specified offset.
+ * The reuseport program reads that byte in short header packets and selects
+ * the socket of the worker, so packets arriving after NAT rebinding or
+ * migration reach the core that owns the connection. Long header packets
+ * are left to the kernel 4-tuple hash.
+ * picoquic_cid_steering_bpf_generate writes the program in a portable
+ * format, picoquic_cid_steering_bpf_attach loads it and attaches it to
+ * the reuseport group of a socket (Linux only).
+ */
+typedef struct st_picoquic_cid_steering_ctx_t {
+    uint8_t connection_id_length;
+    uint8_t worker_byte_offset;
+    uint8_t worker_id;
+    uint8_t nb_workers;
+} picoquic_cid_steering_ctx_t;
+
+int picoquic_cid_steering_config(picoquic_quic_t* quic, uint8_t connection_id_length,
+    uint8_t worker_byte_offset, uint8_t worker_id, uint8_t nb_workers);
+void picoquic_cid_steering_config_free(picoquic_quic_t* quic);
+void picoquic_cid_steering_generate(picoquic_quic_t* quic, picoquic_connection_id_t cnx_id_local,
+    picoquic_connection_id_t cnx_id_remote, void* cnx_id_cb_data, picoquic_connection_id_t* cnx_id_returned);
+int picoquic_cid_steering_worker(picoquic_connection_id_t const* cnx_id, uint8_t worker_byte_offset, uint8_t nb_workers);
+
+#define PICOQUIC_CID_STEERING_BPF_MAX_INSNS 8
+
+typedef struct st_picoquic_bpf_insn_t {
+    uint8_t code;
+    uint8_t dst_reg;
+    uint8_t src_reg;
+    int16_t off;
+    int32_t imm;
+} picoquic_bpf_insn_t;
+
+size_t picoquic_cid_steering_bpf_generate(uint8_t worker_byte_offset, uint8_t nb_workers,
+    picoquic_bpf_insn_t* insns, size_t insns_max);
+int picoquic_cid_steering_bpf_attach(int fd, uint8_t worker_byte_offset, uint8_t nb_workers);
 #ifdef __cplusplus
 }
 #endif
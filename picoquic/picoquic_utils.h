@@ -250,9 +250,42 @@ typedef struct st_picoquictest_sim_packet_t {
     struct sockaddr_storage addr_from;
     struct sockaddr_storage addr_to;
     uint8_t ecn_mark;
-    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
+    size_t bytes_size; /* Allocated size of "bytes", at least PICOQUIC_MAX_PACKET_SIZE */
+    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE]; /* Must be last, extended for jumbo packets */
 } picoquictest_sim_packet_t;
 
+/* DualPI2 simulation, see RFC 9332.
+ * The L4S queue receives the packets marked ECT(1) or CE, and is served
+ * with priority. The classic queue receives the other packets. A PI controller
+ * computes a base probability p' from the classic queue delay. Classic packets
+ * are dropped, or CE marked if ECT(0), with probability p'^2. L4S packets are
+ * CE marked with probability k*p', or if the L4S queue delay exceeds a step
+ * threshold.
+ */
+typedef struct st_picoquictest_sim_dualq_t {
+    uint64_t l4s_queue_time; /* Time at which the L4S queue will be empty */
+    uint64_t target; /* Target delay of the classic queue */
+    uint64_t l4s_threshold; /* Step marking threshold of the L4S queue */
+    uint64_t t_update; /* Interval between updates of the PI controller */
+    uint64_t last_update;
+    uint64_t prev_delay;
+    double p_base; /* Base probability p' */
+    double alpha; /* Integral gain, per second */
+    double beta; /* Proportional gain, per second */
+    double coupling; /* L4S marking probability is coupling * p' */
+    uint64_t random_ctx;
+    /* Statistics */
+    uint64_t l4s_packets;
+    uint64_t l4s_bytes;
+    uint64_t l4s_marked;
+    uint64_t l4s_delay_sum; /* L4S and classic queue delays seen by L4S arrivals */
+    uint64_t classic_delay_sum;
+    uint64_t classic_packets;
+    uint64_t classic_marked;
+    uint64_t classic_bytes;
+    uint64_t classic_dropped;
+} picoquictest_sim_dualq_t;
+
 typedef struct st_picoquictest_sim_link_t {
     uint64_t next_send_time;
     uint64_t queue_time;
@@ -273,6 +306,8 @@ typedef struct st_picoquictest_sim_link_t {
     uint64_t red_queue_max;
     /* L4S MAX sets the ECN mark threshold if doing L4S or DCTCP style ECN marking. */
     uint64_t l4s_max;
+    /* Dual queue AQM, if set */
+    picoquictest_sim_dualq_t* dualq;
     /* Variables for rate limiter simulation */
     double bucket_increase_per_microsec;
     uint64_t bucket_max;
@@ -290,6 +325,9 @@ void picoquictest_sim_link_delete(picoquictest_sim_link_t* link);
 
 picoquictest_sim_packet_t* picoquictest_sim_link_create_packet();
 
+/* Create a packet that can hold at least "length" bytes, e.g., a jumbo packet */
+picoquictest_sim_packet_t* picoquictest_sim_link_create_packet_ex(size_t length);
+
 uint64_t picoquictest_sim_link_next_arrival(picoquictest_sim_link_t* link, uint64_t current_time);
 
 picoquictest_sim_packet_t* picoquictest_sim_link_dequeue(picoquictest_sim_link_t* link,
@@ -298,6 +336,12 @@ picoquictest_sim_packet_t* picoquictest_sim_link_dequeue(picoquictest_sim_link_t
 void picoquictest_sim_link_submit(picoquictest_sim_link_t* link, picoquictest_sim_packet_t* packet,
     uint64_t current_time);
 
+/* Set the link in DualPI2 mode. Target and threshold are in microseconds. If
+ * zero, the default values of RFC 9332 are used: target 15ms, threshold 1ms,
+ * coupling factor 2. */
+int picoquictest_sim_link_set_dualq(picoquictest_sim_link_t* link, uint64_t target,
+    uint64_t l4s_threshold, double coupling, uint64_t current_time);
+
 /* picoquic_test_simlink_suspend simulates and interuption of transmission until the
 * specified "end of interval" time. There are two modes:
 * 
@@ -782,7 +782,7 @@ picoquic_recvmsg_async_ctx_t * picoquic_create_async_socket(int af, int recv_coa
 #ifdef UDP_RECV_MAX_COALESCED_SIZE
                 if (ret == 0) {
                     DWORD coalesced_size = 0x10000;
-                    ctx->recv_buffer_size = (recv_coalesced)?coalesced_size:PICOQUIC_MAX_PACKET_SIZE;
+                    ctx->recv_buffer_size = (recv_coalesced)?coalesced_size:PICOQUIC_MAX_JUMBO_PACKET_SIZE;
                     ctx->recv_buffer = (uint8_t*)malloc(ctx->recv_buffer_size);
                     ctx->supports_udp_recv_coalesced = recv_coalesced;
                     ctx->supports_udp_send_coalesced = send_coalesced;
@@ -804,7 +804,7 @@ picoquic_recvmsg_async_ctx_t * picoquic_create_async_socket(int af, int recv_coa
                 }
 #else
                 if (ret == 0) {
-                    ctx->recv_buffer_size = PICOQUIC_MAX_PACKET_SIZE;
+                    ctx->recv_buffer_size = PICOQUIC_MAX_JUMBO_PACKET_SIZE;
                     ctx->recv_buffer = (uint8_t*)malloc(ctx->recv_buffer_size);
                     ctx->supports_udp_recv_coalesced = 0;
                     ctx->supports_udp_send_coalesced = 0;
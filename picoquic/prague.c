@@ -109,8 +109,10 @@ typedef struct st_picoquic_prague_state_t {
     uint64_t l4s_update_sent;
     uint64_t l4s_epoch_send;
     uint64_t l4s_epoch_ect0;
-    uint64_t l4s_epoch_ce;
+    uint64_t l4s_epoch_ect1;
+    uint64_t l4s_epoch_nb_ce; /* CE marks reported by ecn_ec notifications in the epoch */
     picoquic_min_max_rtt_t rtt_filter;
+    picoquic_cc_slow_start_t slow_start;
 } picoquic_prague_state_t;
 
 static void picoquic_prague_init_reno(picoquic_prague_state_t* pr_state, picoquic_path_t* path_x)
@@ -118,6 +120,7 @@ static void picoquic_prague_init_reno(picoquic_prague_state_t* pr_state, picoqui
     pr_state->alg_state = picoquic_prague_alg_slow_start;
     pr_state->ssthresh = UINT64_MAX;
     pr_state->alpha = 0;
+    picoquic_cc_slow_start_reset(&pr_state->slow_start);
     path_x->cwin = PICOQUIC_CWIN_INITIAL;
 }
 
@@ -159,7 +162,8 @@ static void picoquic_prague_reset_l3s(picoquic_cnx_t* cnx, picoquic_prague_state
     picoquic_packet_context_t* pkt_ctx = picoquic_prague_get_pkt_ctx(cnx, path_x);
     pr_state->l4s_epoch_send = pkt_ctx->send_sequence;
     pr_state->l4s_epoch_ect0 = pkt_ctx->ecn_ect0_total_remote;
-    pr_state->l4s_epoch_ce = pkt_ctx->ecn_ce_total_remote;
+    pr_state->l4s_epoch_ect1 = pkt_ctx->ecn_ect1_total_remote;
+    pr_state->l4s_epoch_nb_ce = 0;
     pr_state->alpha = 0;
     pr_state->alpha_shifted = 0;
 
@@ -217,11 +221,13 @@ static void picoquic_prague_update_alpha(picoquic_cnx_t* cnx,
         uint64_t frac = 0;
         int is_suspect = 0;
         pr_state->l4s_epoch_send = pkt_ctx->send_sequence;
-        uint64_t delta_ect0 = pkt_ctx->ecn_ect0_total_remote - pr_state->l4s_epoch_ect0;
-        uint64_t delta_ce = pkt_ctx->ecn_ce_total_remote - pr_state->l4s_epoch_ce;
+        /* Packets are marked ECT(1) when the path uses L4S, ECT(0) otherwise. */
+        uint64_t delta_ect = (pkt_ctx->ecn_ect0_total_remote - pr_state->l4s_epoch_ect0) +
+            (pkt_ctx->ecn_ect1_total_remote - pr_state->l4s_epoch_ect1);
+        uint64_t delta_ce = pr_state->l4s_epoch_nb_ce;
 
         if (delta_ce > 0) {
-            frac = (delta_ce * 1024) / (delta_ce + delta_ect0);
+            frac = (delta_ce * 1024) / (delta_ce + delta_ect);
         }
         else {
             frac = 0;
@@ -243,7 +249,7 @@ static void picoquic_prague_update_alpha(picoquic_cnx_t* cnx,
         }
         pr_state->l4s_update_sent = update_sent;
 
-        if (delta_ce > 0 || delta_ect0 > 0) {
+        if (delta_ce > 0 || delta_ect > 0) {
             if (frac > pr_state->alpha && (frac > 512 || is_suspect)) {
                 pr_state->alpha = frac;
                 pr_state->alpha_shifted = frac << PRAGUE_SHIFT_G;
@@ -257,7 +263,8 @@ static void picoquic_prague_update_alpha(picoquic_cnx_t* cnx,
         }
         pr_state->l4s_epoch_send = pkt_ctx->send_sequence;
         pr_state->l4s_epoch_ect0 = pkt_ctx->ecn_ect0_total_remote;
-        pr_state->l4s_epoch_ce = pkt_ctx->ecn_ce_total_remote;
+        pr_state->l4s_epoch_ect1 = pkt_ctx->ecn_ect1_total_remote;
+        pr_state->l4s_epoch_nb_ce = 0;
 
         if (delta_ce > 0) {
             if (pr_state->alpha > 512) {
@@ -282,6 +289,22 @@ static void picoquic_prague_update_alpha(picoquic_cnx_t* cnx,
     }
 }
 
+/* Safe retreat if a window seeded by careful resume proved too large
+ */
+static void picoquic_prague_careful_retreat(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_prague_state_t* pr_state, uint64_t lost_packet_number, uint64_t current_time)
+{
+    uint64_t retreat_cwin;
+
+    if (picoquic_cc_careful_resume_retreat(&pr_state->slow_start, cnx, path_x, lost_packet_number, current_time, &retreat_cwin) &&
+        retreat_cwin < path_x->cwin) {
+        path_x->cwin = retreat_cwin;
+        pr_state->ssthresh = retreat_cwin;
+        pr_state->alg_state = picoquic_prague_alg_congestion_avoidance;
+        path_x->is_ssthresh_initialized = 1;
+    }
+}
+
 /* Callback management for Prague
  */
 void picoquic_prague_notify(
@@ -306,12 +329,13 @@ void picoquic_prague_notify(
             picoquic_prague_update_alpha(cnx, path_x, pr_state, nb_bytes_acknowledged, current_time);
             /* Increae or reduce the congestion window based on alpha */
             switch (pr_state->alg_state) {
-            case picoquic_prague_alg_slow_start:
+            case picoquic_prague_alg_slow_start: {
+                uint64_t nb_bytes_increase = picoquic_cc_slow_start_increment(&pr_state->slow_start, nb_bytes_acknowledged);
                 if (path_x->smoothed_rtt <= PICOQUIC_TARGET_RENO_RTT) {
-                    path_x->cwin += (nb_bytes_acknowledged * (1024 - pr_state->alpha)) / 1024;
+                    path_x->cwin += (nb_bytes_increase * (1024 - pr_state->alpha)) / 1024;
                 }
                 else {
-                    uint64_t delta = nb_bytes_acknowledged;
+                    uint64_t delta = nb_bytes_increase;
                     delta *= path_x->smoothed_rtt;
                     delta *= (1024 - pr_state->alpha);
                     delta /= PICOQUIC_TARGET_RENO_RTT;
@@ -323,6 +347,7 @@ void picoquic_prague_notify(
                     pr_state->alg_state = picoquic_prague_alg_congestion_avoidance;
                 }
                 break;
+            }
             case picoquic_prague_alg_congestion_avoidance:
             default: {
                 uint64_t complete_delta = nb_bytes_acknowledged * path_x->send_mtu + pr_state->residual_ack;
@@ -336,7 +361,11 @@ void picoquic_prague_notify(
             break;
         }
         case picoquic_congestion_notification_ecn_ec:
-            // picoquic_prague_update_alpha(cnx, path_x, pr_state, nb_bytes_acknowledged, current_time);
+            /* nb_bytes_acknowledged carries the number of newly reported CE marks.
+             * The ECN counters are now up to date, so this is also the right time
+             * to check for the end of the epoch. */
+            pr_state->l4s_epoch_nb_ce += nb_bytes_acknowledged;
+            picoquic_prague_update_alpha(cnx, path_x, pr_state, nb_bytes_acknowledged, current_time);
             if (pr_state->alg_state == picoquic_prague_alg_slow_start &&
                 pr_state->ssthresh == UINT64_MAX) {
                 if (path_x->cwin > path_x->send_mtu) {
@@ -346,6 +375,7 @@ void picoquic_prague_notify(
                 pr_state->alg_state = picoquic_prague_alg_congestion_avoidance;
                 path_x->is_ssthresh_initialized = 1;
             }
+            picoquic_prague_careful_retreat(cnx, path_x, pr_state, lost_packet_number, current_time);
             break;
         case picoquic_congestion_notification_repeat:
         case picoquic_congestion_notification_timeout:
@@ -353,6 +383,7 @@ void picoquic_prague_notify(
             if (current_time - pr_state->recovery_start > path_x->smoothed_rtt) {
                 picoquic_prague_enter_recovery(cnx, path_x, notification, pr_state, current_time);
             }
+            picoquic_prague_careful_retreat(cnx, path_x, pr_state, lost_packet_number, current_time);
             break;
         case picoquic_congestion_notification_spurious_repeat:
             if (current_time - pr_state->recovery_start < path_x->smoothed_rtt) {
@@ -385,9 +416,8 @@ void picoquic_prague_notify(
                     }
                 }
 
-                if (picoquic_hystart_test(&pr_state->rtt_filter, (cnx->is_time_stamp_enabled) ? one_way_delay : rtt_measurement,
-                    cnx->path[0]->pacing_packet_time_microsec, current_time,
-                    cnx->is_time_stamp_enabled)) {
+                if (picoquic_cc_slow_start_test(&pr_state->slow_start, &pr_state->rtt_filter, cnx, path_x,
+                    rtt_measurement, one_way_delay, current_time)) {
                     /* RTT increased too much, get out of slow start! */
                     pr_state->ssthresh = path_x->cwin;
                     pr_state->alg_state = picoquic_prague_alg_congestion_avoidance;
@@ -409,6 +439,16 @@ void picoquic_prague_notify(
         case picoquic_congestion_notification_reset:
             picoquic_prague_reset(cnx, pr_state, path_x);
             break;
+        case picoquic_congestion_notification_seed_cwin:
+            if (pr_state->alg_state == picoquic_prague_alg_slow_start &&
+                pr_state->ssthresh == UINT64_MAX) {
+                path_x->cwin = picoquic_cc_careful_resume_seed(&pr_state->slow_start, cnx, path_x,
+                    nb_bytes_acknowledged, current_time);
+                pr_state->ssthresh = path_x->cwin;
+                pr_state->alg_state = picoquic_prague_alg_congestion_avoidance;
+                path_x->is_ssthresh_initialized = 1;
+            }
+            break;
         case picoquic_congestion_notification_cwin_blocked:
         default:
             /* ignore */
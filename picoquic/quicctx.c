@@ -357,127 +357,172 @@ picoquic_packet_context_enum picoquic_context_from_epoch(int epoch)
     return (epoch >= 0 && epoch < 4) ? pc[epoch] : 0;
 }
 
-/* Management of issued tickets.
- * For each issued ticket, we create a ticket key:
- * - ticket id
- * - properties
- * The tickets are accessible through a hash table, keyed by ticket ID.
- * They are also organized as an LRU list, with a max number set by default
- * to the number of connections.
+/* Management of the path MTU cache.
+ * When PMTU discovery validates a larger MTU for a peer, the value is
+ * remembered for the lifetime set with picoquic_set_mtu_cache. New
+ * connections to the same address start with the cached value instead
+ * of the initial MTU. The entry is removed if a black hole is detected.
  */
 
-static uint64_t picoquic_issued_ticket_hash(const void* key)
+static uint64_t picoquic_mtu_cache_hash(const void* key)
 {
-    const picoquic_issued_ticket_t* ticket_key = (const picoquic_issued_ticket_t*)key;
+    const picoquic_mtu_cache_entry_t* entry = (const picoquic_mtu_cache_entry_t*)key;
 
-    return ticket_key->ticket_id;
+    return picoquic_hash_addr((const struct sockaddr*)&entry->peer_addr);
 }
 
-static int picoquic_issued_ticket_compare(const void* key1, const void* key2)
+static int picoquic_mtu_cache_compare(const void* key1, const void* key2)
 {
-    const picoquic_issued_ticket_t* ticket_key1 = (const picoquic_issued_ticket_t*)key1;
-    const picoquic_issued_ticket_t* ticket_key2 = (const picoquic_issued_ticket_t*)key2;
-    int ret = (ticket_key1->ticket_id == ticket_key2->ticket_id)?0:1;
+    const picoquic_mtu_cache_entry_t* entry1 = (const picoquic_mtu_cache_entry_t*)key1;
+    const picoquic_mtu_cache_entry_t* entry2 = (const picoquic_mtu_cache_entry_t*)key2;
 
-    return ret;
+    return picoquic_compare_addr((const struct sockaddr*)&entry1->peer_addr,
+        (const struct sockaddr*)&entry2->peer_addr);
 }
 
-picoquic_issued_ticket_t* picoquic_retrieve_issued_ticket(picoquic_quic_t* quic,
-    uint64_t ticket_id)
+static picoquic_mtu_cache_entry_t* picoquic_retrieve_cached_mtu(picoquic_quic_t* quic,
+    const struct sockaddr* peer_addr)
 {
-    picoquic_issued_ticket_t* ret = NULL;
-    picohash_item* item;
-    picoquic_issued_ticket_t key;
+    picoquic_mtu_cache_entry_t* ret = NULL;
 
-    memset(&key, 0, sizeof(key));
-    key.ticket_id = ticket_id;
+    if (quic->table_mtu_cache != NULL) {
+        picohash_item* item;
+        picoquic_mtu_cache_entry_t key;
 
-    item = picohash_retrieve(quic->table_issued_tickets, &key);
+        memset(&key, 0, sizeof(key));
+        picoquic_store_addr(&key.peer_addr, peer_addr);
+        item = picohash_retrieve(quic->table_mtu_cache, &key);
 
-    if (item != NULL) {
-        ret = (picoquic_issued_ticket_t*)item->key;
+        if (item != NULL) {
+            ret = (picoquic_mtu_cache_entry_t*)item->key;
+        }
     }
     return ret;
 }
 
-static void picoquic_update_issued_ticket(
-    picoquic_issued_ticket_t* ticket,
-    uint64_t rtt,
-    uint64_t cwin,
-    const uint8_t* ip_addr,
-    uint8_t ip_addr_length)
-{
-    /* Update in place */
-    if (ip_addr_length > PICOQUIC_STORED_IP_MAX) {
-        ip_addr_length = PICOQUIC_STORED_IP_MAX;
-    }
-    ticket->ip_addr_length = ip_addr_length;
-    memcpy(ticket->ip_addr, ip_addr, ip_addr_length);
-    ticket->rtt = rtt;
-    ticket->cwin = cwin;
-}
-
-static void picoquic_delete_issued_ticket(picoquic_quic_t* quic, picoquic_issued_ticket_t* ticket)
+static void picoquic_delete_cached_mtu(picoquic_quic_t* quic, picoquic_mtu_cache_entry_t* entry)
 {
-    /* Update the linked list */
-    if (ticket->next_ticket == NULL) {
-        quic->table_issued_tickets_last = ticket->previous_ticket;
+    if (entry->next_entry == NULL) {
+        quic->mtu_cache_last = entry->previous_entry;
     }
     else {
-        ticket->next_ticket->previous_ticket = ticket->previous_ticket;
+        entry->next_entry->previous_entry = entry->previous_entry;
     }
 
-    if (ticket->previous_ticket == NULL) {
-        quic->table_issued_tickets_first = ticket->next_ticket;
+    if (entry->previous_entry == NULL) {
+        quic->mtu_cache_first = entry->next_entry;
     }
     else {
-        ticket->previous_ticket->next_ticket = ticket->next_ticket;
+        entry->previous_entry->next_entry = entry->next_entry;
     }
 
-    picohash_delete_key(quic->table_issued_tickets, ticket, 1);
+    picohash_delete_key(quic->table_mtu_cache, entry, 1);
 
-    if (quic->table_issued_tickets_nb > 0) {
-        quic->table_issued_tickets_nb--;
+    if (quic->mtu_cache_nb > 0) {
+        quic->mtu_cache_nb--;
     }
 }
 
-int picoquic_remember_issued_ticket(picoquic_quic_t* quic,
-    uint64_t ticket_id,
-    uint64_t rtt,
-    uint64_t cwin,
-    const uint8_t* ip_addr,
-    uint8_t ip_addr_length)
+void picoquic_update_cached_mtu(picoquic_quic_t* quic, const struct sockaddr* peer_addr,
+    size_t send_mtu, uint64_t current_time)
 {
-    int ret = 0;
+    picoquic_mtu_cache_entry_t* entry;
 
-    picoquic_issued_ticket_t* ticket = picoquic_retrieve_issued_ticket(quic,
-        ticket_id);
-    if (ticket != NULL) {
-        picoquic_update_issued_ticket(ticket, rtt, cwin, ip_addr, ip_addr_length);
+    if (quic->table_mtu_cache == NULL || peer_addr->sa_family == 0) {
+        return;
     }
-    else {
-        while (quic->table_issued_tickets_nb > quic->max_number_connections) {
-            picoquic_delete_issued_ticket(quic, quic->table_issued_tickets_last);
-        }
-        ticket = (picoquic_issued_ticket_t*)malloc(sizeof(picoquic_issued_ticket_t));
-        if (ticket != NULL) {
-            memset(ticket, 0, sizeof(picoquic_issued_ticket_t));
-            ticket->ticket_id = ticket_id;
-            picoquic_update_issued_ticket(ticket, rtt, cwin, ip_addr, ip_addr_length);
-            ticket->next_ticket = quic->table_issued_tickets_first;
-            quic->table_issued_tickets_first = ticket;
-            if (ticket->next_ticket == NULL) {
-                quic->table_issued_tickets_last = ticket;
+
+    entry = picoquic_retrieve_cached_mtu(quic, peer_addr);
+    if (entry != NULL) {
+        /* Move to the head of the LRU list */
+        picoquic_delete_cached_mtu(quic, entry);
+    }
+    while (quic->mtu_cache_nb >= quic->max_number_connections && quic->mtu_cache_last != NULL) {
+        picoquic_delete_cached_mtu(quic, quic->mtu_cache_last);
+    }
+
+    entry = (picoquic_mtu_cache_entry_t*)malloc(sizeof(picoquic_mtu_cache_entry_t));
+    if (entry != NULL) {
+        memset(entry, 0, sizeof(picoquic_mtu_cache_entry_t));
+        picoquic_store_addr(&entry->peer_addr, peer_addr);
+        entry->send_mtu = send_mtu;
+        entry->expiry_time = current_time + quic->mtu_cache_lifetime;
+        entry->next_entry = quic->mtu_cache_first;
+        quic->mtu_cache_first = entry;
+        if (entry->next_entry == NULL) {
+            quic->mtu_cache_last = entry;
+        }
+        else {
+            entry->next_entry->previous_entry = entry;
+        }
+        if (picohash_insert(quic->table_mtu_cache, entry) != 0) {
+            quic->mtu_cache_first = entry->next_entry;
+            if (entry->next_entry == NULL) {
+                quic->mtu_cache_last = NULL;
             }
             else {
-                ticket->next_ticket->previous_ticket = ticket;
+                entry->next_entry->previous_entry = NULL;
             }
-            picohash_insert(quic->table_issued_tickets, ticket);
+            free(entry);
         }
         else {
+            quic->mtu_cache_nb++;
+        }
+    }
+}
+
+size_t picoquic_get_cached_mtu(picoquic_quic_t* quic, const struct sockaddr* peer_addr, uint64_t current_time)
+{
+    size_t send_mtu = 0;
+    picoquic_mtu_cache_entry_t* entry = picoquic_retrieve_cached_mtu(quic, peer_addr);
+
+    if (entry != NULL) {
+        if (entry->expiry_time <= current_time) {
+            picoquic_delete_cached_mtu(quic, entry);
+        }
+        else {
+            send_mtu = entry->send_mtu;
+        }
+    }
+
+    return send_mtu;
+}
+
+void picoquic_remove_cached_mtu(picoquic_quic_t* quic, const struct sockaddr* peer_addr)
+{
+    picoquic_mtu_cache_entry_t* entry = picoquic_retrieve_cached_mtu(quic, peer_addr);
+
+    if (entry != NULL) {
+        picoquic_delete_cached_mtu(quic, entry);
+    }
+}
+
+static void picoquic_mtu_cache_free(picoquic_quic_t* quic)
+{
+    while (quic->mtu_cache_first != NULL) {
+        picoquic_delete_cached_mtu(quic, quic->mtu_cache_first);
+    }
+    if (quic->table_mtu_cache != NULL) {
+        picohash_delete(quic->table_mtu_cache, 1);
+        quic->table_mtu_cache = NULL;
+    }
+}
+
+int picoquic_set_mtu_cache(picoquic_quic_t* quic, uint64_t lifetime_microsec)
+{
+    int ret = 0;
+
+    if (lifetime_microsec == 0) {
+        picoquic_mtu_cache_free(quic);
+    }
+    else if (quic->table_mtu_cache == NULL) {
+        quic->table_mtu_cache = picohash_create((size_t)quic->max_number_connections,
+            picoquic_mtu_cache_hash, picoquic_mtu_cache_compare);
+        if (quic->table_mtu_cache == NULL) {
             ret = PICOQUIC_ERROR_MEMORY;
         }
     }
+    quic->mtu_cache_lifetime = lifetime_microsec;
 
     return ret;
 }
@@ -528,7 +573,11 @@ int picoquic_registered_token_check_reuse(picoquic_quic_t * quic,
     const uint8_t * token, size_t token_length, uint64_t expiry_time)
 {
     int ret = -1;
-    if (token_length >= 8) {
+    if (token_length >= 8 && quic->token_filter != NULL) {
+        ret = picoquic_token_filter_check_reuse(quic->token_filter, PICOPARSE_64(token + token_length - 8),
+            expiry_time, picoquic_get_quic_time(quic));
+    }
+    else if (token_length >= 8) {
         picoquic_registered_token_t* rt = (picoquic_registered_token_t*)malloc(sizeof(picoquic_registered_token_t));
         if (rt != NULL) {
             picosplay_node_t* rt_n = NULL;
@@ -620,6 +669,7 @@ picoquic_quic_t* picoquic_create(uint32_t max_nb_connections,
         quic->p_simulated_time = p_simulated_time;
         quic->local_cnxid_length = 8; /* TODO: should be lower on clients-only implementation */
         quic->padding_multiple_default = 0; /* TODO: consider default = 128 */
+        quic->packet_buffer_size = PICOQUIC_MAX_PACKET_SIZE;
         quic->padding_minsize_default = PICOQUIC_RESET_PACKET_MIN_SIZE;
         quic->crypto_epoch_length_max = 0;
         quic->max_simultaneous_logs = PICOQUIC_DEFAULT_SIMULTANEOUS_LOGS;
@@ -671,15 +721,12 @@ picoquic_quic_t* picoquic_create(uint32_t max_nb_connections,
             quic->table_cnx_by_secret = picohash_create((size_t)max_nb_connections * 4,
                 picoquic_net_secret_hash, picoquic_net_secret_compare);
 
-            quic->table_issued_tickets = picohash_create((size_t)max_nb_connections,
-                picoquic_issued_ticket_hash, picoquic_issued_ticket_compare);
-
             picosplay_init_tree(&quic->token_reuse_tree, picoquic_registered_token_compare,
                 picoquic_registered_token_create, picoquic_registered_token_delete, picoquic_registered_token_value);
 
             if (quic->table_cnx_by_id == NULL || quic->table_cnx_by_net == NULL ||
                 quic->table_cnx_by_icid == NULL || quic->table_cnx_by_secret == NULL ||
-                quic->table_issued_tickets == NULL) {
+                picoquic_set_ticket_table(quic, picoquic_ticket_table_memory_size((size_t)max_nb_connections)) != 0) {
                 ret = -1;
                 DBG_PRINTF("%s", "Cannot initialize hash tables\n");
             }
@@ -883,6 +930,7 @@ void picoquic_free(picoquic_quic_t* quic)
 
         /* Deelete the reused tokens tree */
         picosplay_empty_tree(&quic->token_reuse_tree);
+        picoquic_token_filter_free(quic);
 
         /* delete packets in pool */
         while (quic->p_first_packet != NULL) {
@@ -921,9 +969,11 @@ void picoquic_free(picoquic_quic_t* quic)
             picohash_delete(quic->table_cnx_by_icid, 1);
         }
 
-        if (quic->table_issued_tickets != NULL) {
-            picohash_delete(quic->table_issued_tickets, 1);
-        }
+        picoquic_ticket_table_free(quic);
+
+        picoquic_mtu_cache_free(quic);
+
+        picoquic_path_bdp_free(quic);
 
         if (quic->table_cnx_by_secret != NULL) {
             picohash_delete(quic->table_cnx_by_secret, 1);
@@ -949,6 +999,11 @@ void picoquic_free(picoquic_quic_t* quic)
         /* Close the logs */
         picoquic_log_close_logs(quic);
 
+        /* Complete the pending qlog conversions */
+        if (quic->autoqlog_free_fn != NULL) {
+            quic->autoqlog_free_fn(quic);
+        }
+
         quic->binlog_dir = picoquic_string_free(quic->binlog_dir);
         quic->qlog_dir = picoquic_string_free(quic->qlog_dir);
 
@@ -956,6 +1011,8 @@ void picoquic_free(picoquic_quic_t* quic)
             (void)(quic->perflog_fn)(quic, NULL, 1);
         }
 
+        picoquic_cc_experiment_free(quic);
+
         free(quic);
     }
 }
@@ -966,6 +1023,16 @@ int picoquic_set_low_memory_mode(picoquic_quic_t* quic, int low_memory_mode)
     return picoquic_set_cipher_suite(quic, 0);
 }
 
+void picoquic_set_null_aead(picoquic_quic_t* quic, int use_null_aead)
+{
+    quic->use_null_aead = (use_null_aead == 0) ? 0 : 1;
+}
+
+void picoquic_set_handshake_packing(picoquic_quic_t* quic, int enable)
+{
+    quic->is_handshake_packing_enabled = (enable == 0) ? 0 : 1;
+}
+
 void picoquic_set_null_verifier(picoquic_quic_t* quic) {
     picoquic_dispose_verify_certificate_callback(quic);
 }
@@ -1000,10 +1067,13 @@ uint32_t picoquic_get_max_half_open_retry_threshold(picoquic_quic_t* quic)
 
 picoquic_stateless_packet_t* picoquic_create_stateless_packet(picoquic_quic_t* quic)
 {
-#ifdef _WINDOWS
-    UNREFERENCED_PARAMETER(quic);
-#endif
-    return (picoquic_stateless_packet_t*)malloc(sizeof(picoquic_stateless_packet_t));
+    picoquic_stateless_packet_t* sp = (picoquic_stateless_packet_t*)malloc(
+        PICOQUIC_PACKET_ALLOC_SIZE(sizeof(picoquic_stateless_packet_t), quic->packet_buffer_size));
+
+    if (sp != NULL) {
+        sp->bytes_size = quic->packet_buffer_size;
+    }
+    return sp;
 }
 
 void picoquic_delete_stateless_packet(picoquic_stateless_packet_t* sp)
@@ -1332,9 +1402,42 @@ static void picoquic_wake_list_init(picoquic_quic_t * quic)
         picoquic_wake_list_create_node, picoquic_wake_list_delete_node, picoquic_wake_list_node_value);
 }
 
+static void picoquic_wake_batch_unlink(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
+{
+    picoquic_cnx_t** p_next = &quic->wake_batch_first;
+    picoquic_cnx_t* previous = NULL;
+
+    while (*p_next != NULL && *p_next != cnx) {
+        previous = *p_next;
+        p_next = &previous->next_in_wake_batch;
+    }
+    if (*p_next == cnx) {
+        *p_next = cnx->next_in_wake_batch;
+        if (quic->wake_batch_last == cnx) {
+            quic->wake_batch_last = previous;
+        }
+    }
+    else {
+        p_next = &quic->wake_batch_done;
+        while (*p_next != NULL && *p_next != cnx) {
+            p_next = &(*p_next)->next_in_wake_batch;
+        }
+        if (*p_next == cnx) {
+            *p_next = cnx->next_in_wake_batch;
+        }
+    }
+    cnx->next_in_wake_batch = NULL;
+    cnx->is_in_wake_batch = 0;
+}
+
 static void picoquic_remove_cnx_from_wake_list(picoquic_cnx_t* cnx)
 {
-    picosplay_delete_hint(&cnx->quic->cnx_wake_tree, &cnx->cnx_wake_node);
+    if (cnx->is_in_wake_batch) {
+        picoquic_wake_batch_unlink(cnx->quic, cnx);
+    }
+    else {
+        picosplay_delete_hint(&cnx->quic->cnx_wake_tree, &cnx->cnx_wake_node);
+    }
 }
 
 static void picoquic_insert_cnx_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
@@ -1344,9 +1447,110 @@ static void picoquic_insert_cnx_by_wake_time(picoquic_quic_t* quic, picoquic_cnx
 
 void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t next_time)
 {
-    picoquic_remove_cnx_from_wake_list(cnx);
-    cnx->next_wake_time = next_time;
-    picoquic_insert_cnx_by_wake_time(quic, cnx);
+    if (cnx->is_in_wake_batch) {
+        /* The connection will be reinserted at the end of the batch */
+        cnx->next_wake_time = next_time;
+    }
+    else {
+        picoquic_remove_cnx_from_wake_list(cnx);
+        cnx->next_wake_time = next_time;
+        picoquic_insert_cnx_by_wake_time(quic, cnx);
+    }
+}
+
+/* Batched wakeups.
+ * The first call takes all the connections due before max_wake_time out of
+ * the wake tree. Each following call returns the next connection in round
+ * robin order. After it is served, a connection that sent data and is still
+ * due goes back to the end of the batch, the others wait in the done list.
+ * When no connection is left or the budget is spent, all the connections are
+ * reinserted in the wake tree and the call returns NULL.
+ */
+static void picoquic_wake_batch_end(picoquic_quic_t* quic)
+{
+    picoquic_cnx_t* lists[2];
+
+    lists[0] = quic->wake_batch_first;
+    lists[1] = quic->wake_batch_done;
+    quic->wake_batch_first = NULL;
+    quic->wake_batch_last = NULL;
+    quic->wake_batch_done = NULL;
+
+    for (int i = 0; i < 2; i++) {
+        picoquic_cnx_t* cnx = lists[i];
+        while (cnx != NULL) {
+            picoquic_cnx_t* next = cnx->next_in_wake_batch;
+            cnx->next_in_wake_batch = NULL;
+            cnx->is_in_wake_batch = 0;
+            picoquic_insert_cnx_by_wake_time(quic, cnx);
+            cnx = next;
+        }
+    }
+}
+
+picoquic_cnx_t* picoquic_wake_batch_next(picoquic_quic_t* quic, uint64_t max_wake_time)
+{
+    picoquic_cnx_t* cnx = NULL;
+
+    if (quic->wake_batch_first == NULL && quic->wake_batch_done == NULL) {
+        quic->wake_batch_bytes = 0;
+        quic->wake_batch_packets = 0;
+        while ((cnx = (picoquic_cnx_t*)picoquic_wake_list_node_value(picosplay_first(&quic->cnx_wake_tree))) != NULL &&
+            cnx->next_wake_time <= max_wake_time) {
+            picosplay_delete_hint(&quic->cnx_wake_tree, &cnx->cnx_wake_node);
+            cnx->is_in_wake_batch = 1;
+            cnx->next_in_wake_batch = NULL;
+            if (quic->wake_batch_last == NULL) {
+                quic->wake_batch_first = cnx;
+            }
+            else {
+                quic->wake_batch_last->next_in_wake_batch = cnx;
+            }
+            quic->wake_batch_last = cnx;
+        }
+    }
+
+    if (quic->wake_batch_first == NULL ||
+        quic->wake_batch_bytes >= quic->wake_batch_max_bytes ||
+        quic->wake_batch_packets >= quic->wake_batch_max_packets) {
+        picoquic_wake_batch_end(quic);
+        cnx = NULL;
+    }
+    else {
+        cnx = quic->wake_batch_first;
+        quic->wake_batch_first = cnx->next_in_wake_batch;
+        if (quic->wake_batch_first == NULL) {
+            quic->wake_batch_last = NULL;
+        }
+        cnx->next_in_wake_batch = NULL;
+    }
+
+    return cnx;
+}
+
+void picoquic_wake_batch_done(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t max_wake_time,
+    size_t send_length, size_t send_msg_size)
+{
+    if (send_length > 0) {
+        quic->wake_batch_bytes += send_length;
+        quic->wake_batch_packets += (send_msg_size > 0) ? (send_length + send_msg_size - 1) / send_msg_size : 1;
+    }
+
+    if (cnx->is_in_wake_batch) {
+        if (send_length > 0 && cnx->next_wake_time <= max_wake_time) {
+            if (quic->wake_batch_last == NULL) {
+                quic->wake_batch_first = cnx;
+            }
+            else {
+                quic->wake_batch_last->next_in_wake_batch = cnx;
+            }
+            quic->wake_batch_last = cnx;
+        }
+        else {
+            cnx->next_in_wake_batch = quic->wake_batch_done;
+            quic->wake_batch_done = cnx;
+        }
+    }
 }
 
 picoquic_cnx_t* picoquic_get_earliest_cnx_to_wake(picoquic_quic_t* quic, uint64_t max_wake_time)
@@ -1364,7 +1568,9 @@ uint64_t picoquic_get_next_wake_time(picoquic_quic_t* quic, uint64_t current_tim
 {
     uint64_t wake_time = UINT64_MAX;
 
-    if (quic->pending_stateless_packet != NULL) {
+    if (quic->pending_stateless_packet != NULL ||
+        quic->wake_batch_first != NULL || quic->wake_batch_done != NULL) {
+        /* Stateless packets are waiting, or a wake batch is in progress */
         wake_time = current_time;
     }
     else{
@@ -2686,7 +2892,8 @@ void* picoquic_stream_data_node_value(picosplay_node_t* node)
 
 void picoquic_stream_data_node_recycle(picoquic_stream_data_node_t* stream_data)
 {
-    if (stream_data->quic->nb_data_nodes_in_pool < PICOQUIC_MAX_PACKETS_IN_POOL) {
+    if (stream_data->quic->nb_data_nodes_in_pool < PICOQUIC_MAX_PACKETS_IN_POOL &&
+        stream_data->data_size == stream_data->quic->packet_buffer_size) {
         stream_data->next_stream_data = stream_data->quic->p_first_data_node;
         stream_data->quic->p_first_data_node = stream_data;
         stream_data->quic->nb_data_nodes_in_pool++;
@@ -2709,15 +2916,16 @@ picoquic_stream_data_node_t* picoquic_stream_data_node_alloc(picoquic_quic_t* qu
     picoquic_stream_data_node_t* stream_data = quic->p_first_data_node;
     
     if (stream_data == NULL) {
-        stream_data = (picoquic_stream_data_node_t*)
-            malloc(sizeof(picoquic_stream_data_node_t));
+        size_t alloc_size = PICOQUIC_PACKET_ALLOC_SIZE(sizeof(picoquic_stream_data_node_t), quic->packet_buffer_size);
+        stream_data = (picoquic_stream_data_node_t*)malloc(alloc_size);
 
         if (stream_data != NULL) {
             /* It might be sufficient to zero the metadata, but zeroing everything
              * appears safer, and does not confuse checkers like valgrind.
              */
-            memset(stream_data, 0, sizeof(picoquic_stream_data_node_t));
+            memset(stream_data, 0, alloc_size);
             stream_data->quic = quic;
+            stream_data->data_size = quic->packet_buffer_size;
             quic->nb_data_nodes_allocated++;
         }
     }
@@ -3368,6 +3576,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
             cnx->path[0]->challenge_verified = 1;
 
             cnx->high_priority_stream_id = UINT64_MAX;
+            cnx->early_data_budget = UINT64_MAX;
             for (int i = 0; i < 4; i++) {
                 cnx->next_stream_id[i] = i;
             }
@@ -3462,6 +3671,7 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         cnx->congestion_alg = quic->default_congestion_alg;
         cnx->is_preemptive_repeat_enabled = quic->is_preemptive_repeat_enabled;
         cnx->is_flow_control_limited = quic->is_flow_control_limited;
+        cnx->is_hystart_pp_enabled = quic->is_hystart_pp_enabled;
 
         /* Initialize key rotation interval to default value */
         cnx->crypto_epoch_length_max = quic->crypto_epoch_length_max;
@@ -3572,9 +3782,14 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         picosplay_init_tree(&cnx->stream_tree, picoquic_stream_node_compare, picoquic_stream_node_create, picoquic_stream_node_delete, picoquic_stream_node_value);
 
         cnx->congestion_alg = cnx->quic->default_congestion_alg;
+        picoquic_cc_experiment_assign(cnx);
         if (cnx->congestion_alg != NULL) {
             cnx->congestion_alg->alg_init(cnx->path[0], start_time);
         }
+        if (quic->cc_telemetry_ring_size > 0) {
+            /* Telemetry is best effort, the connection proceeds even if the ring cannot be allocated */
+            (void)picoquic_set_cc_telemetry(cnx, quic->cc_telemetry_ring_size, quic->cc_telemetry_interval);
+        }
     }
 
     /* Only initialize TLS after all parameters have been set */
@@ -3878,6 +4093,31 @@ void picoquic_set_packet_train_mode(picoquic_quic_t* quic, int train_mode)
     quic->packet_train_mode = (train_mode > 0) ? 1 : 0;
 }
 
+void picoquic_set_wake_coalescing_slack(picoquic_quic_t* quic, uint64_t slack_microsec)
+{
+    quic->wake_coalescing_slack = slack_microsec;
+}
+
+void picoquic_set_busy_poll_threshold(picoquic_quic_t* quic, uint64_t threshold_microsec)
+{
+    quic->busy_poll_threshold = threshold_microsec;
+}
+
+uint64_t picoquic_get_busy_poll_threshold(picoquic_quic_t* quic)
+{
+    return quic->busy_poll_threshold;
+}
+
+void picoquic_set_wake_batch_budget(picoquic_quic_t* quic, size_t max_bytes, size_t max_packets)
+{
+    quic->is_wake_batch_enabled = (max_bytes > 0 || max_packets > 0);
+    quic->wake_batch_max_bytes = (max_bytes > 0) ? max_bytes : SIZE_MAX;
+    quic->wake_batch_max_packets = (max_packets > 0) ? max_packets : SIZE_MAX;
+    if (!quic->is_wake_batch_enabled) {
+        picoquic_wake_batch_end(quic);
+    }
+}
+
 void picoquic_set_padding_policy(picoquic_quic_t* quic, uint32_t padding_min_size, uint32_t padding_multiple)
 {
     quic->padding_minsize_default = padding_min_size;
@@ -3915,7 +4155,40 @@ uint64_t picoquic_get_default_connection_id_ttl(picoquic_quic_t* quic)
 
 void picoquic_set_mtu_max(picoquic_quic_t* quic, uint32_t mtu_max)
 {
+    size_t packet_buffer_size = PICOQUIC_MAX_PACKET_SIZE;
+
+    if (mtu_max > PICOQUIC_MAX_JUMBO_PACKET_SIZE) {
+        mtu_max = PICOQUIC_MAX_JUMBO_PACKET_SIZE;
+    }
     quic->mtu_max = mtu_max;
+
+    if (mtu_max > packet_buffer_size) {
+        packet_buffer_size = mtu_max;
+    }
+    if (packet_buffer_size > quic->packet_buffer_size) {
+        /* The pooled packets and data nodes are too small, release them.
+         * Buffers that are in use will be released when recycled. */
+        quic->packet_buffer_size = packet_buffer_size;
+        while (quic->p_first_packet != NULL) {
+            picoquic_packet_t* p = quic->p_first_packet->next_packet;
+            free(quic->p_first_packet);
+            quic->p_first_packet = p;
+            quic->nb_packets_in_pool--;
+            quic->nb_packets_allocated--;
+        }
+        while (quic->p_first_data_node != NULL) {
+            picoquic_stream_data_node_t* p = quic->p_first_data_node->next_stream_data;
+            free(quic->p_first_data_node);
+            quic->p_first_data_node = p;
+            quic->nb_data_nodes_in_pool--;
+            quic->nb_data_nodes_allocated--;
+        }
+    }
+}
+
+size_t picoquic_get_max_packet_size(picoquic_quic_t* quic)
+{
+    return quic->packet_buffer_size;
 }
 
 void picoquic_set_alpn_select_fn(picoquic_quic_t* quic, picoquic_alpn_select_fn alpn_select_fn)
@@ -4180,6 +4453,19 @@ void picoquic_connection_disconnect(picoquic_cnx_t* cnx)
     }
 }
 
+static int picoquic_rotate_encryption_key(picoquic_cnx_t* cnx)
+{
+    int ret = picoquic_compute_new_rotated_keys(cnx);
+
+    if (ret == 0) {
+        picoquic_apply_rotated_keys(cnx, 1);
+        picoquic_crypto_context_free(&cnx->crypto_context_old);
+        cnx->crypto_epoch_sequence = cnx->pkt_ctx[picoquic_packet_context_application].send_sequence;
+    }
+
+    return ret;
+}
+
 int picoquic_start_key_rotation(picoquic_cnx_t* cnx)
 {
     int ret = 0;
@@ -4191,16 +4477,49 @@ int picoquic_start_key_rotation(picoquic_cnx_t* cnx)
         ret = PICOQUIC_ERROR_KEY_ROTATION_NOT_READY;
     }
     else {
-        ret = picoquic_compute_new_rotated_keys(cnx);
+        ret = picoquic_rotate_encryption_key(cnx);
     }
 
-    if (ret == 0) {
-        picoquic_apply_rotated_keys(cnx, 1);
-        picoquic_crypto_context_free(&cnx->crypto_context_old);
-        cnx->crypto_epoch_sequence = cnx->pkt_ctx[picoquic_packet_context_application].send_sequence;
+    return ret;
+}
+
+/* Enforce the AEAD confidentiality limit (RFC 9001, section 6.6).
+ * The number of packets protected with the current key is compared to the
+ * limit of the negotiated AEAD, which differs by orders of magnitude between
+ * AES-GCM and ChaCha20. A rotation is started when 3/4 of the limit is used,
+ * as soon as the previous rotation is complete and one of the packets sent
+ * with the current key was acknowledged. If the rotation still did not happen
+ * when 15/16 of the limit is used, the connection is closed with the error
+ * AEAD_LIMIT_REACHED, keeping some margin for the closing packets.
+ */
+void picoquic_check_aead_limits(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    uint64_t limit = cnx->crypto_key_confidentiality_limit;
+
+    if (limit == 0 || cnx->crypto_key_packets_enc < limit - (limit >> 2)) {
+        return;
     }
 
-    return ret;
+    if (cnx->key_phase_enc == cnx->key_phase_dec && current_time > cnx->crypto_rotation_time_guard) {
+        int is_ready;
+        if (cnx->is_multipath_enabled) {
+            is_ready = cnx->crypto_epoch_sequence <=
+                picoquic_sack_list_last(&cnx->ack_ctx[picoquic_packet_context_application].sack_list);
+        }
+        else {
+            picoquic_packet_context_t* pkt_ctx = &cnx->pkt_ctx[picoquic_packet_context_application];
+            is_ready = pkt_ctx->highest_acknowledged != UINT64_MAX &&
+                pkt_ctx->highest_acknowledged >= cnx->crypto_epoch_sequence;
+        }
+        if (is_ready && picoquic_rotate_encryption_key(cnx) == 0) {
+            return;
+        }
+    }
+
+    if (cnx->crypto_key_packets_enc >= limit - (limit >> 4) && cnx->cnx_state < picoquic_state_disconnecting) {
+        picoquic_log_app_message(cnx, "AEAD confidentiality limit reached after 0x%" PRIx64 " packets.", cnx->crypto_key_packets_enc);
+        (void)picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_AEAD_LIMIT_REACHED, 0);
+    }
 }
 
 void picoquic_delete_sooner_packets(picoquic_cnx_t* cnx)
@@ -4222,6 +4541,14 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
             (void)(cnx->quic->perflog_fn)(cnx->quic, cnx, 0);
         }
 
+        picoquic_cc_experiment_aggregate(cnx);
+        picoquic_cc_telemetry_free(cnx);
+
+        if (cnx->client_mode && cnx->nb_paths > 0 && cnx->path[0]->is_ticket_seeded) {
+            /* Refresh the path estimates with what the connection learned after slow start */
+            picoquic_update_path_bdp(cnx, cnx->path[0], picoquic_get_quic_time(cnx->quic));
+        }
+
         picoquic_log_close_connection(cnx);
 
         if (cnx->is_half_open && cnx->quic->current_number_half_open > 0) {
@@ -4507,6 +4834,16 @@ void picoquic_set_congestion_algorithm(picoquic_cnx_t* cnx, picoquic_congestion_
     }
 }
 
+void picoquic_set_default_hystart_pp(picoquic_quic_t* quic, int enable)
+{
+    quic->is_hystart_pp_enabled = (enable) ? 1 : 0;
+}
+
+void picoquic_set_hystart_pp(picoquic_cnx_t* cnx, int enable)
+{
+    cnx->is_hystart_pp_enabled = (enable) ? 1 : 0;
+}
+
 void picoquic_subscribe_pacing_rate_updates(picoquic_cnx_t* cnx, uint64_t decrease_threshold, uint64_t increase_threshold)
 {
     cnx->pacing_decrease_threshold = decrease_threshold;
@@ -177,6 +177,43 @@ int picoquic_set_stream_priority(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_
     return ret;
 }
 
+int picoquic_set_stream_early_data(picoquic_cnx_t* cnx, uint64_t stream_id, int is_early_data)
+{
+    int ret = 0;
+    picoquic_stream_head_t* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+
+    if (ret == 0) {
+        stream->is_early_data = (is_early_data) ? 1 : 0;
+        if (is_early_data) {
+            cnx->is_early_data_selective = 1;
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_set_early_data_budget(picoquic_cnx_t* cnx, uint64_t budget)
+{
+    cnx->early_data_budget = budget;
+}
+
+static uint64_t picoquic_get_early_data_budget(picoquic_cnx_t* cnx)
+{
+    return (cnx->early_data_budget < (uint64_t)cnx->max_early_data_size) ?
+        cnx->early_data_budget : (uint64_t)cnx->max_early_data_size;
+}
+
+void picoquic_get_early_data_stats(picoquic_cnx_t* cnx, picoquic_early_data_stats_t* stats)
+{
+    stats->budget = picoquic_get_early_data_budget(cnx);
+    stats->data_sent = cnx->early_data_sent;
+    stats->data_replayed = cnx->early_data_replayed;
+    stats->nb_packets_sent = cnx->nb_zero_rtt_sent;
+    stats->nb_packets_acked = cnx->nb_zero_rtt_acked;
+    stats->nb_packets_rejected = cnx->nb_zero_rtt_rejected;
+    stats->is_accepted = cnx->zero_rtt_data_accepted;
+}
+
 int picoquic_mark_high_priority_stream(picoquic_cnx_t * cnx, uint64_t stream_id, int is_high_priority)
 {
     int ret;
@@ -443,6 +480,39 @@ size_t picoquic_pad_to_policy(picoquic_cnx_t * cnx, uint8_t * bytes, size_t leng
     return picoquic_pad_to_target_length(bytes, length, target);
 }
 
+/* Padding of datagrams that carry Initial packets. These datagrams must be at
+ * least PICOQUIC_ENFORCED_INITIAL_MTU bytes long, and by default are padded to
+ * the full path MTU. With handshake packing, the padding stops at the minimum.
+ * The packet may be coalesced after other segments of the same datagram, whose
+ * total length is passed in coalesced_length by the segment loop.
+ */
+static size_t picoquic_pad_initial_datagram_to(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length, size_t target)
+{
+    if (length < target) {
+        cnx->nb_handshake_padding_bytes += target - length;
+        length = picoquic_pad_to_target_length(bytes, length, target);
+    }
+
+    return length;
+}
+
+static size_t picoquic_pad_initial_datagram(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    size_t send_buffer_max, size_t checksum_overhead, size_t coalesced_length)
+{
+    size_t target = send_buffer_max - checksum_overhead;
+
+    if (cnx->quic->is_handshake_packing_enabled) {
+        size_t min_target = (coalesced_length + checksum_overhead < PICOQUIC_ENFORCED_INITIAL_MTU) ?
+            PICOQUIC_ENFORCED_INITIAL_MTU - coalesced_length - checksum_overhead : 0;
+
+        if (min_target < target) {
+            target = min_target;
+        }
+    }
+
+    return picoquic_pad_initial_datagram_to(cnx, bytes, length, target);
+}
+
 
 /*
  * Packet management
@@ -451,9 +521,10 @@ size_t picoquic_pad_to_policy(picoquic_cnx_t * cnx, uint8_t * bytes, size_t leng
 picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
 {
     picoquic_packet_t* packet = quic->p_first_packet;
+    size_t alloc_size = PICOQUIC_PACKET_ALLOC_SIZE(sizeof(picoquic_packet_t), quic->packet_buffer_size);
     
     if (packet == NULL) {
-        packet = (picoquic_packet_t*)malloc(sizeof(picoquic_packet_t));
+        packet = (picoquic_packet_t*)malloc(alloc_size);
         if (packet != NULL) {
             quic->nb_packets_allocated++;
         }
@@ -467,7 +538,8 @@ picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
         /* It might be sufficient to zero the metadata, but zeroing everything
          * appears safer, and does not confuse checkers like valgrind.
          */
-        memset(packet, 0, sizeof(picoquic_packet_t));
+        memset(packet, 0, alloc_size);
+        packet->bytes_size = quic->packet_buffer_size;
     }
 
     return packet;
@@ -476,12 +548,14 @@ picoquic_packet_t* picoquic_create_packet(picoquic_quic_t * quic)
 void picoquic_recycle_packet(picoquic_quic_t * quic, picoquic_packet_t* packet)
 {
     if (packet != NULL) {
-        if (quic->nb_packets_in_pool >= PICOQUIC_MAX_PACKETS_IN_POOL) {
+        if (quic->nb_packets_in_pool >= PICOQUIC_MAX_PACKETS_IN_POOL ||
+            packet->bytes_size != quic->packet_buffer_size) {
             free(packet);
             quic->nb_packets_allocated--;
         }
         else {
             memset(packet, 0, offsetof(struct st_picoquic_packet_t, bytes));
+            packet->bytes_size = quic->packet_buffer_size;
             packet->next_packet = quic->p_first_packet;
             quic->p_first_packet = packet;
             quic->nb_packets_in_pool++;
@@ -817,6 +891,7 @@ static size_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     }
 
     /* Encrypt the packet */
+    PICOQUIC_STAGE_BEGIN(cnx->quic, picoquic_stage_encrypt, encrypt_start);
     if (cnx->is_multipath_enabled && ptype == picoquic_packet_1rtt_protected) {
         send_length = picoquic_aead_encrypt_mp(send_buffer + /* header_length */ h_length,
             bytes + header_length, length - header_length, path_x->p_remote_cnxid->sequence,
@@ -830,6 +905,7 @@ static size_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     }
 
     send_length += /* header_length */ h_length;
+    PICOQUIC_STAGE_END(cnx->quic, picoquic_stage_encrypt, encrypt_start);
 
     /* if needed, log the segment before header protection is applied */
     picoquic_log_outgoing_packet(cnx, path_x,
@@ -863,8 +939,10 @@ static size_t picoquic_protect_packet(picoquic_cnx_t* cnx,
  */
 static void picoquic_update_pacing_bucket(picoquic_path_t * path_x, uint64_t current_time)
 {
-    if (path_x->pacing_bucket_nanosec < -path_x->pacing_packet_time_nanosec) {
-        path_x->pacing_bucket_nanosec = -path_x->pacing_packet_time_nanosec;
+    /* The bucket may be in debt by up to one packet time, plus the coalescing
+     * slack if packets were sent ahead of time. */
+    if (path_x->pacing_bucket_nanosec < -(path_x->pacing_packet_time_nanosec + path_x->pacing_slack_nanosec)) {
+        path_x->pacing_bucket_nanosec = -(path_x->pacing_packet_time_nanosec + path_x->pacing_slack_nanosec);
     }
 
     if (current_time > path_x->pacing_evaluation_time) {
@@ -882,14 +960,22 @@ static void picoquic_update_pacing_bucket(picoquic_path_t * path_x, uint64_t cur
  * 
  * In packet train mode, the wait will last until the bucket is completely full, or
  * if at least N packets are received.
+ *
+ * If timer coalescing is enabled, the transmission is authorized up to the
+ * coalescing slack ahead of time. If timer coalescing or busy polling is
+ * enabled, the next wait time is the first microsecond at which the bucket
+ * will hold enough credit, rounded up rather than padded, so that high data
+ * rates are not slowed by a systematic overshoot.
  */
 int picoquic_is_sending_authorized_by_pacing(picoquic_cnx_t * cnx, picoquic_path_t * path_x, uint64_t current_time, uint64_t * next_time)
 {
     int ret = 1;
+    int64_t slack_nanosec = (int64_t)cnx->quic->wake_coalescing_slack * 1000;
 
+    path_x->pacing_slack_nanosec = slack_nanosec;
     picoquic_update_pacing_bucket(path_x, current_time);
 
-    if (path_x->pacing_bucket_nanosec < path_x->pacing_packet_time_nanosec) {
+    if (path_x->pacing_bucket_nanosec + slack_nanosec < path_x->pacing_packet_time_nanosec) {
         uint64_t next_pacing_time;
         int64_t bucket_required;
         
@@ -906,7 +992,12 @@ int picoquic_is_sending_authorized_by_pacing(picoquic_cnx_t * cnx, picoquic_path
             bucket_required = path_x->pacing_packet_time_nanosec - path_x->pacing_bucket_nanosec;
         }
 
-        next_pacing_time = current_time + 1 + bucket_required / 1000;
+        if (cnx->quic->wake_coalescing_slack > 0 || cnx->quic->busy_poll_threshold > 0) {
+            next_pacing_time = current_time + (bucket_required + 999) / 1000;
+        }
+        else {
+            next_pacing_time = current_time + 1 + bucket_required / 1000;
+        }
         if (next_pacing_time < *next_time) {
             path_x->pacing_bandwidth_pause = 0;
             *next_time = next_pacing_time;
@@ -1271,6 +1362,7 @@ void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx,
             break;
         case picoquic_packet_1rtt_protected:
             /* TODO: if multipath, use 96 bit nonce */
+            cnx->crypto_key_packets_enc++;
             length = picoquic_protect_packet(cnx, packet->ptype, packet->bytes, packet->sequence_number,
                 length, header_length,
                 send_buffer, send_buffer_max, cnx->crypto_context[picoquic_epoch_1rtt].aead_encrypt, cnx->crypto_context[picoquic_epoch_1rtt].pn_enc,
@@ -1717,23 +1809,41 @@ static int picoquic_retransmit_needed_packet(picoquic_cnx_t* cnx, picoquic_packe
             }
             else {
                 int exit_early = 0;
-                if (old_path != NULL) {
+                /* Rejected 0-RTT packets are replayed as 1-RTT, they were not lost.
+                 * Before the server handshake is processed, the rejection is not known
+                 * and 0-RTT packets are retransmitted because they were lost. */
+                int is_zero_rtt_replay = (old_p->ptype == picoquic_packet_0rtt_protected &&
+                    cnx->cnx_state >= picoquic_state_client_almost_ready && !cnx->zero_rtt_data_accepted);
+
+                if (is_zero_rtt_replay) {
+                    cnx->nb_zero_rtt_rejected++;
+                    cnx->early_data_replayed += old_p->length;
+                }
+                else if (old_path != NULL) {
                     old_path->lost++;
                 }
-                if (old_path != NULL &&
+                if (!is_zero_rtt_replay && old_path != NULL &&
                     (old_p->length + old_p->checksum_overhead) == old_path->send_mtu &&
                     cnx->cnx_state >= picoquic_state_ready) {
                     old_path->nb_mtu_losses++;
                     if (old_path->nb_mtu_losses > PICOQUIC_MTU_LOSS_THRESHOLD) {
-                        picoquic_reset_path_mtu(old_path);
+                        /* Black hole: restart the search below the failing size,
+                         * and forget the cached value for this peer. */
+                        size_t failed_mtu = old_path->send_mtu;
                         picoquic_log_app_message(cnx,
                             "Reset path MTU after %d retransmissions, %d MTU losses",
                             old_path->nb_retransmit,
                             old_path->nb_mtu_losses);
+                        picoquic_reset_path_mtu(old_path);
+                        if (failed_mtu > old_path->send_mtu) {
+                            old_path->send_mtu_max_tried = failed_mtu;
+                        }
+                        old_path->nb_mtu_losses = 0;
+                        picoquic_remove_cached_mtu(cnx->quic, (struct sockaddr*)&old_path->peer_addr);
                     }
                 }
 
-                if (timer_based_retransmit != 0) {
+                if (timer_based_retransmit != 0 && !is_zero_rtt_replay) {
                     /* First, keep track of retransmissions per path, in order to
                      * manage scheduling in multipath setup */
                     if (old_path != NULL &&
@@ -1791,9 +1901,11 @@ static int picoquic_retransmit_needed_packet(picoquic_cnx_t* cnx, picoquic_packe
                         length = picoquic_pad_to_target_length(new_bytes, length, send_buffer_max - checksum_length);
                     }
                     packet->length = length;
-                    cnx->nb_retransmission_total++;
+                    if (!is_zero_rtt_replay) {
+                        cnx->nb_retransmission_total++;
+                    }
 
-                    if (old_path != NULL) {
+                    if (!is_zero_rtt_replay && old_path != NULL) {
                         old_path->nb_losses_found++;
                         old_path->total_bytes_lost += old_p->length;
                         if (timer_based_retransmit) {
@@ -1805,6 +1917,9 @@ static int picoquic_retransmit_needed_packet(picoquic_cnx_t* cnx, picoquic_packe
                                 (timer_based_retransmit == 0) ? picoquic_congestion_notification_repeat : picoquic_congestion_notification_timeout,
                                 0, 0, 0, lost_packet_number, current_time);
                         }
+                        picoquic_cc_telemetry_record(cnx, old_path,
+                            (timer_based_retransmit == 0) ? picoquic_congestion_notification_repeat : picoquic_congestion_notification_timeout,
+                            current_time);
                     }
 
                     if (length <= packet->offset) {
@@ -2231,8 +2346,8 @@ static size_t picoquic_next_mtu_probe_length(picoquic_cnx_t* cnx, picoquic_path_
                 cnx->quic->mtu_max - PICOQUIC_MTU_OVERHEAD((struct sockaddr*)&path_x->peer_addr)) {
                 probe_length = cnx->quic->mtu_max - PICOQUIC_MTU_OVERHEAD((struct sockaddr*)&path_x->peer_addr);
             }
-            else if (probe_length > PICOQUIC_MAX_PACKET_SIZE) {
-                probe_length = PICOQUIC_MAX_PACKET_SIZE;
+            else if (probe_length > cnx->quic->packet_buffer_size) {
+                probe_length = cnx->quic->packet_buffer_size;
             }
             if (probe_length < path_x->send_mtu) {
                 probe_length = path_x->send_mtu;
@@ -2246,10 +2361,12 @@ static size_t picoquic_next_mtu_probe_length(picoquic_cnx_t* cnx, picoquic_path_
         }
     }
     else {
-        if (path_x->send_mtu_max_tried > 1500) {
+        /* Binary search between the validated MTU and the smallest probe that
+         * failed, trying first the common 1500 and 1400 bytes plateaus. */
+        if (path_x->send_mtu_max_tried > 1500 && path_x->send_mtu < 1500) {
             probe_length = 1500;
         }
-        else if (path_x->send_mtu_max_tried > 1400) {
+        else if (path_x->send_mtu_max_tried > 1400 && path_x->send_mtu < 1400) {
             probe_length = 1400;
         }
         else {
@@ -2260,6 +2377,32 @@ static size_t picoquic_next_mtu_probe_length(picoquic_cnx_t* cnx, picoquic_path_
     return probe_length;
 }
 
+/* If the MTU cache is enabled, start the path at the MTU previously validated
+ * for the same peer, if the peer and the local settings allow it. The search
+ * for a larger value continues from there, and black hole detection will
+ * reset the path MTU if the cached value is not valid anymore.
+ */
+static void picoquic_apply_cached_mtu(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time)
+{
+    size_t cached_mtu;
+
+    path_x->is_mtu_cache_checked = 1;
+    cached_mtu = picoquic_get_cached_mtu(cnx->quic, (struct sockaddr*)&path_x->peer_addr, current_time);
+    if (cached_mtu == 0 && cnx->client_mode) {
+        /* No estimate for this peer, try the estimate for the network path */
+        cached_mtu = picoquic_get_path_bdp_mtu(cnx->quic, path_x, current_time);
+    }
+
+    if (cached_mtu > path_x->send_mtu &&
+        (cnx->remote_parameters.max_packet_size == 0 || cached_mtu <= cnx->remote_parameters.max_packet_size) &&
+        (cnx->quic->mtu_max == 0 || (int)cached_mtu <=
+            (int)cnx->quic->mtu_max - PICOQUIC_MTU_OVERHEAD((struct sockaddr*)&path_x->peer_addr)) &&
+        cached_mtu <= cnx->quic->packet_buffer_size) {
+        path_x->send_mtu = cached_mtu;
+        picoquic_log_app_message(cnx, "Path MTU set to cached value %zu", cached_mtu);
+    }
+}
+
 /* Decide whether to send an MTU probe */
 picoquic_pmtu_discovery_status_enum picoquic_is_mtu_probe_needed(picoquic_cnx_t* cnx, picoquic_path_t * path_x)
 {
@@ -2267,7 +2410,12 @@ picoquic_pmtu_discovery_status_enum picoquic_is_mtu_probe_needed(picoquic_cnx_t*
 
     if ((cnx->cnx_state == picoquic_state_ready || cnx->cnx_state == picoquic_state_client_ready_start || cnx->cnx_state == picoquic_state_server_false_start)
         && path_x->mtu_probe_sent == 0 && cnx->pmtud_policy != picoquic_pmtud_blocked) {
-        if (path_x->send_mtu_max_tried == 0 || path_x->send_mtu_max_tried > 1400) {
+        if (!path_x->is_mtu_cache_checked &&
+            (cnx->quic->table_mtu_cache != NULL || cnx->quic->table_path_bdp != NULL)) {
+            picoquic_apply_cached_mtu(cnx, path_x, picoquic_get_quic_time(cnx->quic));
+        }
+        if (path_x->send_mtu_max_tried == 0 ||
+            path_x->send_mtu_max_tried > path_x->send_mtu + PICOQUIC_MTU_SEARCH_GRANULARITY) {
             /* MTU discovery is required if the chances of success are large enough
              * and there are enough packets to send to amortize the discovery cost.
              * Of course we don't know at this stage how much data will be sent 
@@ -2339,6 +2487,8 @@ int picoquic_prepare_packet_0rtt(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
     int more_data = 0;
     int is_pure_ack = 1;
     int stream_tried_and_failed = 0;
+    uint64_t early_data_budget = picoquic_get_early_data_budget(cnx);
+    uint64_t early_data_remaining = (cnx->early_data_sent < early_data_budget) ? early_data_budget - cnx->early_data_sent : 0;
 
     send_buffer_max = (send_buffer_max > path_x->send_mtu) ? path_x->send_mtu : send_buffer_max;
     if (path_x->bytes_in_transit + send_buffer_max > PICOQUIC_DEFAULT_0RTT_WINDOW) {
@@ -2351,7 +2501,9 @@ int picoquic_prepare_packet_0rtt(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
     }
     bytes_max = bytes + send_buffer_max - checksum_overhead;
 
-    stream = picoquic_find_ready_stream(cnx);
+    if (early_data_remaining > PICOQUIC_EARLY_DATA_MIN_FRAME) {
+        stream = picoquic_find_ready_stream(cnx);
+    }
     length = picoquic_predict_packet_header_length(cnx, packet_type, &cnx->pkt_ctx[picoquic_packet_context_application]);
     packet->ptype = picoquic_packet_0rtt_protected;
     packet->offset = length;
@@ -2385,8 +2537,26 @@ int picoquic_prepare_packet_0rtt(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
             bytes_next = picoquic_format_bdp_frame(cnx, bytes_next, bytes_max, path_x, &more_data, &is_pure_ack);
         }
 
-        /* Encode the stream frame, or frames */
-        bytes_next = picoquic_format_available_stream_frames(cnx, NULL, bytes_next, bytes_max, &more_data, &is_pure_ack, &stream_tried_and_failed, &ret);
+        /* Encode the stream frame, or frames, within the early data budget.
+         * Frame headers count against the budget, so it is never exceeded. */
+        if (stream != NULL) {
+            uint64_t data_sent_before = cnx->data_sent;
+            uint8_t* bytes_max_stream = bytes_max;
+            int more_stream_data = 0;
+
+            if ((uint64_t)(bytes_max - bytes_next) > early_data_remaining) {
+                bytes_max_stream = bytes_next + (size_t)early_data_remaining;
+            }
+            bytes_next = picoquic_format_available_stream_frames(cnx, NULL, bytes_next, bytes_max_stream, &more_stream_data, &is_pure_ack, &stream_tried_and_failed, &ret);
+            cnx->early_data_sent += cnx->data_sent - data_sent_before;
+            if (cnx->early_data_sent + PICOQUIC_EARLY_DATA_MIN_FRAME >= early_data_budget) {
+                /* Budget exhausted, the remaining data will wait for 1-RTT */
+                stream_tried_and_failed = 0;
+            }
+            else {
+                more_data |= more_stream_data;
+            }
+        }
 
         length = bytes_next - bytes;
 
@@ -2401,7 +2571,7 @@ int picoquic_prepare_packet_0rtt(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
 
         /* Add padding if required */
         if (padding_required) {
-            length = picoquic_pad_to_target_length(bytes, length, send_buffer_max - checksum_overhead);
+            length = picoquic_pad_initial_datagram_to(cnx, bytes, length, send_buffer_max - checksum_overhead);
         }
     }
 
@@ -2589,10 +2759,41 @@ int picoquic_prepare_server_address_migration(picoquic_cnx_t* cnx)
     return ret;
 }
 
+/* With handshake packing, the client defers the acknowledgement of the server's
+ * Handshake packets, in the same way as the acknowledgement of Initial packets,
+ * so the ACK of a multi-datagram server flight can be sent with the Finished
+ * message instead of in separate datagrams.
+ */
+static int picoquic_is_handshake_ack_deferred(picoquic_cnx_t* cnx, picoquic_packet_context_enum pc,
+    uint64_t current_time, uint64_t* next_wake_time)
+{
+    int is_deferred = 0;
+
+    if (cnx->quic->is_handshake_packing_enabled && pc == picoquic_packet_context_handshake &&
+        !cnx->ack_ctx[pc].act[0].is_immediate_ack_required) {
+        uint64_t ack_delay = cnx->path[0]->smoothed_rtt / 8;
+        uint64_t ack_time;
+
+        if (ack_delay > PICOQUIC_ACK_DELAY_MAX) {
+            ack_delay = PICOQUIC_ACK_DELAY_MAX;
+        }
+        ack_time = cnx->ack_ctx[pc].act[0].time_oldest_unack_packet_received + ack_delay;
+        if (ack_time > current_time) {
+            is_deferred = 1;
+            if (ack_time < *next_wake_time) {
+                *next_wake_time = ack_time;
+                SET_LAST_WAKE(cnx->quic, PICOQUIC_SENDER);
+            }
+        }
+    }
+
+    return is_deferred;
+}
+
 /* Prepare the next packet to send when in one of the client initial states */
 int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * path_x, picoquic_packet_t* packet,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length, uint64_t * next_wake_time,
-    int * is_initial_sent)
+    int * is_initial_sent, size_t coalesced_length)
 {
     int ret = 0;
     int tls_ready = 0;
@@ -2766,7 +2967,8 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
 
                 if ((tls_ready == 0 || path_x->cwin <= path_x->bytes_in_transit)
                     && (cnx->cnx_state == picoquic_state_client_almost_ready
-                        || picoquic_is_ack_needed(cnx, current_time, next_wake_time, pc, 0) == 0)
+                        || picoquic_is_ack_needed(cnx, current_time, next_wake_time, pc, 0) == 0
+                        || picoquic_is_handshake_ack_deferred(cnx, pc, current_time, next_wake_time))
                     && cnx->first_misc_frame == NULL && !force_handshake_padding) {
                     length = 0;
                 }
@@ -2807,7 +3009,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
                                 cnx->original_cnxid.id_len != 0) {
                                 /* Pad to minimum packet length. But don't do that if the
                                  * initial packet will be coalesced with 0-RTT packet */
-                                length = picoquic_pad_to_target_length(bytes, length, send_buffer_max - checksum_overhead);
+                                length = picoquic_pad_initial_datagram(cnx, bytes, length, send_buffer_max, checksum_overhead, coalesced_length);
                             }
                         }
                     }
@@ -2864,15 +3066,15 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t * p
                 if (length > 0 && cnx->crypto_context[1].aead_encrypt == NULL && 
                     (cnx->crypto_context[2].aead_encrypt == NULL || length + checksum_overhead + PICOQUIC_MIN_SEGMENT_SIZE > send_buffer_max ||
                         !picoquic_is_tls_stream_ready(cnx))) {
-                    length = picoquic_pad_to_target_length(bytes, length, send_buffer_max - checksum_overhead);
+                    length = picoquic_pad_initial_datagram(cnx, bytes, length, send_buffer_max, checksum_overhead, coalesced_length);
                 }
             }
             else if (packet->ptype == picoquic_packet_handshake && length + checksum_overhead < send_buffer_max &&
                 (cnx->crypto_context[3].aead_encrypt == NULL || length + checksum_overhead + PICOQUIC_MIN_SEGMENT_SIZE > send_buffer_max)) {
-                length = picoquic_pad_to_target_length(bytes, length, send_buffer_max - checksum_overhead);
+                length = picoquic_pad_initial_datagram(cnx, bytes, length, send_buffer_max, checksum_overhead, coalesced_length);
             }
             else if (packet->ptype == picoquic_packet_1rtt_protected) {
-                length = picoquic_pad_to_target_length(bytes, length, send_buffer_max - checksum_overhead);
+                length = picoquic_pad_initial_datagram(cnx, bytes, length, send_buffer_max, checksum_overhead, coalesced_length);
             }
         }
 
@@ -2911,7 +3113,7 @@ uint64_t picoquic_next_challenge_time(picoquic_cnx_t* cnx, picoquic_path_t* path
 /* Prepare the next packet to send when in one the server initial states */
 int picoquic_prepare_packet_server_init(picoquic_cnx_t* cnx, picoquic_path_t * path_x, picoquic_packet_t* packet,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length, uint64_t * next_wake_time,
-    int* is_initial_sent)
+    int* is_initial_sent, size_t coalesced_length)
 {
     int ret = 0;
     int tls_ready = 0;
@@ -3032,12 +3234,12 @@ int picoquic_prepare_packet_server_init(picoquic_cnx_t* cnx, picoquic_path_t * p
             if (length > 0 && cnx->crypto_context[1].aead_encrypt == NULL && 
                 (cnx->crypto_context[2].aead_encrypt == NULL || length + checksum_overhead + PICOQUIC_MIN_SEGMENT_SIZE > send_buffer_max ||
                     !picoquic_is_tls_stream_ready(cnx) || cnx->quic->dont_coalesce_init)) {
-                length = picoquic_pad_to_target_length(bytes, length, send_buffer_max - checksum_overhead);
+                length = picoquic_pad_initial_datagram(cnx, bytes, length, send_buffer_max, checksum_overhead, coalesced_length);
             }
         }
         else if (packet->ptype == picoquic_packet_handshake && length + checksum_overhead < send_buffer_max &&
             (cnx->crypto_context[3].aead_encrypt == NULL || length + checksum_overhead + PICOQUIC_MIN_SEGMENT_SIZE > send_buffer_max)) {
-            length = picoquic_pad_to_target_length(bytes, length, send_buffer_max - checksum_overhead);
+            length = picoquic_pad_initial_datagram(cnx, bytes, length, send_buffer_max, checksum_overhead, coalesced_length);
         }
     }
 
@@ -3402,6 +3604,10 @@ void picoquic_ready_state_transition(picoquic_cnx_t* cnx, uint64_t current_time)
         cnx->crypto_epoch_length_max = 
             picoquic_aead_confidentiality_limit(cnx->crypto_context[picoquic_epoch_1rtt].aead_decrypt);
     }
+    if (cnx->crypto_key_confidentiality_limit == 0) {
+        cnx->crypto_key_confidentiality_limit =
+            picoquic_aead_confidentiality_limit(cnx->crypto_context[picoquic_epoch_1rtt].aead_encrypt);
+    }
 
     /* Use ACK list optimization if simple multipath */
     if (cnx->is_simple_multipath_enabled) {
@@ -3543,7 +3749,7 @@ uint8_t * picoquic_prepare_path_challenge_frames(picoquic_cnx_t* cnx, picoquic_p
  */
 int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* packet,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length, uint64_t* next_wake_time,
-    int* is_initial_sent)
+    int* is_initial_sent, size_t coalesced_length)
 {
     int ret = 0;
     picoquic_packet_type_enum packet_type = picoquic_packet_1rtt_protected;
@@ -3597,7 +3803,7 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
         cnx->initial_repeat_needed = 0;
 
         if (cnx->client_mode && *is_initial_sent && send_buffer_min_max < length + checksum_overhead + PICOQUIC_MIN_SEGMENT_SIZE) {
-            length = picoquic_pad_to_target_length(packet->bytes, length, send_buffer_min_max - checksum_overhead);
+            length = picoquic_pad_initial_datagram(cnx, packet->bytes, length, send_buffer_min_max, checksum_overhead, coalesced_length);
         }
     }
 
@@ -3817,7 +4023,10 @@ int picoquic_prepare_packet_almost_ready(picoquic_cnx_t* cnx, picoquic_path_t* p
 
         /* Ensure that all packets are properly padded before being sent. */
 
-        if (*is_initial_sent || (is_challenge_padding_needed && length < PICOQUIC_ENFORCED_INITIAL_MTU)){
+        if (*is_initial_sent) {
+            length = picoquic_pad_initial_datagram(cnx, bytes, length, send_buffer_min_max, checksum_overhead, coalesced_length);
+        }
+        else if (is_challenge_padding_needed && length < PICOQUIC_ENFORCED_INITIAL_MTU) {
             length = picoquic_pad_to_target_length(bytes, length, (uint32_t)(send_buffer_min_max - checksum_overhead));
         }
         else {
@@ -3875,7 +4084,7 @@ static uint8_t* picoquic_prepare_datagram_ready(picoquic_cnx_t* cnx, picoquic_pa
 /*  Prepare the next packet to send when in the ready state */
 int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* packet,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length, uint64_t* next_wake_time,
-    int* is_initial_sent)
+    int* is_initial_sent, size_t coalesced_length)
 {
     int ret = 0;
     picoquic_packet_type_enum packet_type = picoquic_packet_1rtt_protected;
@@ -3940,6 +4149,12 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
         }
     }
 
+    /* Rotate the keys before reaching the AEAD confidentiality limit */
+    picoquic_check_aead_limits(cnx, current_time);
+
+    /* Derive the keys of the next rotation ahead of time, and retire the old keys */
+    picoquic_prepare_next_rotated_keys(cnx, current_time);
+
     /* The first action is normally to retransmit lost packets. But if retransmit follows an
      * MTU drop, the stream frame will be fragmented and a fragment will be queued as a
      * misc frame. These fragments should have chance to go out before more retransmit is
@@ -4285,7 +4500,10 @@ int picoquic_prepare_packet_ready(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     if (ret == 0 && length > header_length) {
         /* Ensure that all packets are properly padded before being sent. */
 
-        if (*is_initial_sent || (is_challenge_padding_needed && length < PICOQUIC_ENFORCED_INITIAL_MTU)){
+        if (*is_initial_sent) {
+            length = picoquic_pad_initial_datagram(cnx, bytes, length, send_buffer_min_max, checksum_overhead, coalesced_length);
+        }
+        else if (is_challenge_padding_needed && length < PICOQUIC_ENFORCED_INITIAL_MTU) {
             length = picoquic_pad_to_target_length(bytes, length, (uint32_t)(send_buffer_min_max - checksum_overhead));
         }
         else {
@@ -4353,7 +4571,7 @@ static int picoquic_check_idle_timer(picoquic_cnx_t* cnx, uint64_t* next_wake_ti
 /* Prepare next packet to send, or nothing.. */
 int picoquic_prepare_segment(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* packet,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length,
-    uint64_t* next_wake_time, int* is_initial_sent)
+    uint64_t* next_wake_time, int* is_initial_sent, size_t coalesced_length)
 {
     int ret = 0;
 
@@ -4371,12 +4589,12 @@ int picoquic_prepare_segment(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoq
     case picoquic_state_client_renegotiate:
     case picoquic_state_client_handshake_start:
     case picoquic_state_client_almost_ready:
-        ret = picoquic_prepare_packet_client_init(cnx, path_x, packet, current_time, send_buffer, send_buffer_max, send_length, next_wake_time, is_initial_sent);
+        ret = picoquic_prepare_packet_client_init(cnx, path_x, packet, current_time, send_buffer, send_buffer_max, send_length, next_wake_time, is_initial_sent, coalesced_length);
         break;
     case picoquic_state_server_almost_ready:
     case picoquic_state_server_init:
     case picoquic_state_server_handshake:
-        ret = picoquic_prepare_packet_server_init(cnx, path_x, packet, current_time, send_buffer, send_buffer_max, send_length, next_wake_time, is_initial_sent);
+        ret = picoquic_prepare_packet_server_init(cnx, path_x, packet, current_time, send_buffer, send_buffer_max, send_length, next_wake_time, is_initial_sent, coalesced_length);
         break;
     case picoquic_state_server_false_start:
         /*
@@ -4386,15 +4604,15 @@ int picoquic_prepare_segment(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoq
         if (cnx->cnx_state == picoquic_state_server_false_start &&
             cnx->crypto_context[3].aead_decrypt != NULL) {
             picoquic_ready_state_transition(cnx, current_time);
-            return picoquic_prepare_packet_ready(cnx, path_x, packet, current_time, send_buffer, send_buffer_max, send_length, next_wake_time, is_initial_sent);
+            return picoquic_prepare_packet_ready(cnx, path_x, packet, current_time, send_buffer, send_buffer_max, send_length, next_wake_time, is_initial_sent, coalesced_length);
         }
         /* Else, just fall through to almost ready behavior.
          */
     case picoquic_state_client_ready_start:
-        ret = picoquic_prepare_packet_almost_ready(cnx, path_x, packet, current_time, send_buffer, send_buffer_max, send_length, next_wake_time, is_initial_sent);
+        ret = picoquic_prepare_packet_almost_ready(cnx, path_x, packet, current_time, send_buffer, send_buffer_max, send_length, next_wake_time, is_initial_sent, coalesced_length);
         break;
     case picoquic_state_ready:
-        ret = picoquic_prepare_packet_ready(cnx, path_x, packet, current_time, send_buffer, send_buffer_max, send_length, next_wake_time, is_initial_sent);
+        ret = picoquic_prepare_packet_ready(cnx, path_x, packet, current_time, send_buffer, send_buffer_max, send_length, next_wake_time, is_initial_sent, coalesced_length);
         break;
     case picoquic_state_handshake_failure:
     case picoquic_state_handshake_failure_resend:
@@ -4723,6 +4941,7 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
     struct sockaddr_storage addr_from_log;
     uint64_t initial_next_time;
     uint64_t next_wake_time = cnx->latest_progress_time + 2*PICOQUIC_MICROSEC_SILENCE_MAX;
+    PICOQUIC_STAGE_BEGIN(cnx->quic, picoquic_stage_packet_format, format_start);
 
     if (cnx->local_parameters.idle_timeout >(PICOQUIC_MICROSEC_SILENCE_MAX / 500)) {
         next_wake_time = cnx->latest_progress_time + cnx->local_parameters.idle_timeout * 1000ull;
@@ -4787,6 +5006,7 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
         {
             /* Create a new packet, which may include several segments */
             int is_initial_sent = 0;
+            int is_handshake_datagram = 0;
             size_t packet_size = 0;
             size_t packet_max = send_buffer_max - *send_length;
             uint8_t* packet_buffer = send_buffer + *send_length;
@@ -4825,7 +5045,7 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
                 }
                 else {
                     ret = picoquic_prepare_segment(cnx, cnx->path[path_id], packet, current_time,
-                        packet_buffer + packet_size, available, &segment_length, &next_wake_time, &is_initial_sent);
+                        packet_buffer + packet_size, available, &segment_length, &next_wake_time, &is_initial_sent, packet_size);
 
                     if (ret == 0) {
                         packet_size += segment_length;
@@ -4834,7 +5054,11 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
                             picoquic_recycle_packet(cnx->quic, packet);
                             break;
                         }
-                        else if (packet->ptype == picoquic_packet_1rtt_protected) {
+                        else if (packet->ptype == picoquic_packet_initial || packet->ptype == picoquic_packet_handshake) {
+                            is_handshake_datagram = 1;
+                        }
+
+                        if (packet->ptype == picoquic_packet_1rtt_protected) {
                             /* Cannot coalesce packets after 1 rtt packet */
                             break;
                         }
@@ -4870,6 +5094,10 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
                     cnx->max_mtu_sent = packet_size;
                 }
                 cnx->nb_packets_sent++;
+                if (is_handshake_datagram) {
+                    cnx->nb_handshake_datagrams_sent++;
+                    cnx->nb_handshake_bytes_sent += packet_size;
+                }
                 /* if needed, log that the packet is sent */
                 picoquic_log_pdu(cnx, 0, current_time,
                     (struct sockaddr*) & addr_to_log, (struct sockaddr*) & addr_from_log, packet_size);
@@ -4921,6 +5149,7 @@ int picoquic_prepare_packet_ex(picoquic_cnx_t* cnx,
     }
 
     picoquic_reinsert_by_wake_time(cnx->quic, cnx, next_wake_time);
+    PICOQUIC_STAGE_END(cnx->quic, picoquic_stage_packet_format, format_start);
 
     return ret;
 }
@@ -4974,7 +5203,7 @@ void picoquic_close_immediate(picoquic_cnx_t* cnx)
  * will send a stateless packet if one is queued, or ask the first connection in
  * the wake list to prepare a packet */
 
-int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
+static int picoquic_prepare_next_packet_one(picoquic_quic_t* quic,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length,
     struct sockaddr_storage* p_addr_to, struct sockaddr_storage* p_addr_from, int * if_index,
     picoquic_connection_id_t * log_cid, picoquic_cnx_t** p_last_cnx, size_t * send_msg_size)
@@ -5003,7 +5232,10 @@ int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
         picoquic_delete_stateless_packet(sp);
     }
     else {
-        picoquic_cnx_t* cnx = picoquic_get_earliest_cnx_to_wake(quic, current_time);
+        /* Service the connections due within the coalescing slack in the same wakeup */
+        uint64_t max_wake_time = current_time + quic->wake_coalescing_slack;
+        picoquic_cnx_t* cnx = (quic->is_wake_batch_enabled) ? picoquic_wake_batch_next(quic, max_wake_time) :
+            picoquic_get_earliest_cnx_to_wake(quic, max_wake_time);
 
         if (cnx == NULL) {
             *send_length = 0;
@@ -5011,6 +5243,12 @@ int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
         else {
             ret = picoquic_prepare_packet_ex(cnx, current_time, send_buffer, send_buffer_max, send_length, p_addr_to, p_addr_from, 
                 if_index, send_msg_size);
+            if (quic->is_wake_batch_enabled) {
+                /* Put the connection back in the batch lists, even if it is about to be
+                 * deleted: picoquic_delete_cnx unlinks it from these lists. */
+                picoquic_wake_batch_done(quic, cnx, max_wake_time, *send_length,
+                    (send_msg_size == NULL) ? 0 : *send_msg_size);
+            }
             if (log_cid != NULL) {
                 *log_cid = cnx->initial_cnxid;
             }
@@ -5054,6 +5292,33 @@ int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
     return ret;
 }
 
+/* With timer coalescing, the connection served first may have nothing more to
+ * send, e.g., after it just sent a packet, while other connections are due within
+ * the slack. Try these connections, at most once per connection in the context,
+ * before reporting that there is nothing to send in this wakeup.
+ */
+int picoquic_prepare_next_packet_ex(picoquic_quic_t* quic,
+    uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length,
+    struct sockaddr_storage* p_addr_to, struct sockaddr_storage* p_addr_from, int * if_index,
+    picoquic_connection_id_t * log_cid, picoquic_cnx_t** p_last_cnx, size_t * send_msg_size)
+{
+    int ret = picoquic_prepare_next_packet_one(quic, current_time, send_buffer, send_buffer_max, send_length,
+        p_addr_to, p_addr_from, if_index, log_cid, p_last_cnx, send_msg_size);
+
+    if (quic->wake_coalescing_slack > 0) {
+        uint32_t nb_tries = 1;
+
+        while (ret == 0 && *send_length == 0 && nb_tries < quic->current_number_connections &&
+            picoquic_get_earliest_cnx_to_wake(quic, current_time + quic->wake_coalescing_slack) != NULL) {
+            ret = picoquic_prepare_next_packet_one(quic, current_time, send_buffer, send_buffer_max, send_length,
+                p_addr_to, p_addr_from, if_index, log_cid, p_last_cnx, send_msg_size);
+            nb_tries++;
+        }
+    }
+
+    return ret;
+}
+
 int picoquic_prepare_next_packet(picoquic_quic_t* quic,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length,
     struct sockaddr_storage* p_addr_to, struct sockaddr_storage* p_addr_from, int* if_index,
@@ -76,22 +76,34 @@ void picoquictest_sim_link_delete(picoquictest_sim_link_t* link)
         free(packet);
     }
 
+    if (link->dualq != NULL) {
+        free(link->dualq);
+    }
+
     free(link);
 }
 
-picoquictest_sim_packet_t* picoquictest_sim_link_create_packet()
+picoquictest_sim_packet_t* picoquictest_sim_link_create_packet_ex(size_t length)
 {
-    picoquictest_sim_packet_t* packet = (picoquictest_sim_packet_t*)malloc(sizeof(picoquictest_sim_packet_t));
+    size_t bytes_size = (length > PICOQUIC_MAX_PACKET_SIZE) ? length : PICOQUIC_MAX_PACKET_SIZE;
+    picoquictest_sim_packet_t* packet = (picoquictest_sim_packet_t*)malloc(
+        sizeof(picoquictest_sim_packet_t) + bytes_size - PICOQUIC_MAX_PACKET_SIZE);
     if (packet != NULL) {
         packet->next_packet = NULL;
         packet->arrival_time = 0;
         packet->length = 0;
         packet->ecn_mark = 0;
+        packet->bytes_size = bytes_size;
     }
 
     return packet;
 }
 
+picoquictest_sim_packet_t* picoquictest_sim_link_create_packet()
+{
+    return picoquictest_sim_link_create_packet_ex(PICOQUIC_MAX_PACKET_SIZE);
+}
+
 uint64_t picoquictest_sim_link_next_arrival(picoquictest_sim_link_t* link, uint64_t current_time)
 {
     picoquictest_sim_packet_t* packet = link->first_packet;
@@ -149,17 +161,168 @@ static uint64_t picoquictest_sim_link_jitter(picoquictest_sim_link_t* link)
     return jitter;
 }
 
+/* Draw a random number between 0 and 1, used for the AQM probabilities */
+static double picoquictest_sim_link_random_01(uint64_t* random_ctx)
+{
+    return ((double)(picoquic_test_random(random_ctx) >> 11)) / 9007199254740992.0;
+}
+
+int picoquictest_sim_link_set_dualq(picoquictest_sim_link_t* link, uint64_t target,
+    uint64_t l4s_threshold, double coupling, uint64_t current_time)
+{
+    int ret = 0;
+
+    if (link->dualq == NULL) {
+        link->dualq = (picoquictest_sim_dualq_t*)malloc(sizeof(picoquictest_sim_dualq_t));
+    }
+    if (link->dualq == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(link->dualq, 0, sizeof(picoquictest_sim_dualq_t));
+        link->dualq->l4s_queue_time = current_time;
+        link->dualq->target = (target == 0) ? 15000 : target;
+        link->dualq->l4s_threshold = (l4s_threshold == 0) ? 1000 : l4s_threshold;
+        link->dualq->coupling = (coupling <= 0) ? 2.0 : coupling;
+        link->dualq->t_update = 16000;
+        link->dualq->alpha = 0.16;
+        link->dualq->beta = 3.2;
+        link->dualq->last_update = current_time;
+        link->dualq->random_ctx = 0xD0A1B1220CAFEull;
+    }
+
+    return ret;
+}
+
+/* Update the base probability p' of the PI controller, based on the
+ * delay of the classic queue. */
+static void picoquictest_sim_dualq_update(picoquictest_sim_link_t* link, uint64_t current_time)
+{
+    picoquictest_sim_dualq_t* dualq = link->dualq;
+
+    if (current_time >= dualq->last_update + dualq->t_update) {
+        uint64_t classic_delay = (current_time > link->queue_time) ? 0 : link->queue_time - current_time;
+
+        dualq->p_base += dualq->alpha * (((double)classic_delay - (double)dualq->target) / 1000000.0) +
+            dualq->beta * (((double)classic_delay - (double)dualq->prev_delay) / 1000000.0);
+        if (dualq->p_base < 0) {
+            dualq->p_base = 0;
+        }
+        else if (dualq->p_base > 1.0) {
+            dualq->p_base = 1.0;
+        }
+        dualq->prev_delay = classic_delay;
+        dualq->last_update = current_time;
+    }
+}
+
+/* Apply the DualPI2 policy to a packet, returns 1 if the packet shall be dropped.
+ * The departure time is computed with strict priority for the L4S queue: L4S
+ * packets only wait for the L4S queue, and delay the classic queue by their
+ * transmission time.
+ */
+static int picoquictest_sim_dualq_submit(picoquictest_sim_link_t* link, picoquictest_sim_packet_t* packet,
+    uint64_t transmit_time, uint64_t current_time, uint64_t* departure_time)
+{
+    picoquictest_sim_dualq_t* dualq = link->dualq;
+    int should_drop = 0;
+
+    picoquictest_sim_dualq_update(link, current_time);
+
+    if ((packet->ecn_mark & 0x01) != 0) {
+        /* ECT(1) or CE, L4S queue */
+        uint64_t l4s_delay = (current_time > dualq->l4s_queue_time) ? 0 : dualq->l4s_queue_time - current_time;
+        double mark_probability = dualq->coupling * dualq->p_base;
+
+        dualq->l4s_packets++;
+        dualq->l4s_delay_sum += l4s_delay;
+        dualq->classic_delay_sum += (current_time > link->queue_time) ? 0 : link->queue_time - current_time;
+        if (link->queue_delay_max > 0 && l4s_delay >= link->queue_delay_max) {
+            should_drop = 1;
+        }
+        else {
+            if (l4s_delay >= dualq->l4s_threshold ||
+                picoquictest_sim_link_random_01(&dualq->random_ctx) < mark_probability) {
+                packet->ecn_mark = PICOQUIC_ECN_CE;
+                dualq->l4s_marked++;
+            }
+            dualq->l4s_bytes += packet->length;
+            dualq->l4s_queue_time = current_time + l4s_delay + transmit_time;
+            *departure_time = dualq->l4s_queue_time;
+            link->queue_time = ((current_time > link->queue_time) ? current_time : link->queue_time) + transmit_time;
+        }
+    }
+    else {
+        uint64_t classic_delay = (current_time > link->queue_time) ? 0 : link->queue_time - current_time;
+
+        dualq->classic_packets++;
+        if (link->queue_delay_max > 0 && classic_delay >= link->queue_delay_max) {
+            should_drop = 1;
+        }
+        else if (picoquictest_sim_link_random_01(&dualq->random_ctx) < dualq->p_base * dualq->p_base) {
+            if (packet->ecn_mark == PICOQUIC_ECN_ECT_0) {
+                packet->ecn_mark = PICOQUIC_ECN_CE;
+                dualq->classic_marked++;
+            }
+            else {
+                should_drop = 1;
+            }
+        }
+        if (should_drop) {
+            dualq->classic_dropped++;
+        }
+        else {
+            uint64_t queue_start = current_time + classic_delay;
+            if (dualq->l4s_queue_time > queue_start) {
+                queue_start = dualq->l4s_queue_time;
+            }
+            dualq->classic_bytes += packet->length;
+            link->queue_time = queue_start + transmit_time;
+            *departure_time = link->queue_time;
+        }
+    }
+    return should_drop;
+}
+
+/* Queue a packet in the order of arrival times. This is only needed in
+ * dual queue mode, since L4S packets may overtake classic packets. */
+static void picoquictest_sim_link_insert_packet(picoquictest_sim_link_t* link, picoquictest_sim_packet_t* packet)
+{
+    if (link->last_packet == NULL || link->last_packet->arrival_time <= packet->arrival_time) {
+        if (link->last_packet == NULL) {
+            link->first_packet = packet;
+        }
+        else {
+            link->last_packet->next_packet = packet;
+        }
+        link->last_packet = packet;
+        packet->next_packet = NULL;
+    }
+    else {
+        picoquictest_sim_packet_t** pprevious = &link->first_packet;
+
+        while (*pprevious != NULL && (*pprevious)->arrival_time <= packet->arrival_time) {
+            pprevious = &(*pprevious)->next_packet;
+        }
+        packet->next_packet = *pprevious;
+        *pprevious = packet;
+    }
+}
+
 void picoquictest_sim_link_submit(picoquictest_sim_link_t* link, picoquictest_sim_packet_t* packet,
     uint64_t current_time)
 {
     uint64_t queue_delay = (current_time > link->queue_time) ? 0 : link->queue_time - current_time;
     uint64_t transmit_time = ((link->picosec_per_byte * ((uint64_t)packet->length)) >> 20);
+    uint64_t departure_time = 0;
     uint64_t should_drop = 0;
 
     if (transmit_time <= 0)
         transmit_time = 1;
 
-    if (link->bucket_increase_per_microsec > 0) {
+    if (link->dualq != NULL) {
+        should_drop = picoquictest_sim_dualq_submit(link, packet, transmit_time, current_time, &departure_time);
+    } else if (link->bucket_increase_per_microsec > 0) {
         /* Simulate a rate limiter based on classic leaky bucket algorithm */
         uint64_t delta_microsec = current_time - link->bucket_arrival_last;
         link->bucket_arrival_last = current_time;
@@ -185,10 +348,13 @@ void picoquictest_sim_link_submit(picoquictest_sim_link_t* link, picoquictest_si
     }
 
     if (!should_drop) {
-        link->queue_time = current_time + queue_delay + transmit_time;
-        /* TODO: proper simulation of marking policy */
-        if (link->l4s_max > 0 && queue_delay >= link->l4s_max) {
-            packet->ecn_mark = PICOQUIC_ECN_CE;
+        if (link->dualq == NULL) {
+            link->queue_time = current_time + queue_delay + transmit_time;
+            departure_time = link->queue_time;
+            /* TODO: proper simulation of marking policy */
+            if (link->l4s_max > 0 && queue_delay >= link->l4s_max) {
+                packet->ecn_mark = PICOQUIC_ECN_CE;
+            }
         }
         if (packet->length > link->path_mtu || picoquictest_sim_link_testloss(link->loss_mask) != 0 ||
             link->is_switched_off) {
@@ -196,21 +362,26 @@ void picoquictest_sim_link_submit(picoquictest_sim_link_t* link, picoquictest_si
             free(packet);
         } else {
             link->packets_sent++;
-            if (link->last_packet == NULL) {
-                link->first_packet = packet;
-            } else {
-                link->last_packet->next_packet = packet;
-            }
-            link->last_packet = packet;
             packet->next_packet = NULL;
-            packet->arrival_time = link->queue_time + link->microsec_latency;
+            packet->arrival_time = departure_time + link->microsec_latency;
             if (link->jitter != 0) {
                 packet->arrival_time += picoquictest_sim_link_jitter(link);
             }
             if (packet->arrival_time < link->resume_time) {
                 packet->arrival_time = link->resume_time;
             }
-
+            if (link->dualq != NULL) {
+                picoquictest_sim_link_insert_packet(link, packet);
+            }
+            else {
+                if (link->last_packet == NULL) {
+                    link->first_packet = packet;
+                }
+                else {
+                    link->last_packet->next_packet = packet;
+                }
+                link->last_packet = packet;
+            }
         }
     } else {
         /* simulate congestion loss or random drop on queue full */
@@ -295,7 +466,7 @@ int sim_link_one_test(uint64_t* loss_mask, uint64_t queue_delay_max, uint64_t nb
                     ret = -1;
                 }
                 else {
-                    packet->length = sizeof(packet->bytes);
+                    packet->length = PICOQUIC_MAX_PACKET_SIZE;
                     picoquictest_sim_link_submit(link, packet, departure_time);
                     departure_time += 250;
                     queued++;
@@ -336,6 +507,101 @@ int sim_link_test()
     return ret;
 }
 
+/* Test of the dual queue simulation. Unresponsive L4S and classic flows
+ * are sent at 40% and 80% of the link capacity. The classic queue builds up,
+ * the PI controller raises the base probability, classic packets are dropped
+ * and L4S packets are marked, and the L4S queue delay stays much lower than
+ * the classic queue delay.
+ */
+int sim_dualq_test()
+{
+    int ret = 0;
+    uint64_t current_time = 0;
+    picoquictest_sim_link_t* link = picoquictest_sim_link_create(0.01, 10000, NULL, 100000, current_time);
+    uint64_t next_l4s = 0;
+    uint64_t next_classic = 0;
+    uint64_t last_arrival = 0;
+    uint64_t nb_queued = 0;
+    uint64_t nb_dequeued = 0;
+    uint64_t nb_samples = 0;
+    uint64_t l4s_delay_sum = 0;
+    uint64_t classic_delay_sum = 0;
+    const uint64_t packet_time = 1152;
+    const uint64_t test_duration = 5000000;
+
+    if (link == NULL || picoquictest_sim_link_set_dualq(link, 0, 0, 0, current_time) != 0) {
+        ret = -1;
+    }
+
+    while (ret == 0) {
+        uint64_t next_submit = (next_l4s < next_classic) ? next_l4s : next_classic;
+        picoquictest_sim_packet_t* packet;
+
+        if (next_submit > test_duration) {
+            next_submit = UINT64_MAX;
+        }
+        current_time = picoquictest_sim_link_next_arrival(link, next_submit);
+        if (current_time == UINT64_MAX) {
+            break;
+        }
+
+        packet = picoquictest_sim_link_dequeue(link, current_time);
+        if (packet != NULL) {
+            if (packet->arrival_time < last_arrival) {
+                ret = -1;
+            }
+            last_arrival = packet->arrival_time;
+            nb_dequeued++;
+            free(packet);
+        }
+        else if ((packet = picoquictest_sim_link_create_packet()) == NULL) {
+            ret = -1;
+        }
+        else {
+            packet->length = 1440;
+            if (current_time >= next_l4s) {
+                packet->ecn_mark = PICOQUIC_ECN_ECT_1;
+                next_l4s += (5 * packet_time) / 2;
+            }
+            else {
+                next_classic += (5 * packet_time) / 4;
+            }
+            picoquictest_sim_link_submit(link, packet, current_time);
+            nb_queued++;
+            /* Sample the queue delays */
+            l4s_delay_sum += (link->dualq->l4s_queue_time > current_time) ? link->dualq->l4s_queue_time - current_time : 0;
+            classic_delay_sum += (link->queue_time > current_time) ? link->queue_time - current_time : 0;
+            nb_samples++;
+        }
+    }
+
+    if (ret == 0) {
+        picoquictest_sim_dualq_t* dualq = link->dualq;
+
+        if (nb_dequeued + link->packets_dropped != nb_queued) {
+            DBG_PRINTF("Queued %" PRIu64 ", dequeued %" PRIu64 ", dropped %" PRIu64 "\n",
+                nb_queued, nb_dequeued, link->packets_dropped);
+            ret = -1;
+        }
+        else if (dualq->p_base <= 0 || dualq->l4s_marked == 0 || dualq->classic_dropped == 0) {
+            DBG_PRINTF("p = %f, l4s marked %" PRIu64 ", classic dropped %" PRIu64 "\n",
+                dualq->p_base, dualq->l4s_marked, dualq->classic_dropped);
+            ret = -1;
+        }
+        else if (l4s_delay_sum * 4 > classic_delay_sum) {
+            DBG_PRINTF("L4S delay %" PRIu64 ", classic delay %" PRIu64 "\n",
+                l4s_delay_sum / nb_samples, classic_delay_sum / nb_samples);
+            ret = -1;
+        }
+    }
+
+    if (link != NULL) {
+        picoquictest_sim_link_delete(link);
+    }
+
+    return ret;
+}
+
 void picoquic_set_test_address(struct sockaddr_in * addr, uint32_t addr_val, uint16_t port)
 {
     /* Init of the IP addresses */
@@ -214,11 +214,12 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
     struct sockaddr_storage addr_from;
     struct sockaddr_storage addr_to;
     int if_index_to;
-    uint8_t buffer[1536];
+    uint8_t* buffer = NULL;
+    size_t buffer_size = quic->packet_buffer_size;
     uint8_t* send_buffer = NULL;
     size_t send_length = 0;
     size_t send_msg_size = 0;
-    size_t send_buffer_size = 1536;
+    size_t send_buffer_size = quic->packet_buffer_size;
     size_t* send_msg_ptr = NULL;
     int bytes_recv;
     picoquic_connection_id_t log_cid;
@@ -258,7 +259,8 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
             send_msg_ptr = &send_msg_size;
         }
         send_buffer = malloc(send_buffer_size);
-        if (send_buffer == NULL) {
+        buffer = malloc(buffer_size);
+        if (send_buffer == NULL || buffer == NULL) {
             ret = -1;
         }
     }
@@ -283,13 +285,18 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
                     delta_t = time_check_arg.delta_t;
                 }
             }
+            if (delta_t > 0 && delta_t < delay_max && (uint64_t)delta_t < quic->busy_poll_threshold) {
+                /* Short waits overshoot when implemented with select(): poll instead.
+                 * An idle loop waits for delay_max, and always sleeps. */
+                delta_t = 0;
+            }
         }
         loop_immediate = 0;
 
         bytes_recv = picoquic_select_ex(s_socket, nb_sockets,
             &addr_from,
             &addr_to, &if_index_to, &received_ecn,
-            buffer, sizeof(buffer),
+            buffer, (int)buffer_size,
             delta_t, &socket_rank, &current_time);
         if (bytes_recv < 0) {
             ret = -1;
@@ -372,10 +379,12 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
                                     send_socket = s_socket[nb_sockets - 1];
                                 }
                             }
+                            PICOQUIC_STAGE_BEGIN(quic, picoquic_stage_socket_send, send_start);
 
                             sock_ret = picoquic_sendmsg(send_socket,
                                 (struct sockaddr*)&peer_addr, (struct sockaddr*)&local_addr, if_index,
                                 (const char*)send_buffer, (int)send_length, (int)send_msg_size, &sock_err);
+                            PICOQUIC_STAGE_END(quic, picoquic_stage_socket_send, send_start);
                         }
 
                         if (sock_ret <= 0) {
@@ -510,5 +519,9 @@ int picoquic_packet_loop(picoquic_quic_t* quic,
         free(send_buffer);
     }
 
+    if (buffer != NULL) {
+        free(buffer);
+    }
+
     return ret;
 }
@@ -0,0 +1,128 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Per stage cost accounting.
+ *
+ * The counters are stored in the QUIC context, and updated without locks
+ * since a QUIC context is only used by one thread at a time. The cycle
+ * counter is read with rdtsc on x86, from the virtual counter on ARM64,
+ * and defaults to the wall clock in microseconds on other platforms.
+ */
+
+#include "picoquic_internal.h"
+#include <string.h>
+#ifdef PICOQUIC_WITH_USDT
+#include <sys/sdt.h>
+#endif
+#if defined(PICOQUIC_WITH_STAGE_CYCLES) && defined(_WINDOWS)
+#include <intrin.h>
+#endif
+
+static const char* stage_names[picoquic_stage_max] = {
+    "receive_parse",
+    "decrypt",
+    "frame_decode",
+    "ack_process",
+    "cc_notify",
+    "stream_select",
+    "packet_format",
+    "encrypt",
+    "socket_send"
+};
+
+const char* picoquic_stage_name(picoquic_stage_enum stage)
+{
+    return ((unsigned int)stage < picoquic_stage_max) ? stage_names[stage] : "unknown";
+}
+
+#ifdef PICOQUIC_WITH_STAGE_CYCLES
+static uint64_t picoquic_stage_cycles(void)
+{
+#if defined(_WINDOWS) && (defined(_M_X64) || defined(_M_IX86))
+    return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return picoquic_current_time();
+#endif
+}
+#endif
+
+#if defined(PICOQUIC_WITH_STAGE_CYCLES) || defined(PICOQUIC_WITH_USDT)
+uint64_t picoquic_stage_begin(picoquic_quic_t* quic, picoquic_stage_enum stage)
+{
+#ifdef PICOQUIC_WITH_USDT
+    DTRACE_PROBE2(picoquic, stage_begin, quic, stage);
+#else
+    (void)quic;
+    (void)stage;
+#endif
+#ifdef PICOQUIC_WITH_STAGE_CYCLES
+    return picoquic_stage_cycles();
+#else
+    return 0;
+#endif
+}
+
+void picoquic_stage_end(picoquic_quic_t* quic, picoquic_stage_enum stage, uint64_t start_cycles)
+{
+#ifdef PICOQUIC_WITH_STAGE_CYCLES
+    quic->stage_stats[stage].nb_calls++;
+    quic->stage_stats[stage].nb_cycles += picoquic_stage_cycles() - start_cycles;
+#else
+    (void)start_cycles;
+#endif
+#ifdef PICOQUIC_WITH_USDT
+    DTRACE_PROBE2(picoquic, stage_end, quic, stage);
+#endif
+}
+#endif
+
+int picoquic_get_stage_stats(picoquic_quic_t* quic, picoquic_stage_enum stage, picoquic_stage_stats_t* stats)
+{
+#ifdef PICOQUIC_WITH_STAGE_CYCLES
+    int ret = 0;
+
+    if ((unsigned int)stage >= picoquic_stage_max) {
+        ret = -1;
+    }
+    else {
+        *stats = quic->stage_stats[stage];
+    }
+
+    return ret;
+#else
+    (void)quic;
+    (void)stage;
+    memset(stats, 0, sizeof(picoquic_stage_stats_t));
+    return -1;
+#endif
+}
+
+void picoquic_reset_stage_stats(picoquic_quic_t* quic)
+{
+    memset(quic->stage_stats, 0, sizeof(quic->stage_stats));
+}
@@ -452,6 +452,12 @@ int picoquic_load_tickets(picoquic_stored_ticket_t** pp_first_ticket,
             /* end of file */
             break;
         }
+        else if ((storage_size & PICOQUIC_PATH_BDP_RECORD_FLAG) != 0) {
+            /* Path cache record, loaded by picoquic_load_path_bdp */
+            if (fseek(F, (long)(storage_size & ~PICOQUIC_PATH_BDP_RECORD_FLAG), SEEK_CUR) != 0) {
+                ret = PICOQUIC_ERROR_INVALID_FILE;
+            }
+        }
         else if (storage_size > 2048 ||
             (record_size = storage_size + offsetof(struct st_picoquic_stored_ticket_t, time_valid_until)) > 2048) {
             ret = PICOQUIC_ERROR_INVALID_FILE;
@@ -510,7 +516,14 @@ void picoquic_free_tickets(picoquic_stored_ticket_t** pp_first_ticket)
 
 int picoquic_save_session_tickets(picoquic_quic_t* quic, char const* ticket_store_filename)
 {
-    return picoquic_save_tickets(quic->p_first_ticket, picoquic_get_quic_time(quic), ticket_store_filename);
+    uint64_t current_time = picoquic_get_quic_time(quic);
+    int ret = picoquic_save_tickets(quic->p_first_ticket, current_time, ticket_store_filename);
+
+    if (ret == 0 && quic->table_path_bdp != NULL) {
+        ret = picoquic_save_path_bdp(quic, current_time, ticket_store_filename);
+    }
+
+    return ret;
 }
 
 int picoquic_load_retry_tokens(picoquic_quic_t* quic, char const* token_store_filename)
@@ -571,6 +584,7 @@ void picoquic_seed_ticket(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t
 {
     if (cnx->client_mode) {
         picoquic_update_stored_ticket(cnx, path_x, current_time);
+        picoquic_update_path_bdp(cnx, path_x, current_time);
     }
     else {
         uint8_t* ip_addr;
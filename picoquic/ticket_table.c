@@ -0,0 +1,292 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Fixed memory table of the tickets issued by a server.
+ *
+ * For each ticket, the server remembers the RTT, the congestion window and
+ * the IP address of the client, so that the connection can be seeded when
+ * the ticket is used for resumption. The table is a single block of memory
+ * without pointers, holding fixed size records, so that the memory usage is
+ * bounded and the table can be placed in memory shared between threads or
+ * processes. With a shared table, the BDP seed is found even if the client
+ * resumes on a different worker.
+ *
+ * The table is open addressed. The hash of the ticket ID selects a group
+ * of PICOQUIC_TICKET_TABLE_WAYS consecutive records, and the ticket can be
+ * stored in any record of that group. When the group is full, a victim is
+ * selected with the "clock" approximation of LRU: records are marked as
+ * referenced when they are created or read, the clock hand sweeps through
+ * the group, clearing the reference marks, and the first record without
+ * mark is replaced.
+ *
+ * Each record is protected by a version number used as sequence lock. The
+ * version is zero if the record is empty, and odd while a writer updates
+ * it. Readers copy the record and check that the version did not change.
+ * A writer that finds the record locked gives up: the BDP seed is only a
+ * hint, and losing an update is harmless.
+ */
+
+#include "picoquic_internal.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WINDOWS
+#include <intrin.h>
+#endif
+
+#define PICOQUIC_TICKET_TABLE_WAYS 8
+
+typedef struct st_picoquic_ticket_record_t {
+    uint32_t version;
+    uint32_t referenced;
+    uint64_t ticket_id;
+    uint64_t cwin;
+    uint32_t rtt; /* in microseconds, capped at about 71 minutes */
+    uint8_t ip_addr[PICOQUIC_STORED_IP_MAX];
+    uint8_t ip_addr_length;
+    uint8_t padding[3];
+} picoquic_ticket_record_t;
+
+typedef struct st_picoquic_ticket_table_t {
+    uint64_t nb_groups;
+    uint64_t clock_hand;
+} picoquic_ticket_table_t;
+
+#ifdef _WINDOWS
+#define picoquic_ticket_table_load(p) ((uint32_t)_InterlockedOr((volatile long*)(p), 0))
+#define picoquic_ticket_table_store(p, v) ((void)_InterlockedExchange((volatile long*)(p), (long)(v)))
+#define picoquic_ticket_table_fence() MemoryBarrier()
+#define picoquic_ticket_table_next_hand(p) ((uint64_t)_InterlockedIncrement64((volatile __int64*)(p)))
+static int picoquic_ticket_table_cas(uint32_t* p, uint32_t expected, uint32_t desired)
+{
+    return (uint32_t)_InterlockedCompareExchange((volatile long*)p, (long)desired, (long)expected) == expected;
+}
+#else
+#define picoquic_ticket_table_load(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define picoquic_ticket_table_store(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define picoquic_ticket_table_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define picoquic_ticket_table_next_hand(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+static int picoquic_ticket_table_cas(uint32_t* p, uint32_t expected, uint32_t desired)
+{
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#endif
+
+static picoquic_ticket_record_t* picoquic_ticket_table_group(picoquic_ticket_table_t* table, uint64_t ticket_id)
+{
+    /* Ticket IDs are random numbers, but mix them anyway in case of a weak generator */
+    uint64_t h = ticket_id;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+
+    return ((picoquic_ticket_record_t*)(table + 1)) + (h % table->nb_groups) * PICOQUIC_TICKET_TABLE_WAYS;
+}
+
+size_t picoquic_ticket_table_memory_size(size_t nb_tickets_max)
+{
+    size_t nb_groups = (nb_tickets_max + PICOQUIC_TICKET_TABLE_WAYS - 1) / PICOQUIC_TICKET_TABLE_WAYS;
+
+    if (nb_groups == 0) {
+        nb_groups = 1;
+    }
+
+    return sizeof(picoquic_ticket_table_t) + nb_groups * PICOQUIC_TICKET_TABLE_WAYS * sizeof(picoquic_ticket_record_t);
+}
+
+int picoquic_ticket_table_init(void* memory, size_t memory_size)
+{
+    int ret = 0;
+    picoquic_ticket_table_t* table = (picoquic_ticket_table_t*)memory;
+    size_t group_size = PICOQUIC_TICKET_TABLE_WAYS * sizeof(picoquic_ticket_record_t);
+
+    if (memory == NULL || memory_size < sizeof(picoquic_ticket_table_t) + group_size) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        size_t nb_groups = (memory_size - sizeof(picoquic_ticket_table_t)) / group_size;
+
+        memset(memory, 0, sizeof(picoquic_ticket_table_t) + nb_groups * group_size);
+        table->nb_groups = nb_groups;
+    }
+
+    return ret;
+}
+
+int picoquic_set_ticket_table(picoquic_quic_t* quic, size_t memory_max)
+{
+    int ret = 0;
+    void* memory = (memory_max < picoquic_ticket_table_memory_size(1)) ? NULL : malloc(memory_max);
+
+    if (memory == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else if ((ret = picoquic_ticket_table_init(memory, memory_max)) != 0) {
+        free(memory);
+    }
+    else {
+        picoquic_ticket_table_free(quic);
+        quic->ticket_table = (picoquic_ticket_table_t*)memory;
+        quic->is_ticket_table_owned = 1;
+    }
+
+    return ret;
+}
+
+void picoquic_set_shared_ticket_table(picoquic_quic_t* quic, void* memory)
+{
+    picoquic_ticket_table_free(quic);
+    quic->ticket_table = (picoquic_ticket_table_t*)memory;
+    quic->is_ticket_table_owned = 0;
+}
+
+void picoquic_ticket_table_free(picoquic_quic_t* quic)
+{
+    if (quic->ticket_table != NULL && quic->is_ticket_table_owned) {
+        free(quic->ticket_table);
+    }
+    quic->ticket_table = NULL;
+    quic->is_ticket_table_owned = 0;
+}
+
+/* Copy a record if it is stable and holds the ticket ID. Returns 0 if found. */
+static int picoquic_ticket_record_read(picoquic_ticket_record_t* record, uint64_t ticket_id,
+    picoquic_issued_ticket_t* ticket)
+{
+    int ret = -1;
+    uint32_t version = picoquic_ticket_table_load(&record->version);
+
+    if (version != 0 && (version & 1) == 0 && record->ticket_id == ticket_id) {
+        ticket->ticket_id = ticket_id;
+        ticket->rtt = record->rtt;
+        ticket->cwin = record->cwin;
+        ticket->ip_addr_length = record->ip_addr_length;
+        if (ticket->ip_addr_length > PICOQUIC_STORED_IP_MAX) {
+            ticket->ip_addr_length = PICOQUIC_STORED_IP_MAX;
+        }
+        memcpy(ticket->ip_addr, record->ip_addr, ticket->ip_addr_length);
+        picoquic_ticket_table_fence();
+        if (picoquic_ticket_table_load(&record->version) == version) {
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_retrieve_issued_ticket(picoquic_quic_t* quic,
+    uint64_t ticket_id, picoquic_issued_ticket_t* ticket)
+{
+    int ret = -1;
+
+    if (quic->ticket_table != NULL) {
+        picoquic_ticket_record_t* group = picoquic_ticket_table_group(quic->ticket_table, ticket_id);
+
+        memset(ticket, 0, sizeof(picoquic_issued_ticket_t));
+        for (int i = 0; i < PICOQUIC_TICKET_TABLE_WAYS; i++) {
+            if (picoquic_ticket_record_read(&group[i], ticket_id, ticket) == 0) {
+                picoquic_ticket_table_store(&group[i].referenced, 1);
+                ret = 0;
+                break;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Find the record holding the ticket, or else an empty record, or else
+ * the first record found by the clock hand without reference mark.
+ */
+static picoquic_ticket_record_t* picoquic_ticket_table_select(picoquic_ticket_table_t* table, uint64_t ticket_id)
+{
+    picoquic_ticket_record_t* group = picoquic_ticket_table_group(table, ticket_id);
+    picoquic_ticket_record_t* empty = NULL;
+
+    for (int i = 0; i < PICOQUIC_TICKET_TABLE_WAYS; i++) {
+        uint32_t version = picoquic_ticket_table_load(&group[i].version);
+
+        if (version == 0) {
+            if (empty == NULL) {
+                empty = &group[i];
+            }
+        }
+        else if (group[i].ticket_id == ticket_id) {
+            return &group[i];
+        }
+    }
+
+    if (empty == NULL) {
+        /* Two turns of the clock are enough to find a record without mark */
+        for (int i = 0; i < 2 * PICOQUIC_TICKET_TABLE_WAYS; i++) {
+            uint64_t hand = picoquic_ticket_table_next_hand(&table->clock_hand);
+            picoquic_ticket_record_t* record = &group[hand % PICOQUIC_TICKET_TABLE_WAYS];
+
+            if (picoquic_ticket_table_load(&record->referenced) == 0) {
+                empty = record;
+                break;
+            }
+            picoquic_ticket_table_store(&record->referenced, 0);
+        }
+        if (empty == NULL) {
+            empty = &group[0];
+        }
+    }
+
+    return empty;
+}
+
+int picoquic_remember_issued_ticket(picoquic_quic_t* quic,
+    uint64_t ticket_id,
+    uint64_t rtt,
+    uint64_t cwin,
+    const uint8_t* ip_addr,
+    uint8_t ip_addr_length)
+{
+    int ret = 0;
+
+    if (quic->ticket_table == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        picoquic_ticket_record_t* record = picoquic_ticket_table_select(quic->ticket_table, ticket_id);
+        uint32_t version = picoquic_ticket_table_load(&record->version);
+
+        if ((version & 1) == 0 && picoquic_ticket_table_cas(&record->version, version, version + 1)) {
+            if (ip_addr_length > PICOQUIC_STORED_IP_MAX) {
+                ip_addr_length = PICOQUIC_STORED_IP_MAX;
+            }
+            record->ticket_id = ticket_id;
+            record->rtt = (rtt > UINT32_MAX) ? UINT32_MAX : (uint32_t)rtt;
+            record->cwin = cwin;
+            record->ip_addr_length = ip_addr_length;
+            memset(record->ip_addr, 0, PICOQUIC_STORED_IP_MAX);
+            memcpy(record->ip_addr, ip_addr, ip_addr_length);
+            picoquic_ticket_table_store(&record->referenced, 1);
+            /* Skip the value 0, reserved for empty records */
+            picoquic_ticket_table_store(&record->version, (version + 2 == 0) ? 2 : version + 2);
+        }
+    }
+
+    return ret;
+}
@@ -1164,21 +1164,21 @@ int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_tick
                         picoquic_supported_versions[quic->cnx_in_progress->version_index].version, version_number);
                 }
                 else {
-                    picoquic_issued_ticket_t* server_ticket;
+                    picoquic_issued_ticket_t server_ticket;
                     dst->off += decrypted - 4;
                     picoquic_log_app_message(quic->cnx_in_progress, "%s",
                         "Session ticket properly decrypted");
                     /* Remember resumed ticket ID in connection context */
                     quic->cnx_in_progress->resumed_ticket_id = seq_num;
                     /* Remember rtt and cwin from ticket */
-                    server_ticket = picoquic_retrieve_issued_ticket(quic, seq_num);
-                    if (server_ticket != NULL && server_ticket->cwin > 0) {
+                    if (picoquic_retrieve_issued_ticket(quic, seq_num, &server_ticket) == 0 &&
+                        server_ticket.cwin > 0) {
                         picoquic_seed_bandwidth(
                             quic->cnx_in_progress,
-                            server_ticket->rtt,
-                            server_ticket->cwin,
-                            server_ticket->ip_addr,
-                            server_ticket->ip_addr_length);
+                            server_ticket.rtt,
+                            server_ticket.cwin,
+                            server_ticket.ip_addr,
+                            server_ticket.ip_addr_length);
                     }
                 }
             }
@@ -1307,6 +1307,183 @@ static int picoquic_set_pn_enc_from_secret(void ** v_pn_enc, ptls_cipher_suite_t
     return ret;
 }
 
+/* Null AEAD and null header protection, for simulations only.
+ *
+ * Large simulation sweeps spend much of their time encrypting and decrypting
+ * packets. When the quic context is set with "use_null_aead", the crypto
+ * contexts derived from the TLS secrets are replaced by null contexts. The
+ * payload is left in clear text, and a fake 16 bytes tag is appended so that
+ * packet sizes are the same as with AES-GCM. The tag is a simple hash of
+ * the key identifier, the sequence number, the header and the payload, so
+ * that corrupted packets, packets decrypted with the wrong key, and stateless
+ * resets are still rejected as with real crypto. The header protection
+ * mask is always zero.
+ *
+ * The null contexts use the same picotls structures as the real contexts,
+ * so the generic functions such as ptls_aead_free or the checks of tag size
+ * and usage limits do not need to be changed. They are recognized by their
+ * algorithm pointer in the encrypt, decrypt and header protection functions.
+ * This provides no security whatsoever, and shall never be used outside of tests.
+ */
+#define PICOQUIC_NULL_AEAD_TAG_SIZE 16
+
+static ptls_aead_algorithm_t picoquic_null_aead_algorithm = {
+    .name = "null-aead",
+    .confidentiality_limit = UINT64_MAX,
+    .integrity_limit = UINT64_MAX,
+    .key_size = 16,
+    .iv_size = 12,
+    .tag_size = PICOQUIC_NULL_AEAD_TAG_SIZE,
+    .context_size = sizeof(ptls_aead_context_t)
+};
+
+static ptls_cipher_algorithm_t picoquic_null_hp_algorithm = {
+    .name = "null-hp",
+    .key_size = 16,
+    .block_size = 1,
+    .iv_size = 16,
+    .context_size = sizeof(ptls_cipher_context_t)
+};
+
+typedef struct st_picoquic_null_aead_t {
+    ptls_aead_context_t super;
+    uint64_t key_id;
+} picoquic_null_aead_t;
+
+static void picoquic_null_aead_dispose(ptls_aead_context_t* ctx)
+{
+    UNREFERENCED_PARAMETER(ctx);
+}
+
+static void picoquic_null_hp_dispose(ptls_cipher_context_t* ctx)
+{
+    UNREFERENCED_PARAMETER(ctx);
+}
+
+static int picoquic_is_null_aead(void* aead_context)
+{
+    return ((ptls_aead_context_t*)aead_context)->algo == &picoquic_null_aead_algorithm;
+}
+
+static int picoquic_set_null_aead_from_secret(void** v_aead, ptls_cipher_suite_t* cipher, const void* secret)
+{
+    int ret = 0;
+    picoquic_null_aead_t* null_aead;
+
+    if (*v_aead != NULL) {
+        ptls_aead_free((ptls_aead_context_t*)*v_aead);
+        *v_aead = NULL;
+    }
+
+    if ((null_aead = (picoquic_null_aead_t*)malloc(sizeof(picoquic_null_aead_t))) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+    }
+    else {
+        uint8_t key_bytes[8];
+
+        memset(null_aead, 0, sizeof(picoquic_null_aead_t));
+        null_aead->super.algo = &picoquic_null_aead_algorithm;
+        null_aead->super.dispose_crypto = picoquic_null_aead_dispose;
+        /* The key identifier only needs to differ between secrets. */
+        memset(key_bytes, 0, sizeof(key_bytes));
+        memcpy(key_bytes, secret, (cipher->hash->digest_size < sizeof(key_bytes)) ? cipher->hash->digest_size : sizeof(key_bytes));
+        null_aead->key_id = PICOPARSE_64(key_bytes);
+        *v_aead = null_aead;
+    }
+
+    return ret;
+}
+
+static int picoquic_set_null_pn_enc(void** v_pn_enc)
+{
+    int ret = 0;
+    ptls_cipher_context_t* pn_enc;
+
+    if (*v_pn_enc != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t*)*v_pn_enc);
+        *v_pn_enc = NULL;
+    }
+
+    if ((pn_enc = (ptls_cipher_context_t*)malloc(sizeof(ptls_cipher_context_t))) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+    }
+    else {
+        memset(pn_enc, 0, sizeof(ptls_cipher_context_t));
+        pn_enc->algo = &picoquic_null_hp_algorithm;
+        pn_enc->do_dispose = picoquic_null_hp_dispose;
+        *v_pn_enc = pn_enc;
+    }
+
+    return ret;
+}
+
+static uint64_t picoquic_null_aead_hash(uint64_t h, const uint8_t* bytes, size_t length)
+{
+    size_t i = 0;
+
+    while (i + 8 <= length) {
+        h ^= PICOPARSE_64(bytes + i);
+        h *= 0x100000001b3ull;
+        h ^= h >> 29;
+        i += 8;
+    }
+    while (i < length) {
+        h ^= bytes[i];
+        h *= 0x100000001b3ull;
+        i++;
+    }
+    h ^= length;
+    h *= 0x9E3779B97F4A7C15ull;
+    h ^= h >> 32;
+
+    return h;
+}
+
+static void picoquic_null_aead_tag(uint8_t* tag, picoquic_null_aead_t* null_aead, uint64_t path_id, uint64_t seq_num,
+    const uint8_t* auth_data, size_t auth_data_length, const uint8_t* text, size_t text_length)
+{
+    uint64_t h = null_aead->key_id ^ (path_id * 0xC2B2AE3D27D4EB4Full) ^ (seq_num * 0x9E3779B97F4A7C15ull);
+
+    h = picoquic_null_aead_hash(h, auth_data, auth_data_length);
+    h = picoquic_null_aead_hash(h, text, text_length);
+    picoformat_64(tag, h);
+    picoformat_64(tag + 8, h ^ null_aead->key_id);
+}
+
+static size_t picoquic_null_aead_encrypt(uint8_t* output, const uint8_t* input, size_t input_length,
+    uint64_t path_id, uint64_t seq_num, const uint8_t* auth_data, size_t auth_data_length, void* aead_context)
+{
+    if (output != input) {
+        memmove(output, input, input_length);
+    }
+    picoquic_null_aead_tag(output + input_length, (picoquic_null_aead_t*)aead_context, path_id, seq_num,
+        auth_data, auth_data_length, output, input_length);
+
+    return input_length + PICOQUIC_NULL_AEAD_TAG_SIZE;
+}
+
+static size_t picoquic_null_aead_decrypt(uint8_t* output, const uint8_t* input, size_t input_length,
+    uint64_t path_id, uint64_t seq_num, const uint8_t* auth_data, size_t auth_data_length, void* aead_context)
+{
+    size_t decrypted = SIZE_MAX;
+
+    if (input_length >= PICOQUIC_NULL_AEAD_TAG_SIZE) {
+        uint8_t tag[PICOQUIC_NULL_AEAD_TAG_SIZE];
+        size_t text_length = input_length - PICOQUIC_NULL_AEAD_TAG_SIZE;
+
+        picoquic_null_aead_tag(tag, (picoquic_null_aead_t*)aead_context, path_id, seq_num,
+            auth_data, auth_data_length, input, text_length);
+        if (memcmp(tag, input + text_length, PICOQUIC_NULL_AEAD_TAG_SIZE) == 0) {
+            if (output != input) {
+                memmove(output, input, text_length);
+            }
+            decrypted = text_length;
+        }
+    }
+
+    return decrypted;
+}
+
 void picoquic_aes128_ecb_free(void * v_aesecb)
 {
     ptls_cipher_free((ptls_cipher_context_t *)v_aesecb);
@@ -1317,11 +1494,17 @@ void picoquic_aes128_ecb_encrypt(void* v_aesecb, uint8_t * output, const uint8_t
     ptls_cipher_encrypt((ptls_cipher_context_t*)v_aesecb, output, input, len);
 }
 
-static int picoquic_set_key_from_secret(ptls_cipher_suite_t * cipher, int is_enc, int is_rotation, picoquic_crypto_context_t * ctx, const void *secret, const char *prefix_label)
+static int picoquic_set_key_from_secret(ptls_cipher_suite_t * cipher, int is_enc, int is_rotation, int use_null_aead, picoquic_crypto_context_t * ctx, const void *secret, const char *prefix_label)
 {
     int ret = 0;
 
-    if (is_enc != 0) {
+    if (use_null_aead) {
+        ret = picoquic_set_null_aead_from_secret((is_enc) ? &ctx->aead_encrypt : &ctx->aead_decrypt, cipher, secret);
+
+        if (ret == 0 && !is_rotation) {
+            ret = picoquic_set_null_pn_enc((is_enc) ? &ctx->pn_enc : &ctx->pn_dec);
+        }
+    } else if (is_enc != 0) {
         ret = picoquic_set_aead_from_secret(&ctx->aead_encrypt, cipher, is_enc, secret, prefix_label);
         
         if (ret == 0 && !is_rotation) {
@@ -1374,7 +1557,7 @@ static int picoquic_update_traffic_key_callback(ptls_update_traffic_key_t * self
     UNREFERENCED_PARAMETER(self);
     const char *prefix_label = picoquic_supported_versions[cnx->version_index].tls_prefix_label;
 
-    int ret = picoquic_set_key_from_secret(cipher, is_enc, 0, &cnx->crypto_context[epoch], secret, prefix_label);
+    int ret = picoquic_set_key_from_secret(cipher, is_enc, 0, cnx->quic->use_null_aead, &cnx->crypto_context[epoch], secret, prefix_label);
     if (cnx->cnx_state < picoquic_state_ready) {
         cnx->recycle_sooner_needed = 1;
     }
@@ -1489,10 +1672,10 @@ int picoquic_setup_initial_traffic_keys(picoquic_cnx_t* cnx)
             secret2 = server_secret;
         }
         
-        ret = picoquic_set_key_from_secret(cipher, 1, 0, &cnx->crypto_context[0], secret1, prefix_label);
+        ret = picoquic_set_key_from_secret(cipher, 1, 0, cnx->quic->use_null_aead, &cnx->crypto_context[0], secret1, prefix_label);
 
         if (ret == 0) {
-            ret = picoquic_set_key_from_secret(cipher, 0, 0, &cnx->crypto_context[0], secret2, prefix_label);
+            ret = picoquic_set_key_from_secret(cipher, 0, 0, cnx->quic->use_null_aead, &cnx->crypto_context[0], secret2, prefix_label);
         }
     }
 
@@ -1580,7 +1763,7 @@ int picoquic_compute_new_rotated_keys(picoquic_cnx_t * cnx)
     }
 
     if (ret == 0) {
-        ret = picoquic_set_key_from_secret(cipher, 1, 1, &cnx->crypto_context_new, tls_ctx->app_secret_enc, prefix_label);
+        ret = picoquic_set_key_from_secret(cipher, 1, 1, cnx->quic->use_null_aead, &cnx->crypto_context_new, tls_ctx->app_secret_enc, prefix_label);
     }
 
     if (ret == 0) {
@@ -1598,7 +1781,7 @@ int picoquic_compute_new_rotated_keys(picoquic_cnx_t * cnx)
     }
 
     if (ret == 0) {
-        ret = picoquic_set_key_from_secret(cipher, 0, 1, &cnx->crypto_context_new, tls_ctx->app_secret_dec, prefix_label);
+        ret = picoquic_set_key_from_secret(cipher, 0, 1, cnx->quic->use_null_aead, &cnx->crypto_context_new, tls_ctx->app_secret_dec, prefix_label);
     }
 
     return (ret == 0)?0: PICOQUIC_ERROR_CANNOT_COMPUTE_KEY;
@@ -1615,6 +1798,7 @@ void picoquic_apply_rotated_keys(picoquic_cnx_t * cnx, int is_enc)
         cnx->crypto_context_new.aead_encrypt = NULL;
 
         cnx->key_phase_enc ^= 1;
+        cnx->crypto_key_packets_enc = 0;
         picoquic_log_pn_dec_trial(cnx);
     }
     else {
@@ -1630,6 +1814,35 @@ void picoquic_apply_rotated_keys(picoquic_cnx_t * cnx, int is_enc)
     }
 }
 
+/*
+ * Prepare the next key rotation in advance.
+ *
+ * This is called from the sender loop when the connection is ready. Once the
+ * previous rotation is complete, the keys of the next generation are derived
+ * and kept in the new crypto context, so that a rotation initiated by either
+ * peer only has to swap the contexts, without running the key derivation on
+ * the packet decryption path. The old decryption key is retired when the
+ * rotation time guard expires, since packets received with the old key phase
+ * are ignored after that time.
+ */
+void picoquic_prepare_next_rotated_keys(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    if (current_time > cnx->crypto_rotation_time_guard &&
+        cnx->crypto_context_old.aead_decrypt != NULL) {
+        picoquic_crypto_context_free(&cnx->crypto_context_old);
+    }
+
+    if (cnx->cnx_state == picoquic_state_ready &&
+        cnx->crypto_context[picoquic_epoch_1rtt].aead_encrypt != NULL &&
+        cnx->crypto_context[picoquic_epoch_1rtt].aead_decrypt != NULL &&
+        cnx->crypto_context_new.aead_encrypt == NULL &&
+        cnx->crypto_context_new.aead_decrypt == NULL) {
+        /* On failure, the partial context causes the next rotation to fail,
+         * which is the same outcome as computing the keys on demand. */
+        (void)picoquic_compute_new_rotated_keys(cnx);
+    }
+}
+
 /*
  * Release the crypto context, and the associated keys.
  */
@@ -2350,8 +2563,16 @@ size_t picoquic_pn_iv_size(void *pn_enc)
 
 void picoquic_pn_encrypt(void *pn_enc, const void * iv, void *output, const void *input, size_t len)
 {
-    ptls_cipher_init((ptls_cipher_context_t *) pn_enc, iv);
-    ptls_cipher_encrypt((ptls_cipher_context_t *) pn_enc, output, input, len);
+    if (((ptls_cipher_context_t*)pn_enc)->algo == &picoquic_null_hp_algorithm) {
+        /* Null header protection: the mask is the input, i.e., all zeroes. */
+        if (output != input) {
+            memmove(output, input, len);
+        }
+    }
+    else {
+        ptls_cipher_init((ptls_cipher_context_t*)pn_enc, iv);
+        ptls_cipher_encrypt((ptls_cipher_context_t*)pn_enc, output, input, len);
+    }
 }
 
 /* Utility functions, so applications do not have to load picotls.h */
@@ -2432,6 +2653,8 @@ size_t picoquic_aead_decrypt_generic(uint8_t* output, const uint8_t* input, size
 
     if (aead_ctx == NULL) {
         decrypted = SIZE_MAX;
+    } else if (picoquic_is_null_aead(aead_ctx)) {
+        decrypted = picoquic_null_aead_decrypt(output, input, input_length, 0, seq_num, auth_data, auth_data_length, aead_ctx);
     } else {
         decrypted = ptls_aead_decrypt((ptls_aead_context_t*)aead_ctx,
             (void*)output, (const void*)input, input_length, seq_num,
@@ -2446,9 +2669,14 @@ size_t picoquic_aead_encrypt_generic(uint8_t* output, const uint8_t* input, size
 {
     size_t encrypted = 0;
 
-    encrypted = ptls_aead_encrypt((ptls_aead_context_t*)aead_context,
-        (void*)output, (const void*)input, input_length, seq_num,
-        (void*)auth_data, auth_data_length);
+    if (picoquic_is_null_aead(aead_context)) {
+        encrypted = picoquic_null_aead_encrypt(output, input, input_length, 0, seq_num, auth_data, auth_data_length, aead_context);
+    }
+    else {
+        encrypted = ptls_aead_encrypt((ptls_aead_context_t*)aead_context,
+            (void*)output, (const void*)input, input_length, seq_num,
+            (void*)auth_data, auth_data_length);
+    }
 
     return encrypted;
 }
@@ -2461,6 +2689,9 @@ size_t picoquic_aead_decrypt_mp(uint8_t* output, const uint8_t* input, size_t in
     if (aead_context == NULL) {
         decrypted = SIZE_MAX;
     }
+    else if (picoquic_is_null_aead(aead_context)) {
+        decrypted = picoquic_null_aead_decrypt(output, input, input_length, path_id, seq_num, auth_data, auth_data_length, aead_context);
+    }
     else {
         uint8_t seq32[4];
 
@@ -2479,14 +2710,20 @@ size_t picoquic_aead_encrypt_mp(uint8_t* output, const uint8_t* input, size_t in
     uint64_t path_id, uint64_t seq_num, const uint8_t* auth_data, size_t auth_data_length, void* aead_context)
 {
     size_t encrypted = 0;
-    uint8_t seq32[4];
-
-    picoformat_32(seq32, (uint32_t)path_id);
-    ptls_aead_xor_iv((ptls_aead_context_t*)aead_context, seq32, sizeof(seq32));
-    encrypted = ptls_aead_encrypt((ptls_aead_context_t*)aead_context,
-        (void*)output, (const void*)input, input_length, seq_num,
-        (void*)auth_data, auth_data_length);
-    ptls_aead_xor_iv((ptls_aead_context_t*)aead_context, seq32, sizeof(seq32));
+
+    if (picoquic_is_null_aead(aead_context)) {
+        encrypted = picoquic_null_aead_encrypt(output, input, input_length, path_id, seq_num, auth_data, auth_data_length, aead_context);
+    }
+    else {
+        uint8_t seq32[4];
+
+        picoformat_32(seq32, (uint32_t)path_id);
+        ptls_aead_xor_iv((ptls_aead_context_t*)aead_context, seq32, sizeof(seq32));
+        encrypted = ptls_aead_encrypt((ptls_aead_context_t*)aead_context,
+            (void*)output, (const void*)input, input_length, seq_num,
+            (void*)auth_data, auth_data_length);
+        ptls_aead_xor_iv((ptls_aead_context_t*)aead_context, seq32, sizeof(seq32));
+    }
 
     return encrypted;
 }
@@ -0,0 +1,250 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Fixed memory anti-replay filter for tokens and tickets.
+ *
+ * The default token register keeps one node per token in a splay tree, which
+ * grows with the number of connections. The filter replaces it with a set of
+ * Bloom filters of fixed size, one per "generation". A token is recorded in
+ * the generation of its expiry time, i.e., expiry_time / lifetime. Tokens are
+ * only accepted before they expire, and their expiry is at most "lifetime"
+ * after the current time, so only the generations of the current and next
+ * periods are live. With three generations, the slot used by a new generation
+ * was last used by an expired generation, and can be cleared.
+ *
+ * The filter is a single block of memory without pointers, so that it can be
+ * placed in memory shared between threads or processes. Bits are set with
+ * atomic operations. The worker that recycles a generation marks it as busy
+ * while the bits are cleared; tokens that fall in a busy generation are
+ * refused, which is safe since the client will fall back to a full handshake.
+ * Two presentations of the same token processed at the same instant by two
+ * workers may both be accepted; all other replays are detected.
+ */
+
+#include "picoquic_internal.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WINDOWS
+#include <intrin.h>
+#endif
+
+#define PICOQUIC_TOKEN_FILTER_GENERATIONS 3
+#define PICOQUIC_TOKEN_FILTER_BUSY UINT64_MAX
+#define PICOQUIC_TOKEN_FILTER_MAX_HASHES 32
+#define PICOQUIC_TOKEN_FILTER_MAX_BITS (1ull << 40)
+
+typedef struct st_picoquic_token_filter_t {
+    uint64_t lifetime;
+    uint64_t nb_bits; /* Bits per generation, power of 2 */
+    uint64_t nb_hashes;
+    uint64_t generation[PICOQUIC_TOKEN_FILTER_GENERATIONS];
+} picoquic_token_filter_t;
+
+#ifdef _WINDOWS
+#define picoquic_token_filter_fetch_or(p, v) ((uint64_t)_InterlockedOr64((volatile __int64*)(p), (__int64)(v)))
+#define picoquic_token_filter_load(p) ((uint64_t)_InterlockedOr64((volatile __int64*)(p), 0))
+#define picoquic_token_filter_store(p, v) ((void)_InterlockedExchange64((volatile __int64*)(p), (__int64)(v)))
+static int picoquic_token_filter_cas(uint64_t* p, uint64_t expected, uint64_t desired)
+{
+    return (uint64_t)_InterlockedCompareExchange64((volatile __int64*)p, (__int64)desired, (__int64)expected) == expected;
+}
+#else
+#define picoquic_token_filter_fetch_or(p, v) __atomic_fetch_or((p), (v), __ATOMIC_SEQ_CST)
+#define picoquic_token_filter_load(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define picoquic_token_filter_store(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+static int picoquic_token_filter_cas(uint64_t* p, uint64_t expected, uint64_t desired)
+{
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#endif
+
+/* The optimal number of hash functions for a false positive rate p is
+ * log2(1/p), and the optimal number of bits per entry is that number
+ * divided by ln(2). Each token is checked against a single generation,
+ * so the rate applies directly. The number of bits is rounded up to a
+ * power of 2, which can only lower the false positive rate.
+ */
+static int picoquic_token_filter_dimension(size_t nb_tokens_max, double false_positive_rate,
+    uint64_t* nb_bits, uint64_t* nb_hashes)
+{
+    int ret = 0;
+
+    if (nb_tokens_max == 0 || !(false_positive_rate > 0.0 && false_positive_rate < 1.0)) {
+        ret = -1;
+    }
+    else {
+        double p = 0.5;
+        double bits_needed;
+        uint64_t k = 1;
+        uint64_t m = 64;
+
+        while (p > false_positive_rate && k < PICOQUIC_TOKEN_FILTER_MAX_HASHES) {
+            p /= 2.0;
+            k++;
+        }
+        bits_needed = ((double)nb_tokens_max) * ((double)k) * 1.4427;
+        while ((double)m < bits_needed && m < PICOQUIC_TOKEN_FILTER_MAX_BITS) {
+            m <<= 1;
+        }
+        if ((double)m < bits_needed) {
+            ret = -1;
+        }
+        else {
+            *nb_bits = m;
+            *nb_hashes = k;
+        }
+    }
+
+    return ret;
+}
+
+static uint64_t* picoquic_token_filter_bits(picoquic_token_filter_t* filter, size_t slot)
+{
+    return ((uint64_t*)(filter + 1)) + slot * (filter->nb_bits / 64);
+}
+
+size_t picoquic_token_filter_memory_size(size_t nb_tokens_max, double false_positive_rate)
+{
+    uint64_t nb_bits = 0;
+    uint64_t nb_hashes = 0;
+    size_t memory_size = 0;
+
+    if (picoquic_token_filter_dimension(nb_tokens_max, false_positive_rate, &nb_bits, &nb_hashes) == 0) {
+        memory_size = sizeof(picoquic_token_filter_t) + PICOQUIC_TOKEN_FILTER_GENERATIONS * (size_t)(nb_bits / 8);
+    }
+
+    return memory_size;
+}
+
+int picoquic_token_filter_init(void* memory, size_t memory_size, size_t nb_tokens_max,
+    double false_positive_rate, uint64_t lifetime)
+{
+    int ret = 0;
+    picoquic_token_filter_t* filter = (picoquic_token_filter_t*)memory;
+    size_t required = picoquic_token_filter_memory_size(nb_tokens_max, false_positive_rate);
+
+    if (memory == NULL || required == 0 || memory_size < required) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        memset(memory, 0, required);
+        (void)picoquic_token_filter_dimension(nb_tokens_max, false_positive_rate, &filter->nb_bits, &filter->nb_hashes);
+        filter->lifetime = (lifetime == 0) ? PICOQUIC_TOKEN_DELAY_LONG : lifetime;
+    }
+
+    return ret;
+}
+
+int picoquic_set_token_filter(picoquic_quic_t* quic, size_t nb_tokens_max, double false_positive_rate, uint64_t lifetime)
+{
+    int ret = 0;
+    size_t memory_size = picoquic_token_filter_memory_size(nb_tokens_max, false_positive_rate);
+    void* memory = (memory_size == 0) ? NULL : malloc(memory_size);
+
+    if (memory == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else if ((ret = picoquic_token_filter_init(memory, memory_size, nb_tokens_max, false_positive_rate, lifetime)) != 0) {
+        free(memory);
+    }
+    else {
+        picoquic_token_filter_free(quic);
+        quic->token_filter = (picoquic_token_filter_t*)memory;
+        quic->is_token_filter_owned = 1;
+    }
+
+    return ret;
+}
+
+void picoquic_set_shared_token_filter(picoquic_quic_t* quic, void* memory)
+{
+    picoquic_token_filter_free(quic);
+    quic->token_filter = (picoquic_token_filter_t*)memory;
+    quic->is_token_filter_owned = 0;
+}
+
+void picoquic_token_filter_free(picoquic_quic_t* quic)
+{
+    if (quic->token_filter != NULL && quic->is_token_filter_owned) {
+        free(quic->token_filter);
+    }
+    quic->token_filter = NULL;
+    quic->is_token_filter_owned = 0;
+}
+
+/* Derive two independent 64 bit hashes from the token hash and the expiry
+ * time, using the splitmix64 finalizer. The k bit positions are then
+ * computed by double hashing, h1 + i*h2.
+ */
+static uint64_t picoquic_token_filter_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+/* Check whether the token was already seen, and record it.
+ * Returns 0 if the token is new, -1 if it was seen before or cannot be
+ * recorded.
+ */
+int picoquic_token_filter_check_reuse(picoquic_token_filter_t* filter, uint64_t token_hash,
+    uint64_t expiry_time, uint64_t current_time)
+{
+    int ret = -1;
+    uint64_t epoch = expiry_time / filter->lifetime;
+    uint64_t current_epoch = current_time / filter->lifetime;
+    size_t slot = (size_t)(epoch % PICOQUIC_TOKEN_FILTER_GENERATIONS);
+    uint64_t slot_epoch = picoquic_token_filter_load(&filter->generation[slot]);
+
+    if (epoch + 1 < current_epoch + PICOQUIC_TOKEN_FILTER_GENERATIONS && slot_epoch != PICOQUIC_TOKEN_FILTER_BUSY) {
+        uint64_t* bits = picoquic_token_filter_bits(filter, slot);
+
+        if (slot_epoch < epoch) {
+            /* The slot holds an expired generation. Reset it. */
+            if (picoquic_token_filter_cas(&filter->generation[slot], slot_epoch, PICOQUIC_TOKEN_FILTER_BUSY)) {
+                memset(bits, 0, (size_t)(filter->nb_bits / 8));
+                picoquic_token_filter_store(&filter->generation[slot], epoch);
+            }
+            slot_epoch = picoquic_token_filter_load(&filter->generation[slot]);
+        }
+
+        if (slot_epoch == epoch) {
+            uint64_t h1 = picoquic_token_filter_mix(token_hash ^ picoquic_token_filter_mix(expiry_time));
+            uint64_t h2 = picoquic_token_filter_mix(h1) | 1;
+            uint64_t mask = filter->nb_bits - 1;
+
+            for (uint64_t i = 0; i < filter->nb_hashes; i++) {
+                uint64_t bit = (h1 + i * h2) & mask;
+                uint64_t flag = 1ull << (bit & 63);
+                if ((picoquic_token_filter_fetch_or(&bits[bit >> 6], flag) & flag) == 0) {
+                    ret = 0;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
@@ -475,7 +475,7 @@ int picoquic_prepare_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
 
     if (!cnx->client_mode && cnx->local_parameters.max_datagram_frame_size == 0 &&
         cnx->remote_parameters.max_datagram_frame_size > 0) {
-        cnx->local_parameters.max_datagram_frame_size = PICOQUIC_MAX_PACKET_SIZE;
+        cnx->local_parameters.max_datagram_frame_size = (uint32_t)cnx->quic->packet_buffer_size;
     }
 
     if (cnx->local_parameters.max_datagram_frame_size > 0 && bytes != NULL) {
@@ -441,7 +441,7 @@ int picoquic_packet_loop_win(picoquic_quic_t* quic,
 
     /* Create a list of contexts for sending packets */
     if (ret == 0) {
-        size_t send_buffer_size = PICOQUIC_MAX_PACKET_SIZE;
+        size_t send_buffer_size = quic->packet_buffer_size;
         if (sock_ctx[0]->supports_udp_send_coalesced) {
             send_buffer_size *= 10;
         }
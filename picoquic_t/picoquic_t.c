@@ -77,11 +77,13 @@ static const picoquic_test_def_t test_table[] = {
     { "ack_horizon", ack_horizon_test },
     { "ack_of_ack", ack_of_ack_test },
     { "sim_link", sim_link_test },
+    { "sim_dualq", sim_dualq_test },
     { "clear_text_aead", cleartext_aead_test },
     { "pn_ctr", pn_ctr_test },
     { "cleartext_pn_enc", cleartext_pn_enc_test },
     { "cid_for_lb", cid_for_lb_test },
     { "cid_for_lb_cli", cid_for_lb_cli_test },
+    { "cid_steering", cid_steering_test },
     { "retry_protection_vector", retry_protection_vector_test },
     { "retry_protection_v2", retry_protection_v2_test },
     { "draft17_vector", draft17_vector_test },
@@ -93,6 +95,10 @@ static const picoquic_test_def_t test_table[] = {
     { "new_cnxid_stash", cnxid_stash_test },
     { "new_cnxid", new_cnxid_test },
     { "pacing", pacing_test },
+    { "pacing_gap", pacing_gap_test },
+    { "pacing_coalescing", pacing_coalescing_test },
+    { "wake_coalescing", wake_coalescing_test },
+    { "wake_batch", wake_batch_test },
 #if 0
     /* The TLS API connect test is only useful when debugging issues step by step */
     { "tls_api_connect", tls_api_connect_test },
@@ -160,12 +166,16 @@ static const picoquic_test_def_t test_table[] = {
     { "netperf_bbr", netperf_bbr_test },
     { "nat_attack", nat_attack_test },
     { "sockets", socket_test },
+    { "sockloop_busy_poll", sockloop_busy_poll_test },
     { "socket_ecn", socket_ecn_test },
     { "ticket_store", ticket_store_test },
     { "ticket_seed", ticket_seed_test },
     { "ticket_seed_from_bdp_frame", ticket_seed_from_bdp_frame_test },
     { "token_store", token_store_test },
     { "token_reuse_api", token_reuse_api_test },
+    { "token_filter", token_filter_test },
+    { "ticket_table", ticket_table_test },
+    { "path_bdp_cache", path_bdp_cache_test },
     { "session_resume", session_resume_test },
     { "zero_rtt", zero_rtt_test },
     { "zero_rtt_loss", zero_rtt_loss_test },
@@ -177,6 +187,11 @@ static const picoquic_test_def_t test_table[] = {
     { "mtu_delayed", mtu_delayed_test },
     { "mtu_required", mtu_required_test },
     { "mtu_max", mtu_max_test },
+    { "mtu_cache", mtu_cache_test },
+    { "mtu_black_hole", mtu_black_hole_test },
+    { "mtu_bisect", mtu_bisect_test },
+    { "mtu_cache_learn", mtu_cache_learn_test },
+    { "jumbo", jumbo_test },
     { "mtu_drop", mtu_drop_test },
     { "red_cc", red_cc_test },
     { "multi_segment", multi_segment_test },
@@ -233,12 +248,18 @@ static const picoquic_test_def_t test_table[] = {
     { "initial_server_close", initial_server_close_test },
     { "new_rotated_key", new_rotated_key_test },
     { "key_rotation", key_rotation_test },
+    { "key_rotation_precompute", key_rotation_precompute_test },
     { "key_rotation_server", key_rotation_auto_server },
     { "key_rotation_client", key_rotation_auto_client },
     { "false_migration", false_migration_test },
     { "nat_handshake", nat_handshake_test },
     { "key_rotation_vector", key_rotation_vector_test },
     { "key_rotation_stress", key_rotation_stress_test },
+    { "key_rotation_aead_limit", key_rotation_aead_limit_test },
+    { "stage_stats", stage_stats_test },
+    { "null_aead", null_aead_test },
+    { "handshake_packing", handshake_packing_test },
+    { "early_data", early_data_test },
     { "short_initial_cid", short_initial_cid_test },
     { "stream_id_max", stream_id_max_test },
     { "padding_test", padding_test },
@@ -246,7 +267,9 @@ static const picoquic_test_def_t test_table[] = {
     { "qlog_trace", qlog_trace_test },
     { "qlog_trace_auto", qlog_trace_auto_test },
     { "qlog_trace_only", qlog_trace_only_test },
+    { "qlog_trace_sync", qlog_trace_sync_test },
     { "qlog_trace_ecn", qlog_trace_ecn_test },
+    { "binlog_replay", binlog_replay_test },
     { "path_packet_queue", path_packet_queue_test },
     { "perflog", perflog_test },
     { "nat_rebinding_stress", rebinding_stress_test },
@@ -279,6 +302,15 @@ static const picoquic_test_def_t test_table[] = {
     { "bbr_asym400", bbr_asym400_test },
     { "l4s_reno", l4s_reno_test },
     { "l4s_prague", l4s_prague_test },
+    { "l4s_dualq_prague", l4s_dualq_prague_test },
+    { "l4s_dualq_cubic", l4s_dualq_cubic_test },
+    { "l4s_dualq_bbr", l4s_dualq_bbr_test },
+    { "l4s_dualq_coexist", l4s_dualq_coexist_test },
+    { "l4s_dualq_coexist_bbr", l4s_dualq_coexist_bbr_test },
+    { "cc_telemetry", cc_telemetry_test },
+    { "cc_experiment", cc_experiment_test },
+    { "cc_hystart_pp", cc_hystart_pp_test },
+    { "cc_careful_resume", cc_careful_resume_test },
     { "long_rtt", long_rtt_test },
     { "high_latency_basic", high_latency_basic_test },
     { "high_latency_bbr", high_latency_bbr_test },
@@ -300,6 +332,10 @@ static const picoquic_test_def_t test_table[] = {
     { "bdp_ip", bdp_ip_test },
     { "bdp_rtt", bdp_rtt_test },
     { "bdp_reno", bdp_reno_test },
+    { "bdp_prague", bdp_prague_test },
+    { "bdp_hystart_pp", bdp_hystart_pp_test },
+    { "resume_first_mb", resume_first_mb_test },
+    { "path_bdp_upload", path_bdp_upload_test },
 #if 0
     { "bdp_cubic", bdp_cubic_test },
 #endif
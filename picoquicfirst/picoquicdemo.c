@@ -368,6 +368,7 @@ int quic_server(const char* server_name, picoquic_quic_config_t * config, int ju
     if (qserver != NULL) {
         picoquic_free(qserver);
     }
+    h3zero_server_parameters_release(&picoquic_file_param);
 
     return ret;
 }
@@ -0,0 +1,247 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "picoquic_internal.h"
+#include "picoquictest_internal.h"
+#include "cc_common.h"
+
+/* Unit tests of the shared slow start module. The tests use a bare
+ * connection context, and drive the path packet numbers directly in order
+ * to simulate the succession of rounds.
+ */
+
+static int cc_slow_start_test_cnx(picoquic_quic_t** quic, picoquic_cnx_t** cnx)
+{
+    int ret = 0;
+    struct sockaddr_in test_addr;
+
+    *cnx = NULL;
+    *quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, 0, NULL, NULL, NULL, 0);
+    if (*quic == NULL) {
+        DBG_PRINTF("%s", "Could not create Quic context.\n");
+        ret = -1;
+    }
+    else {
+        memset(&test_addr, 0, sizeof(struct sockaddr_in));
+        test_addr.sin_family = AF_INET;
+        test_addr.sin_port = 4433;
+        *cnx = picoquic_create_cnx(*quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&test_addr, 0, 0, NULL, NULL, 1);
+        if (*cnx == NULL) {
+            DBG_PRINTF("%s", "Could not create connection context.\n");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* Feed one round of RTT samples. Returns the value of the last slow start test */
+static int cc_slow_start_test_round(picoquic_cc_slow_start_t* slow_start, picoquic_min_max_rtt_t* rtt_filter,
+    picoquic_cnx_t* cnx, int round_index, uint64_t rtt, uint64_t* current_time)
+{
+    int ret = 0;
+    picoquic_path_t* path_x = cnx->path[0];
+
+    /* All packets of the previous round are acked, a new batch is sent */
+    path_x->path_packet_acked_number = (uint64_t)round_index * 100;
+    path_x->path_packet_number = (uint64_t)(round_index + 1) * 100;
+
+    for (int i = 0; ret == 0 && i < PICOQUIC_HYSTART_PP_N_RTT_SAMPLE; i++) {
+        *current_time += 2000;
+        ret = picoquic_cc_slow_start_test(slow_start, rtt_filter, cnx, path_x, rtt, 0, *current_time);
+    }
+
+    return ret;
+}
+
+int cc_hystart_pp_test()
+{
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_cc_slow_start_t slow_start;
+    picoquic_min_max_rtt_t rtt_filter;
+    uint64_t current_time = 0;
+    int round_index = 0;
+    int ret = cc_slow_start_test_cnx(&quic, &cnx);
+
+    if (ret == 0) {
+        cnx->is_hystart_pp_enabled = 1;
+        memset(&rtt_filter, 0, sizeof(rtt_filter));
+        picoquic_cc_slow_start_reset(&slow_start);
+
+        /* Stable RTT, stay in slow start */
+        for (; ret == 0 && round_index < 3; round_index++) {
+            if (cc_slow_start_test_round(&slow_start, &rtt_filter, cnx, round_index, 50000, &current_time) != 0 ||
+                slow_start.hpp_state != picoquic_hystart_pp_slow_start) {
+                DBG_PRINTF("Unexpected exit from slow start, round_index %d\n", round_index);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* RTT increases by 10ms, more than the 6.25ms threshold: enter CSS */
+        if (cc_slow_start_test_round(&slow_start, &rtt_filter, cnx, round_index, 60000, &current_time) != 0 ||
+            slow_start.hpp_state != picoquic_hystart_pp_css) {
+            DBG_PRINTF("%s", "Conservative slow start not entered\n");
+            ret = -1;
+        }
+        else if (picoquic_cc_slow_start_increment(&slow_start, 4000) != 1000 ||
+            picoquic_cc_slow_start_increment(&slow_start, 1001) != 250 ||
+            picoquic_cc_slow_start_increment(&slow_start, 3) != 1) {
+            DBG_PRINTF("%s", "Unexpected CSS increment\n");
+            ret = -1;
+        }
+        round_index++;
+    }
+
+    if (ret == 0) {
+        /* RTT decreases below the baseline: back to slow start */
+        if (cc_slow_start_test_round(&slow_start, &rtt_filter, cnx, round_index, 50000, &current_time) != 0 ||
+            slow_start.hpp_state != picoquic_hystart_pp_slow_start) {
+            DBG_PRINTF("%s", "Slow start not resumed\n");
+            ret = -1;
+        }
+        else if (picoquic_cc_slow_start_increment(&slow_start, 4000) != 4000) {
+            DBG_PRINTF("%s", "Unexpected slow start increment\n");
+            ret = -1;
+        }
+        round_index++;
+    }
+
+    if (ret == 0) {
+        /* RTT increases again, and stays high: exit after CSS rounds */
+        int nb_css_rounds = 0;
+
+        if (cc_slow_start_test_round(&slow_start, &rtt_filter, cnx, round_index, 60000, &current_time) != 0 ||
+            slow_start.hpp_state != picoquic_hystart_pp_css) {
+            DBG_PRINTF("%s", "Conservative slow start not entered again\n");
+            ret = -1;
+        }
+        round_index++;
+
+        while (ret == 0 && slow_start.hpp_state == picoquic_hystart_pp_css) {
+            int exit_ss = cc_slow_start_test_round(&slow_start, &rtt_filter, cnx, round_index, 60000, &current_time);
+            nb_css_rounds++;
+            round_index++;
+            if (exit_ss != (slow_start.hpp_state == picoquic_hystart_pp_done)) {
+                DBG_PRINTF("%s", "Exit signal does not match HyStart++ state\n");
+                ret = -1;
+            }
+            else if (nb_css_rounds > PICOQUIC_HYSTART_PP_CSS_ROUNDS) {
+                DBG_PRINTF("%s", "Conservative slow start lasts too long\n");
+                ret = -1;
+            }
+        }
+
+        if (ret == 0 && nb_css_rounds != PICOQUIC_HYSTART_PP_CSS_ROUNDS) {
+            DBG_PRINTF("Exit after %d CSS rounds, expected %d\n", nb_css_rounds, PICOQUIC_HYSTART_PP_CSS_ROUNDS);
+            ret = -1;
+        }
+    }
+
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+int cc_careful_resume_test()
+{
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_cc_slow_start_t slow_start;
+    uint64_t current_time = 1000000;
+    uint64_t retreat_cwin = 0;
+    int ret = cc_slow_start_test_cnx(&quic, &cnx);
+
+    if (ret == 0) {
+        picoquic_path_t* path_x = cnx->path[0];
+
+        picoquic_cc_slow_start_reset(&slow_start);
+        path_x->cwin = PICOQUIC_CWIN_INITIAL;
+        path_x->smoothed_rtt = 100000;
+        path_x->delivered = 10000;
+        path_x->path_packet_number = 10;
+
+        if (picoquic_cc_careful_resume_seed(&slow_start, cnx, path_x, 100000, current_time) != 100000 ||
+            slow_start.cr_state != picoquic_careful_resume_unvalidated) {
+            DBG_PRINTF("%s", "Seed not applied\n");
+            ret = -1;
+        }
+        else if (picoquic_cc_careful_resume_seed(&slow_start, cnx, path_x, 200000, current_time) != path_x->cwin) {
+            DBG_PRINTF("%s", "Seed applied twice\n");
+            ret = -1;
+        }
+        else if (picoquic_cc_careful_resume_retreat(&slow_start, cnx, path_x, 5, current_time + 50000, &retreat_cwin)) {
+            DBG_PRINTF("%s", "Retreat on loss of packet sent before the jump\n");
+            ret = -1;
+        }
+        else {
+            path_x->delivered += 40000;
+            if (!picoquic_cc_careful_resume_retreat(&slow_start, cnx, path_x, 12, current_time + 150000, &retreat_cwin)) {
+                DBG_PRINTF("%s", "No retreat during validation\n");
+                ret = -1;
+            }
+            else if (retreat_cwin != 20000) {
+                DBG_PRINTF("Retreat to %" PRIu64 ", expected 20000\n", retreat_cwin);
+                ret = -1;
+            }
+            else if (slow_start.cr_state != picoquic_careful_resume_normal ||
+                picoquic_cc_careful_resume_retreat(&slow_start, cnx, path_x, 13, current_time + 160000, &retreat_cwin)) {
+                DBG_PRINTF("%s", "Retreat repeated\n");
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* Losses after the validation period do not cause a retreat */
+        picoquic_path_t* path_x = cnx->path[0];
+
+        picoquic_cc_slow_start_reset(&slow_start);
+        (void)picoquic_cc_careful_resume_seed(&slow_start, cnx, path_x, 100000, current_time);
+        if (picoquic_cc_careful_resume_retreat(&slow_start, cnx, path_x, 12, current_time + 250000, &retreat_cwin) ||
+            slow_start.cr_state != picoquic_careful_resume_normal) {
+            DBG_PRINTF("%s", "Unexpected retreat after validation\n");
+            ret = -1;
+        }
+    }
+
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
@@ -0,0 +1,207 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2022, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "picoquic_internal.h"
+#include "picoquictest_internal.h"
+#include "tls_api.h"
+
+static test_api_stream_desc_t test_scenario_cc_telemetry[] = {
+    { 4, 0, 257, 1000000 },
+    { 8, 4, 257, 1000000 }
+};
+
+/* Verify that the telemetry ring records state changes and samples, that
+ * events are ordered in time, and that the ring wraps around when it is
+ * not drained fast enough. */
+int cc_telemetry_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t sample_interval = 10000;
+    size_t ring_size = 16;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_connection_id_t initial_cid = { {0xcc, 0x7e, 0, 0, 0, 0, 0, 0}, 8 };
+    picoquic_cc_event_t events[16];
+    size_t nb_events = 0;
+    uint64_t nb_lost = 0;
+    int ret = tls_api_init_ctx_ex(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0, &initial_cid);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, picoquic_bbr_algorithm);
+        picoquic_set_default_cc_telemetry(test_ctx->qserver, ring_size, sample_interval);
+
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_cc_telemetry, sizeof(test_scenario_cc_telemetry), 0, 0, 0, 20000, 2000000);
+    }
+
+    if (ret == 0 && test_ctx->cnx_server == NULL) {
+        DBG_PRINTF("%s", "Cannot assess server connection");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        nb_events = picoquic_get_cc_events(test_ctx->cnx_server, events, ring_size, &nb_lost);
+        if (nb_events != ring_size) {
+            DBG_PRINTF("Expected %zu events, got %zu", ring_size, nb_events);
+            ret = -1;
+        }
+        else if (nb_lost == 0) {
+            DBG_PRINTF("%s", "Expected the telemetry ring to wrap around");
+            ret = -1;
+        }
+        else if (picoquic_get_cc_events(test_ctx->cnx_server, events, ring_size, NULL) != 0) {
+            DBG_PRINTF("%s", "Telemetry ring not drained");
+            ret = -1;
+        }
+        else {
+            for (size_t i = 1; ret == 0 && i < nb_events; i++) {
+                if (events[i].event_time < events[i - 1].event_time) {
+                    DBG_PRINTF("Event %zu out of order", i);
+                    ret = -1;
+                }
+                else if (events[i].event_type == picoquic_cc_event_sample &&
+                    events[i].unique_path_id == events[i - 1].unique_path_id &&
+                    events[i - 1].event_type == picoquic_cc_event_sample &&
+                    events[i].event_time < events[i - 1].event_time + sample_interval) {
+                    DBG_PRINTF("Samples %zu and %zu too close", i - 1, i);
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    /* The client has telemetry disabled, it should not report anything */
+    if (ret == 0 && picoquic_get_cc_events(test_ctx->cnx_client, events, ring_size, &nb_lost) != 0) {
+        DBG_PRINTF("%s", "Unexpected client telemetry");
+        ret = -1;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/* Verify that connections are assigned to experiment arms based on the
+ * hash of the initial CID, that the arm algorithm is used, and that the
+ * statistics are aggregated when the connection is deleted. */
+int cc_experiment_test()
+{
+    picoquic_congestion_algorithm_t const* arm_algs[3];
+    int ret = 0;
+
+    arm_algs[0] = picoquic_newreno_algorithm;
+    arm_algs[1] = picoquic_cubic_algorithm;
+    arm_algs[2] = picoquic_bbr_algorithm;
+
+    for (uint8_t trial = 0; ret == 0 && trial < 3; trial++) {
+        uint64_t simulated_time = 0;
+        picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+        picoquic_connection_id_t initial_cid = { {0xcc, 0xe4, 0, 0, 0, 0, 0, 0}, 8 };
+        int expected_arm;
+
+        initial_cid.id[7] = trial;
+        expected_arm = (int)(picoquic_connection_id_hash(&initial_cid) % 3);
+
+        ret = tls_api_init_ctx_ex(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0, &initial_cid);
+
+        if (ret == 0 && test_ctx == NULL) {
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            ret = picoquic_set_cc_experiment(test_ctx->qserver, arm_algs, 3);
+        }
+
+        if (ret == 0) {
+            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+                test_scenario_cc_telemetry, sizeof(test_scenario_cc_telemetry), 0, 0, 0, 20000, 2000000);
+        }
+
+        if (ret == 0 && test_ctx->cnx_server == NULL) {
+            DBG_PRINTF("%s", "Cannot assess server connection");
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            if (picoquic_get_cc_experiment_arm(test_ctx->cnx_server) != expected_arm) {
+                DBG_PRINTF("Expected arm %d, got %d", expected_arm, picoquic_get_cc_experiment_arm(test_ctx->cnx_server));
+                ret = -1;
+            }
+            else if (test_ctx->cnx_server->congestion_alg != arm_algs[expected_arm]) {
+                DBG_PRINTF("Arm %d does not use the expected algorithm", expected_arm);
+                ret = -1;
+            }
+            else if (picoquic_get_cc_experiment_arm(test_ctx->cnx_client) != -1) {
+                DBG_PRINTF("%s", "Client should not be part of the experiment");
+                ret = -1;
+            }
+        }
+
+        if (ret == 0) {
+            uint64_t data_sent = test_ctx->cnx_server->data_sent;
+
+            picoquic_delete_cnx(test_ctx->cnx_server);
+            test_ctx->cnx_server = NULL;
+
+            for (size_t arm = 0; ret == 0 && arm < 3; arm++) {
+                picoquic_cc_arm_stats_t stats;
+
+                if (picoquic_get_cc_experiment_stats(test_ctx->qserver, arm, &stats) != 0) {
+                    DBG_PRINTF("Cannot get stats for arm %zu", arm);
+                    ret = -1;
+                }
+                else if (arm == (size_t)expected_arm) {
+                    if (stats.nb_connections != 1 || stats.data_sent != data_sent ||
+                        stats.duration == 0 || stats.smoothed_rtt_sum == 0) {
+                        DBG_PRINTF("Unexpected stats for arm %zu", arm);
+                        ret = -1;
+                    }
+                }
+                else if (stats.nb_connections != 0) {
+                    DBG_PRINTF("Unexpected connection count for arm %zu", arm);
+                    ret = -1;
+                }
+            }
+        }
+
+        if (test_ctx != NULL) {
+            tls_api_delete_ctx(test_ctx);
+            test_ctx = NULL;
+        }
+    }
+
+    if (ret == 0 && picoquic_set_cc_experiment(NULL, arm_algs, PICOQUIC_CC_EXPERIMENT_MAX_ARMS + 1) == 0) {
+        DBG_PRINTF("%s", "Too many arms accepted");
+        ret = -1;
+    }
+
+    return ret;
+}
@@ -0,0 +1,288 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "h3zero_common.h"
+#include "h3zero_router.h"
+
+/* Test of the compiled request router.
+ */
+#define ROUTER_TEST_ITEM(p) { (char*)p, sizeof(p) - 1, NULL, NULL }
+
+static picohttp_server_path_item_t router_test_table[] = {
+    ROUTER_TEST_ITEM("/"),
+    ROUTER_TEST_ITEM("/baton"),
+    ROUTER_TEST_ITEM("/api/users"),
+    ROUTER_TEST_ITEM("/api/users/{id}"),
+    ROUTER_TEST_ITEM("/api/users/me"),
+    ROUTER_TEST_ITEM("/api/users/:id/posts/{post}"),
+    ROUTER_TEST_ITEM("/static/*"),
+    ROUTER_TEST_ITEM("/static/special"),
+    ROUTER_TEST_ITEM("/baton"),
+    ROUTER_TEST_ITEM("/*")
+};
+
+typedef struct st_h3zero_router_test_case_t {
+    char const* path;
+    int path_item;
+    size_t query_offset;
+    size_t nb_params;
+    char const* param[2];
+} h3zero_router_test_case_t;
+
+static h3zero_router_test_case_t router_test_cases[] = {
+    { "/", 0, 1, 0, { NULL, NULL } },
+    { "/?x=1", 0, 2, 0, { NULL, NULL } },
+    { "/baton", 1, 6, 0, { NULL, NULL } },
+    { "/baton?version=1&count=2", 1, 7, 0, { NULL, NULL } },
+    { "/api/users", 2, 10, 0, { NULL, NULL } },
+    { "/api/users/1234", 3, 15, 1, { "1234", NULL } },
+    { "/api/users/me", 4, 13, 0, { NULL, NULL } },
+    { "/api/users/me/posts/17?full", 5, 23, 2, { "me", "17" } },
+    { "/api/users/42/posts/17", 5, 22, 2, { "42", "17" } },
+    { "/static/index.html", 6, 18, 0, { NULL, NULL } },
+    { "/static/css/main.css", 6, 20, 0, { NULL, NULL } },
+    { "/static/special", 7, 15, 0, { NULL, NULL } },
+    { "/static/special/file", 6, 20, 0, { NULL, NULL } },
+    { "/batons", 9, 7, 0, { NULL, NULL } },
+    { "/api/users/42/comments", 9, 22, 0, { NULL, NULL } },
+    { "/api/users/", 9, 11, 0, { NULL, NULL } }
+};
+
+static size_t nb_router_test_cases = sizeof(router_test_cases) / sizeof(h3zero_router_test_case_t);
+
+int h3zero_router_test()
+{
+    int ret = 0;
+    size_t table_nb = sizeof(router_test_table) / sizeof(picohttp_server_path_item_t);
+    h3zero_router_t* router = h3zero_router_create(router_test_table, table_nb);
+
+    if (router == NULL) {
+        DBG_PRINTF("%s", "Cannot create router");
+        ret = -1;
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_router_test_cases; i++) {
+        h3zero_route_match_t match;
+        const uint8_t* path = (const uint8_t*)router_test_cases[i].path;
+        int path_item = h3zero_router_find(router, path, strlen(router_test_cases[i].path), &match);
+
+        if (path_item != router_test_cases[i].path_item) {
+            DBG_PRINTF("Path %s, item %d instead of %d", router_test_cases[i].path, path_item, router_test_cases[i].path_item);
+            ret = -1;
+        }
+        else if (match.query_offset != router_test_cases[i].query_offset) {
+            DBG_PRINTF("Path %s, query offset %zu instead of %zu", router_test_cases[i].path, match.query_offset, router_test_cases[i].query_offset);
+            ret = -1;
+        }
+        else if (match.nb_params != router_test_cases[i].nb_params) {
+            DBG_PRINTF("Path %s, %zu params instead of %zu", router_test_cases[i].path, match.nb_params, router_test_cases[i].nb_params);
+            ret = -1;
+        }
+        else {
+            for (size_t j = 0; j < match.nb_params; j++) {
+                if (match.params[j].length != strlen(router_test_cases[i].param[j]) ||
+                    memcmp(path + match.params[j].offset, router_test_cases[i].param[j], match.params[j].length) != 0) {
+                    DBG_PRINTF("Path %s, param %zu does not match", router_test_cases[i].path, j);
+                    ret = -1;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* Without a wildcard route, unknown paths are not matched */
+    if (ret == 0) {
+        h3zero_router_t* router2 = h3zero_router_create(router_test_table, table_nb - 1);
+
+        if (router2 == NULL) {
+            ret = -1;
+        }
+        else {
+            if (h3zero_router_find(router2, (const uint8_t*)"/batons", 7, NULL) != -1 ||
+                h3zero_router_find(router2, (const uint8_t*)"/api/users/", 11, NULL) != -1) {
+                DBG_PRINTF("%s", "Unexpected match without wildcard");
+                ret = -1;
+            }
+            h3zero_router_delete(router2);
+        }
+    }
+
+    if (router != NULL) {
+        h3zero_router_delete(router);
+    }
+
+    return ret;
+}
+
+/* Test that the router is compiled once per server parameters and shared
+ * by all the callback contexts created from them, and that the route
+ * captures are returned through the callback context lookup.
+ */
+int h3zero_router_shared_test()
+{
+    int ret = 0;
+    picohttp_server_parameters_t param;
+    h3zero_callback_ctx_t* ctx[2] = { NULL, NULL };
+    h3zero_route_match_t match;
+    const uint8_t* path = (const uint8_t*)"/api/users/42/posts/17?full";
+    size_t path_length = strlen((const char*)path);
+
+    memset(&param, 0, sizeof(param));
+    param.path_table = router_test_table;
+    param.path_table_nb = sizeof(router_test_table) / sizeof(picohttp_server_path_item_t);
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        if ((ctx[i] = h3zero_callback_create_context(&param)) == NULL) {
+            DBG_PRINTF("Cannot create callback context %d\n", i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (param.router == NULL || !param.is_router_compiled ||
+        ctx[0]->router != param.router || ctx[1]->router != param.router)) {
+        DBG_PRINTF("%s", "Router not shared by the callback contexts\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        memset(&match, 0, sizeof(match));
+        if (h3zero_callback_find_path_item(ctx[1], path, path_length, &match) != 5 ||
+            match.nb_params != 2 || match.query_offset != 23 ||
+            match.params[0].length != 2 || memcmp(path + match.params[0].offset, "42", 2) != 0 ||
+            match.params[1].length != 2 || memcmp(path + match.params[1].offset, "17", 2) != 0) {
+            DBG_PRINTF("%s", "Route captures not returned by the callback context\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Without a router, the linear scan still fills the match */
+        h3zero_router_t* router = ctx[1]->router;
+
+        ctx[1]->router = NULL;
+        memset(&match, 0xff, sizeof(match));
+        if (h3zero_callback_find_path_item(ctx[1], (const uint8_t*)"/baton?x", 8, &match) != 1 ||
+            match.path_item != 1 || match.nb_params != 0 || match.path_length != 6 || match.query_offset != 7) {
+            DBG_PRINTF("%s", "Linear lookup does not fill the match\n");
+            ret = -1;
+        }
+        ctx[1]->router = router;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (ctx[i] != NULL) {
+            h3zero_callback_delete_context(NULL, ctx[i]);
+        }
+    }
+
+    if (ret == 0 && param.router == NULL) {
+        DBG_PRINTF("%s", "Router deleted with the callback context\n");
+        ret = -1;
+    }
+
+    h3zero_server_parameters_release(&param);
+    if (ret == 0 && (param.router != NULL || param.is_router_compiled)) {
+        DBG_PRINTF("%s", "Router not released with the server parameters\n");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Routing micro benchmark.
+ * Build a table with a large number of literal routes, and compare
+ * the results and the duration of the lookups using the router and
+ * using the linear scan of the table.
+ */
+#define ROUTER_BENCH_NB_ROUTES 512
+#define ROUTER_BENCH_NB_LOOKUPS 100000
+
+int h3zero_router_bench_test()
+{
+    int ret = 0;
+    picohttp_server_path_item_t* table = (picohttp_server_path_item_t*)malloc(
+        ROUTER_BENCH_NB_ROUTES * sizeof(picohttp_server_path_item_t));
+    char* names = (char*)malloc(ROUTER_BENCH_NB_ROUTES * 32);
+    h3zero_router_t* router = NULL;
+
+    if (table == NULL || names == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(table, 0, ROUTER_BENCH_NB_ROUTES * sizeof(picohttp_server_path_item_t));
+        for (size_t i = 0; i < ROUTER_BENCH_NB_ROUTES; i++) {
+            size_t name_length = 0;
+            char* name = names + 32 * i;
+            (void)picoquic_sprintf(name, 32, &name_length, "/api/v%zu/resource%zu", i % 4, i);
+            table[i].path = name;
+            table[i].path_length = name_length;
+        }
+        if ((router = h3zero_router_create(table, ROUTER_BENCH_NB_ROUTES)) == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        uint64_t start_time = picoquic_current_time();
+        uint64_t router_time;
+        uint64_t linear_time;
+        uint64_t check_router = 0;
+        uint64_t check_linear = 0;
+
+        for (size_t i = 0; i < ROUTER_BENCH_NB_LOOKUPS; i++) {
+            size_t rank = (i * 7919) % ROUTER_BENCH_NB_ROUTES;
+            check_router += h3zero_router_find(router, (const uint8_t*)table[rank].path, table[rank].path_length, NULL);
+        }
+        router_time = picoquic_current_time() - start_time;
+        start_time = picoquic_current_time();
+        for (size_t i = 0; i < ROUTER_BENCH_NB_LOOKUPS; i++) {
+            size_t rank = (i * 7919) % ROUTER_BENCH_NB_ROUTES;
+            check_linear += h3zero_find_path_item((const uint8_t*)table[rank].path, table[rank].path_length, table, ROUTER_BENCH_NB_ROUTES);
+        }
+        linear_time = picoquic_current_time() - start_time;
+
+        if (check_router != check_linear) {
+            DBG_PRINTF("Router and linear lookups differ: %" PRIu64 " vs %" PRIu64, check_router, check_linear);
+            ret = -1;
+        }
+        else {
+            DBG_PRINTF("%d lookups in %d routes: router %" PRIu64 "us, linear %" PRIu64 "us",
+                ROUTER_BENCH_NB_LOOKUPS, ROUTER_BENCH_NB_ROUTES, router_time, linear_time);
+        }
+    }
+
+    if (router != NULL) {
+        h3zero_router_delete(router);
+    }
+    if (table != NULL) {
+        free(table);
+    }
+    if (names != NULL) {
+        free(names);
+    }
+
+    return ret;
+}
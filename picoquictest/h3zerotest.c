@@ -28,6 +28,8 @@
 #include "tls_api.h"
 #include "h3zero.h"
 #include "h3zero_common.h"
+#include "h3zero_pool.h"
+#include "pico_webtransport.h"
 #include "democlient.h"
 #include "demoserver.h"
 #ifdef _WINDOWS
@@ -1327,6 +1329,195 @@ int h3zero_stream_test()
     return ret;
 }
 
+/*
+ * Test of the capsule accumulator. Capsules received in a single chunk
+ * are parsed in place, without copy. Capsules split across chunks are
+ * copied to the scratch buffer, which is reused for the next capsules.
+ */
+
+static uint8_t h3zero_capsule_test_data[] = {
+    0x68, 0x43, 5, 'h', 'e', 'l', 'l', 'o',
+    h3zero_frame_goaway, 1, 4,
+    0x21, 0
+};
+
+static const uint64_t h3zero_capsule_test_type[] = { 0x2843, h3zero_frame_goaway, 0x21 };
+static const size_t h3zero_capsule_test_offset[] = { 3, 10, 13 };
+static const size_t h3zero_capsule_test_length[] = { 5, 1, 0 };
+
+static int h3zero_capsule_test_one(size_t chunk_size)
+{
+    int ret = 0;
+    h3zero_capsule_t capsule;
+    const uint8_t* bytes = h3zero_capsule_test_data;
+    const uint8_t* bytes_end = bytes + sizeof(h3zero_capsule_test_data);
+    uint8_t* scratch = NULL;
+    size_t nb_capsules = 0;
+
+    memset(&capsule, 0, sizeof(capsule));
+
+    while (ret == 0 && bytes != NULL && bytes < bytes_end) {
+        const uint8_t* bytes_max = (chunk_size < (size_t)(bytes_end - bytes)) ? bytes + chunk_size : bytes_end;
+
+        while (ret == 0 && bytes != NULL && bytes < bytes_max) {
+            bytes = h3zero_accumulate_capsule(bytes, bytes_max, &capsule);
+            if (bytes == NULL) {
+                DBG_PRINTF("Cannot parse capsule %zu, chunk size %zu", nb_capsules, chunk_size);
+                ret = -1;
+            }
+            else if (capsule.is_stored) {
+                if (nb_capsules >= sizeof(h3zero_capsule_test_type) / sizeof(uint64_t) ||
+                    capsule.capsule_type != h3zero_capsule_test_type[nb_capsules] ||
+                    capsule.capsule_length != h3zero_capsule_test_length[nb_capsules] ||
+                    (capsule.capsule_length > 0 && memcmp(capsule.value,
+                        h3zero_capsule_test_data + h3zero_capsule_test_offset[nb_capsules], capsule.capsule_length) != 0)) {
+                    DBG_PRINTF("Wrong capsule %zu, chunk size %zu", nb_capsules, chunk_size);
+                    ret = -1;
+                }
+                else if (chunk_size >= sizeof(h3zero_capsule_test_data) &&
+                    (capsule.value != h3zero_capsule_test_data + h3zero_capsule_test_offset[nb_capsules] ||
+                    capsule.capsule != NULL)) {
+                    DBG_PRINTF("Capsule %zu copied, chunk size %zu", nb_capsules, chunk_size);
+                    ret = -1;
+                }
+                else if (scratch != NULL && capsule.capsule != scratch) {
+                    DBG_PRINTF("Scratch buffer not reused for capsule %zu", nb_capsules);
+                    ret = -1;
+                }
+                scratch = capsule.capsule;
+                nb_capsules++;
+            }
+        }
+    }
+
+    if (ret == 0 && nb_capsules != sizeof(h3zero_capsule_test_type) / sizeof(uint64_t)) {
+        DBG_PRINTF("Found %zu capsules, chunk size %zu", nb_capsules, chunk_size);
+        ret = -1;
+    }
+
+    h3zero_release_capsule(&capsule);
+
+    return ret;
+}
+
+int h3zero_capsule_test()
+{
+    int ret = 0;
+
+    for (size_t chunk_size = 1; ret == 0 && chunk_size <= sizeof(h3zero_capsule_test_data); chunk_size++) {
+        ret = h3zero_capsule_test_one(chunk_size);
+    }
+
+    if (ret == 0) {
+        /* Header frames received in a single chunk are parsed without allocation */
+        h3zero_data_stream_state_t stream_state;
+        uint8_t* bytes = h3zero_stream_test3;
+        uint8_t* bytes_max = bytes + sizeof(h3zero_stream_test3);
+        size_t available_data;
+        uint16_t error_found;
+
+        memset(&stream_state, 0, sizeof(h3zero_data_stream_state_t));
+
+        while (ret == 0 && bytes != NULL && bytes < bytes_max) {
+            bytes = h3zero_parse_data_stream(bytes, bytes_max, &stream_state, &available_data, &error_found);
+            if (bytes == NULL) {
+                DBG_PRINTF("Cannot parse stream, error 0x%x", error_found);
+                ret = -1;
+            }
+            else if (stream_state.current_frame != NULL) {
+                DBG_PRINTF("%s", "Header frame copied to stream state");
+                ret = -1;
+            }
+            else {
+                bytes += available_data;
+            }
+        }
+
+        if (ret == 0 && (!stream_state.header_found || !stream_state.trailer_found)) {
+            DBG_PRINTF("%s", "Header or trailer not found");
+            ret = -1;
+        }
+
+        h3zero_delete_data_stream_state(&stream_state);
+    }
+
+    return ret;
+}
+
+/* The close message of a web transport capsule received in a single chunk
+ * must remain valid after the input bytes are reused.
+ */
+static size_t wt_capsule_test_encode(uint8_t* buffer, size_t buffer_size, uint32_t error_code, const char* msg)
+{
+    size_t msg_len = strlen(msg);
+    uint8_t* bytes = buffer;
+    uint8_t* bytes_max = buffer + buffer_size;
+
+    if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, 0x2843)) != NULL &&
+        (bytes = picoquic_frames_varint_encode(bytes, bytes_max, 4 + msg_len)) != NULL &&
+        (bytes = picoquic_frames_uint32_encode(bytes, bytes_max, error_code)) != NULL &&
+        bytes + msg_len <= bytes_max) {
+        memcpy(bytes, msg, msg_len);
+        bytes += msg_len;
+    }
+    else {
+        bytes = buffer;
+    }
+
+    return bytes - buffer;
+}
+
+int h3zero_wt_capsule_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    const char* msg[2] = { "bye", "session closed by the test" };
+    uint8_t buffer[64];
+    picowt_capsule_t capsule;
+    struct sockaddr_in addr;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, "h3", NULL, NULL, NULL, NULL, NULL,
+        simulated_time, &simulated_time, NULL, NULL, 0);
+    picoquic_cnx_t* cnx = NULL;
+
+    memset(&capsule, 0, sizeof(capsule));
+    picoquic_set_test_address(&addr, 0x0A000001, 443);
+    if (quic == NULL || (cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*)&addr, simulated_time, 0, "test.example.com", "h3", 1)) == NULL) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        size_t length = wt_capsule_test_encode(buffer, sizeof(buffer), 0x1234 + i, msg[i]);
+
+        if (length == 0 || picowt_receive_capsule(cnx, buffer, buffer + length, &capsule) != 0 ||
+            !capsule.h3_capsule.is_stored) {
+            DBG_PRINTF("Cannot receive capsule %d\n", i);
+            ret = -1;
+        }
+        else {
+            /* Reuse the input buffer, as a stream receive loop would */
+            memset(buffer, 0xff, sizeof(buffer));
+            if (capsule.error_code != (uint32_t)(0x1234 + i) || capsule.error_msg_len != strlen(msg[i]) ||
+                memcmp(capsule.error_msg, msg[i], capsule.error_msg_len) != 0) {
+                DBG_PRINTF("Capsule %d, wrong error code or message after buffer reuse\n", i);
+                ret = -1;
+            }
+        }
+    }
+
+    picowt_release_capsule(&capsule);
+    if (ret == 0 && (capsule.error_msg != NULL || capsule.error_msg_len != 0)) {
+        DBG_PRINTF("%s", "Capsule message not released\n");
+        ret = -1;
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
 
 /*
  * Test the scenario parsing function
@@ -1632,6 +1823,10 @@ static int demo_server_test(char const * alpn, picoquic_stream_data_cb_fn server
         tls_api_delete_ctx(test_ctx);
         test_ctx = NULL;
     }
+
+    if (server_param != NULL) {
+        h3zero_server_parameters_release((picohttp_server_parameters_t*)server_param);
+    }
     
     return ret;
 }
@@ -3213,4 +3408,730 @@ int h3zero_settings_test()
     }
 
     return ret;
-}
\ No newline at end of file
+}
+
+/* Test of the HTTP/3 client pool.
+ * The pool runs on a client QUIC context, connected to an h3zero server
+ * through a pair of simulated links. Each test queues a set of requests
+ * and runs the simulation until all the requests are complete.
+ */
+#define H3ZERO_POOL_TEST_MAX_REQUESTS 256
+
+typedef struct st_h3zero_pool_test_t {
+    uint64_t simulated_time;
+    picoquic_quic_t* qserver;
+    picoquic_quic_t* qclient;
+    picoquictest_sim_link_t* link_to_server;
+    picoquictest_sim_link_t* link_to_client;
+    struct sockaddr_storage server_address;
+    struct sockaddr_storage client_address;
+    h3zero_pool_t* pool;
+    size_t nb_requested;
+    size_t nb_completed;
+    size_t nb_failed;
+    uint64_t bytes_received;
+    uint64_t start_time[H3ZERO_POOL_TEST_MAX_REQUESTS];
+    uint64_t latency[H3ZERO_POOL_TEST_MAX_REQUESTS];
+    int send_goaway;
+    int goaway_sent;
+} h3zero_pool_test_t;
+
+static void h3zero_pool_test_response(h3zero_pool_t* pool, uint64_t request_id, h3zero_pool_event_enum event,
+    int status, const uint8_t* bytes, size_t length, void* request_ctx)
+{
+    h3zero_pool_test_t* pt = (h3zero_pool_test_t*)request_ctx;
+
+    switch (event) {
+    case h3zero_pool_event_data:
+        pt->bytes_received += length;
+        break;
+    case h3zero_pool_event_complete:
+        if (status == 200) {
+            pt->nb_completed++;
+        }
+        else {
+            pt->nb_failed++;
+        }
+        if (request_id < H3ZERO_POOL_TEST_MAX_REQUESTS) {
+            pt->latency[request_id] = pt->simulated_time - pt->start_time[request_id];
+        }
+        break;
+    case h3zero_pool_event_failed:
+        pt->nb_failed++;
+        break;
+    default:
+        break;
+    }
+}
+
+static void h3zero_pool_test_delete(h3zero_pool_test_t* pt)
+{
+    if (pt->pool != NULL) {
+        h3zero_pool_delete(pt->pool);
+    }
+    if (pt->qclient != NULL) {
+        picoquic_free(pt->qclient);
+    }
+    if (pt->qserver != NULL) {
+        picoquic_free(pt->qserver);
+    }
+    if (pt->link_to_server != NULL) {
+        picoquictest_sim_link_delete(pt->link_to_server);
+    }
+    if (pt->link_to_client != NULL) {
+        picoquictest_sim_link_delete(pt->link_to_client);
+    }
+    free(pt);
+}
+
+static h3zero_pool_test_t* h3zero_pool_test_create(size_t max_cnx, size_t max_requests_per_cnx, uint64_t idle_timeout)
+{
+    int ret = 0;
+    char test_server_cert_file[512];
+    char test_server_key_file[512];
+    h3zero_pool_test_t* pt = (h3zero_pool_test_t*)malloc(sizeof(h3zero_pool_test_t));
+
+    if (pt == NULL) {
+        return NULL;
+    }
+    memset(pt, 0, sizeof(h3zero_pool_test_t));
+
+    ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_CERT);
+    if (ret == 0) {
+        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
+    }
+    if (ret == 0) {
+        ret = picoquic_store_text_addr(&pt->server_address, "1::1", 443);
+    }
+    if (ret == 0) {
+        ret = picoquic_store_text_addr(&pt->client_address, "2::2", 4443);
+    }
+    if (ret == 0) {
+        pt->qserver = picoquic_create(8, test_server_cert_file, test_server_key_file, NULL, H3ZERO_POOL_ALPN,
+            h3zero_callback, NULL, NULL, NULL, NULL, pt->simulated_time, &pt->simulated_time, NULL, NULL, 0);
+        pt->qclient = picoquic_create(8, NULL, NULL, NULL, H3ZERO_POOL_ALPN, NULL, NULL, NULL, NULL, NULL,
+            pt->simulated_time, &pt->simulated_time, NULL, NULL, 0);
+        pt->link_to_server = picoquictest_sim_link_create(0.01, 10000, NULL, 0, pt->simulated_time);
+        pt->link_to_client = picoquictest_sim_link_create(0.01, 10000, NULL, 0, pt->simulated_time);
+        if (pt->qserver == NULL || pt->qclient == NULL || pt->link_to_server == NULL || pt->link_to_client == NULL) {
+            ret = -1;
+        }
+        else {
+            picoquic_set_null_verifier(pt->qclient);
+            pt->pool = h3zero_pool_create(pt->qclient, max_cnx, max_requests_per_cnx, idle_timeout);
+            if (pt->pool == NULL) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret != 0) {
+        h3zero_pool_test_delete(pt);
+        pt = NULL;
+    }
+
+    return pt;
+}
+
+static int h3zero_pool_test_request(h3zero_pool_test_t* pt, size_t nb_requests, char const* path)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_requests; i++) {
+        uint64_t request_id = 0;
+
+        ret = h3zero_pool_request(pt->pool, (struct sockaddr*)&pt->server_address, PICOQUIC_TEST_SNI, path,
+            h3zero_pool_test_response, pt, pt->simulated_time, &request_id);
+        if (ret == 0 && request_id < H3ZERO_POOL_TEST_MAX_REQUESTS) {
+            pt->start_time[request_id] = pt->simulated_time;
+        }
+        pt->nb_requested++;
+    }
+
+    return ret;
+}
+
+/* Check whether the server connection is ready, and if yes send a GOAWAY
+ * that lets the server process only the first two requests. */
+static int h3zero_pool_test_goaway(h3zero_pool_test_t* pt)
+{
+    int ret = 0;
+    picoquic_cnx_t* cnx = picoquic_get_first_cnx(pt->qserver);
+
+    if (cnx != NULL && picoquic_get_cnx_state(cnx) == picoquic_state_ready &&
+        picoquic_get_callback_context(cnx) != picoquic_get_default_callback_context(pt->qserver)) {
+        /* The server callback replaced the default context with its h3zero context */
+        ret = h3zero_send_goaway(cnx, (h3zero_callback_ctx_t*)picoquic_get_callback_context(cnx), 8);
+        pt->goaway_sent = 1;
+    }
+
+    return ret;
+}
+
+static int h3zero_pool_test_prepare(picoquic_quic_t* quic, picoquictest_sim_link_t* link,
+    struct sockaddr_storage* addr_from, uint64_t simulated_time)
+{
+    int ret = 0;
+    picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
+
+    if (packet == NULL) {
+        ret = -1;
+    }
+    else {
+        int if_index = 0;
+
+        ret = picoquic_prepare_next_packet(quic, simulated_time, packet->bytes, sizeof(packet->bytes), &packet->length,
+            &packet->addr_to, &packet->addr_from, &if_index, NULL, NULL);
+        if (ret != 0 || packet->length == 0) {
+            free(packet);
+        }
+        else {
+            if (packet->addr_from.ss_family == 0) {
+                picoquic_store_addr(&packet->addr_from, (struct sockaddr*)addr_from);
+            }
+            picoquictest_sim_link_submit(link, packet, simulated_time);
+        }
+    }
+
+    return ret;
+}
+
+static int h3zero_pool_test_arrival(picoquic_quic_t* quic, picoquictest_sim_link_t* link, uint64_t simulated_time)
+{
+    int ret = 0;
+    picoquictest_sim_packet_t* packet = picoquictest_sim_link_dequeue(link, simulated_time);
+
+    if (packet != NULL) {
+        ret = picoquic_incoming_packet(quic, packet->bytes, packet->length,
+            (struct sockaddr*)&packet->addr_from, (struct sockaddr*)&packet->addr_to, 0, 0, simulated_time);
+        free(packet);
+    }
+
+    return ret;
+}
+
+/* Run the simulation until all requests are complete, and, if wait_idle
+ * is set, until the pool has closed all its connections. */
+static int h3zero_pool_test_run(h3zero_pool_test_t* pt, int wait_idle, uint64_t max_time)
+{
+    int ret = 0;
+
+    while (ret == 0 && (pt->nb_completed + pt->nb_failed < pt->nb_requested ||
+        (wait_idle && h3zero_pool_nb_connections(pt->pool) > 0))) {
+        uint64_t server_time = picoquic_get_next_wake_time(pt->qserver, pt->simulated_time);
+        uint64_t client_time = picoquic_get_next_wake_time(pt->qclient, pt->simulated_time);
+        uint64_t pool_time = h3zero_pool_next_wake_time(pt->pool);
+        uint64_t to_server_time = picoquictest_sim_link_next_arrival(pt->link_to_server, UINT64_MAX);
+        uint64_t to_client_time = picoquictest_sim_link_next_arrival(pt->link_to_client, UINT64_MAX);
+        uint64_t next_time = server_time;
+
+        if (client_time < next_time) {
+            next_time = client_time;
+        }
+        if (pool_time < next_time) {
+            next_time = pool_time;
+        }
+        if (to_server_time < next_time) {
+            next_time = to_server_time;
+        }
+        if (to_client_time < next_time) {
+            next_time = to_client_time;
+        }
+        if (next_time == UINT64_MAX || next_time > max_time) {
+            DBG_PRINTF("Simulation stalled at %" PRIu64 ", %zu requests complete\n", pt->simulated_time, pt->nb_completed);
+            ret = -1;
+            break;
+        }
+        if (next_time > pt->simulated_time) {
+            pt->simulated_time = next_time;
+        }
+
+        if (to_server_time <= pt->simulated_time) {
+            ret = h3zero_pool_test_arrival(pt->qserver, pt->link_to_server, pt->simulated_time);
+        }
+        else if (to_client_time <= pt->simulated_time) {
+            ret = h3zero_pool_test_arrival(pt->qclient, pt->link_to_client, pt->simulated_time);
+        }
+        else if (server_time <= pt->simulated_time) {
+            ret = h3zero_pool_test_prepare(pt->qserver, pt->link_to_client, &pt->server_address, pt->simulated_time);
+        }
+        else if (client_time <= pt->simulated_time) {
+            ret = h3zero_pool_test_prepare(pt->qclient, pt->link_to_server, &pt->client_address, pt->simulated_time);
+        }
+
+        if (ret == 0 && pt->send_goaway && !pt->goaway_sent) {
+            ret = h3zero_pool_test_goaway(pt);
+        }
+        if (ret == 0) {
+            ret = h3zero_pool_check(pt->pool, pt->simulated_time);
+        }
+    }
+
+    return ret;
+}
+
+static int h3zero_pool_test_check(h3zero_pool_test_t* pt, char const* test_name, uint64_t expected_bytes)
+{
+    int ret = 0;
+
+    if (pt->nb_completed != pt->nb_requested || pt->nb_failed != 0) {
+        DBG_PRINTF("%s: %zu requests, %zu completed, %zu failed\n", test_name, pt->nb_requested, pt->nb_completed, pt->nb_failed);
+        ret = -1;
+    }
+    else if (pt->bytes_received != expected_bytes) {
+        DBG_PRINTF("%s: received %" PRIu64 " bytes instead of %" PRIu64 "\n", test_name, pt->bytes_received, expected_bytes);
+        ret = -1;
+    }
+    else if (h3zero_pool_nb_pending(pt->pool) != 0 || h3zero_pool_nb_active(pt->pool) != 0) {
+        DBG_PRINTF("%s: %zu pending, %zu active\n", test_name, h3zero_pool_nb_pending(pt->pool), h3zero_pool_nb_active(pt->pool));
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int h3zero_pool_test()
+{
+    int ret = 0;
+    h3zero_pool_stats_t stats;
+    h3zero_pool_test_t* pt = h3zero_pool_test_create(2, 8, H3ZERO_POOL_IDLE_TIMEOUT_DEFAULT);
+
+    if (pt == NULL) {
+        ret = -1;
+    }
+    else {
+        ret = h3zero_pool_test_request(pt, 40, "/1000");
+        if (ret == 0) {
+            ret = h3zero_pool_test_run(pt, 0, 10000000);
+        }
+        if (ret == 0) {
+            ret = h3zero_pool_test_check(pt, "pool", 40000);
+        }
+        if (ret == 0) {
+            h3zero_pool_get_stats(pt->pool, &stats);
+            if (stats.nb_cnx_created != 2 || h3zero_pool_nb_connections(pt->pool) != 2 || stats.nb_retried != 0) {
+                DBG_PRINTF("Pool created %" PRIu64 " connections, %zu open, %" PRIu64 " retries\n",
+                    stats.nb_cnx_created, h3zero_pool_nb_connections(pt->pool), stats.nb_retried);
+                ret = -1;
+            }
+        }
+        h3zero_pool_test_delete(pt);
+    }
+
+    return ret;
+}
+
+int h3zero_pool_goaway_test()
+{
+    int ret = 0;
+    h3zero_pool_stats_t stats;
+    h3zero_pool_test_t* pt = h3zero_pool_test_create(2, 8, H3ZERO_POOL_IDLE_TIMEOUT_DEFAULT);
+
+    if (pt == NULL) {
+        ret = -1;
+    }
+    else {
+        pt->send_goaway = 1;
+        ret = h3zero_pool_test_request(pt, 40, "/1000");
+        if (ret == 0) {
+            ret = h3zero_pool_test_run(pt, 0, 10000000);
+        }
+        if (ret == 0) {
+            ret = h3zero_pool_test_check(pt, "pool_goaway", 40000);
+        }
+        if (ret == 0) {
+            h3zero_pool_get_stats(pt->pool, &stats);
+            if (!pt->goaway_sent || stats.nb_cnx_goaway != 1 || stats.nb_cnx_created < 2) {
+                DBG_PRINTF("Goaway sent: %d, received: %" PRIu64 ", connections: %" PRIu64 "\n",
+                    pt->goaway_sent, stats.nb_cnx_goaway, stats.nb_cnx_created);
+                ret = -1;
+            }
+        }
+        h3zero_pool_test_delete(pt);
+    }
+
+    return ret;
+}
+
+int h3zero_pool_zero_rtt_test()
+{
+    int ret = 0;
+    h3zero_pool_stats_t stats;
+    h3zero_pool_test_t* pt = h3zero_pool_test_create(1, 0, 1000000);
+
+    if (pt == NULL) {
+        ret = -1;
+    }
+    else {
+        /* The first batch gets the session ticket, then the connection is
+         * closed when idle. The second batch should use 0-RTT. */
+        ret = h3zero_pool_test_request(pt, 4, "/1000");
+        if (ret == 0) {
+            ret = h3zero_pool_test_run(pt, 1, 10000000);
+        }
+        if (ret == 0) {
+            ret = h3zero_pool_test_request(pt, 4, "/1000");
+        }
+        if (ret == 0) {
+            ret = h3zero_pool_test_run(pt, 0, 20000000);
+        }
+        if (ret == 0) {
+            ret = h3zero_pool_test_check(pt, "pool_zero_rtt", 8000);
+        }
+        if (ret == 0) {
+            h3zero_pool_get_stats(pt->pool, &stats);
+            if (stats.nb_cnx_created != 2 || stats.nb_cnx_zero_rtt != 1 || stats.nb_cnx_closed_idle != 1) {
+                DBG_PRINTF("Connections: %" PRIu64 ", zero rtt: %" PRIu64 ", closed idle: %" PRIu64 "\n",
+                    stats.nb_cnx_created, stats.nb_cnx_zero_rtt, stats.nb_cnx_closed_idle);
+                ret = -1;
+            }
+        }
+        h3zero_pool_test_delete(pt);
+    }
+
+    return ret;
+}
+
+static int h3zero_pool_latency_compare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+/* Measure the request rate and the 99th percentile latency of the pool,
+ * in simulated time. */
+int h3zero_pool_bench_test()
+{
+    int ret = 0;
+    size_t nb_requests = 200;
+    h3zero_pool_test_t* pt = h3zero_pool_test_create(2, 32, H3ZERO_POOL_IDLE_TIMEOUT_DEFAULT);
+
+    if (pt == NULL) {
+        ret = -1;
+    }
+    else {
+        ret = h3zero_pool_test_request(pt, nb_requests, "/1000");
+        if (ret == 0) {
+            ret = h3zero_pool_test_run(pt, 0, 30000000);
+        }
+        if (ret == 0) {
+            ret = h3zero_pool_test_check(pt, "pool_bench", 1000 * (uint64_t)nb_requests);
+        }
+        if (ret == 0) {
+            uint64_t p99;
+            double requests_per_second = (pt->simulated_time > 0) ?
+                ((double)nb_requests * 1000000.0) / ((double)pt->simulated_time) : 0;
+
+            qsort(pt->latency, nb_requests, sizeof(uint64_t), h3zero_pool_latency_compare);
+            p99 = pt->latency[(nb_requests * 99) / 100];
+            DBG_PRINTF("Pool bench: %zu requests in %" PRIu64 " us, %.1f requests/s, p99 latency %" PRIu64 " us\n",
+                nb_requests, pt->simulated_time, requests_per_second, p99);
+            if (p99 > 5000000) {
+                DBG_PRINTF("P99 latency %" PRIu64 " is too high\n", p99);
+                ret = -1;
+            }
+        }
+        h3zero_pool_test_delete(pt);
+    }
+
+    return ret;
+}
+
+/* Web transport session isolation.
+ * The client opens three sessions on the same connection. The first one
+ * sends bulk data on successive streams, the two others send a small
+ * message every 20 ms, each on its own stream. The server measures the
+ * latency of the small messages. The test runs once with the default
+ * session scheduling, and once with all streams competing directly in
+ * the QUIC scheduler, and verifies that the session scheduling reduces
+ * the latency of the small messages.
+ */
+#define H3ZERO_WT_SESSION_TEST_PATH "/wt_sessions"
+#define H3ZERO_WT_SESSION_TEST_NB 3
+#define H3ZERO_WT_SESSION_TEST_MAX_STREAMS 1024
+#define H3ZERO_WT_SESSION_TEST_HEADER 9
+#define H3ZERO_WT_SESSION_TEST_BULK 0x200000
+#define H3ZERO_WT_SESSION_TEST_BULK_STREAM 0x40000
+#define H3ZERO_WT_SESSION_TEST_CHUNK 0x4000
+#define H3ZERO_WT_SESSION_TEST_SMALL 100
+#define H3ZERO_WT_SESSION_TEST_INTERVAL 20000
+
+typedef struct st_h3zero_wt_session_test_client_t {
+    picowt_session_t* session;
+    int is_ready;
+    int is_closed;
+} h3zero_wt_session_test_client_t;
+
+typedef struct st_h3zero_wt_session_test_t {
+    picowt_session_limits_t limits;
+    /* Server side measurements, indexed by the client stream rank */
+    uint8_t header[H3ZERO_WT_SESSION_TEST_MAX_STREAMS][H3ZERO_WT_SESSION_TEST_HEADER];
+    size_t received[H3ZERO_WT_SESSION_TEST_MAX_STREAMS];
+    size_t nb_server_sessions;
+    uint64_t bulk_received;
+    uint64_t nb_small_received;
+    uint64_t small_latency_max;
+    uint64_t small_latency_sum;
+    /* Client side state */
+    h3zero_wt_session_test_client_t client[H3ZERO_WT_SESSION_TEST_NB];
+    uint64_t nb_small_sent;
+} h3zero_wt_session_test_t;
+
+static int h3zero_wt_session_test_server_cb(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t wt_event, picohttp_server_stream_ctx_t* stream_ctx, void* path_app_ctx)
+{
+    int ret = 0;
+    h3zero_wt_session_test_t* wt_test = (h3zero_wt_session_test_t*)path_app_ctx;
+
+    switch (wt_event) {
+    case picohttp_callback_connect:
+        if (picowt_session_accept(cnx, stream_ctx, &wt_test->limits, h3zero_wt_session_test_server_cb, wt_test) == NULL) {
+            ret = -1;
+        }
+        else {
+            wt_test->nb_server_sessions++;
+        }
+        break;
+    case picohttp_callback_post_data:
+    case picohttp_callback_post_fin:
+        if (stream_ctx != NULL && !PICOQUIC_IS_BIDIR_STREAM_ID(stream_ctx->stream_id)) {
+            size_t rank = (size_t)(stream_ctx->stream_id >> 2);
+
+            if (rank >= H3ZERO_WT_SESSION_TEST_MAX_STREAMS) {
+                ret = -1;
+                break;
+            }
+            for (size_t i = 0; i < length && wt_test->received[rank] + i < H3ZERO_WT_SESSION_TEST_HEADER; i++) {
+                wt_test->header[rank][wt_test->received[rank] + i] = bytes[i];
+            }
+            wt_test->received[rank] += length;
+            if (wt_test->header[rank][0] == 0) {
+                wt_test->bulk_received += length;
+            }
+            else if (wt_event == picohttp_callback_post_fin) {
+                uint64_t sent_time = PICOPARSE_64(&wt_test->header[rank][1]);
+                uint64_t latency = picoquic_get_quic_time(cnx->quic) - sent_time;
+
+                wt_test->nb_small_received++;
+                wt_test->small_latency_sum += latency;
+                if (latency > wt_test->small_latency_max) {
+                    wt_test->small_latency_max = latency;
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+static int h3zero_wt_session_test_client_cb(picoquic_cnx_t* cnx, uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t wt_event, picohttp_server_stream_ctx_t* stream_ctx, void* path_app_ctx)
+{
+    h3zero_wt_session_test_client_t* client = (h3zero_wt_session_test_client_t*)path_app_ctx;
+
+    switch (wt_event) {
+    case picohttp_callback_connect_accepted:
+        client->is_ready = 1;
+        break;
+    case picohttp_callback_connect_refused:
+    case picohttp_callback_deregister:
+        client->is_closed = 1;
+        client->session = NULL;
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static int h3zero_wt_session_test_send_small(h3zero_wt_session_test_t* wt_test, size_t session_rank, uint64_t current_time)
+{
+    int ret = 0;
+    uint8_t message[H3ZERO_WT_SESSION_TEST_SMALL];
+    picohttp_server_stream_ctx_t* stream_ctx = picowt_session_create_stream(wt_test->client[session_rank].session, 0);
+
+    if (stream_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(message, 0, sizeof(message));
+        message[0] = (uint8_t)session_rank;
+        picoformat_64(&message[1], current_time);
+        ret = picowt_session_send(wt_test->client[session_rank].session, stream_ctx, message, sizeof(message), 1);
+        wt_test->nb_small_sent++;
+    }
+
+    return ret;
+}
+
+static int h3zero_wt_session_test_one(int is_isolated, uint64_t* small_latency_max)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t next_small_time = 0;
+    uint64_t bulk_queued = 0;
+    uint64_t bulk_stream_queued = 0;
+    int was_active = 0;
+    int nb_trials = 0;
+    int ret = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picohttp_server_parameters_t server_param = { 0 };
+    picohttp_server_path_item_t path_item = { 0 };
+    picoquic_connection_id_t initial_cid = { {0x77, 0x75, 0x5e, (uint8_t)is_isolated, 0, 0, 0, 0}, 8 };
+    h3zero_callback_ctx_t* h3zero_cb = NULL;
+    h3zero_wt_session_test_t* wt_test = (h3zero_wt_session_test_t*)malloc(sizeof(h3zero_wt_session_test_t));
+    picohttp_server_stream_ctx_t* bulk_stream = NULL;
+    uint8_t chunk[H3ZERO_WT_SESSION_TEST_CHUNK];
+
+    if (wt_test == NULL) {
+        return -1;
+    }
+    memset(wt_test, 0, sizeof(h3zero_wt_session_test_t));
+    picowt_session_limits_init(&wt_test->limits);
+    if (!is_isolated) {
+        /* All streams compete directly in the QUIC scheduler, with the default priority */
+        wt_test->limits.priority = PICOQUIC_DEFAULT_STREAM_PRIORITY;
+        wt_test->limits.max_active = 0;
+        wt_test->limits.quantum = 0;
+    }
+    wt_test->limits.max_streams = H3ZERO_WT_SESSION_TEST_MAX_STREAMS;
+    memset(chunk, 0, sizeof(chunk));
+
+    ret = tls_api_init_ctx_ex(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, "h3",
+        &simulated_time, NULL, NULL, 0, 1, 0, &initial_cid);
+    if (ret == 0 && (test_ctx == NULL || test_ctx->cnx_client == NULL || test_ctx->qserver == NULL)) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        picowt_set_transport_parameters(test_ctx->cnx_client);
+        path_item.path = (char*)H3ZERO_WT_SESSION_TEST_PATH;
+        path_item.path_length = strlen(H3ZERO_WT_SESSION_TEST_PATH);
+        path_item.path_callback = h3zero_wt_session_test_server_cb;
+        path_item.path_app_ctx = wt_test;
+        server_param.path_table = &path_item;
+        server_param.path_table_nb = 1;
+        picoquic_set_alpn_select_fn(test_ctx->qserver, picoquic_demo_server_callback_select_alpn);
+        picoquic_set_default_callback(test_ctx->qserver, h3zero_callback, &server_param);
+
+        if ((h3zero_cb = h3zero_callback_create_context(NULL)) == NULL) {
+            ret = -1;
+        }
+        else {
+            picoquic_set_callback(test_ctx->cnx_client, h3zero_callback, h3zero_cb);
+            ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    for (size_t i = 0; ret == 0 && i < H3ZERO_WT_SESSION_TEST_NB; i++) {
+        ret = picowt_session_connect(test_ctx->cnx_client, h3zero_cb, H3ZERO_WT_SESSION_TEST_PATH,
+            &wt_test->limits, h3zero_wt_session_test_client_cb, &wt_test->client[i], &wt_test->client[i].session);
+    }
+
+    while (ret == 0 && (wt_test->bulk_received < H3ZERO_WT_SESSION_TEST_BULK ||
+        wt_test->nb_small_received < wt_test->nb_small_sent)) {
+        int all_ready = 1;
+
+        for (size_t i = 0; i < H3ZERO_WT_SESSION_TEST_NB; i++) {
+            if (wt_test->client[i].is_closed) {
+                ret = -1;
+            }
+            all_ready &= wt_test->client[i].is_ready;
+        }
+        if (ret == 0 && all_ready) {
+            picowt_session_t* bulk_session = wt_test->client[0].session;
+
+            /* Keep the bulk session queue full, on successive streams */
+            while (ret == 0 && bulk_queued < H3ZERO_WT_SESSION_TEST_BULK &&
+                picowt_session_available(bulk_session) >= H3ZERO_WT_SESSION_TEST_CHUNK + 16) {
+                if (bulk_stream == NULL) {
+                    if ((bulk_stream = picowt_session_create_stream(bulk_session, 0)) == NULL) {
+                        ret = -1;
+                        break;
+                    }
+                    bulk_stream_queued = 0;
+                }
+                bulk_stream_queued += H3ZERO_WT_SESSION_TEST_CHUNK;
+                bulk_queued += H3ZERO_WT_SESSION_TEST_CHUNK;
+                ret = picowt_session_send(bulk_session, bulk_stream, chunk, sizeof(chunk),
+                    bulk_stream_queued >= H3ZERO_WT_SESSION_TEST_BULK_STREAM || bulk_queued >= H3ZERO_WT_SESSION_TEST_BULK);
+                if (bulk_stream_queued >= H3ZERO_WT_SESSION_TEST_BULK_STREAM) {
+                    bulk_stream = NULL;
+                }
+            }
+            /* Send the small messages while the bulk transfer is in progress */
+            if (ret == 0 && simulated_time >= next_small_time && wt_test->bulk_received < H3ZERO_WT_SESSION_TEST_BULK) {
+                for (size_t i = 1; ret == 0 && i < H3ZERO_WT_SESSION_TEST_NB; i++) {
+                    ret = h3zero_wt_session_test_send_small(wt_test, i, simulated_time);
+                }
+                next_small_time = simulated_time + H3ZERO_WT_SESSION_TEST_INTERVAL;
+            }
+        }
+        if (ret == 0) {
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time,
+                (all_ready && next_small_time > simulated_time) ? next_small_time : simulated_time + 1000, &was_active);
+        }
+        if (++nb_trials > 1000000 || simulated_time > 60000000) {
+            DBG_PRINTF("Session test stuck after %" PRIu64 " bulk bytes, %" PRIu64 "/%" PRIu64 " messages",
+                wt_test->bulk_received, wt_test->nb_small_received, wt_test->nb_small_sent);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picowt_session_stats_t stats;
+
+        picowt_session_get_stats(wt_test->client[0].session, &stats);
+        if (wt_test->nb_server_sessions != H3ZERO_WT_SESSION_TEST_NB || wt_test->nb_small_received == 0 ||
+            stats.bytes_sent < H3ZERO_WT_SESSION_TEST_BULK || stats.max_bytes_buffered > wt_test->limits.max_buffered) {
+            DBG_PRINTF("Session test: %zu sessions, %" PRIu64 " messages, %" PRIu64 " bytes sent, max buffered %zu",
+                wt_test->nb_server_sessions, wt_test->nb_small_received, stats.bytes_sent, stats.max_bytes_buffered);
+            ret = -1;
+        }
+        else {
+            *small_latency_max = wt_test->small_latency_max;
+            DBG_PRINTF("Sessions %s: %" PRIu64 " messages, latency average %" PRIu64 " us, max %" PRIu64 " us, bulk done at %" PRIu64,
+                (is_isolated) ? "isolated" : "shared", wt_test->nb_small_received,
+                wt_test->small_latency_sum / wt_test->nb_small_received, wt_test->small_latency_max, simulated_time);
+        }
+    }
+
+    if (h3zero_cb != NULL) {
+        h3zero_callback_delete_context(test_ctx->cnx_client, h3zero_cb);
+    }
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+    }
+    h3zero_server_parameters_release(&server_param);
+    free(wt_test);
+
+    return ret;
+}
+
+int h3zero_wt_sessions_test()
+{
+    uint64_t latency_isolated = 0;
+    uint64_t latency_shared = 0;
+    int ret = h3zero_wt_session_test_one(1, &latency_isolated);
+
+    if (ret == 0) {
+        ret = h3zero_wt_session_test_one(0, &latency_shared);
+    }
+    if (ret == 0 && latency_isolated >= latency_shared) {
+        DBG_PRINTF("Session isolation does not reduce latency: %" PRIu64 " vs %" PRIu64 " us",
+            latency_isolated, latency_shared);
+        ret = -1;
+    }
+
+    return ret;
+}
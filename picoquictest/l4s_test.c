@@ -39,7 +39,13 @@ static test_api_stream_desc_t test_scenario_l4s[] = {
 };
 
 
-static int l4s_congestion_test(picoquic_congestion_algorithm_t* ccalgo, uint64_t max_completion_time, uint64_t max_losses, uint64_t max_rttvar)
+/* The congestion test runs over either the single queue L4S marking of the
+ * simulated link, or a dual queue AQM. In the dual queue case, Prague packets
+ * are marked ECT(1) and use the L4S queue, other algorithms use the classic
+ * queue. The L4S step threshold is the same as in the single queue case.
+ */
+static int l4s_congestion_test(picoquic_congestion_algorithm_t* ccalgo, uint64_t max_completion_time, uint64_t max_losses, uint64_t max_rttvar,
+    int is_dualq)
 {
     uint64_t simulated_time = 0;
     uint64_t queue_delay_max = 20000;
@@ -65,13 +71,24 @@ static int l4s_congestion_test(picoquic_congestion_algorithm_t* ccalgo, uint64_t
         picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
 
 
-        if (strcmp(ccalgo->congestion_algorithm_id, "prague") == 0) {
+        if (is_dualq) {
+            if (picoquictest_sim_link_set_dualq(test_ctx->c_to_s_link, 0, l4s_max, 0, simulated_time) != 0 ||
+                picoquictest_sim_link_set_dualq(test_ctx->s_to_c_link, 0, l4s_max, 0, simulated_time) != 0) {
+                ret = -1;
+            }
+            else if (strcmp(ccalgo->congestion_algorithm_id, "prague") == 0) {
+                test_ctx->packet_ecn_default = PICOQUIC_ECN_ECT_1;
+            }
+        }
+        else if (strcmp(ccalgo->congestion_algorithm_id, "prague") == 0) {
             test_ctx->c_to_s_link->l4s_max = l4s_max;
             test_ctx->s_to_c_link->l4s_max = l4s_max;
             test_ctx->packet_ecn_default = PICOQUIC_ECN_ECT_0;
         }
         picoquic_set_binlog(test_ctx->qserver, ".");
+    }
 
+    if (ret == 0) {
         ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
             test_scenario_l4s, sizeof(test_scenario_l4s), 0, 0, 0, queue_delay_max, max_completion_time);
     }
@@ -112,7 +129,7 @@ int l4s_reno_test()
 {
     picoquic_congestion_algorithm_t* ccalgo = picoquic_newreno_algorithm;
 
-    int ret = l4s_congestion_test(ccalgo, 3650000, 50, 9000);
+    int ret = l4s_congestion_test(ccalgo, 3650000, 50, 9000, 0);
 
     return ret;
 }
@@ -121,7 +138,274 @@ int l4s_prague_test()
 {
     picoquic_congestion_algorithm_t* ccalgo = picoquic_prague_algorithm;
 
-    int ret = l4s_congestion_test(ccalgo, 3500000, 5, 6000);
+    int ret = l4s_congestion_test(ccalgo, 3500000, 5, 6000, 0);
+
+    return ret;
+}
+
+/* Dual queue tests. Prague uses the L4S queue, Cubic and BBR use the classic
+ * queue, in which the PI controller keeps the delay close to the 15ms target.
+ */
+int l4s_dualq_prague_test()
+{
+    picoquic_congestion_algorithm_t* ccalgo = picoquic_prague_algorithm;
+
+    int ret = l4s_congestion_test(ccalgo, 4000000, 10, 5000, 1);
+
+    return ret;
+}
+
+int l4s_dualq_cubic_test()
+{
+    picoquic_congestion_algorithm_t* ccalgo = picoquic_cubic_algorithm;
+
+    int ret = l4s_congestion_test(ccalgo, 4000000, 350, 6000, 1);
+
+    return ret;
+}
+
+int l4s_dualq_bbr_test()
+{
+    picoquic_congestion_algorithm_t* ccalgo = picoquic_bbr_algorithm;
+
+    int ret = l4s_congestion_test(ccalgo, 4000000, 50, 3000, 1);
+
+    return ret;
+}
+
+/* Coexistence of Prague with a classic flow on a dual queue bottleneck.
+ * Two client-server pairs share the links of the first test context, with
+ * a different client port for the second pair. The first pair uses Prague
+ * and marks packets ECT(1), the second uses a classic algorithm without ECN.
+ * Departures are simulated by the regular test rounds of each context,
+ * arrivals are dispatched here to the pair of the client address.
+ */
+static int l4s_coexist_link_arrival(picoquic_test_tls_api_ctx_t** test_ctx, picoquictest_sim_link_t* link,
+    int is_to_client, uint64_t current_time)
+{
+    int ret = 0;
+    picoquictest_sim_packet_t* packet = picoquictest_sim_link_dequeue(link, current_time);
+
+    if (packet != NULL) {
+        struct sockaddr* client_addr = (struct sockaddr*)((is_to_client) ? &packet->addr_to : &packet->addr_from);
+
+        for (int i = 0; i < 2; i++) {
+            if (picoquic_compare_addr((struct sockaddr*)&test_ctx[i]->client_addr, client_addr) == 0) {
+                ret = picoquic_incoming_packet((is_to_client) ? test_ctx[i]->qclient : test_ctx[i]->qserver,
+                    packet->bytes, (uint32_t)packet->length,
+                    (struct sockaddr*)&packet->addr_from, (struct sockaddr*)&packet->addr_to, 0,
+                    packet->ecn_mark, current_time);
+                if (ret == 0 && test_ctx[i]->cnx_server == NULL) {
+                    test_ctx[i]->cnx_server = picoquic_get_first_cnx(test_ctx[i]->qserver);
+                }
+                break;
+            }
+        }
+        free(packet);
+    }
+
+    return ret;
+}
+
+static int l4s_coexist_one_round(picoquic_test_tls_api_ctx_t** test_ctx, uint64_t* simulated_time, int* was_active)
+{
+    int ret = 0;
+    int next_ctx = -1;
+    uint64_t next_time = *simulated_time + 120000000ull;
+    uint64_t client_arrival;
+    uint64_t server_arrival;
+
+    for (int i = 0; i < 2; i++) {
+        uint64_t departure = UINT64_MAX;
+
+        if (test_ctx[i]->qserver->pending_stateless_packet != NULL) {
+            departure = *simulated_time;
+        }
+        if (test_ctx[i]->cnx_client->cnx_state != picoquic_state_disconnected &&
+            test_ctx[i]->cnx_client->next_wake_time < departure) {
+            departure = test_ctx[i]->cnx_client->next_wake_time;
+        }
+        if (test_ctx[i]->cnx_server != NULL && test_ctx[i]->cnx_server->cnx_state != picoquic_state_disconnected &&
+            test_ctx[i]->cnx_server->next_wake_time < departure) {
+            departure = test_ctx[i]->cnx_server->next_wake_time;
+        }
+        if (departure < next_time) {
+            next_time = departure;
+            next_ctx = i;
+        }
+    }
+
+    client_arrival = picoquictest_sim_link_next_arrival(test_ctx[0]->s_to_c_link, next_time);
+    server_arrival = picoquictest_sim_link_next_arrival(test_ctx[0]->c_to_s_link, next_time);
+
+    if (client_arrival < next_time || server_arrival < next_time) {
+        int is_to_client = client_arrival <= server_arrival;
+
+        next_time = (is_to_client) ? client_arrival : server_arrival;
+        if (next_time > *simulated_time) {
+            *simulated_time = next_time;
+        }
+        ret = l4s_coexist_link_arrival(test_ctx, (is_to_client) ? test_ctx[0]->s_to_c_link : test_ctx[0]->c_to_s_link,
+            is_to_client, *simulated_time);
+        *was_active |= 1;
+    }
+    else if (next_ctx >= 0) {
+        /* The shared links have no arrival before this departure, so the
+         * round of the context simulates the departure. */
+        ret = tls_api_one_sim_round(test_ctx[next_ctx], simulated_time, 0, was_active);
+    }
+    else {
+        *simulated_time = next_time;
+    }
+
+    return ret;
+}
+
+static int l4s_coexist_test(picoquic_congestion_algorithm_t* classic_algo, uint64_t max_completion_time,
+    uint64_t max_l4s_losses, uint64_t min_share_percent)
+{
+    uint64_t simulated_time = 0;
+    uint64_t queue_delay_max = 20000;
+    uint64_t l4s_max = queue_delay_max / 4;
+    uint64_t completion_time[2] = { 0, 0 };
+    uint64_t shared_l4s_bytes = 0;
+    uint64_t shared_classic_bytes = 0;
+    picoquic_congestion_algorithm_t* ccalgo[2] = { picoquic_prague_algorithm, classic_algo };
+    picoquic_test_tls_api_ctx_t* test_ctx[2] = { NULL, NULL };
+    picoquictest_sim_link_t* own_links[2] = { NULL, NULL };
+    int nb_trials = 0;
+    int nb_inactive = 0;
+    int ret = 0;
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        picoquic_connection_id_t initial_cid = { {0x45, 0xc0, 0, 0, 0, 0, 0, 0}, 8 };
+
+        initial_cid.id[2] = ccalgo[i]->congestion_algorithm_number;
+        initial_cid.id[3] = (uint8_t)i;
+        ret = tls_api_init_ctx_ex(&test_ctx[i], PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN,
+            &simulated_time, NULL, NULL, 0, 1, 0, &initial_cid);
+        if (ret == 0 && test_ctx[i] == NULL) {
+            ret = -1;
+        }
+        if (ret == 0) {
+            picoquic_set_default_congestion_algorithm(test_ctx[i]->qserver, ccalgo[i]);
+            picoquic_set_congestion_algorithm(test_ctx[i]->cnx_client, ccalgo[i]);
+        }
+    }
+
+    if (ret == 0) {
+        test_ctx[0]->packet_ecn_default = PICOQUIC_ECN_ECT_1;
+        test_ctx[0]->c_to_s_link->queue_delay_max = queue_delay_max;
+        test_ctx[0]->s_to_c_link->queue_delay_max = queue_delay_max;
+        test_ctx[1]->client_addr.sin_port = htons(1235);
+        /* The second pair sends over the links of the first one */
+        own_links[0] = test_ctx[1]->c_to_s_link;
+        own_links[1] = test_ctx[1]->s_to_c_link;
+        test_ctx[1]->c_to_s_link = test_ctx[0]->c_to_s_link;
+        test_ctx[1]->s_to_c_link = test_ctx[0]->s_to_c_link;
+
+        if (picoquictest_sim_link_set_dualq(test_ctx[0]->c_to_s_link, 0, l4s_max, 0, simulated_time) != 0 ||
+            picoquictest_sim_link_set_dualq(test_ctx[0]->s_to_c_link, 0, l4s_max, 0, simulated_time) != 0) {
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        if ((ret = picoquic_start_client_cnx(test_ctx[i]->cnx_client)) == 0) {
+            ret = test_api_init_send_recv_scenario(test_ctx[i], test_scenario_l4s, sizeof(test_scenario_l4s));
+        }
+    }
+
+    while (ret == 0 && nb_trials < 4000000 && nb_inactive < 256 && (completion_time[0] == 0 || completion_time[1] == 0)) {
+        int was_active = 0;
+
+        nb_trials++;
+        ret = l4s_coexist_one_round(test_ctx, &simulated_time, &was_active);
+
+        for (int i = 0; ret == 0 && i < 2; i++) {
+            if (completion_time[i] == 0 && test_ctx[i]->test_finished) {
+                completion_time[i] = simulated_time;
+                if (shared_l4s_bytes == 0) {
+                    /* Measure the shares while both flows are active */
+                    shared_l4s_bytes = test_ctx[0]->s_to_c_link->dualq->l4s_bytes;
+                    shared_classic_bytes = test_ctx[0]->s_to_c_link->dualq->classic_bytes;
+                }
+            }
+            if (test_ctx[i]->cnx_client->cnx_state == picoquic_state_disconnected) {
+                DBG_PRINTF("Connection %d disconnected.\n", i);
+                ret = -1;
+            }
+        }
+
+        if (was_active) {
+            nb_inactive = 0;
+        }
+        else {
+            nb_inactive++;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        if (completion_time[i] == 0 || completion_time[i] > max_completion_time) {
+            DBG_PRINTF("Flow %d completes at %" PRIu64 ", expected maximum %" PRIu64 "\n",
+                i, completion_time[i], max_completion_time);
+            ret = -1;
+        }
+        else {
+            ret = tls_api_one_scenario_verify(test_ctx[i]);
+        }
+    }
+
+    if (ret == 0) {
+        /* Prague sees few losses, both flows get a reasonable share of the
+         * link, and the L4S queue stays shorter than the classic queue. */
+        picoquictest_sim_dualq_t* dualq = test_ctx[0]->s_to_c_link->dualq;
+        uint64_t total_bytes = shared_l4s_bytes + shared_classic_bytes;
+
+        if (test_ctx[0]->cnx_server->nb_retransmission_total > max_l4s_losses) {
+            DBG_PRINTF("Noted %" PRIu64 " Prague losses, expected maximum %" PRIu64 "\n",
+                test_ctx[0]->cnx_server->nb_retransmission_total, max_l4s_losses);
+            ret = -1;
+        }
+        else if (shared_l4s_bytes * 100 < total_bytes * min_share_percent ||
+            shared_classic_bytes * 100 < total_bytes * min_share_percent) {
+            DBG_PRINTF("L4S bytes %" PRIu64 ", classic bytes %" PRIu64 "\n", shared_l4s_bytes, shared_classic_bytes);
+            ret = -1;
+        }
+        else if (dualq->l4s_packets == 0 || dualq->l4s_delay_sum > dualq->classic_delay_sum) {
+            DBG_PRINTF("L4S delay sum %" PRIu64 ", classic delay sum %" PRIu64 "\n", dualq->l4s_delay_sum, dualq->classic_delay_sum);
+            ret = -1;
+        }
+    }
+
+    if (test_ctx[1] != NULL && own_links[0] != NULL) {
+        test_ctx[1]->c_to_s_link = own_links[0];
+        test_ctx[1]->s_to_c_link = own_links[1];
+    }
+    for (int i = 0; i < 2; i++) {
+        if (test_ctx[i] != NULL) {
+            tls_api_delete_ctx(test_ctx[i]);
+            test_ctx[i] = NULL;
+        }
+    }
+
+    return ret;
+}
+
+/* The share of Cubic is sensitive to small timing changes, it varied between
+ * 23% and 35% when only the schedule of MTU probes changed. */
+int l4s_dualq_coexist_test()
+{
+    int ret = l4s_coexist_test(picoquic_cubic_algorithm, 7500000, 5, 20);
 
     return ret;
-}
\ No newline at end of file
+}
+
+/* BBR reduces its inflight bound when it sees the drops of the classic
+ * queue, and gets a smaller share of the link than Cubic. */
+int l4s_dualq_coexist_bbr_test()
+{
+    int ret = l4s_coexist_test(picoquic_bbr_algorithm, 7500000, 5, 10);
+
+    return ret;
+}
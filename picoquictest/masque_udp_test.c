@@ -0,0 +1,328 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2023, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "picosocks.h"
+#include "picoquic.h"
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "picoquictest_internal.h"
+#include "h3zero.h"
+#include "h3zero_common.h"
+#include "demoserver.h"
+#include "masque_udp.h"
+
+/* MASQUE CONNECT-UDP tests.
+ * The QUIC connection between client and proxy runs over the link simulator,
+ * but the proxy sends the UDP payloads to a real "echo" socket on the loopback
+ * address, so the test exercises the socket batching code.
+ */
+
+typedef struct st_masque_udp_test_ctx_t {
+    masque_udp_tunnel_t* tunnel;
+    int is_ready;
+    int is_refused;
+    int is_closed;
+    size_t nb_received;
+    size_t nb_errors;
+    size_t payload_length;
+} masque_udp_test_ctx_t;
+
+static void masque_udp_test_fill(uint8_t* payload, size_t length, uint32_t sequence)
+{
+    for (size_t i = 0; i < length; i++) {
+        payload[i] = (i < 4) ? (uint8_t)(sequence >> (8 * i)) : (uint8_t)(sequence + i);
+    }
+}
+
+static void masque_udp_test_client_fn(masque_udp_tunnel_t* tunnel, masque_udp_event_enum event,
+    const uint8_t* bytes, size_t length, void* app_ctx)
+{
+    masque_udp_test_ctx_t* test_ctx = (masque_udp_test_ctx_t*)app_ctx;
+
+    switch (event) {
+    case masque_udp_event_ready:
+        test_ctx->is_ready = 1;
+        break;
+    case masque_udp_event_refused:
+        test_ctx->is_refused = 1;
+        break;
+    case masque_udp_event_datagram:
+        if (length != test_ctx->payload_length || length < 4) {
+            test_ctx->nb_errors++;
+        }
+        else {
+            uint8_t expected[MASQUE_UDP_MAX_PAYLOAD_DEFAULT];
+            uint32_t sequence = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+            masque_udp_test_fill(expected, length, sequence);
+            if (memcmp(expected, bytes, length) != 0) {
+                test_ctx->nb_errors++;
+            }
+        }
+        test_ctx->nb_received++;
+        break;
+    case masque_udp_event_closed:
+        test_ctx->is_closed = 1;
+        test_ctx->tunnel = NULL;
+        break;
+    default:
+        break;
+    }
+}
+
+/* Echo all the payloads waiting on the target socket */
+static int masque_udp_test_echo(SOCKET_TYPE fd)
+{
+    int ret = 0;
+    uint8_t buffer[PICOQUIC_MAX_PACKET_SIZE];
+    struct sockaddr_storage addr_from;
+    struct sockaddr_storage addr_dest;
+    int dest_if = 0;
+    unsigned char received_ecn = 0;
+    uint64_t current_time = picoquic_current_time();
+    int bytes_recv;
+
+    while ((bytes_recv = picoquic_select(&fd, 1, &addr_from, &addr_dest, &dest_if, &received_ecn,
+        buffer, sizeof(buffer), 0, &current_time)) > 0) {
+        socklen_t addr_length = (addr_from.ss_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+        if (sendto(fd, (const char*)buffer, bytes_recv, 0, (struct sockaddr*)&addr_from, addr_length) != bytes_recv) {
+            ret = -1;
+            break;
+        }
+    }
+    if (bytes_recv < 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int masque_udp_test_one(uint8_t test_id, const char* target_host, int allow_internal, int expect_refused,
+    size_t nb_datagrams, size_t payload_length, size_t window, int is_bench)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t start_time = 0;
+    int was_active = 0;
+    int nb_trials = 0;
+    int ret = 0;
+    size_t nb_sent = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picohttp_server_parameters_t server_param = { 0 };
+    picohttp_server_path_item_t path_item = { 0 };
+    picoquic_connection_id_t initial_cid = { {0x4d, 0x55, 0xdb, 0, 0, 0, 0, 0}, 8 };
+    h3zero_callback_ctx_t* h3zero_cb = NULL;
+    masque_udp_proxy_t* proxy = NULL;
+    masque_udp_test_ctx_t client_ctx = { 0 };
+    masque_udp_stats_t stats = { 0 };
+    SOCKET_TYPE echo_fd = INVALID_SOCKET;
+    struct sockaddr_storage echo_addr = { 0 };
+    uint8_t payload[MASQUE_UDP_MAX_PAYLOAD_DEFAULT];
+
+    initial_cid.id[3] = test_id;
+    client_ctx.payload_length = payload_length;
+
+    /* Create the echo target on the loopback address */
+    if ((echo_fd = picoquic_open_client_socket(AF_INET)) == INVALID_SOCKET ||
+        picoquic_store_text_addr(&echo_addr, "127.0.0.1", 0) != 0 ||
+        bind(echo_fd, (struct sockaddr*)&echo_addr, sizeof(struct sockaddr_in)) != 0 ||
+        picoquic_get_local_address(echo_fd, &echo_addr) != 0) {
+        DBG_PRINTF("%s", "Cannot create the echo socket\n");
+        ret = -1;
+    }
+    else if ((proxy = masque_udp_proxy_create(0, 0)) == NULL) {
+        ret = -1;
+    }
+    else {
+        masque_udp_proxy_allow_internal_targets(proxy, allow_internal);
+        ret = tls_api_init_ctx_ex(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, "h3",
+            &simulated_time, NULL, NULL, 0, 1, 0, &initial_cid);
+        if (ret == 0 && (test_ctx == NULL || test_ctx->cnx_client == NULL || test_ctx->qserver == NULL)) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        masque_udp_set_transport_parameters(test_ctx->cnx_client);
+        /* Set up the proxy as the handler of the well known path */
+        path_item.path = (char*)MASQUE_UDP_PATH_PREFIX;
+        path_item.path_length = strlen(MASQUE_UDP_PATH_PREFIX);
+        path_item.path_callback = masque_udp_proxy_callback;
+        path_item.path_app_ctx = proxy;
+        server_param.path_table = &path_item;
+        server_param.path_table_nb = 1;
+        picoquic_set_alpn_select_fn(test_ctx->qserver, picoquic_demo_server_callback_select_alpn);
+        picoquic_set_default_callback(test_ctx->qserver, h3zero_callback, &server_param);
+
+        if ((h3zero_cb = h3zero_callback_create_context(NULL)) == NULL) {
+            ret = -1;
+        }
+        else {
+            picoquic_set_callback(test_ctx->cnx_client, h3zero_callback, h3zero_cb);
+            ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = masque_udp_client_connect(test_ctx->cnx_client, h3zero_cb, target_host,
+            ntohs(((struct sockaddr_in*)&echo_addr)->sin_port), masque_udp_test_client_fn, &client_ctx, &client_ctx.tunnel);
+    }
+
+    /* Send the datagrams through the tunnel, keeping at most "window" of them in flight. */
+    start_time = picoquic_current_time();
+    while (ret == 0 && client_ctx.nb_received < nb_datagrams && !client_ctx.is_refused && !client_ctx.is_closed) {
+        while (client_ctx.is_ready && client_ctx.tunnel != NULL && nb_sent < nb_datagrams &&
+            nb_sent - client_ctx.nb_received < window) {
+            masque_udp_test_fill(payload, payload_length, (uint32_t)nb_sent);
+            if (masque_udp_tunnel_send(client_ctx.tunnel, payload, payload_length) != 0) {
+                break;
+            }
+            nb_sent++;
+        }
+        if ((ret = masque_udp_test_echo(echo_fd)) == 0) {
+            (void)masque_udp_proxy_poll(proxy);
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, simulated_time + 1000, &was_active);
+        }
+        if (++nb_trials > 1000000) {
+            DBG_PRINTF("Stuck after %zu sent, %zu received\n", nb_sent, client_ctx.nb_received);
+            ret = -1;
+        }
+        else if (!client_ctx.is_ready && simulated_time > 10000000) {
+            DBG_PRINTF("%s", "Tunnel not established\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        masque_udp_proxy_get_stats(proxy, &stats);
+        if (!expect_refused) {
+            if (client_ctx.nb_received != nb_datagrams || client_ctx.nb_errors != 0 || stats.nb_tunnels != 1 ||
+                stats.nb_datagrams_to_target < nb_datagrams || stats.nb_datagrams_to_client < nb_datagrams) {
+                DBG_PRINTF("Received %zu/%zu, %zu errors, tunnels: %" PRIu64 "\n", client_ctx.nb_received,
+                    nb_datagrams, client_ctx.nb_errors, stats.nb_tunnels);
+                ret = -1;
+            }
+            else if (is_bench) {
+                uint64_t duration = picoquic_current_time() - start_time;
+                double mbps = (duration == 0) ? 0 : ((double)(2 * nb_datagrams * payload_length * 8)) / ((double)duration);
+                DBG_PRINTF("Relayed %zu datagrams both ways in %" PRIu64 " us, %.2f Mbps, %" PRIu64 " recv calls\n",
+                    nb_datagrams, duration, mbps, stats.nb_recv_calls);
+            }
+        }
+        else if (!client_ctx.is_refused || stats.nb_tunnels_refused != 1 || masque_udp_proxy_nb_tunnels(proxy) != 0) {
+            DBG_PRINTF("Tunnel to %s was not refused\n", target_host);
+            ret = -1;
+        }
+    }
+
+    /* Closing the tunnel shall remove it from the proxy */
+    if (ret == 0 && client_ctx.tunnel != NULL) {
+        masque_udp_tunnel_close(client_ctx.tunnel);
+        if (client_ctx.tunnel != NULL || !client_ctx.is_closed) {
+            ret = -1;
+        }
+        nb_trials = 0;
+        while (ret == 0 && masque_udp_proxy_nb_tunnels(proxy) > 0 && ++nb_trials < 1000) {
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, simulated_time + 1000, &was_active);
+        }
+        if (ret == 0 && masque_udp_proxy_nb_tunnels(proxy) != 0) {
+            DBG_PRINTF("%s", "Tunnel not closed on proxy\n");
+            ret = -1;
+        }
+    }
+
+    if (h3zero_cb != NULL) {
+        h3zero_callback_delete_context(test_ctx->cnx_client, h3zero_cb);
+    }
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+    }
+    h3zero_server_parameters_release(&server_param);
+    if (proxy != NULL) {
+        masque_udp_proxy_delete(proxy);
+    }
+    if (echo_fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(echo_fd);
+    }
+
+    return ret;
+}
+
+int masque_udp_test()
+{
+    int ret = masque_udp_test_one(1, "127.0.0.1", 1, 0, 10, 200, 4, 0);
+
+    if (ret == 0) {
+        ret = masque_udp_test_one(2, "invalid.example", 1, 1, 1, 200, 1, 0);
+    }
+
+    return ret;
+}
+
+int masque_udp_bench_test()
+{
+    return masque_udp_test_one(3, "127.0.0.1", 1, 0, 2000, 1000, 64, 1);
+}
+
+/* Verify that the proxy refuses internal targets unless explicitly allowed */
+int masque_udp_internal_test()
+{
+    static const char* internal_addr[] = {
+        "0.0.0.0", "10.1.2.3", "100.64.0.1", "127.0.0.1", "169.254.169.254", "172.16.0.1",
+        "192.0.0.8", "192.168.1.1", "224.0.0.251", "255.255.255.255",
+        "::", "::1", "::127.0.0.1", "fc00::1", "fd12:3456::1", "fe80::1", "fec0::1", "ff02::1",
+        "::ffff:127.0.0.1", "::ffff:10.0.0.1", "64:ff9b::169.254.169.254" };
+    static const char* external_addr[] = {
+        "1.1.1.1", "8.8.8.8", "100.128.0.1", "172.32.0.1", "192.0.2.1", "223.255.255.255",
+        "2001:db8::1", "2606:4700::1111", "::ffff:8.8.8.8", "64:ff9b::808:808" };
+    struct sockaddr_storage addr;
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < sizeof(internal_addr) / sizeof(const char*); i++) {
+        if (picoquic_store_text_addr(&addr, internal_addr[i], 443) != 0 ||
+            !masque_udp_is_internal_target((struct sockaddr*)&addr)) {
+            DBG_PRINTF("Address %s not detected as internal\n", internal_addr[i]);
+            ret = -1;
+        }
+    }
+    for (size_t i = 0; ret == 0 && i < sizeof(external_addr) / sizeof(const char*); i++) {
+        if (picoquic_store_text_addr(&addr, external_addr[i], 443) != 0 ||
+            masque_udp_is_internal_target((struct sockaddr*)&addr)) {
+            DBG_PRINTF("Address %s detected as internal\n", external_addr[i]);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = masque_udp_test_one(4, "127.0.0.1", 0, 1, 1, 200, 1, 0);
+    }
+    if (ret == 0) {
+        ret = masque_udp_test_one(5, "::1", 0, 1, 1, 200, 1, 0);
+    }
+
+    return ret;
+}
@@ -29,6 +29,13 @@
 #include "picoquic_lb.h"
 #include <string.h>
 #include "picoquictest_internal.h"
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
 
 /* Test of the CID generation function.
  */
@@ -1219,4 +1226,226 @@ int cid_for_lb_cli_test()
     }
     /* Done */
     return ret;
-}
\ No newline at end of file
+}
+
+/* Test of worker steering.
+ * Verify that the CIDs issued by a worker carry its ID, that invalid
+ * configurations are rejected, and that the reuseport program selects
+ * the worker socket for short header packets and falls back to the hash
+ * for long header packets and out of range values. The program is run
+ * by a minimal interpreter, and on Linux, if it can be loaded, attached
+ * to a set of reuseport sockets on the loopback address.
+ */
+#define CID_STEERING_TEST_NB_WORKERS 4
+#define CID_STEERING_TEST_OFFSET 2
+
+static uint32_t cid_steering_test_run(picoquic_bpf_insn_t* insns, size_t nb_insns, uint8_t* packet, size_t length)
+{
+    uint64_t reg[11];
+    size_t pc = 0;
+
+    memset(reg, 0, sizeof(reg));
+    while (pc < nb_insns) {
+        picoquic_bpf_insn_t* insn = &insns[pc++];
+        switch (insn->code) {
+        case 0xbf: /* mov64 reg */
+            reg[insn->dst_reg] = reg[insn->src_reg];
+            break;
+        case 0xb7: /* mov64 imm */
+            reg[insn->dst_reg] = (uint64_t)(int64_t)insn->imm;
+            break;
+        case 0x30: /* ld_abs byte, exits with 0 if out of bounds */
+            if ((size_t)insn->imm >= length) {
+                return 0;
+            }
+            reg[0] = packet[insn->imm];
+            break;
+        case 0x45: /* jset imm */
+            if ((reg[insn->dst_reg] & (uint64_t)(int64_t)insn->imm) != 0) {
+                pc += insn->off;
+            }
+            break;
+        case 0x35: /* jge imm */
+            if (reg[insn->dst_reg] >= (uint64_t)(int64_t)insn->imm) {
+                pc += insn->off;
+            }
+            break;
+        case 0x95: /* exit */
+            return (uint32_t)reg[0];
+        default:
+            return 0xFFFFFFFE;
+        }
+    }
+    return 0xFFFFFFFE;
+}
+
+#ifdef __linux__
+/* Returns 1 if the program could not be attached, which is expected
+ * without the privileges required to load BPF programs. */
+static int cid_steering_socket_test()
+{
+    int ret = 0;
+    int s[CID_STEERING_TEST_NB_WORKERS];
+    int fd_send = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    /* The first socket binds to an ephemeral port, the others join it */
+    addr.sin_port = 0;
+
+    if (fd_send < 0) {
+        DBG_PRINTF("%s", "Cannot open the sending socket\n");
+        ret = -1;
+    }
+
+    for (int i = 0; i < CID_STEERING_TEST_NB_WORKERS; i++) {
+        int one = 1;
+        socklen_t addr_len = sizeof(addr);
+        s[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        if (ret != 0 || s[i] < 0 || setsockopt(s[i], SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+            bind(s[i], (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            getsockname(s[i], (struct sockaddr*)&addr, &addr_len) != 0 ||
+            fcntl(s[i], F_SETFL, O_NONBLOCK) != 0) {
+            DBG_PRINTF("Cannot bind reuseport socket %d\n", i);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && picoquic_cid_steering_bpf_attach(s[0], CID_STEERING_TEST_OFFSET, CID_STEERING_TEST_NB_WORKERS) != 0) {
+        ret = 1;
+    }
+
+    for (int w = 0; ret == 0 && w < CID_STEERING_TEST_NB_WORKERS; w++) {
+        uint8_t packet[64];
+        int nb_received = 0;
+
+        memset(packet, 0, sizeof(packet));
+        packet[0] = 0x40;
+        packet[1 + CID_STEERING_TEST_OFFSET] = (uint8_t)w;
+        if (sendto(fd_send, packet, sizeof(packet), 0, (struct sockaddr*)&addr, sizeof(addr)) != (ssize_t)sizeof(packet)) {
+            ret = -1;
+        }
+        for (int trial = 0; ret == 0 && nb_received == 0 && trial < 100; trial++) {
+            usleep(1000);
+            for (int i = 0; i < CID_STEERING_TEST_NB_WORKERS; i++) {
+                uint8_t buffer[128];
+                if (recv(s[i], buffer, sizeof(buffer), 0) > 0) {
+                    nb_received++;
+                    if (i != w) {
+                        DBG_PRINTF("Worker %d packet received on socket %d\n", w, i);
+                        ret = -1;
+                    }
+                }
+            }
+        }
+        if (ret == 0 && nb_received != 1) {
+            DBG_PRINTF("Worker %d packet received %d times\n", w, nb_received);
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; i < CID_STEERING_TEST_NB_WORKERS; i++) {
+        if (s[i] >= 0) {
+            close(s[i]);
+        }
+    }
+    if (fd_send >= 0) {
+        close(fd_send);
+    }
+
+    return ret;
+}
+#endif
+
+int cid_steering_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_bpf_insn_t insns[PICOQUIC_CID_STEERING_BPF_MAX_INSNS];
+    size_t nb_insns = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, simulated_time,
+        &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Could not create the quic context.");
+        ret = -1;
+    }
+    else if (picoquic_cid_steering_config(quic, 8, 8, 1, CID_STEERING_TEST_NB_WORKERS) == 0 ||
+        picoquic_cid_steering_config(quic, 8, CID_STEERING_TEST_OFFSET, CID_STEERING_TEST_NB_WORKERS, CID_STEERING_TEST_NB_WORKERS) == 0) {
+        DBG_PRINTF("%s", "Invalid steering configuration accepted.");
+        ret = -1;
+    }
+    else if (picoquic_cid_steering_config(quic, 8, CID_STEERING_TEST_OFFSET, 3, CID_STEERING_TEST_NB_WORKERS) != 0) {
+        DBG_PRINTF("%s", "Could not configure steering.");
+        ret = -1;
+    }
+    else {
+        for (int i = 0; ret == 0 && i < 32; i++) {
+            picoquic_connection_id_t cid;
+
+            memset(&cid, 0, sizeof(cid));
+            picoquic_public_random(cid.id, quic->local_cnxid_length);
+            cid.id_len = quic->local_cnxid_length;
+            quic->cnx_id_callback_fn(quic, cid, picoquic_null_connection_id, quic->cnx_id_callback_ctx, &cid);
+            if (cid.id_len != 8 ||
+                picoquic_cid_steering_worker(&cid, CID_STEERING_TEST_OFFSET, CID_STEERING_TEST_NB_WORKERS) != 3) {
+                DBG_PRINTF("CID %d does not encode worker 3\n", i);
+                ret = -1;
+            }
+        }
+        picoquic_cid_steering_config_free(quic);
+        if (quic->cnx_id_callback_fn != NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        nb_insns = picoquic_cid_steering_bpf_generate(CID_STEERING_TEST_OFFSET, CID_STEERING_TEST_NB_WORKERS,
+            insns, PICOQUIC_CID_STEERING_BPF_MAX_INSNS);
+        if (nb_insns == 0) {
+            ret = -1;
+        }
+    }
+
+    for (int w = 0; ret == 0 && w < 8; w++) {
+        uint8_t packet[32];
+        uint32_t expected = (w < CID_STEERING_TEST_NB_WORKERS) ? (uint32_t)w : 0xFFFFFFFF;
+        uint32_t selected;
+
+        memset(packet, 0, sizeof(packet));
+        packet[0] = 0x40;
+        packet[1 + CID_STEERING_TEST_OFFSET] = (uint8_t)w;
+        selected = cid_steering_test_run(insns, nb_insns, packet, sizeof(packet));
+        if (selected != expected) {
+            DBG_PRINTF("Short header, worker %d, selected %x\n", w, selected);
+            ret = -1;
+        }
+        else {
+            packet[0] = 0xc0;
+            selected = cid_steering_test_run(insns, nb_insns, packet, sizeof(packet));
+            if (selected != 0xFFFFFFFF) {
+                DBG_PRINTF("Long header, worker %d, selected %x\n", w, selected);
+                ret = -1;
+            }
+        }
+    }
+
+#ifdef __linux__
+    if (ret == 0) {
+        ret = cid_steering_socket_test();
+        if (ret == 1) {
+            DBG_PRINTF("%s", "Reuseport program not attached, socket test skipped.\n");
+            ret = 0;
+        }
+    }
+#endif
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
@@ -79,6 +79,7 @@ int stateless_reset_client_test();
 int stateless_reset_handshake_test();
 int immediate_close_test();
 int sim_link_test();
+int sim_dualq_test();
 int tls_api_very_long_stream_test();
 int tls_api_very_long_max_test();
 int tls_api_very_long_with_err_test();
@@ -117,6 +118,11 @@ int mtu_blocked_test();
 int mtu_delayed_test();
 int mtu_required_test();
 int mtu_max_test();
+int mtu_cache_test();
+int mtu_black_hole_test();
+int mtu_bisect_test();
+int mtu_cache_learn_test();
+int jumbo_test();
 int mtu_drop_test();
 int spurious_retransmit_test();
 int pn_ctr_test();
@@ -187,12 +193,18 @@ int initial_close_test();
 int fuzz_initial_test();
 int new_rotated_key_test();
 int key_rotation_test();
+int key_rotation_precompute_test();
 int key_rotation_auto_server();
 int key_rotation_auto_client();
 int false_migration_test();
 int nat_handshake_test();
 int key_rotation_vector_test();
 int key_rotation_stress_test();
+int key_rotation_aead_limit_test();
+int stage_stats_test();
+int null_aead_test();
+int handshake_packing_test();
+int early_data_test();
 int short_initial_cid_test();
 int stream_id_max_test();
 int padding_test();
@@ -200,7 +212,9 @@ int packet_trace_test();
 int qlog_trace_test();
 int qlog_trace_auto_test();
 int qlog_trace_only_test();
+int qlog_trace_sync_test();
 int qlog_trace_ecn_test();
+int binlog_replay_test();
 int path_packet_queue_test();
 int perflog_test();
 int rebinding_stress_test();
@@ -235,6 +249,10 @@ int satellite_cubic_loss_test();
 int bdp_basic_test();
 int bdp_reno_test();
 int bdp_cubic_test();
+int bdp_prague_test();
+int bdp_hystart_pp_test();
+int resume_first_mb_test();
+int path_bdp_upload_test();
 int bdp_rtt_test();
 int bdp_ip_test();
 int bdp_delay_test();
@@ -252,9 +270,14 @@ int h3zero_parse_qpack_test();
 int h3zero_prepare_qpack_test();
 int h3zero_user_agent_test();
 int h3zero_uri_test();
+int h3zero_router_test();
+int h3zero_router_shared_test();
+int h3zero_router_bench_test();
 int h3zero_null_sni_test();
 int h3zero_qpack_fuzz_test();
 int h3zero_stream_test();
+int h3zero_capsule_test();
+int h3zero_wt_capsule_test();
 int parse_demo_scenario_test();
 int h3zero_server_test();
 int h09_server_test();
@@ -266,12 +289,14 @@ int optimistic_ack_test();
 int optimistic_hole_test();
 int document_addresses_test();
 int socket_ecn_test();
+int sockloop_busy_poll_test();
 int null_sni_test();
 int preferred_address_test();
 int preferred_address_dis_mig_test();
 int preferred_address_zero_test();
 int cid_for_lb_test();
 int cid_for_lb_cli_test();
+int cid_steering_test();
 int retry_protection_vector_test();
 int retry_protection_v2_test();
 int test_copy_for_retransmit();
@@ -299,6 +324,15 @@ int bbr_asym100_nodelay_test();
 int bbr_asym400_test();
 int l4s_reno_test();
 int l4s_prague_test();
+int l4s_dualq_prague_test();
+int l4s_dualq_cubic_test();
+int l4s_dualq_bbr_test();
+int l4s_dualq_coexist_test();
+int l4s_dualq_coexist_bbr_test();
+int cc_telemetry_test();
+int cc_experiment_test();
+int cc_hystart_pp_test();
+int cc_careful_resume_test();
 int large_client_hello_test();
 int fast_nat_rebinding_test();
 int datagram_test();
@@ -323,6 +357,10 @@ int direct_receive_test();
 int app_limit_cc_test();
 int initial_race_test();
 int pacing_test();
+int pacing_gap_test();
+int pacing_coalescing_test();
+int wake_coalescing_test();
+int wake_batch_test();
 int chacha20_test();
 int cnx_limit_test();
 int cert_verify_bad_cert_test();
@@ -390,6 +428,9 @@ int simple_multipath_perf_test();
 int simple_multipath_qlog_test();
 int simple_multipath_quality_test();
 int token_reuse_api_test();
+int token_filter_test();
+int ticket_table_test();
+int path_bdp_cache_test();
 int grease_quic_bit_test();
 int grease_quic_bit_one_way_test();
 int pn_random_test();
@@ -425,6 +466,14 @@ int h09_multi_file_test();
 int h09_multi_file_loss_test();
 int h09_multi_file_preemptive_test();
 int h3zero_settings_test();
+int h3zero_pool_test();
+int h3zero_pool_goaway_test();
+int h3zero_pool_zero_rtt_test();
+int h3zero_pool_bench_test();
+int masque_udp_test();
+int masque_udp_bench_test();
+int masque_udp_internal_test();
+int h3zero_wt_sessions_test();
 int picowt_baton_basic_test();
 int picowt_baton_error_test();
 int picowt_baton_long_test();
@@ -19,8 +19,11 @@
 * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <string.h>
+#include "picoquic.h"
 #include "picosocks.h"
 #include "picoquic_utils.h"
+#include "picoquic_packet_loop.h"
 
 static int socket_ping_pong(SOCKET_TYPE fd, struct sockaddr* server_addr,
     picoquic_server_sockets_t* server_sockets)
@@ -240,3 +243,127 @@ int socket_ecn_test()
 
     return ret;
 }
+
+/*
+ * Test that the packet loop only busy polls while a wake up is close.
+ * During the first 10 ms, the time check callback shortens the wait to
+ * 1 ms, below the busy poll threshold, and the loop polls. After that the
+ * loop is idle and waits for the maximum delay, which must be done with
+ * select() even though the threshold is larger. A helper thread wakes the
+ * loop after 200 ms by sending a datagram, which ends the test.
+ */
+
+typedef struct st_busy_poll_test_ctx_t {
+    uint64_t start_time;
+    struct sockaddr_storage loop_addr;
+    int nb_busy;
+    int nb_idle;
+    int is_thread_started;
+    picoquic_thread_t thread;
+    picoquic_event_t event;
+} busy_poll_test_ctx_t;
+
+static picoquic_thread_return_t busy_poll_wake_thread(void* vctx)
+{
+    busy_poll_test_ctx_t* ctx = (busy_poll_test_ctx_t*)vctx;
+    uint8_t message[8];
+    SOCKET_TYPE fd;
+
+    memset(message, 0, sizeof(message));
+    /* Nobody signals the event, the wait is just a sleep */
+    (void)picoquic_wait_for_event(&ctx->event, 200000);
+    fd = picoquic_open_client_socket(ctx->loop_addr.ss_family);
+    if (fd != INVALID_SOCKET) {
+        (void)sendto(fd, (const char*)message, sizeof(message), 0, (struct sockaddr*)&ctx->loop_addr,
+            (ctx->loop_addr.ss_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+        SOCKET_CLOSE(fd);
+    }
+
+    picoquic_thread_do_return;
+}
+
+static int busy_poll_test_callback(picoquic_quic_t* quic, picoquic_packet_loop_cb_enum cb_mode,
+    void* callback_ctx, void* callback_arg)
+{
+    busy_poll_test_ctx_t* ctx = (busy_poll_test_ctx_t*)callback_ctx;
+    int ret = 0;
+
+    switch (cb_mode) {
+    case picoquic_packet_loop_ready:
+        ((picoquic_packet_loop_options_t*)callback_arg)->do_time_check = 1;
+        ctx->start_time = picoquic_get_quic_time(quic);
+        break;
+    case picoquic_packet_loop_port_update:
+        picoquic_store_addr(&ctx->loop_addr, (struct sockaddr*)callback_arg);
+        if (!ctx->is_thread_started) {
+            ret = picoquic_create_thread(&ctx->thread, busy_poll_wake_thread, ctx);
+            ctx->is_thread_started = (ret == 0);
+        }
+        break;
+    case picoquic_packet_loop_time_check: {
+        packet_loop_time_check_arg_t* time_check_arg = (packet_loop_time_check_arg_t*)callback_arg;
+
+        if (time_check_arg->current_time < ctx->start_time + 10000) {
+            time_check_arg->delta_t = 1000;
+            ctx->nb_busy++;
+        }
+        else {
+            ctx->nb_idle++;
+        }
+        break;
+    }
+    case picoquic_packet_loop_after_receive:
+        ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+int sockloop_busy_poll_test()
+{
+    int ret = 0;
+    busy_poll_test_ctx_t ctx;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, picoquic_current_time(), NULL, NULL, NULL, 0);
+
+    memset(&ctx, 0, sizeof(ctx));
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else if ((ret = picoquic_create_event(&ctx.event)) != 0) {
+        DBG_PRINTF("Create event returns %d (0x%x)\n", ret, ret);
+    }
+    else {
+        /* Larger than the maximum delay of the loop */
+        picoquic_set_busy_poll_threshold(quic, 20000000);
+        ret = picoquic_packet_loop(quic, 0, AF_INET, 0, 0, 1, busy_poll_test_callback, &ctx);
+
+        if (ctx.is_thread_started) {
+            picoquic_delete_thread(&ctx.thread);
+        }
+        picoquic_delete_event(&ctx.event);
+
+        if (ret != 0) {
+            DBG_PRINTF("Packet loop returns %d (0x%x)\n", ret, ret);
+        }
+        else if (ctx.nb_busy < 100) {
+            DBG_PRINTF("Only %d loops while busy polling\n", ctx.nb_busy);
+            ret = -1;
+        }
+        else if (ctx.nb_idle > 2) {
+            DBG_PRINTF("%d loops while idle, busy poll did not stop\n", ctx.nb_idle);
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
@@ -507,6 +507,407 @@ int token_reuse_api_test()
     return ret;
 }
 
+/* Check the fixed memory token filter. The tokens of the reuse API test
+ * are checked again with the filter, then the test verifies the rotation
+ * of generations, the false positive rate, and the sharing of a filter
+ * between two QUIC contexts.
+ */
+static void token_filter_test_token(uint8_t* token, uint64_t seed)
+{
+    uint64_t random_context = 0xF11E7E57ull ^ seed;
+    picoquic_test_random_bytes(&random_context, token, 16);
+}
+
+int token_filter_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    const uint64_t lifetime = 1000000;
+    const size_t nb_tokens_max = 2000;
+    const double fp_rate = 0.01;
+    uint8_t token[16];
+    void* shared = NULL;
+    size_t shared_size = picoquic_token_filter_memory_size(nb_tokens_max, fp_rate);
+    picoquic_quic_t* quic = picoquic_create(4, NULL, NULL, NULL, "test", NULL, NULL, NULL, NULL,
+        NULL, 0, &simulated_time, NULL, NULL, 0);
+    picoquic_quic_t* quic2 = picoquic_create(4, NULL, NULL, NULL, "test", NULL, NULL, NULL, NULL,
+        NULL, 0, &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL || quic2 == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        ret = -1;
+    }
+    else if (shared_size == 0 || shared_size > 16 * nb_tokens_max + 1024 ||
+        picoquic_token_filter_memory_size(0, fp_rate) != 0 ||
+        picoquic_token_filter_memory_size(nb_tokens_max, 1.0) != 0) {
+        DBG_PRINTF("Unexpected filter size: %zu", shared_size);
+        ret = -1;
+    }
+    else if (picoquic_set_token_filter(quic, nb_tokens_max, fp_rate, lifetime) != 0) {
+        DBG_PRINTF("%s", "Cannot set token filter");
+        ret = -1;
+    }
+
+    /* All tokens are new, then all are reused */
+    for (int pass = 0; ret == 0 && pass < 2; pass++) {
+        for (size_t i = 0; ret == 0 && i < nb_token_reuse_api_cases; i++) {
+            int x = picoquic_registered_token_check_reuse(quic,
+                token_reuse_api_cases[i].token,
+                token_reuse_api_cases[i].token_length,
+                token_reuse_api_cases[i].expiry_date);
+            if ((x == 0) != (pass == 0)) {
+                DBG_PRINTF("Token[%zu], pass %d, returns %d", i, pass, x);
+                ret = -1;
+            }
+        }
+    }
+
+    /* Tokens shorter than 8 bytes, or expiring after the next generation, are refused */
+    if (ret == 0) {
+        token_filter_test_token(token, 0);
+        if (picoquic_registered_token_check_reuse(quic, token, 7, 10) == 0 ||
+            picoquic_registered_token_check_reuse(quic, token, 16, 2 * lifetime) == 0) {
+            DBG_PRINTF("%s", "Invalid token accepted");
+            ret = -1;
+        }
+    }
+
+    /* Rotate generations. Tokens of live generations are still detected,
+     * and the slots of expired generations are reused. */
+    for (uint64_t epoch = 1; ret == 0 && epoch < 8; epoch++) {
+        uint64_t expiry = epoch * lifetime + lifetime / 2;
+        simulated_time = expiry - lifetime / 2;
+        token_filter_test_token(token, epoch);
+        if (picoquic_registered_token_check_reuse(quic, token, 16, expiry) != 0 ||
+            picoquic_registered_token_check_reuse(quic, token, 16, expiry) == 0) {
+            DBG_PRINTF("Reuse not detected in epoch %" PRIu64, epoch);
+            ret = -1;
+        }
+        else if (epoch > 1) {
+            token_filter_test_token(token, epoch - 1);
+            if (picoquic_registered_token_check_reuse(quic, token, 16, expiry - lifetime) == 0) {
+                DBG_PRINTF("Reuse of previous token not detected in epoch %" PRIu64, epoch);
+                ret = -1;
+            }
+        }
+    }
+
+    /* Register half of the capacity, then check that the false positive rate
+     * for new tokens stays close to the target. */
+    if (ret == 0) {
+        uint64_t expiry = simulated_time + lifetime / 2;
+        size_t nb_false_positive = 0;
+
+        for (size_t i = 0; ret == 0 && i < nb_tokens_max / 2; i++) {
+            token_filter_test_token(token, 0x10000 + i);
+            if (picoquic_registered_token_check_reuse(quic, token, 16, expiry) != 0) {
+                nb_false_positive++;
+            }
+        }
+        for (size_t i = 0; ret == 0 && i < nb_tokens_max / 2; i++) {
+            token_filter_test_token(token, 0x20000 + i);
+            if (picoquic_registered_token_check_reuse(quic, token, 16, expiry) != 0) {
+                nb_false_positive++;
+            }
+        }
+        if (nb_false_positive > (size_t)(2.0 * fp_rate * (double)nb_tokens_max)) {
+            DBG_PRINTF("%zu false positives for %zu tokens", nb_false_positive, nb_tokens_max);
+            ret = -1;
+        }
+    }
+
+    /* Share a filter between two contexts */
+    if (ret == 0) {
+        shared = malloc(shared_size);
+        if (shared == NULL || picoquic_token_filter_init(shared, shared_size, nb_tokens_max, fp_rate, lifetime) != 0 ||
+            picoquic_token_filter_init(shared, shared_size - 1, nb_tokens_max, fp_rate, lifetime) == 0) {
+            DBG_PRINTF("%s", "Cannot initialize shared filter");
+            ret = -1;
+        }
+        else {
+            uint64_t expiry = simulated_time + lifetime / 2;
+
+            picoquic_set_shared_token_filter(quic, shared);
+            picoquic_set_shared_token_filter(quic2, shared);
+            for (size_t i = 0; ret == 0 && i < 16; i++) {
+                token_filter_test_token(token, 0x30000 + i);
+                if (picoquic_registered_token_check_reuse((i & 1) ? quic : quic2, token, 16, expiry) != 0 ||
+                    picoquic_registered_token_check_reuse((i & 1) ? quic2 : quic, token, 16, expiry) == 0) {
+                    DBG_PRINTF("Shared filter fails for token %zu", i);
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+    if (quic2 != NULL) {
+        picoquic_free(quic2);
+    }
+    if (shared != NULL) {
+        free(shared);
+    }
+
+    return ret;
+}
+
+/* Check the fixed memory table of issued tickets: storage and update of
+ * records, replacement of the records not recently used when the table
+ * is full, memory bounds, and sharing of a table between two QUIC contexts.
+ */
+int ticket_table_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint8_t ip_addr[4] = { 10, 0, 0, 1 };
+    size_t table_size = picoquic_ticket_table_memory_size(8);
+    void* shared = NULL;
+    picoquic_issued_ticket_t ticket;
+    picoquic_quic_t* quic = picoquic_create(4, NULL, NULL, NULL, "test", NULL, NULL, NULL, NULL,
+        NULL, 0, &simulated_time, NULL, NULL, 0);
+    picoquic_quic_t* quic2 = picoquic_create(4, NULL, NULL, NULL, "test", NULL, NULL, NULL, NULL,
+        NULL, 0, &simulated_time, NULL, NULL, 0);
+
+    if (quic == NULL || quic2 == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else if (table_size > 8 * 64 + 64 || picoquic_ticket_table_memory_size(9) <= table_size) {
+        DBG_PRINTF("Unexpected table size: %zu\n", table_size);
+        ret = -1;
+    }
+    else if (picoquic_set_ticket_table(quic, table_size - 1) == 0 ||
+        picoquic_set_ticket_table(quic, table_size) != 0) {
+        /* A single group of 8 records fits in table_size, not in table_size - 1 */
+        DBG_PRINTF("%s", "Cannot set ticket table\n");
+        ret = -1;
+    }
+
+    /* Fill the table, then update one record */
+    for (uint64_t i = 0; ret == 0 && i < 8; i++) {
+        ret = picoquic_remember_issued_ticket(quic, 0x1000 + i, 10000 + i, 20000 + i, ip_addr, sizeof(ip_addr));
+    }
+    if (ret == 0) {
+        ret = picoquic_remember_issued_ticket(quic, 0x1003, 30000, 40000, ip_addr, sizeof(ip_addr));
+    }
+    for (uint64_t i = 0; ret == 0 && i < 8; i++) {
+        if (picoquic_retrieve_issued_ticket(quic, 0x1000 + i, &ticket) != 0 ||
+            ticket.ticket_id != 0x1000 + i ||
+            ticket.rtt != ((i == 3) ? 30000 : 10000 + i) ||
+            ticket.cwin != ((i == 3) ? 40000 : 20000 + i) ||
+            ticket.ip_addr_length != sizeof(ip_addr) ||
+            memcmp(ticket.ip_addr, ip_addr, sizeof(ip_addr)) != 0) {
+            DBG_PRINTF("Ticket %" PRIu64 " not found or incorrect\n", i);
+            ret = -1;
+        }
+    }
+    if (ret == 0 && picoquic_retrieve_issued_ticket(quic, 0x2000, &ticket) == 0) {
+        DBG_PRINTF("%s", "Unexpected ticket found\n");
+        ret = -1;
+    }
+
+    /* Adding a ticket evicts one record. After that sweep, use some tickets,
+     * and verify that the next eviction spares them. */
+    if (ret == 0) {
+        int nb_found = 0;
+
+        ret = picoquic_remember_issued_ticket(quic, 0x2000, 1, 2, ip_addr, sizeof(ip_addr));
+        for (uint64_t i = 0; ret == 0 && i < 8; i++) {
+            if (picoquic_retrieve_issued_ticket(quic, 0x1000 + i, &ticket) == 0) {
+                nb_found++;
+            }
+        }
+        if (ret == 0 && (nb_found != 7 || picoquic_retrieve_issued_ticket(quic, 0x2000, &ticket) != 0)) {
+            DBG_PRINTF("After eviction, %d old tickets found\n", nb_found);
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        uint64_t used[2] = { 0, 0 };
+        int nb_used = 0;
+
+        /* All records were marked by the retrievals. Add a ticket to clear the marks,
+         * then mark two tickets and add another one. */
+        ret = picoquic_remember_issued_ticket(quic, 0x2001, 1, 2, ip_addr, sizeof(ip_addr));
+        for (uint64_t i = 0; ret == 0 && i < 8 && nb_used < 2; i++) {
+            if (picoquic_retrieve_issued_ticket(quic, 0x1000 + i, &ticket) == 0) {
+                used[nb_used++] = 0x1000 + i;
+            }
+        }
+        if (ret == 0) {
+            ret = picoquic_remember_issued_ticket(quic, 0x2002, 1, 2, ip_addr, sizeof(ip_addr));
+        }
+        if (ret == 0 && (nb_used != 2 ||
+            picoquic_retrieve_issued_ticket(quic, used[0], &ticket) != 0 ||
+            picoquic_retrieve_issued_ticket(quic, used[1], &ticket) != 0 ||
+            picoquic_retrieve_issued_ticket(quic, 0x2002, &ticket) != 0)) {
+            DBG_PRINTF("%s", "Recently used tickets were evicted\n");
+            ret = -1;
+        }
+    }
+
+    /* Share a table between two contexts */
+    if (ret == 0) {
+        size_t shared_size = picoquic_ticket_table_memory_size(1000);
+
+        shared = malloc(shared_size);
+        if (shared == NULL || picoquic_ticket_table_init(shared, shared_size) != 0 ||
+            picoquic_ticket_table_init(shared, 16) == 0) {
+            DBG_PRINTF("%s", "Cannot initialize shared table\n");
+            ret = -1;
+        }
+        else {
+            picoquic_set_shared_ticket_table(quic, shared);
+            picoquic_set_shared_ticket_table(quic2, shared);
+            for (uint64_t i = 0; ret == 0 && i < 100; i++) {
+                ret = picoquic_remember_issued_ticket((i & 1) ? quic : quic2, 0x3000 + i, 1000 + i, 2000 + i,
+                    ip_addr, sizeof(ip_addr));
+            }
+            for (uint64_t i = 0; ret == 0 && i < 100; i++) {
+                if (picoquic_retrieve_issued_ticket((i & 1) ? quic2 : quic, 0x3000 + i, &ticket) != 0 ||
+                    ticket.rtt != 1000 + i || ticket.cwin != 2000 + i) {
+                    DBG_PRINTF("Shared table fails for ticket %" PRIu64 "\n", i);
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+    if (quic2 != NULL) {
+        picoquic_free(quic2);
+    }
+    if (shared != NULL) {
+        free(shared);
+    }
+
+    return ret;
+}
+
+/* Path BDP cache. Verify that estimates are shared by the servers in the same
+ * prefix and on the same interface, that the window is halved for servers
+ * other than the one that produced the estimates, and that the estimates
+ * survive saving and reloading the ticket file.
+ */
+static char const* path_bdp_cache_store = "path_bdp_cache_store.bin";
+
+static picoquic_cnx_t* path_bdp_cache_test_cnx(picoquic_quic_t* quic, uint8_t last_byte, uint8_t third_byte,
+    unsigned long if_index, uint64_t current_time)
+{
+    struct sockaddr_in addr;
+    uint8_t ip_addr[4] = { 10, 0, 0, 0 };
+    picoquic_cnx_t* cnx;
+
+    ip_addr[2] = third_byte;
+    ip_addr[3] = last_byte;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(443);
+    memcpy(&addr.sin_addr, ip_addr, 4);
+
+    cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*)&addr, current_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+    if (cnx != NULL) {
+        cnx->path[0]->if_index_dest = if_index;
+    }
+
+    return cnx;
+}
+
+static int path_bdp_cache_test_seed(picoquic_quic_t* quic, uint8_t last_byte, uint8_t third_byte,
+    unsigned long if_index, uint64_t current_time, uint64_t expected_cwin)
+{
+    int ret = 0;
+    picoquic_cnx_t* cnx = path_bdp_cache_test_cnx(quic, last_byte, third_byte, if_index, current_time);
+
+    if (cnx == NULL) {
+        ret = -1;
+    }
+    else {
+        picoquic_seed_from_path_bdp(cnx, cnx->path[0], current_time);
+        if (cnx->seed_cwin != expected_cwin || (expected_cwin != 0 && cnx->seed_rtt_min != 20000)) {
+            DBG_PRINTF("Seed cwin %" PRIu64 ", expected %" PRIu64, cnx->seed_cwin, expected_cwin);
+            ret = -1;
+        }
+        else if (picoquic_get_path_bdp_mtu(quic, cnx->path[0], current_time) != ((expected_cwin == 0) ? 0 : 1440)) {
+            DBG_PRINTF("%s", "Unexpected path MTU");
+            ret = -1;
+        }
+        picoquic_delete_cnx(cnx);
+    }
+
+    return ret;
+}
+
+int path_bdp_cache_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_quic_t* quic = picoquic_create(4, NULL, NULL, NULL, PICOQUIC_TEST_ALPN, NULL, NULL, NULL, NULL,
+        NULL, 0, &simulated_time, NULL, NULL, 0);
+    picoquic_quic_t* quic2 = NULL;
+
+    if (quic == NULL || picoquic_set_path_bdp_cache(quic, 10000000) != 0 ||
+        (cnx = path_bdp_cache_test_cnx(quic, 1, 0, 2, simulated_time)) == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context");
+        ret = -1;
+    }
+    else {
+        cnx->path[0]->rtt_min = 20000;
+        cnx->path[0]->cwin = 200000;
+        cnx->path[0]->send_mtu = 1440;
+        picoquic_update_path_bdp(cnx, cnx->path[0], simulated_time);
+        picoquic_delete_cnx(cnx);
+    }
+
+    /* Same server, same prefix, other prefix, other interface */
+    if (ret == 0 && (path_bdp_cache_test_seed(quic, 1, 0, 2, simulated_time, 200000) != 0 ||
+        path_bdp_cache_test_seed(quic, 7, 0, 2, simulated_time, 100000) != 0 ||
+        path_bdp_cache_test_seed(quic, 1, 1, 2, simulated_time, 0) != 0 ||
+        path_bdp_cache_test_seed(quic, 1, 0, 3, simulated_time, 0) != 0)) {
+        ret = -1;
+    }
+
+    /* Save and reload */
+    if (ret == 0 && picoquic_save_session_tickets(quic, path_bdp_cache_store) != 0) {
+        DBG_PRINTF("%s", "Cannot save the ticket file");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        simulated_time += 1000000;
+        quic2 = picoquic_create(4, NULL, NULL, NULL, PICOQUIC_TEST_ALPN, NULL, NULL, NULL, NULL,
+            NULL, 0, &simulated_time, path_bdp_cache_store, NULL, 0);
+        if (quic2 == NULL || picoquic_set_path_bdp_cache(quic2, 10000000) != 0 || quic2->path_bdp_nb != 1) {
+            DBG_PRINTF("%s", "Cannot reload the path estimates");
+            ret = -1;
+        }
+        else {
+            ret = path_bdp_cache_test_seed(quic2, 7, 0, 2, simulated_time, 100000);
+        }
+    }
+
+    /* Expiry */
+    if (ret == 0) {
+        simulated_time += 10000000;
+        ret = path_bdp_cache_test_seed(quic2, 1, 0, 2, simulated_time, 0);
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+    if (quic2 != NULL) {
+        picoquic_free(quic2);
+    }
+
+    return ret;
+}
+
 /* Ticket seed. Do a connection, and verify that server and client have properly
  * documented the congestion parameters in the outgoing or incoming tickets
  */
@@ -582,27 +983,22 @@ int ticket_seed_test_one(int bdp_option)
 
     if (ret == 0) {
         /* Check the issued tickets list at the server. */
-        picoquic_issued_ticket_t* server_ticket;
+        picoquic_issued_ticket_t server_ticket;
+        uint64_t issued_ticket_id = (test_ctx->cnx_server == NULL) ?
+            client_ticket_id : test_ctx->cnx_server->issued_ticket_id;
 
-        if (test_ctx->cnx_server == NULL) {
-            server_ticket = test_ctx->qserver->table_issued_tickets_first;
-        }
-        else {
-            server_ticket = picoquic_retrieve_issued_ticket(test_ctx->qserver,
-                test_ctx->cnx_server->issued_ticket_id);
-        }
-        if (server_ticket == NULL) {
+        if (picoquic_retrieve_issued_ticket(test_ctx->qserver, issued_ticket_id, &server_ticket) != 0) {
             DBG_PRINTF("%s", "No ticket found for server.");
             ret = -1;
         }
         else {
-            server_ticket_id = server_ticket->ticket_id;
+            server_ticket_id = server_ticket.ticket_id;
 
-            if (server_ticket->rtt == 0) {
+            if (server_ticket.rtt == 0) {
                 DBG_PRINTF("%s", "RTT not set for server ticket.");
                 ret = -1;
             }
-            if (server_ticket->cwin == 0) {
+            if (server_ticket.cwin == 0) {
                 DBG_PRINTF("%s", "CWIN not set for server ticket.");
                 ret = -1;
             }
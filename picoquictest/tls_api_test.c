@@ -35,6 +35,8 @@
 #include "csv.h"
 #include "qlog.h"
 #include "autoqlog.h"
+#include "logreplay.h"
+#include "logreader.h"
 #include "picoquic_logger.h"
 #include "performance_log.h"
 #include "picoquictest.h"
@@ -1493,10 +1495,16 @@ int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
                     size_t size_sent = 0;
                     uint8_t *  send_buffer = test_ctx->send_buffer;
                     if (p_segment_size == NULL) {
-                        segment_size = PICOQUIC_MAX_PACKET_SIZE;
+                        segment_size = send_length;
                     }
                     while (ret == 0 && size_sent < send_length) {
-                        picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
+                        size_t packet_length = send_length - size_sent;
+                        picoquictest_sim_packet_t* packet;
+
+                        if (packet_length > segment_size) {
+                            packet_length = segment_size;
+                        }
+                        packet = picoquictest_sim_link_create_packet_ex(packet_length);
 
                         if (packet == NULL) {
                             ret = -1;
@@ -1505,10 +1513,7 @@ int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
                             picoquic_store_addr(&packet->addr_from, (struct sockaddr*) & addr_from);
                             picoquic_store_addr(&packet->addr_to, (struct sockaddr*) & addr_to);
                             packet->ecn_mark = test_ctx->packet_ecn_default;
-                            packet->length = send_length - size_sent;
-                            if (packet->length > segment_size) {
-                                packet->length = segment_size;
-                            }
+                            packet->length = packet_length;
                             memcpy(packet->bytes, send_buffer, packet->length);
                             picoquictest_sim_link_submit(target_link, packet, *simulated_time);
                             size_sent += segment_size;
@@ -4374,76 +4379,81 @@ int mtu_max_test()
 }
 
 /*
-* MTU drop test. Perform a long duration transmission.
-* Verify that MTU was properly set to expected value, then
-* simulate a routing event that causes the MTU to drop.
-* Check that the MTU gets reduced, and the transmission
-* completes.
+* MTU cache test. The server cache is primed with an MTU of 1440 bytes for
+* the client address. With the delayed PMTUD policy and a short scenario,
+* the server would normally stay at the initial MTU; with the cache, it
+* starts at 1440. In the black hole variant, the link MTU is lower than the
+* cached value: the server must detect the losses of full size packets,
+* fall back to a smaller MTU, and remove or lower the cache entry.
 */
 
-static int mtu_drop_cc_algotest(picoquic_congestion_algorithm_t* cc_algo, uint64_t target_time)
+static int mtu_cache_test_one(int black_hole)
 {
     uint64_t simulated_time = 0;
     uint64_t loss_mask = 0;
-    const uint64_t mtu_drop_latency = 100000;
-    const uint64_t picosec_1mbps = 8000000;
+    const size_t cached_mtu = 1440;
+    const size_t black_hole_mtu = 1300;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    picoquic_connection_id_t initial_cid = { {0xa1, 0x10, 0xcc, 0xa1, 0x90, 6, 7, 8}, 8 };
-    int ret;
-
-    initial_cid.id[4] = cc_algo->congestion_algorithm_number;
-    
-    ret = tls_api_init_ctx_ex(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0, &initial_cid);
-
-    if (ret == 0) {
-        /* Set long delays, 1 Mbps each way */
-        test_ctx->c_to_s_link->microsec_latency = mtu_drop_latency;
-        test_ctx->c_to_s_link->picosec_per_byte = picosec_1mbps;
-        test_ctx->s_to_c_link->microsec_latency = mtu_drop_latency;
-        test_ctx->s_to_c_link->picosec_per_byte = picosec_1mbps;
-        /* Set the CC algorithm to selected value */
-        picoquic_set_default_congestion_algorithm(test_ctx->qserver, cc_algo);
-        picoquic_set_binlog(test_ctx->qserver, ".");
-        test_ctx->qserver->use_long_log = 1;
-    }
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
 
     if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 2*mtu_drop_latency, &simulated_time);
+        picoquic_set_default_pmtud_policy(test_ctx->qserver, picoquic_pmtud_delayed);
+        picoquic_cnx_set_pmtud_policy(test_ctx->cnx_client, picoquic_pmtud_delayed);
+        ret = picoquic_set_mtu_cache(test_ctx->qserver, PICOQUIC_MTU_CACHE_LIFETIME_DEFAULT);
     }
 
-    /* Prepare to send data */
     if (ret == 0) {
-        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
+        picoquic_update_cached_mtu(test_ctx->qserver, (struct sockaddr*)&test_ctx->client_addr,
+            cached_mtu, simulated_time);
+        if (picoquic_get_cached_mtu(test_ctx->qserver, (struct sockaddr*)&test_ctx->client_addr,
+            simulated_time) != cached_mtu) {
+            DBG_PRINTF("%s", "Cannot retrieve the cached MTU\n");
+            ret = -1;
+        }
+        else if (black_hole) {
+            test_ctx->s_to_c_link->path_mtu = black_hole_mtu;
+        }
     }
 
-    /* Send for 1 seconds, check that MTU is discovered, and then drop the MTU size in the s_to_c direction */
     if (ret == 0) {
-        ret = tls_api_wait_for_timeout(test_ctx, &simulated_time, 1000000);
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
     }
 
     if (ret == 0) {
-        if (test_ctx->cnx_client->path[0]->send_mtu != test_ctx->cnx_server->local_parameters.max_packet_size) {
-            ret = -1;
+        if (black_hole) {
+            ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
         }
-        else if (test_ctx->cnx_server->path[0]->send_mtu != test_ctx->cnx_client->local_parameters.max_packet_size) {
-            ret = -1;
+        else {
+            ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q_and_r, sizeof(test_scenario_q_and_r));
         }
     }
 
     if (ret == 0) {
-        test_ctx->c_to_s_link->path_mtu = (PICOQUIC_INITIAL_MTU_IPV4 + test_ctx->c_to_s_link->path_mtu) / 2;
-        test_ctx->s_to_c_link->path_mtu = (PICOQUIC_INITIAL_MTU_IPV4 + test_ctx->s_to_c_link->path_mtu) / 2;
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
     }
 
-    /* Try to complete the data sending loop */
-    if (ret == 0) {
-        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    if (ret == 0 && test_ctx->cnx_server == NULL) {
+        ret = -1;
     }
 
-    /* verify that the transmission was complete */
     if (ret == 0) {
-        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, target_time);
+        size_t server_mtu = test_ctx->cnx_server->path[0]->send_mtu;
+        size_t cache_mtu = picoquic_get_cached_mtu(test_ctx->qserver, (struct sockaddr*)&test_ctx->client_addr,
+            simulated_time);
+
+        if (!black_hole && server_mtu != cached_mtu) {
+            DBG_PRINTF("Server MTU %zu, expected cached value %zu\n", server_mtu, cached_mtu);
+            ret = -1;
+        }
+        else if (black_hole && (server_mtu > black_hole_mtu || cache_mtu > black_hole_mtu)) {
+            DBG_PRINTF("Server MTU %zu, cached %zu, expected at most %zu\n", server_mtu, cache_mtu, black_hole_mtu);
+            ret = -1;
+        }
+        else if (test_ctx->cnx_client->path[0]->send_mtu != PICOQUIC_INITIAL_MTU_IPV4) {
+            DBG_PRINTF("Client MTU %zu, expected %d\n", test_ctx->cnx_client->path[0]->send_mtu, PICOQUIC_INITIAL_MTU_IPV4);
+            ret = -1;
+        }
     }
 
     if (test_ctx != NULL) {
@@ -4454,71 +4464,68 @@ static int mtu_drop_cc_algotest(picoquic_congestion_algorithm_t* cc_algo, uint64
     return ret;
 }
 
-int mtu_drop_test()
+int mtu_cache_test()
 {
-    picoquic_congestion_algorithm_t* algo_list[5] = {
-        picoquic_newreno_algorithm,
-        picoquic_cubic_algorithm,
-        picoquic_dcubic_algorithm,
-        picoquic_fastcc_algorithm,
-        picoquic_bbr_algorithm
-    };
-    uint64_t algo_time[5] = {
-        13000000,
-        11500000,
-        10500000,
-        11000000,
-        10700000
-    };
-    int ret = 0;
-
-    for (int i = 0; i < 5 && ret == 0; i++) {
-        ret = mtu_drop_cc_algotest(algo_list[i], algo_time[i]);
-        if (ret != 0) {
-            DBG_PRINTF("MTU drop test fails for CC=%s", algo_list[i]->congestion_algorithm_id);
-        }
-    }
+    return mtu_cache_test_one(0);
+}
 
-    return ret;
+int mtu_black_hole_test()
+{
+    return mtu_cache_test_one(1);
 }
 
 /*
- * Trying to reproduce the scenario that resulted in
- * spurious retransmissions,and checking that it is fixed.
- */
+* MTU bisection test. The link MTU is set to 1350 bytes in both directions,
+* below the 1400 bytes plateau, and the MTU cache is not used. The expected
+* probe schedule is 1440 (lost), 1400 (lost), 1326, 1363 (lost), 1344: the
+* search stops when the interval is smaller than the search granularity.
+* Verify that both ends converge to 1344, and that exactly three probes were
+* dropped by each link.
+*/
 
-int spurious_retransmit_test()
+#define MTU_BISECT_LINK_MTU 1350
+#define MTU_BISECT_EXPECTED 1344
+#define MTU_BISECT_DROPS 3
+
+int mtu_bisect_test()
 {
-    uint64_t loss_mask = 0;
     uint64_t simulated_time = 0;
-    uint64_t next_time = 0;
+    uint64_t loss_mask = 0;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
 
     if (ret == 0) {
-        test_ctx->c_to_s_link->microsec_latency = 50000ull;
-        test_ctx->s_to_c_link->microsec_latency = 50000ull;
-
+        picoquic_set_default_pmtud_policy(test_ctx->qserver, picoquic_pmtud_required);
+        picoquic_cnx_set_pmtud_policy(test_ctx->cnx_client, picoquic_pmtud_required);
+        test_ctx->c_to_s_link->path_mtu = MTU_BISECT_LINK_MTU;
+        test_ctx->s_to_c_link->path_mtu = MTU_BISECT_LINK_MTU;
         ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
     }
 
-    /* simulate 1 second of silence */
-    next_time = simulated_time + 1000000ull;
-    while (ret == 0 && simulated_time < next_time && TEST_CLIENT_READY && TEST_SERVER_READY) {
-        int was_active = 0;
-
-        ret = tls_api_one_sim_round(test_ctx, &simulated_time, next_time, &was_active);
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
     }
 
     if (ret == 0) {
-        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0 && test_ctx->cnx_server == NULL) {
+        ret = -1;
     }
 
     if (ret == 0) {
-        /* verify the absence of any spurious retransmission */
-        if (test_ctx->cnx_client->nb_spurious != 0) {
+        if (test_ctx->cnx_client->path[0]->send_mtu != MTU_BISECT_EXPECTED ||
+            test_ctx->cnx_server->path[0]->send_mtu != MTU_BISECT_EXPECTED) {
+            DBG_PRINTF("Client MTU %zu, server MTU %zu, expected %d\n", test_ctx->cnx_client->path[0]->send_mtu,
+                test_ctx->cnx_server->path[0]->send_mtu, MTU_BISECT_EXPECTED);
             ret = -1;
-        } else if (test_ctx->cnx_server != NULL && test_ctx->cnx_server->nb_spurious != 0) {
+        }
+        else if (test_ctx->c_to_s_link->packets_dropped != MTU_BISECT_DROPS ||
+            test_ctx->s_to_c_link->packets_dropped != MTU_BISECT_DROPS) {
+            DBG_PRINTF("Probes dropped, c_to_s %" PRIu64 ", s_to_c %" PRIu64 ", expected %d\n",
+                test_ctx->c_to_s_link->packets_dropped, test_ctx->s_to_c_link->packets_dropped, MTU_BISECT_DROPS);
             ret = -1;
         }
     }
@@ -4532,121 +4539,109 @@ int spurious_retransmit_test()
 }
 
 /*
-* Set up a connection, and verify
-* that the key generated for PN encryption on
-* client and server produce the correct results.
+* MTU cache learning test. The server MTU cache is enabled but empty. The
+* first connection discovers the path MTU by bisection, which stores the
+* validated value in the cache. The second connection from the same client
+* uses the delayed PMTUD policy and a short scenario, which would normally
+* keep the initial MTU; the server must start it at the learned value, without
+* sending any oversized probe.
 */
 
-int pn_enc_1rtt_test()
+int mtu_cache_learn_test()
 {
-    uint64_t loss_mask = 0;
     uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t dropped_before = 0;
+    size_t learned_mtu = 0;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
 
     if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+        picoquic_set_default_pmtud_policy(test_ctx->qserver, picoquic_pmtud_required);
+        picoquic_cnx_set_pmtud_policy(test_ctx->cnx_client, picoquic_pmtud_required);
+        test_ctx->c_to_s_link->path_mtu = MTU_BISECT_LINK_MTU;
+        test_ctx->s_to_c_link->path_mtu = MTU_BISECT_LINK_MTU;
+        ret = picoquic_set_mtu_cache(test_ctx->qserver, PICOQUIC_MTU_CACHE_LIFETIME_DEFAULT);
     }
 
-    if (ret == 0) {
-        ret = wait_application_aead_ready(test_ctx, &simulated_time);
+    if (ret == 0 && picoquic_get_cached_mtu(test_ctx->qserver, (struct sockaddr*)&test_ctx->client_addr,
+        simulated_time) != 0) {
+        DBG_PRINTF("%s", "MTU cache is not empty\n");
+        ret = -1;
     }
 
-    if (ret == 0)
-    {
-        /* Try to encrypt a sequence number */
-        uint8_t seq_num_1[4] = { 0xde, 0xad, 0xbe, 0xef };
-        uint8_t sample_1[16] = {
-            0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
-            0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a };
-        uint8_t seq_num_2[4] = { 0xba, 0xba, 0xc0, 0x0l };
-        uint8_t sample_2[16] = {
-            0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
-            0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96 };
-
-        for (int i = 1; i < 4; i *= 2)
-        {
-            ret = test_one_pn_enc_pair(seq_num_1, 4, test_ctx->cnx_client->crypto_context[3].pn_enc, test_ctx->cnx_server->crypto_context[3].pn_dec, sample_1);
-
-            if (ret == 0)
-            {
-                ret = test_one_pn_enc_pair(seq_num_2, 4, test_ctx->cnx_server->crypto_context[3].pn_enc, test_ctx->cnx_client->crypto_context[3].pn_dec, sample_2);
-            }
-        }
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
     }
 
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
     }
 
-    return ret;
-}
-
-int bad_certificate_test()
-{
-    uint64_t simulated_time = 0;
-    uint64_t loss_mask = 0;
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    char test_server_cert_file[512];
-    char test_server_key_file[512];
-    char test_server_cert_store_file[512];
-    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
-
     if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_BAD_CERT);
-
-        if (ret == 0) {
-            ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
-        }
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
 
-        if (ret == 0) {
-            ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
+    if (ret == 0) {
+        learned_mtu = picoquic_get_cached_mtu(test_ctx->qserver, (struct sockaddr*)&test_ctx->client_addr,
+            simulated_time);
+        if (learned_mtu != MTU_BISECT_EXPECTED) {
+            DBG_PRINTF("Cached MTU %zu, expected %d\n", learned_mtu, MTU_BISECT_EXPECTED);
+            ret = -1;
         }
-
-        if (ret != 0) {
-            DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
+        else {
+            ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
         }
     }
 
-    /* Delete the server context, and recreate it with the bad certificate */
-
-    if (ret == 0)
-    {
-        if (test_ctx->qserver != NULL) {
-            picoquic_free(test_ctx->qserver);
+    if (ret == 0) {
+        /* Start a second connection from the same client */
+        while (test_ctx->qclient->cnx_list != NULL) {
+            picoquic_delete_cnx(test_ctx->qclient->cnx_list);
         }
+        test_ctx->cnx_server = NULL;
+        picoquic_set_default_pmtud_policy(test_ctx->qserver, picoquic_pmtud_delayed);
+        dropped_before = test_ctx->s_to_c_link->packets_dropped;
 
-        test_ctx->qserver = picoquic_create(8,
-            test_server_cert_file, test_server_key_file, test_server_cert_store_file,
-            PICOQUIC_TEST_ALPN, test_api_callback, (void*)&test_ctx->server_callback, NULL, NULL, NULL,
-            simulated_time, &simulated_time, NULL,
-            test_ticket_encrypt_key, sizeof(test_ticket_encrypt_key));
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+            picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, simulated_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
 
-        if (test_ctx->qserver == NULL) {
+        if (test_ctx->cnx_client == NULL) {
             ret = -1;
         }
+        else {
+            picoquic_cnx_set_pmtud_policy(test_ctx->cnx_client, picoquic_pmtud_delayed);
+            ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+        }
     }
 
-    /* Proceed with the connection loop. It should fail, and thus we don't test the return code */
     if (ret == 0) {
-        (void)tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
 
-        if (test_ctx->cnx_client == NULL) {
-            ret = -1;
-        }
-        else if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
-            ret = -1;
-        }
-        else if (!picoquic_is_handshake_error(picoquic_get_local_error(test_ctx->cnx_client))) {
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q_and_r, sizeof(test_scenario_q_and_r));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0 && test_ctx->cnx_server == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        if (test_ctx->cnx_server->path[0]->send_mtu != learned_mtu) {
+            DBG_PRINTF("Server MTU %zu, expected learned value %zu\n", test_ctx->cnx_server->path[0]->send_mtu, learned_mtu);
             ret = -1;
         }
-        else if (!picoquic_is_handshake_error(picoquic_get_remote_error(test_ctx->cnx_server))) {
+        else if (test_ctx->s_to_c_link->packets_dropped != dropped_before) {
+            DBG_PRINTF("%" PRIu64 " packets dropped on second connection\n", test_ctx->s_to_c_link->packets_dropped - dropped_before);
             ret = -1;
         }
-        else {
-            ret = 0;
-        }
     }
 
     if (test_ctx != NULL) {
@@ -4658,127 +4653,184 @@ int bad_certificate_test()
 }
 
 /*
-* Test setting the verify certificate callback.
+* Jumbo packet test. Transfer 10 MB on a simulated 10 Gbps link with low
+* latency, as in a data center. If mtu_max is set on both ends, verify that
+* path MTU discovery converges to the jumbo packet size. The same transfer is
+* done with the default MTU, and the wall clock time of both simulated runs is
+* reported. This measures the per packet processing cost of the stack, i.e.,
+* encryption, framing and acknowledgements; it does not include the socket
+* and system call costs of a loopback or network transfer.
 */
 
-typedef struct st_verify_certificate_test_cb_t {
-    ptls_verify_certificate_t super;
-    int callcount;
-} verify_certificate_test_cb_t;
-
-static int verify_sign_test(void* verify_ctx, uint16_t algo, ptls_iovec_t data, ptls_iovec_t sign)
-{
-    int* ptr = (int*)verify_ctx;
-    *ptr += 1;
-
-    return 0;
-}
-/*
-    int (*cb)(struct st_ptls_verify_certificate_t *self, ptls_t *tls, const char *server_name,
-              int (**verify_sign)(void *verify_ctx, uint16_t algo, ptls_iovec_t data, ptls_iovec_t sign), void **verify_data,
-              ptls_iovec_t *certs, size_t num_certs);
-*/
-static int verify_certificate_test_cb(struct st_ptls_verify_certificate_t* self, ptls_t* tls, const char* server_name,
-    int (**verify_sign)(void* verify_ctx, uint16_t algo, ptls_iovec_t data, ptls_iovec_t sign), void** verify_data,
-    ptls_iovec_t* certs, size_t num_certs)
-{
-
-    int ret = 0;
-    verify_certificate_test_cb_t* verify_cb_ctx = (verify_certificate_test_cb_t*)
-        ((char*)self - offsetof(verify_certificate_test_cb_t, super.cb));
-
-    *verify_sign = verify_sign_test;
-    *verify_data = (void*)&verify_cb_ctx->callcount;
-
-    return ret;
-}
-
-int set_verify_certificate_callback_test()
+static int jumbo_test_one(uint32_t mtu_max, size_t* send_mtu, uint64_t* wall_time)
 {
     uint64_t simulated_time = 0;
     uint64_t loss_mask = 0;
+    const uint64_t latency_target = 50;
+    const uint64_t picosec_per_byte = (1000000ull * 8) / 10000;
+    uint64_t start_wall_time;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    char test_server_cert_file[512];
-    char test_server_key_file[512];
-    char test_server_cert_store_file[512];
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
-    static const uint16_t default_algos[] = {
-        PTLS_SIGNATURE_ED25519, PTLS_SIGNATURE_RSA_PSS_RSAE_SHA256,
-        PTLS_SIGNATURE_ECDSA_SECP256R1_SHA256, PTLS_SIGNATURE_RSA_PKCS1_SHA256, 
-        PTLS_SIGNATURE_RSA_PKCS1_SHA1, UINT16_MAX };
+    picoquic_connection_id_t initial_cid = { {0x90, 0xb0, 0, 0, 0, 6, 7, 8}, 8 };
+    int ret = tls_api_init_ctx_ex2(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0, &initial_cid, 8, 0,
+        PICOQUIC_MAX_JUMBO_PACKET_SIZE);
 
-    verify_certificate_test_cb_t verify_cb = { 0 };
+    if (ret == 0) {
+        test_ctx->c_to_s_link->microsec_latency = latency_target;
+        test_ctx->c_to_s_link->picosec_per_byte = picosec_per_byte;
+        test_ctx->s_to_c_link->microsec_latency = latency_target;
+        test_ctx->s_to_c_link->picosec_per_byte = picosec_per_byte;
+        if (mtu_max > 0) {
+            test_ctx->c_to_s_link->path_mtu = mtu_max;
+            test_ctx->s_to_c_link->path_mtu = mtu_max;
+            picoquic_set_mtu_max(test_ctx->qserver, mtu_max);
+            picoquic_set_mtu_max(test_ctx->qclient, mtu_max);
+            /* Re-create the client connection so it picks up the mtu max */
+            picoquic_delete_cnx(test_ctx->cnx_client);
+            test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+                initial_cid, picoquic_null_connection_id,
+                (struct sockaddr*)&test_ctx->server_addr, 0,
+                PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+            if (test_ctx->cnx_client == NULL) {
+                ret = -1;
+            }
+            else {
+                ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+            }
+        }
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, picoquic_bbr_algorithm);
+        picoquic_set_congestion_algorithm(test_ctx->cnx_client, picoquic_bbr_algorithm);
+    }
 
-    verify_cb.super.cb = verify_certificate_test_cb;
-    verify_cb.super.algos = default_algos;
+    start_wall_time = picoquic_current_time();
 
     if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_CERT);
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, latency_target, &simulated_time);
     }
 
     if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_10mb, sizeof(test_scenario_10mb));
     }
 
     if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
     }
 
-    if (ret != 0) {
-        DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 1000000);
     }
 
-    /* Delete the client context, and recreate with a certificate */
+    *wall_time = picoquic_current_time() - start_wall_time;
+
     if (ret == 0) {
-        if (test_ctx->qclient != NULL) {
-            picoquic_free(test_ctx->qclient);
-            test_ctx->cnx_client = NULL;
-        }
+        *send_mtu = test_ctx->cnx_server->path[0]->send_mtu;
+    }
 
-        test_ctx->qclient = picoquic_create(8,
-            test_server_cert_file, test_server_key_file, test_server_cert_store_file,
-            NULL, test_api_callback, (void*)&test_ctx->client_callback, NULL, NULL, NULL,
-            simulated_time, &simulated_time, NULL, NULL, 0);
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
 
-        if (test_ctx->qclient == NULL) {
+    return ret;
+}
+
+int jumbo_test()
+{
+    uint32_t jumbo_mtu = 9000;
+    size_t send_mtu_default = 0;
+    size_t send_mtu_jumbo = 0;
+    uint64_t wall_time_default = 0;
+    uint64_t wall_time_jumbo = 0;
+    int ret = jumbo_test_one(0, &send_mtu_default, &wall_time_default);
+
+    if (ret == 0) {
+        ret = jumbo_test_one(jumbo_mtu, &send_mtu_jumbo, &wall_time_jumbo);
+    }
+
+    if (ret == 0) {
+        DBG_PRINTF("10 MB transfer, MTU %zu: %" PRIu64 " us, MTU %zu: %" PRIu64 " us\n",
+            send_mtu_default, wall_time_default, send_mtu_jumbo, wall_time_jumbo);
+        /* The test addresses are IPv4, with 28 bytes of IP and UDP overhead */
+        if (send_mtu_jumbo != jumbo_mtu - 28) {
+            DBG_PRINTF("Jumbo MTU %zu, expected %u\n", send_mtu_jumbo, jumbo_mtu - 28);
             ret = -1;
         }
     }
 
-    /* recreate the client connection */
+    return ret;
+}
+
+/*
+* MTU drop test. Perform a long duration transmission.
+* Verify that MTU was properly set to expected value, then
+* simulate a routing event that causes the MTU to drop.
+* Check that the MTU gets reduced, and the transmission
+* completes.
+*/
+
+static int mtu_drop_cc_algotest(picoquic_congestion_algorithm_t* cc_algo, uint64_t target_time)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    const uint64_t mtu_drop_latency = 100000;
+    const uint64_t picosec_1mbps = 8000000;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_connection_id_t initial_cid = { {0xa1, 0x10, 0xcc, 0xa1, 0x90, 6, 7, 8}, 8 };
+    int ret;
+
+    initial_cid.id[4] = cc_algo->congestion_algorithm_number;
+    
+    ret = tls_api_init_ctx_ex(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0, &initial_cid);
+
     if (ret == 0) {
-        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient, picoquic_null_connection_id,
-                                                   picoquic_null_connection_id,
-                                                   (struct sockaddr*)&test_ctx->server_addr, 0,
-                                                   0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+        /* Set long delays, 1 Mbps each way */
+        test_ctx->c_to_s_link->microsec_latency = mtu_drop_latency;
+        test_ctx->c_to_s_link->picosec_per_byte = picosec_1mbps;
+        test_ctx->s_to_c_link->microsec_latency = mtu_drop_latency;
+        test_ctx->s_to_c_link->picosec_per_byte = picosec_1mbps;
+        /* Set the CC algorithm to selected value */
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, cc_algo);
+        picoquic_set_binlog(test_ctx->qserver, ".");
+        test_ctx->qserver->use_long_log = 1;
+    }
 
-        if (test_ctx->cnx_client == NULL) {
-            ret = -1;
-        } else {
-            ret = picoquic_start_client_cnx(test_ctx->cnx_client);
-        }
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 2*mtu_drop_latency, &simulated_time);
     }
 
-    /* Set the verify callback for the client */
+    /* Prepare to send data */
     if (ret == 0) {
-        ret = picoquic_set_verify_certificate_callback(test_ctx->qclient, &verify_cb.super, NULL);
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
     }
 
-    /* Set the verify callback for the server */
+    /* Send for 1 seconds, check that MTU is discovered, and then drop the MTU size in the s_to_c direction */
     if (ret == 0) {
-        ret = picoquic_set_verify_certificate_callback(test_ctx->qserver, &verify_cb.super, NULL);
+        ret = tls_api_wait_for_timeout(test_ctx, &simulated_time, 1000000);
     }
 
-    /* Activate client authentication */
     if (ret == 0) {
-        picoquic_set_client_authentication(test_ctx->qserver, 1);
+        if (test_ctx->cnx_client->path[0]->send_mtu != test_ctx->cnx_server->local_parameters.max_packet_size) {
+            ret = -1;
+        }
+        else if (test_ctx->cnx_server->path[0]->send_mtu != test_ctx->cnx_client->local_parameters.max_packet_size) {
+            ret = -1;
+        }
+    }
 
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    if (ret == 0) {
+        test_ctx->c_to_s_link->path_mtu = (PICOQUIC_INITIAL_MTU_IPV4 + test_ctx->c_to_s_link->path_mtu) / 2;
+        test_ctx->s_to_c_link->path_mtu = (PICOQUIC_INITIAL_MTU_IPV4 + test_ctx->s_to_c_link->path_mtu) / 2;
     }
 
-    if (ret == 0 && verify_cb.callcount != 2) {
-        ret = -1;
+    /* Try to complete the data sending loop */
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    /* verify that the transmission was complete */
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, target_time);
     }
 
     if (test_ctx != NULL) {
@@ -4789,150 +4841,136 @@ int set_verify_certificate_callback_test()
     return ret;
 }
 
+int mtu_drop_test()
+{
+    picoquic_congestion_algorithm_t* algo_list[5] = {
+        picoquic_newreno_algorithm,
+        picoquic_cubic_algorithm,
+        picoquic_dcubic_algorithm,
+        picoquic_fastcc_algorithm,
+        picoquic_bbr_algorithm
+    };
+    uint64_t algo_time[5] = {
+        13000000,
+        11500000,
+        10500000,
+        11000000,
+        10700000
+    };
+    int ret = 0;
+
+    for (int i = 0; i < 5 && ret == 0; i++) {
+        ret = mtu_drop_cc_algotest(algo_list[i], algo_time[i]);
+        if (ret != 0) {
+            DBG_PRINTF("MTU drop test fails for CC=%s", algo_list[i]->congestion_algorithm_id);
+        }
+    }
+
+    return ret;
+}
+
 /*
- * Verify that the simulated time works as expected
+ * Trying to reproduce the scenario that resulted in
+ * spurious retransmissions,and checking that it is fixed.
  */
 
-int virtual_time_test()
+int spurious_retransmit_test()
 {
-    int ret = 0;
-    uint64_t test_time = 0;
+    uint64_t loss_mask = 0;
     uint64_t simulated_time = 0;
-    uint64_t current_time = picoquic_current_time();
-    uint64_t ptls_time = 0;
-    uint8_t callback_ctx[256];
-    char test_server_cert_store_file[512];
-    picoquic_quic_t * qsimul = NULL;
-    picoquic_quic_t * qdirect = NULL;
+    uint64_t next_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
 
-    ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
+    if (ret == 0) {
+        test_ctx->c_to_s_link->microsec_latency = 50000ull;
+        test_ctx->s_to_c_link->microsec_latency = 50000ull;
 
-    if (ret != 0) {
-        DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
     }
-    else {
 
-        qsimul = picoquic_create(8, NULL, NULL, test_server_cert_store_file,
-            NULL, test_api_callback,
-            (void*)callback_ctx, NULL, NULL, NULL, simulated_time,
-            &simulated_time, ticket_file_name, NULL, 0);
-        qdirect = picoquic_create(8, NULL, NULL, PICOQUIC_TEST_FILE_CERT_STORE,
-            NULL, test_api_callback,
-            (void*)callback_ctx, NULL, NULL, NULL, current_time,
-            NULL, ticket_file_name, NULL, 0);
+    /* simulate 1 second of silence */
+    next_time = simulated_time + 1000000ull;
+    while (ret == 0 && simulated_time < next_time && TEST_CLIENT_READY && TEST_SERVER_READY) {
+        int was_active = 0;
 
-        if (qsimul == NULL || qdirect == NULL)
-        {
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, next_time, &was_active);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    if (ret == 0) {
+        /* verify the absence of any spurious retransmission */
+        if (test_ctx->cnx_client->nb_spurious != 0) {
+            ret = -1;
+        } else if (test_ctx->cnx_server != NULL && test_ctx->cnx_server->nb_spurious != 0) {
             ret = -1;
         }
-        else
-        {
-            /* Check that the simulated time follows the simulation */
-            for (int i = 0; ret == 0 && i < 5; i++) {
-                simulated_time += 12345678;
-                test_time = picoquic_get_quic_time(qsimul);
-                ptls_time = picoquic_get_tls_time(qsimul);
-                if (test_time != simulated_time) {
-                    DBG_PRINTF("Test time: %llu != Simulated: %llu",
-                        (unsigned long long)test_time,
-                        (unsigned long long)simulated_time);
-                    ret = -1;
-                }
-                else if (ptls_time < (test_time / 1000) || ptls_time >(test_time / 1000) + 1) {
-                    DBG_PRINTF("Test time: %llu does match ptls time: %llu",
-                        (unsigned long long)test_time,
-                        (unsigned long long)ptls_time);
-                    ret = -1;
-                }
-            }
-        }
-
-        /* Check that the non simulated time follows the current time */
-        for (int i = 0; ret == 0 && i < 5; i++) {
-#ifdef _WINDOWS
-            Sleep(1);
-#else
-            usleep(1000);
-#endif
-            current_time = picoquic_current_time();
-            test_time = picoquic_get_quic_time(qdirect);
-            ptls_time = picoquic_get_tls_time(qdirect);
-
-            if (test_time < current_time) {
-                DBG_PRINTF("Test time: %llu < previous current time: %llu",
-                    (unsigned long long)test_time,
-                    (unsigned long long)current_time);
-                ret = -1;
-            }
-            else {
-                current_time = picoquic_current_time();
-                if (test_time > current_time) {
-                    DBG_PRINTF("Test time: %llu > next current time: %llu",
-                        (unsigned long long)test_time,
-                        (unsigned long long)current_time);
-                    ret = -1;
-                }
-                else if (ptls_time < (test_time / 1000) || ptls_time >(test_time / 1000) + 1) {
-                    DBG_PRINTF("Test current time: %llu does match ptls time: %llu",
-                        (unsigned long long)test_time,
-                        (unsigned long long)ptls_time);
-                    ret = -1;
-                }
-            }
-        }
-    }
-
-    if (qsimul != NULL)
-    {
-        picoquic_free(qsimul);
-        qsimul = NULL;
     }
 
-    if (qdirect != NULL)
-    {
-        picoquic_free(qdirect);
-        qdirect = NULL;
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
     }
 
     return ret;
 }
 
 /*
- * Testing with different initial connection parameters
- */
+* Set up a connection, and verify
+* that the key generated for PN encryption on
+* client and server produce the correct results.
+*/
 
-int tls_different_params_test()
+int pn_enc_1rtt_test()
 {
-    picoquic_tp_t test_parameters;
-
-    memset(&test_parameters, 0, sizeof(picoquic_tp_t));
-
-    picoquic_init_transport_parameters(&test_parameters, 1);
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
 
-    test_parameters.initial_max_stream_id_bidir = 0;
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
 
-    return tls_api_one_scenario_test(test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 0, 0, 3510000, &test_parameters, NULL);
-}
+    if (ret == 0) {
+        ret = wait_application_aead_ready(test_ctx, &simulated_time);
+    }
 
-int tls_quant_params_test()
-{
-    picoquic_tp_t test_parameters;
+    if (ret == 0)
+    {
+        /* Try to encrypt a sequence number */
+        uint8_t seq_num_1[4] = { 0xde, 0xad, 0xbe, 0xef };
+        uint8_t sample_1[16] = {
+            0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+            0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a };
+        uint8_t seq_num_2[4] = { 0xba, 0xba, 0xc0, 0x0l };
+        uint8_t sample_2[16] = {
+            0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+            0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96 };
 
-    memset(&test_parameters, 0, sizeof(picoquic_tp_t));
+        for (int i = 1; i < 4; i *= 2)
+        {
+            ret = test_one_pn_enc_pair(seq_num_1, 4, test_ctx->cnx_client->crypto_context[3].pn_enc, test_ctx->cnx_server->crypto_context[3].pn_dec, sample_1);
 
-    picoquic_init_transport_parameters(&test_parameters, 1);
+            if (ret == 0)
+            {
+                ret = test_one_pn_enc_pair(seq_num_2, 4, test_ctx->cnx_server->crypto_context[3].pn_enc, test_ctx->cnx_client->crypto_context[3].pn_dec, sample_2);
+            }
+        }
+    }
 
-    test_parameters.initial_max_data = 0x4000;
-    test_parameters.initial_max_stream_id_bidir = 0;
-    test_parameters.initial_max_stream_id_unidir = 16384;
-    test_parameters.initial_max_stream_data_bidi_local = 0x2000;
-    test_parameters.initial_max_stream_data_bidi_remote = 0x2000;
-    test_parameters.initial_max_stream_data_uni = 0x2000;
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
 
-    return tls_api_one_scenario_test(test_scenario_quant, sizeof(test_scenario_quant), 0, 0, 0, 0, 0, 3510000, &test_parameters, NULL);
+    return ret;
 }
 
-int set_certificate_and_key_test()
+int bad_certificate_test()
 {
     uint64_t simulated_time = 0;
     uint64_t loss_mask = 0;
@@ -4943,22 +4981,23 @@ int set_certificate_and_key_test()
     int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
 
     if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_CERT);
-    }
+        ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_BAD_CERT);
 
-    if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
-    }
+        if (ret == 0) {
+            ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
+        }
 
-    if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
-    }
+        if (ret == 0) {
+            ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
+        }
 
-    if (ret != 0) {
-        DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
+        if (ret != 0) {
+            DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
+        }
     }
 
-    /* Delete the server context, and recreate it. */
+    /* Delete the server context, and recreate it with the bad certificate */
+
     if (ret == 0)
     {
         if (test_ctx->qserver != NULL) {
@@ -4966,7 +5005,7 @@ int set_certificate_and_key_test()
         }
 
         test_ctx->qserver = picoquic_create(8,
-            NULL, NULL, NULL,
+            test_server_cert_file, test_server_key_file, test_server_cert_store_file,
             PICOQUIC_TEST_ALPN, test_api_callback, (void*)&test_ctx->server_callback, NULL, NULL, NULL,
             simulated_time, &simulated_time, NULL,
             test_ticket_encrypt_key, sizeof(test_ticket_encrypt_key));
@@ -4974,54 +5013,27 @@ int set_certificate_and_key_test()
         if (test_ctx->qserver == NULL) {
             ret = -1;
         }
+    }
 
-        if (ret == 0) {
-            int length;
-            uint8_t* key_der = picoquic_get_private_key_from_key_file(test_server_key_file, &length);
-
-            if (picoquic_set_tls_key(test_ctx->qserver, key_der, length) != 0) {
-                ret = -1;
-            }
+    /* Proceed with the connection loop. It should fail, and thus we don't test the return code */
+    if (ret == 0) {
+        (void)tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
 
-            if (key_der != NULL) {
-                free(key_der);
-            }
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
         }
-
-        if (ret == 0) {
-            size_t count = 0;
-            ptls_iovec_t* chain = picoquic_get_certs_from_file(test_server_cert_file, &count);
-            if (chain == NULL) {
-                ret = -1;
-            } else {
-                picoquic_set_tls_certificate_chain(test_ctx->qserver, chain, count);
-            }
+        else if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
+            ret = -1;
         }
-
-        if (ret == 0) {
-            size_t count = 0;
-            ptls_iovec_t* chain = picoquic_get_certs_from_file(test_server_cert_store_file, &count);
-
-            if (chain == NULL) {
-                ret = -1;
-            } else {
-                picoquic_set_tls_root_certificates(test_ctx->qserver, chain, count);
-                for (size_t i = 0; i < count; i++) {
-                    free(chain[i].base);
-                }
-                free(chain);
-            }
+        else if (!picoquic_is_handshake_error(picoquic_get_local_error(test_ctx->cnx_client))) {
+            ret = -1;
+        }
+        else if (!picoquic_is_handshake_error(picoquic_get_remote_error(test_ctx->cnx_server))) {
+            ret = -1;
+        }
+        else {
+            ret = 0;
         }
-    }
-
-    /* Proceed with the connection loop. */
-    if (ret == 0) {
-        picoquic_enforce_client_only(test_ctx->qserver, 0);
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
-    }
-
-    if (ret == 0 && (!TEST_CLIENT_READY || !TEST_SERVER_READY)) {
-        ret = -1;
     }
 
     if (test_ctx != NULL) {
@@ -5032,7 +5044,43 @@ int set_certificate_and_key_test()
     return ret;
 }
 
-int request_client_authentication_test()
+/*
+* Test setting the verify certificate callback.
+*/
+
+typedef struct st_verify_certificate_test_cb_t {
+    ptls_verify_certificate_t super;
+    int callcount;
+} verify_certificate_test_cb_t;
+
+static int verify_sign_test(void* verify_ctx, uint16_t algo, ptls_iovec_t data, ptls_iovec_t sign)
+{
+    int* ptr = (int*)verify_ctx;
+    *ptr += 1;
+
+    return 0;
+}
+/*
+    int (*cb)(struct st_ptls_verify_certificate_t *self, ptls_t *tls, const char *server_name,
+              int (**verify_sign)(void *verify_ctx, uint16_t algo, ptls_iovec_t data, ptls_iovec_t sign), void **verify_data,
+              ptls_iovec_t *certs, size_t num_certs);
+*/
+static int verify_certificate_test_cb(struct st_ptls_verify_certificate_t* self, ptls_t* tls, const char* server_name,
+    int (**verify_sign)(void* verify_ctx, uint16_t algo, ptls_iovec_t data, ptls_iovec_t sign), void** verify_data,
+    ptls_iovec_t* certs, size_t num_certs)
+{
+
+    int ret = 0;
+    verify_certificate_test_cb_t* verify_cb_ctx = (verify_certificate_test_cb_t*)
+        ((char*)self - offsetof(verify_certificate_test_cb_t, super.cb));
+
+    *verify_sign = verify_sign_test;
+    *verify_data = (void*)&verify_cb_ctx->callcount;
+
+    return ret;
+}
+
+int set_verify_certificate_callback_test()
 {
     uint64_t simulated_time = 0;
     uint64_t loss_mask = 0;
@@ -5040,30 +5088,36 @@ int request_client_authentication_test()
     char test_server_cert_file[512];
     char test_server_key_file[512];
     char test_server_cert_store_file[512];
-    int ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_CERT);
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+    static const uint16_t default_algos[] = {
+        PTLS_SIGNATURE_ED25519, PTLS_SIGNATURE_RSA_PSS_RSAE_SHA256,
+        PTLS_SIGNATURE_ECDSA_SECP256R1_SHA256, PTLS_SIGNATURE_RSA_PKCS1_SHA256, 
+        PTLS_SIGNATURE_RSA_PKCS1_SHA1, UINT16_MAX };
 
-    if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
-    }
+    verify_certificate_test_cb_t verify_cb = { 0 };
+
+    verify_cb.super.cb = verify_certificate_test_cb;
+    verify_cb.super.algos = default_algos;
 
     if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
+        ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_CERT);
     }
 
-    if (ret != 0) {
-        DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
+    if (ret == 0) {
+        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
     }
-    else {
-        ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
     }
 
-    if (ret == 0 && test_ctx == NULL) {
-        ret = -1;
+    if (ret != 0) {
+        DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
     }
 
     /* Delete the client context, and recreate with a certificate */
-    if (ret == 0)
-    {
+    if (ret == 0) {
         if (test_ctx->qclient != NULL) {
             picoquic_free(test_ctx->qclient);
             test_ctx->cnx_client = NULL;
@@ -5077,10 +5131,6 @@ int request_client_authentication_test()
         if (test_ctx->qclient == NULL) {
             ret = -1;
         }
-        else {
-            /* Enforce client only mode on the client side. */
-            picoquic_enforce_client_only(test_ctx->qclient, 1);
-        }
     }
 
     /* recreate the client connection */
@@ -5097,21 +5147,25 @@ int request_client_authentication_test()
         }
     }
 
+    /* Set the verify callback for the client */
+    if (ret == 0) {
+        ret = picoquic_set_verify_certificate_callback(test_ctx->qclient, &verify_cb.super, NULL);
+    }
+
+    /* Set the verify callback for the server */
+    if (ret == 0) {
+        ret = picoquic_set_verify_certificate_callback(test_ctx->qserver, &verify_cb.super, NULL);
+    }
+
+    /* Activate client authentication */
     if (ret == 0) {
         picoquic_set_client_authentication(test_ctx->qserver, 1);
-        
-        /* Proceed with the connection loop. */
+
         ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
     }
-  
-    /* Check that both the client and server are ready. */
-    if (ret == 0) {
-        if (test_ctx->cnx_client == NULL
-            || test_ctx->cnx_server == NULL
-            || !TEST_CLIENT_READY
-            || !TEST_SERVER_READY) {
-            ret = -1;
-        }
+
+    if (ret == 0 && verify_cb.callcount != 2) {
+        ret = -1;
     }
 
     if (test_ctx != NULL) {
@@ -5122,228 +5176,239 @@ int request_client_authentication_test()
     return ret;
 }
 
-int bad_client_certificate_test()
+/*
+ * Verify that the simulated time works as expected
+ */
+
+int virtual_time_test()
 {
+    int ret = 0;
+    uint64_t test_time = 0;
     uint64_t simulated_time = 0;
-    uint64_t loss_mask = 0;
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    char test_server_cert_file[512];
-    char test_server_key_file[512];
+    uint64_t current_time = picoquic_current_time();
+    uint64_t ptls_time = 0;
+    uint8_t callback_ctx[256];
     char test_server_cert_store_file[512];
-    int ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_BAD_CERT);
-
-    if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
-    }
+    picoquic_quic_t * qsimul = NULL;
+    picoquic_quic_t * qdirect = NULL;
 
-    if (ret == 0) {
-        ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
-    }
+    ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
 
     if (ret != 0) {
         DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
     }
     else {
-        ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
-    }
 
-    if (ret == 0 && test_ctx == NULL) {
-        ret = -1;
-    }
-
-    /* Delete the client context, and recreate with a certificate */
-    if (ret == 0)
-    {
-        if (test_ctx->qclient != NULL) {
-            picoquic_free(test_ctx->qclient);
-            test_ctx->cnx_client = NULL;
-        }
-
-        test_ctx->qclient = picoquic_create(8,
-            test_server_cert_file, test_server_key_file, test_server_cert_store_file,
-            NULL, test_api_callback, (void*)&test_ctx->client_callback, NULL, NULL, NULL,
-            simulated_time, &simulated_time, NULL, NULL, 0);
+        qsimul = picoquic_create(8, NULL, NULL, test_server_cert_store_file,
+            NULL, test_api_callback,
+            (void*)callback_ctx, NULL, NULL, NULL, simulated_time,
+            &simulated_time, ticket_file_name, NULL, 0);
+        qdirect = picoquic_create(8, NULL, NULL, PICOQUIC_TEST_FILE_CERT_STORE,
+            NULL, test_api_callback,
+            (void*)callback_ctx, NULL, NULL, NULL, current_time,
+            NULL, ticket_file_name, NULL, 0);
 
-        if (test_ctx->qclient == NULL) {
+        if (qsimul == NULL || qdirect == NULL)
+        {
             ret = -1;
         }
-    }
+        else
+        {
+            /* Check that the simulated time follows the simulation */
+            for (int i = 0; ret == 0 && i < 5; i++) {
+                simulated_time += 12345678;
+                test_time = picoquic_get_quic_time(qsimul);
+                ptls_time = picoquic_get_tls_time(qsimul);
+                if (test_time != simulated_time) {
+                    DBG_PRINTF("Test time: %llu != Simulated: %llu",
+                        (unsigned long long)test_time,
+                        (unsigned long long)simulated_time);
+                    ret = -1;
+                }
+                else if (ptls_time < (test_time / 1000) || ptls_time >(test_time / 1000) + 1) {
+                    DBG_PRINTF("Test time: %llu does match ptls time: %llu",
+                        (unsigned long long)test_time,
+                        (unsigned long long)ptls_time);
+                    ret = -1;
+                }
+            }
+        }
 
-    /* recreate the client connection */
-    if (ret == 0) {
-        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient, picoquic_null_connection_id,
-                                                   picoquic_null_connection_id,
-                                                   (struct sockaddr*)&test_ctx->server_addr, 0,
-                                                   0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+        /* Check that the non simulated time follows the current time */
+        for (int i = 0; ret == 0 && i < 5; i++) {
+#ifdef _WINDOWS
+            Sleep(1);
+#else
+            usleep(1000);
+#endif
+            current_time = picoquic_current_time();
+            test_time = picoquic_get_quic_time(qdirect);
+            ptls_time = picoquic_get_tls_time(qdirect);
 
-        if (test_ctx->cnx_client == NULL) {
-            ret = -1;
-        } else {
-            ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+            if (test_time < current_time) {
+                DBG_PRINTF("Test time: %llu < previous current time: %llu",
+                    (unsigned long long)test_time,
+                    (unsigned long long)current_time);
+                ret = -1;
+            }
+            else {
+                current_time = picoquic_current_time();
+                if (test_time > current_time) {
+                    DBG_PRINTF("Test time: %llu > next current time: %llu",
+                        (unsigned long long)test_time,
+                        (unsigned long long)current_time);
+                    ret = -1;
+                }
+                else if (ptls_time < (test_time / 1000) || ptls_time >(test_time / 1000) + 1) {
+                    DBG_PRINTF("Test current time: %llu does match ptls time: %llu",
+                        (unsigned long long)test_time,
+                        (unsigned long long)ptls_time);
+                    ret = -1;
+                }
+            }
         }
     }
 
-    if (ret == 0) {
-        picoquic_set_client_authentication(test_ctx->qserver, 1);
-        
-        /* Proceed with the connection loop. It should fail */
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
-    }
-
-    if (ret == 0) {
-        if (test_ctx->cnx_client == NULL) {
-            ret = -1;
-        }
-        else if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
-            ret = -1;
-        }
-        else if (!picoquic_is_handshake_error(picoquic_get_local_error(test_ctx->cnx_server))) {
-            ret = -1;
-        }
-        else if (!picoquic_is_handshake_error(picoquic_get_remote_error(test_ctx->cnx_client))) {
-            ret = -1;
-        }
+    if (qsimul != NULL)
+    {
+        picoquic_free(qsimul);
+        qsimul = NULL;
     }
 
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
+    if (qdirect != NULL)
+    {
+        picoquic_free(qdirect);
+        qdirect = NULL;
     }
 
     return ret;
 }
 
 /*
-* NAT Rebinding test. The client is unaware of the migration.
-* Start with one basic transmission, then switch the client
-* to a different port number. Verify that the server issues 
-* a path challenge, that the client responds with a path
-* response, and that the connection completes.
-*/
+ * Testing with different initial connection parameters
+ */
 
-int nat_rebinding_count_r_cid(picoquic_cnx_t* cnx) {
-    int nb_cid = 0;
-    picoquic_remote_cnxid_t* r_cid = cnx->cnxid_stash_first;
+int tls_different_params_test()
+{
+    picoquic_tp_t test_parameters;
 
-    while (r_cid) {
-        nb_cid++;
-        r_cid = r_cid->next;
-    }
+    memset(&test_parameters, 0, sizeof(picoquic_tp_t));
 
-    return nb_cid;
+    picoquic_init_transport_parameters(&test_parameters, 1);
+
+    test_parameters.initial_max_stream_id_bidir = 0;
+
+    return tls_api_one_scenario_test(test_scenario_very_long, sizeof(test_scenario_very_long), 0, 0, 0, 0, 0, 3510000, &test_parameters, NULL);
 }
 
-int nat_rebinding_test_one(uint64_t loss_mask_data, int zero_cid, uint64_t latency)
+int tls_quant_params_test()
 {
-    int ret;
-    uint64_t simulated_time = 0;
-    uint64_t next_time = 0;
-    uint64_t loss_mask = 0;
-    uint64_t initial_challenge = 0;
-    int nb_inactive = 0;
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    picoquic_connection_id_t initial_cid = { {0x19, 0x8a, 0, 0, 0, 0, 0, 0}, 8 };
+    picoquic_tp_t test_parameters;
 
-    if (loss_mask_data != 0) {
-        initial_cid.id[2] = 0x10;
-    }
+    memset(&test_parameters, 0, sizeof(picoquic_tp_t));
 
-    if (zero_cid != 0) {
-        initial_cid.id[3] = 0xc1;
-    }
+    picoquic_init_transport_parameters(&test_parameters, 1);
 
-    ret = tls_api_init_ctx_ex2(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0, &initial_cid, 8, zero_cid, 0);
+    test_parameters.initial_max_data = 0x4000;
+    test_parameters.initial_max_stream_id_bidir = 0;
+    test_parameters.initial_max_stream_id_unidir = 16384;
+    test_parameters.initial_max_stream_data_bidi_local = 0x2000;
+    test_parameters.initial_max_stream_data_bidi_remote = 0x2000;
+    test_parameters.initial_max_stream_data_uni = 0x2000;
 
-    if (ret == 0 && test_ctx == NULL) {
-        ret = PICOQUIC_ERROR_MEMORY;
-    }
-    else {
-        if (latency > 0) {
-            test_ctx->c_to_s_link->microsec_latency = latency;
-            test_ctx->s_to_c_link->microsec_latency = latency;
-        }
-        picoquic_set_log_level(test_ctx->qserver, 1);
-        ret = picoquic_set_binlog(test_ctx->qserver, ".");
-        picoquic_set_log_level(test_ctx->qclient, 1);
-        if (ret == 0) {
-            ret = picoquic_set_binlog(test_ctx->qclient, ".");
-            binlog_new_connection(test_ctx->cnx_client);
-        }
-    }
+    return tls_api_one_scenario_test(test_scenario_quant, sizeof(test_scenario_quant), 0, 0, 0, 0, 0, 3510000, &test_parameters, NULL);
+}
 
-    if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
-    }
+int set_certificate_and_key_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    char test_server_cert_file[512];
+    char test_server_key_file[512];
+    char test_server_cert_store_file[512];
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
 
-    /* run a receive loop until no outstanding data */
     if (ret == 0) {
-        ret = tls_api_synch_to_empty_loop(test_ctx, &simulated_time, 2048, PICOQUIC_NB_PATH_TARGET, 1);
+        ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_CERT);
     }
 
     if (ret == 0) {
-        initial_challenge = test_ctx->cnx_server->path[0]->challenge[0];
-        loss_mask = loss_mask_data; 
-        
-        /* Change the client address */
-        test_ctx->client_addr_natted = test_ctx->client_addr;
-        test_ctx->client_addr_natted.sin_port += 17;
-        test_ctx->client_use_nat = 1;
-
-        /* Prepare to send data */
-        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q_and_r, sizeof(test_scenario_q_and_r));
+        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
     }
 
-    /* Perform a data sending loop */
     if (ret == 0) {
-        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+        ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
     }
-    
-    /* verify that the transmission was complete */
-    if (ret == 0) {
-        ret = tls_api_one_scenario_verify(test_ctx);
+
+    if (ret != 0) {
+        DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
     }
 
-    /* Add a time loop of 3 seconds to give some time for the challenge to be repeated */
-    next_time = simulated_time + 3000000;
-    loss_mask = 0;
-    while (ret == 0 && simulated_time < next_time && TEST_CLIENT_READY 
-        && TEST_SERVER_READY && !zero_cid
-        && (test_ctx->cnx_server->path[0]->challenge_verified != 1 ||
-            test_ctx->cnx_server->nb_paths > 1 ||
-            test_ctx->cnx_server->cnxid_stash_first->sequence == 0 ||
-            nat_rebinding_count_r_cid(test_ctx->cnx_server) < 8 )) {
-        int was_active = 0;
+    /* Delete the server context, and recreate it. */
+    if (ret == 0)
+    {
+        if (test_ctx->qserver != NULL) {
+            picoquic_free(test_ctx->qserver);
+        }
 
-        ret = tls_api_one_sim_round(test_ctx, &simulated_time, next_time, &was_active);
+        test_ctx->qserver = picoquic_create(8,
+            NULL, NULL, NULL,
+            PICOQUIC_TEST_ALPN, test_api_callback, (void*)&test_ctx->server_callback, NULL, NULL, NULL,
+            simulated_time, &simulated_time, NULL,
+            test_ticket_encrypt_key, sizeof(test_ticket_encrypt_key));
 
-        if (was_active) {
-            nb_inactive = 0;
+        if (test_ctx->qserver == NULL) {
+            ret = -1;
         }
-        else {
-            nb_inactive++;
-            if (nb_inactive > 128) {
-                ret = 0;
-                if (nb_inactive > 256) {
-                    break;
+
+        if (ret == 0) {
+            int length;
+            uint8_t* key_der = picoquic_get_private_key_from_key_file(test_server_key_file, &length);
+
+            if (picoquic_set_tls_key(test_ctx->qserver, key_der, length) != 0) {
+                ret = -1;
+            }
+
+            if (key_der != NULL) {
+                free(key_der);
+            }
+        }
+
+        if (ret == 0) {
+            size_t count = 0;
+            ptls_iovec_t* chain = picoquic_get_certs_from_file(test_server_cert_file, &count);
+            if (chain == NULL) {
+                ret = -1;
+            } else {
+                picoquic_set_tls_certificate_chain(test_ctx->qserver, chain, count);
+            }
+        }
+
+        if (ret == 0) {
+            size_t count = 0;
+            ptls_iovec_t* chain = picoquic_get_certs_from_file(test_server_cert_store_file, &count);
+
+            if (chain == NULL) {
+                ret = -1;
+            } else {
+                picoquic_set_tls_root_certificates(test_ctx->qserver, chain, count);
+                for (size_t i = 0; i < count; i++) {
+                    free(chain[i].base);
                 }
+                free(chain);
             }
         }
     }
 
-    /* Verify that the challenge was updated and done */
+    /* Proceed with the connection loop. */
     if (ret == 0) {
-        if (test_ctx->cnx_server == NULL) {
-            DBG_PRINTF("%s", "Server connection disappeared");
-            ret = -1;
-        } else if (initial_challenge == test_ctx->cnx_server->path[0]->challenge[0]) {
-            DBG_PRINTF("%s", "Challenge was not renewed after NAT rebinding");
-            ret = -1;
-        }
-        else if (test_ctx->cnx_server->path[0]->challenge_verified != 1) {
-            DBG_PRINTF("%s", "Challenge was not verified after NAT rebinding");
-            ret = -1;
-        }
+        picoquic_enforce_client_only(test_ctx->qserver, 0);
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0 && (!TEST_CLIENT_READY || !TEST_SERVER_READY)) {
+        ret = -1;
     }
 
     if (test_ctx != NULL) {
@@ -5354,143 +5419,177 @@ int nat_rebinding_test_one(uint64_t loss_mask_data, int zero_cid, uint64_t laten
     return ret;
 }
 
-int nat_rebinding_test()
+int request_client_authentication_test()
 {
+    uint64_t simulated_time = 0;
     uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    char test_server_cert_file[512];
+    char test_server_key_file[512];
+    char test_server_cert_store_file[512];
+    int ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_CERT);
 
-    return nat_rebinding_test_one(loss_mask, 0, 0);
-}
+    if (ret == 0) {
+        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
+    }
 
-int nat_rebinding_loss_test()
-{
-    uint64_t loss_mask = 0x2012;
+    if (ret == 0) {
+        ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
+    }
 
-    return nat_rebinding_test_one(loss_mask, 0, 0);
-}
+    if (ret != 0) {
+        DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
+    }
+    else {
+        ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+    }
 
-int nat_rebinding_zero_test()
-{
-    /* Test of NAT rebinding with zero-length client CID */
-    uint64_t loss_mask = 0;
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
 
-    return nat_rebinding_test_one(loss_mask, 1, 0);
-}
+    /* Delete the client context, and recreate with a certificate */
+    if (ret == 0)
+    {
+        if (test_ctx->qclient != NULL) {
+            picoquic_free(test_ctx->qclient);
+            test_ctx->cnx_client = NULL;
+        }
 
-int nat_rebinding_latency_test()
-{
-    /* Test of NAT rebinding with zero-length client CID */
-    uint64_t loss_mask = 0;
+        test_ctx->qclient = picoquic_create(8,
+            test_server_cert_file, test_server_key_file, test_server_cert_store_file,
+            NULL, test_api_callback, (void*)&test_ctx->client_callback, NULL, NULL, NULL,
+            simulated_time, &simulated_time, NULL, NULL, 0);
 
-    return nat_rebinding_test_one(loss_mask, 0, 100000);
-}
+        if (test_ctx->qclient == NULL) {
+            ret = -1;
+        }
+        else {
+            /* Enforce client only mode on the client side. */
+            picoquic_enforce_client_only(test_ctx->qclient, 1);
+        }
+    }
 
+    /* recreate the client connection */
+    if (ret == 0) {
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient, picoquic_null_connection_id,
+                                                   picoquic_null_connection_id,
+                                                   (struct sockaddr*)&test_ctx->server_addr, 0,
+                                                   0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
 
-/*
-* Fast NAT Rebinding test. The client is unaware of the migration,
-* and is programmed to not support migration. The NAT alternates
-* between ports based on time, or packet counts. The test checks that
-* the connection survives 6 NAT transitions at short intervals.
-*/
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
+        } else {
+            ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+        }
+    }
 
-int fast_nat_rebinding_test()
+    if (ret == 0) {
+        picoquic_set_client_authentication(test_ctx->qserver, 1);
+        
+        /* Proceed with the connection loop. */
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+  
+    /* Check that both the client and server are ready. */
+    if (ret == 0) {
+        if (test_ctx->cnx_client == NULL
+            || test_ctx->cnx_server == NULL
+            || !TEST_CLIENT_READY
+            || !TEST_SERVER_READY) {
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int bad_client_certificate_test()
 {
     uint64_t simulated_time = 0;
     uint64_t loss_mask = 0;
-    const int nb_switches_required = 6;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+    char test_server_cert_file[512];
+    char test_server_key_file[512];
+    char test_server_cert_store_file[512];
+    int ret = picoquic_get_input_path(test_server_cert_file, sizeof(test_server_cert_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_BAD_CERT);
 
-    if (ret == 0 && test_ctx == NULL) {
-        ret = PICOQUIC_ERROR_MEMORY;
+    if (ret == 0) {
+        ret = picoquic_get_input_path(test_server_key_file, sizeof(test_server_key_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_SERVER_KEY);
     }
 
     if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+        ret = picoquic_get_input_path(test_server_cert_store_file, sizeof(test_server_cert_store_file), picoquic_solution_dir, PICOQUIC_TEST_FILE_CERT_STORE);
     }
 
-    if (ret == 0) {
-        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
+    if (ret != 0) {
+        DBG_PRINTF("%s", "Cannot set the cert, key or store file names.\n");
+    }
+    else {
+        ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
     }
 
-    /* Perform a data sending loop */
-    if (ret == 0) {
-        uint64_t delta_t = 5 * (test_ctx->c_to_s_link->microsec_latency + test_ctx->s_to_c_link->microsec_latency);
-        uint64_t next_time = simulated_time + 200000000;
-        int nb_trials = 0;
-        int nb_inactive = 0;
-        int max_trials = 1000000;
-        uint64_t switch_time = simulated_time;
-        int switched = 0;
-        int nb_switched = 0;
-
-        test_ctx->client_use_nat = 1;
-        test_ctx->client_addr_natted = test_ctx->client_addr;
-        test_ctx->client_addr_natted.sin_port += 17;
-
-        while (ret == 0 && nb_trials < max_trials && nb_inactive < 256 && simulated_time < next_time && TEST_CLIENT_READY && TEST_SERVER_READY) {
-            int was_active = 0;
-
-            nb_trials++;
-
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, next_time, &was_active);
-
-            if (ret < 0)
-            {
-                break;
-            }
-
-            if (ret == 0 && test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state == picoquic_state_ready) {
-                if (((struct sockaddr_in*) & test_ctx->cnx_server->path[0]->peer_addr)->sin_port == 0) {
-                    DBG_PRINTF("Client address out of sync, port: %d", ((struct sockaddr_in*) & test_ctx->cnx_server->path[0]->peer_addr)->sin_port);
-                }
-                else if (((struct sockaddr_in*) & test_ctx->cnx_server->path[0]->peer_addr)->sin_port == test_ctx->client_addr_natted.sin_port) {
-                    if (switched) {
-                        if (simulated_time > switch_time + delta_t &&
-                            nb_switched < nb_switches_required) {
-                            switched = 0;
-                        }
-                    }
-                    else
-                    {
-                        /* Change the client address */
-                        test_ctx->client_addr_natted.sin_port += 17;
-                        switched = 1;
-                        switch_time = simulated_time;
-                        nb_switched++;
-                    }
-                }
-            }
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
 
-            if (was_active) {
-                nb_inactive = 0;
-            }
-            else {
-                nb_inactive++;
+    /* Delete the client context, and recreate with a certificate */
+    if (ret == 0)
+    {
+        if (test_ctx->qclient != NULL) {
+            picoquic_free(test_ctx->qclient);
+            test_ctx->cnx_client = NULL;
+        }
 
-                if (nb_inactive == 254) {
-                    DBG_PRINTF("Almost stalled after %d trials, %d inactive, %d switches", nb_trials, nb_inactive, nb_switched);
-                }
-            }
+        test_ctx->qclient = picoquic_create(8,
+            test_server_cert_file, test_server_key_file, test_server_cert_store_file,
+            NULL, test_api_callback, (void*)&test_ctx->client_callback, NULL, NULL, NULL,
+            simulated_time, &simulated_time, NULL, NULL, 0);
 
-            if (test_ctx->test_finished) {
-                if (picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) && picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
-                    break;
-                }
-            }
+        if (test_ctx->qclient == NULL) {
+            ret = -1;
         }
+    }
 
-        DBG_PRINTF("Exit after %d trials, %d inactive, %d switches", nb_trials, nb_inactive, nb_switched);
+    /* recreate the client connection */
+    if (ret == 0) {
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient, picoquic_null_connection_id,
+                                                   picoquic_null_connection_id,
+                                                   (struct sockaddr*)&test_ctx->server_addr, 0,
+                                                   0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
 
-        /* Verify that the test was effective */
-        if (ret == 0 && nb_switched < nb_switches_required) {
+        if (test_ctx->cnx_client == NULL) {
             ret = -1;
+        } else {
+            ret = picoquic_start_client_cnx(test_ctx->cnx_client);
         }
     }
 
-    /* verify that the transmission was complete */
     if (ret == 0) {
-        ret = tls_api_one_scenario_verify(test_ctx);
+        picoquic_set_client_authentication(test_ctx->qserver, 1);
+        
+        /* Proceed with the connection loop. It should fail */
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
+        }
+        else if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
+            ret = -1;
+        }
+        else if (!picoquic_is_handshake_error(picoquic_get_local_error(test_ctx->cnx_server))) {
+            ret = -1;
+        }
+        else if (!picoquic_is_handshake_error(picoquic_get_remote_error(test_ctx->cnx_client))) {
+            ret = -1;
+        }
     }
 
     if (test_ctx != NULL) {
@@ -5502,78 +5601,366 @@ int fast_nat_rebinding_test()
 }
 
 /*
- * Spin bit test. Verify that the bit does spin, and that the number
- * of rotations is plausible given the duration and the min delay.
- */
+* NAT Rebinding test. The client is unaware of the migration.
+* Start with one basic transmission, then switch the client
+* to a different port number. Verify that the server issues 
+* a path challenge, that the client responds with a path
+* response, and that the connection completes.
+*/
 
-int spin_bit_test()
+int nat_rebinding_count_r_cid(picoquic_cnx_t* cnx) {
+    int nb_cid = 0;
+    picoquic_remote_cnxid_t* r_cid = cnx->cnxid_stash_first;
+
+    while (r_cid) {
+        nb_cid++;
+        r_cid = r_cid->next;
+    }
+
+    return nb_cid;
+}
+
+int nat_rebinding_test_one(uint64_t loss_mask_data, int zero_cid, uint64_t latency)
 {
+    int ret;
     uint64_t simulated_time = 0;
+    uint64_t next_time = 0;
     uint64_t loss_mask = 0;
-    uint64_t spin_duration = 0;
+    uint64_t initial_challenge = 0;
+    int nb_inactive = 0;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int spin_count = 0;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+    picoquic_connection_id_t initial_cid = { {0x19, 0x8a, 0, 0, 0, 0, 0, 0}, 8 };
 
-    if (ret != 0)
-    {
-        DBG_PRINTF("%s", "Could not create the QUIC test contexts\n");
+    if (loss_mask_data != 0) {
+        initial_cid.id[2] = 0x10;
     }
 
-    if (ret == 0) {
-        /* force spinbit policy to basic, then start */
-        test_ctx->cnx_client->spin_policy = picoquic_spinbit_basic;
+    if (zero_cid != 0) {
+        initial_cid.id[3] = 0xc1;
+    }
 
-        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
-        if (ret != 0)
-        {
-            DBG_PRINTF("%s", "Could not initialize stream zero for the client\n");
-        }
+    ret = tls_api_init_ctx_ex2(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0, &initial_cid, 8, zero_cid, 0);
 
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        if (latency > 0) {
+            test_ctx->c_to_s_link->microsec_latency = latency;
+            test_ctx->s_to_c_link->microsec_latency = latency;
+        }
+        picoquic_set_log_level(test_ctx->qserver, 1);
+        ret = picoquic_set_binlog(test_ctx->qserver, ".");
+        picoquic_set_log_level(test_ctx->qclient, 1);
+        if (ret == 0) {
+            ret = picoquic_set_binlog(test_ctx->qclient, ".");
+            binlog_new_connection(test_ctx->cnx_client);
+        }
     }
 
     if (ret == 0) {
         ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
-
-        if (ret != 0)
-        {
-            DBG_PRINTF("Connection loop returns error %d\n", ret);
-        }
     }
 
-    /* Prepare to send data */
+    /* run a receive loop until no outstanding data */
     if (ret == 0) {
-        /* force the server spin bit policy to basic, then init the scenario */
-        test_ctx->cnx_server->spin_policy = picoquic_spinbit_basic;
+        ret = tls_api_synch_to_empty_loop(test_ctx, &simulated_time, 2048, PICOQUIC_NB_PATH_TARGET, 1);
+    }
 
-        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
+    if (ret == 0) {
+        initial_challenge = test_ctx->cnx_server->path[0]->challenge[0];
+        loss_mask = loss_mask_data; 
+        
+        /* Change the client address */
+        test_ctx->client_addr_natted = test_ctx->client_addr;
+        test_ctx->client_addr_natted.sin_port += 17;
+        test_ctx->client_use_nat = 1;
 
-        if (ret != 0)
-        {
-            DBG_PRINTF("Init send receive scenario returns %d\n", ret);
-        }
+        /* Prepare to send data */
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q_and_r, sizeof(test_scenario_q_and_r));
     }
 
-    /* Explore the data sending loop so we can observe the spin bit  */
+    /* Perform a data sending loop */
     if (ret == 0) {
-        uint64_t spin_begin_time = simulated_time;
-        uint64_t next_time = simulated_time + 10000000;
-        int ret = 0;
-        int nb_trials = 0;
-        int nb_inactive = 0;
-        int max_trials = 100000;
-        int current_spin = test_ctx->cnx_client->path[0]->current_spin;
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+    
+    /* verify that the transmission was complete */
+    if (ret == 0) {
+        ret = tls_api_one_scenario_verify(test_ctx);
+    }
 
-        test_ctx->c_to_s_link->loss_mask = &loss_mask;
-        test_ctx->s_to_c_link->loss_mask = &loss_mask;
+    /* Add a time loop of 3 seconds to give some time for the challenge to be repeated */
+    next_time = simulated_time + 3000000;
+    loss_mask = 0;
+    while (ret == 0 && simulated_time < next_time && TEST_CLIENT_READY 
+        && TEST_SERVER_READY && !zero_cid
+        && (test_ctx->cnx_server->path[0]->challenge_verified != 1 ||
+            test_ctx->cnx_server->nb_paths > 1 ||
+            test_ctx->cnx_server->cnxid_stash_first->sequence == 0 ||
+            nat_rebinding_count_r_cid(test_ctx->cnx_server) < 8 )) {
+        int was_active = 0;
 
-        while (ret == 0 && nb_trials < max_trials && simulated_time < next_time && nb_inactive < 256 && TEST_CLIENT_READY && TEST_SERVER_READY) {
-            int was_active = 0;
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, next_time, &was_active);
 
-            nb_trials++;
+        if (was_active) {
+            nb_inactive = 0;
+        }
+        else {
+            nb_inactive++;
+            if (nb_inactive > 128) {
+                ret = 0;
+                if (nb_inactive > 256) {
+                    break;
+                }
+            }
+        }
+    }
 
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, next_time, &was_active);
+    /* Verify that the challenge was updated and done */
+    if (ret == 0) {
+        if (test_ctx->cnx_server == NULL) {
+            DBG_PRINTF("%s", "Server connection disappeared");
+            ret = -1;
+        } else if (initial_challenge == test_ctx->cnx_server->path[0]->challenge[0]) {
+            DBG_PRINTF("%s", "Challenge was not renewed after NAT rebinding");
+            ret = -1;
+        }
+        else if (test_ctx->cnx_server->path[0]->challenge_verified != 1) {
+            DBG_PRINTF("%s", "Challenge was not verified after NAT rebinding");
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int nat_rebinding_test()
+{
+    uint64_t loss_mask = 0;
+
+    return nat_rebinding_test_one(loss_mask, 0, 0);
+}
+
+int nat_rebinding_loss_test()
+{
+    uint64_t loss_mask = 0x2012;
+
+    return nat_rebinding_test_one(loss_mask, 0, 0);
+}
+
+int nat_rebinding_zero_test()
+{
+    /* Test of NAT rebinding with zero-length client CID */
+    uint64_t loss_mask = 0;
+
+    return nat_rebinding_test_one(loss_mask, 1, 0);
+}
+
+int nat_rebinding_latency_test()
+{
+    /* Test of NAT rebinding with zero-length client CID */
+    uint64_t loss_mask = 0;
+
+    return nat_rebinding_test_one(loss_mask, 0, 100000);
+}
+
+
+/*
+* Fast NAT Rebinding test. The client is unaware of the migration,
+* and is programmed to not support migration. The NAT alternates
+* between ports based on time, or packet counts. The test checks that
+* the connection survives 6 NAT transitions at short intervals.
+*/
+
+int fast_nat_rebinding_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    const int nb_switches_required = 6;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
+    }
+
+    /* Perform a data sending loop */
+    if (ret == 0) {
+        uint64_t delta_t = 5 * (test_ctx->c_to_s_link->microsec_latency + test_ctx->s_to_c_link->microsec_latency);
+        uint64_t next_time = simulated_time + 200000000;
+        int nb_trials = 0;
+        int nb_inactive = 0;
+        int max_trials = 1000000;
+        uint64_t switch_time = simulated_time;
+        int switched = 0;
+        int nb_switched = 0;
+
+        test_ctx->client_use_nat = 1;
+        test_ctx->client_addr_natted = test_ctx->client_addr;
+        test_ctx->client_addr_natted.sin_port += 17;
+
+        while (ret == 0 && nb_trials < max_trials && nb_inactive < 256 && simulated_time < next_time && TEST_CLIENT_READY && TEST_SERVER_READY) {
+            int was_active = 0;
+
+            nb_trials++;
+
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, next_time, &was_active);
+
+            if (ret < 0)
+            {
+                break;
+            }
+
+            if (ret == 0 && test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state == picoquic_state_ready) {
+                if (((struct sockaddr_in*) & test_ctx->cnx_server->path[0]->peer_addr)->sin_port == 0) {
+                    DBG_PRINTF("Client address out of sync, port: %d", ((struct sockaddr_in*) & test_ctx->cnx_server->path[0]->peer_addr)->sin_port);
+                }
+                else if (((struct sockaddr_in*) & test_ctx->cnx_server->path[0]->peer_addr)->sin_port == test_ctx->client_addr_natted.sin_port) {
+                    if (switched) {
+                        if (simulated_time > switch_time + delta_t &&
+                            nb_switched < nb_switches_required) {
+                            switched = 0;
+                        }
+                    }
+                    else
+                    {
+                        /* Change the client address */
+                        test_ctx->client_addr_natted.sin_port += 17;
+                        switched = 1;
+                        switch_time = simulated_time;
+                        nb_switched++;
+                    }
+                }
+            }
+
+            if (was_active) {
+                nb_inactive = 0;
+            }
+            else {
+                nb_inactive++;
+
+                if (nb_inactive == 254) {
+                    DBG_PRINTF("Almost stalled after %d trials, %d inactive, %d switches", nb_trials, nb_inactive, nb_switched);
+                }
+            }
+
+            if (test_ctx->test_finished) {
+                if (picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) && picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
+                    break;
+                }
+            }
+        }
+
+        DBG_PRINTF("Exit after %d trials, %d inactive, %d switches", nb_trials, nb_inactive, nb_switched);
+
+        /* Verify that the test was effective */
+        if (ret == 0 && nb_switched < nb_switches_required) {
+            ret = -1;
+        }
+    }
+
+    /* verify that the transmission was complete */
+    if (ret == 0) {
+        ret = tls_api_one_scenario_verify(test_ctx);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Spin bit test. Verify that the bit does spin, and that the number
+ * of rotations is plausible given the duration and the min delay.
+ */
+
+int spin_bit_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t spin_duration = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int spin_count = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret != 0)
+    {
+        DBG_PRINTF("%s", "Could not create the QUIC test contexts\n");
+    }
+
+    if (ret == 0) {
+        /* force spinbit policy to basic, then start */
+        test_ctx->cnx_client->spin_policy = picoquic_spinbit_basic;
+
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+        if (ret != 0)
+        {
+            DBG_PRINTF("%s", "Could not initialize stream zero for the client\n");
+        }
+
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+
+        if (ret != 0)
+        {
+            DBG_PRINTF("Connection loop returns error %d\n", ret);
+        }
+    }
+
+    /* Prepare to send data */
+    if (ret == 0) {
+        /* force the server spin bit policy to basic, then init the scenario */
+        test_ctx->cnx_server->spin_policy = picoquic_spinbit_basic;
+
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
+
+        if (ret != 0)
+        {
+            DBG_PRINTF("Init send receive scenario returns %d\n", ret);
+        }
+    }
+
+    /* Explore the data sending loop so we can observe the spin bit  */
+    if (ret == 0) {
+        uint64_t spin_begin_time = simulated_time;
+        uint64_t next_time = simulated_time + 10000000;
+        int ret = 0;
+        int nb_trials = 0;
+        int nb_inactive = 0;
+        int max_trials = 100000;
+        int current_spin = test_ctx->cnx_client->path[0]->current_spin;
+
+        test_ctx->c_to_s_link->loss_mask = &loss_mask;
+        test_ctx->s_to_c_link->loss_mask = &loss_mask;
+
+        while (ret == 0 && nb_trials < max_trials && simulated_time < next_time && nb_inactive < 256 && TEST_CLIENT_READY && TEST_SERVER_READY) {
+            int was_active = 0;
+
+            nb_trials++;
+
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, next_time, &was_active);
 
             if (ret < 0)
             {
@@ -6458,10 +6845,622 @@ int rebinding_stress_test()
                 }
             }
         }
-        if (ret != 0)
-        {
-            DBG_PRINTF("Test scenario verification returns %d\n", ret);
-        }
+        if (ret != 0)
+        {
+            DBG_PRINTF("Test scenario verification returns %d\n", ret);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+
+
+/* Connection ID renewal test.
+ * The client starts using a new server CID.
+ * We expect the server to switch to using a new client CID
+ */
+
+int cnxid_renewal_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t next_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_connection_id_t target_id = picoquic_null_connection_id;
+    picoquic_connection_id_t previous_local_id = picoquic_null_connection_id;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    /* run a receive loop until no outstanding data */
+    if (ret == 0) {
+        ret = tls_api_synch_to_empty_loop(test_ctx, &simulated_time, 2048, PICOQUIC_NB_PATH_TARGET, 1);
+    }
+
+    /* Renew the connection ID */
+    if (ret == 0) {
+        ret = picoquic_renew_connection_id(test_ctx->cnx_client, 0);
+        if (ret == 0) {
+            target_id = test_ctx->cnx_client->path[0]->p_remote_cnxid->cnx_id;
+            previous_local_id = test_ctx->cnx_client->path[0]->p_local_cnxid->cnx_id;
+        }
+    }
+
+    /* Prepare to send data */
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q_and_r, sizeof(test_scenario_q_and_r));
+    }
+
+    /* Perform a data sending loop */
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    /* Add a time loop of 7 seconds to give some time for the probes to be repeated,
+     * and to ensure that the demotion timers expire. */
+    next_time = simulated_time + 7000000;
+    loss_mask = 0;
+    while (ret == 0 && simulated_time < next_time && TEST_CLIENT_READY
+        && TEST_SERVER_READY) {
+        int was_active = 0;
+
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, next_time, &was_active);
+    }
+
+    /* verify that path[0] was not demoted */
+    if (ret == 0) {
+        if (test_ctx->cnx_client->path[0]->path_is_demoted) {
+            DBG_PRINTF("%s", "The default client path is demoted");
+            ret = -1;
+        }
+        if (test_ctx->cnx_server != NULL && test_ctx->cnx_server->path[0]->path_is_demoted) {
+            DBG_PRINTF("%s", "The default server path is demoted");
+            ret = -1;
+        }
+    }
+
+    /* Verify that the connection ID are what we expect */
+    if (ret == 0) {
+        if (picoquic_compare_connection_id(&test_ctx->cnx_client->path[0]->p_remote_cnxid->cnx_id, &target_id) != 0) {
+            DBG_PRINTF("%s", "The remote CNX ID migrated from the selected value");
+            ret = -1;
+        }
+        else if (picoquic_compare_connection_id(&test_ctx->cnx_client->path[0]->p_local_cnxid->cnx_id, &previous_local_id) == 0) {
+            DBG_PRINTF("%s", "The local CNX ID did not change to a new value");
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Perform a test of the "retire connection id" function.
+ * The test will artificially retire connection ID on the client,
+ * and verify that the server will refill the stash of 
+ * connection ID.
+ */
+int retire_cnxid_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    /* run a receive loop until no outstanding data */
+    if (ret == 0) {
+        ret = tls_api_synch_to_empty_loop(test_ctx, &simulated_time, 2048, PICOQUIC_NB_PATH_TARGET, 0);
+    }
+
+    if (ret == 0) {
+        if (test_ctx->cnx_client->nb_local_cnxid < PICOQUIC_NB_PATH_TARGET) {
+            DBG_PRINTF("Only %d paths created on client.\n", test_ctx->cnx_client->nb_paths);
+            ret = -1;
+        }
+        else if (test_ctx->cnx_server->nb_local_cnxid < PICOQUIC_NB_PATH_TARGET) {
+            DBG_PRINTF("Only %d paths created on server.\n", test_ctx->cnx_server->nb_paths);
+            ret = -1;
+        }
+    }
+
+    /* Delete several connection ID */
+    for (int i = 2; ret == 0 && i < PICOQUIC_NB_PATH_TARGET; i++) {
+        picoquic_remote_cnxid_t * stashed = picoquic_obtain_stashed_cnxid(test_ctx->cnx_client);
+
+        if (stashed == NULL) {
+            DBG_PRINTF("Could not retrieve cnx ID #%d.\n", i-1);
+            ret = -1;
+        } else {
+            ret = picoquic_queue_retire_connection_id_frame(test_ctx->cnx_client, stashed->sequence);
+            (void)picoquic_remove_stashed_cnxid(test_ctx->cnx_client, stashed, NULL, 0);
+        }
+    }
+
+    /* run the loop again until no outstanding data */
+    if (ret == 0) {
+        uint64_t time_out = simulated_time + 8000000;
+        int nb_rounds = 0;
+        int success = 0;
+
+        while (ret == 0 && simulated_time < time_out &&
+            nb_rounds < 2048 && test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
+            int was_active = 0; 
+
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, time_out, &was_active);
+            nb_rounds++;
+
+            if (test_ctx->cnx_client->nb_local_cnxid >= PICOQUIC_NB_PATH_TARGET &&
+                test_ctx->cnx_server->nb_local_cnxid >= PICOQUIC_NB_PATH_TARGET &&
+                test_ctx->cnx_client->first_misc_frame == NULL &&
+                test_cnxid_count_stash(test_ctx->cnx_client) >= (PICOQUIC_NB_PATH_TARGET - 1) &&
+                picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) &&
+                picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
+                success = 1;
+                break;
+            }
+        }
+
+        if (ret == 0 && success == 0) {
+            DBG_PRINTF("Exit synch loop after %d rounds, backlog or not enough paths (%d & %d).\n",
+                nb_rounds, test_ctx->cnx_client->nb_paths, test_ctx->cnx_server->nb_paths);
+        }
+    }
+
+    /* Check */
+
+    if (ret == 0) {
+        if (test_ctx->cnx_server->nb_local_cnxid != PICOQUIC_NB_PATH_TARGET) {
+            DBG_PRINTF("Found %d paths active on server instead of %d.\n", test_ctx->cnx_server->nb_paths, PICOQUIC_NB_PATH_TARGET);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = transmit_cnxid_test_stash(test_ctx->cnx_client, test_ctx->cnx_server, "client");
+    }
+
+    if (ret == 0) {
+        ret = transmit_cnxid_test_stash(test_ctx->cnx_server, test_ctx->cnx_client, "server");
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Perform a test of the "not before" CNXID function.
+ * The test will artificially simulate receiving a "not before"
+ * parameter in a new connection ID test, to check that the
+ * old connection ID are removed and successfully replaced.
+ */
+int not_before_cnxid_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t not_before;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    /* run a receive loop until no outstanding data */
+    if (ret == 0) {
+        ret = tls_api_synch_to_empty_loop(test_ctx, &simulated_time, 2048, PICOQUIC_NB_PATH_TARGET, 0);
+    }
+
+    /* find a plausible "not before" value,and apply it */
+    if (ret == 0) {
+        not_before = test_ctx->cnx_server->local_cnxid_sequence_next - 1;
+        ret = picoquic_remove_not_before_cid(test_ctx->cnx_client, not_before, simulated_time);
+    }
+
+    /* run the loop again until no outstanding data */
+    if (ret == 0) {
+        uint64_t time_out = simulated_time + 8000000;
+        int nb_rounds = 0;
+        int success = 0;
+
+        while (ret == 0 && simulated_time < time_out &&
+            nb_rounds < 2048 && test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
+            int was_active = 0;
+
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, time_out, &was_active);
+            nb_rounds++;
+
+            if (nb_rounds == 30) {
+                ret = 0;
+            }
+
+            if (test_ctx->cnx_client->nb_local_cnxid >= PICOQUIC_NB_PATH_TARGET &&
+                test_ctx->cnx_server->nb_local_cnxid >= PICOQUIC_NB_PATH_TARGET &&
+                test_ctx->cnx_client->first_misc_frame == NULL &&
+                test_cnxid_count_stash(test_ctx->cnx_client) >= (PICOQUIC_NB_PATH_TARGET - 1) &&
+                test_cnxid_count_stash(test_ctx->cnx_server) >= (PICOQUIC_NB_PATH_TARGET - 1) &&
+                picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) &&
+                picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
+                success = 1;
+                break;
+            }
+        }
+
+        if (ret == 0 && success == 0) {
+            DBG_PRINTF("Exit synch loop after %d rounds, backlog or not enough cid (%d & %d).\n",
+                nb_rounds, test_ctx->cnx_client->nb_local_cnxid, test_ctx->cnx_server->nb_local_cnxid);
+        }
+    }
+
+    /* Check */
+
+    if (ret == 0) {
+        if (test_ctx->cnx_server->nb_local_cnxid != PICOQUIC_NB_PATH_TARGET) {
+            DBG_PRINTF("Found %d cid active on server instead of %d.\n", test_ctx->cnx_server->nb_local_cnxid, PICOQUIC_NB_PATH_TARGET + 1);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = transmit_cnxid_test_stash(test_ctx->cnx_client, test_ctx->cnx_server, "client");
+    }
+
+    if (ret == 0) {
+        ret = transmit_cnxid_test_stash(test_ctx->cnx_server, test_ctx->cnx_client, "server");
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Server busy. Verify that the connection fails with the proper error code, and then that once the server is not busy the next connection succeeds.
+ */
+
+int server_busy_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        test_ctx->qserver->server_busy = 1;
+        (void) tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+
+        if (test_ctx->cnx_server != NULL &&
+            test_ctx->cnx_server->cnx_state != picoquic_state_disconnected) {
+            DBG_PRINTF("Server state: %d, local error: %" PRIx64, test_ctx->cnx_server->cnx_state, test_ctx->cnx_server->local_error);
+            ret = -1;
+        }
+        else if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected ||
+            test_ctx->cnx_client->remote_error != PICOQUIC_TRANSPORT_SERVER_BUSY) {
+            DBG_PRINTF("Client state: %d, remote error: %" PRIx64, test_ctx->cnx_client->cnx_state, test_ctx->cnx_client->remote_error);
+            ret = -1;
+        }
+        else if (simulated_time > 50000ull) {
+            DBG_PRINTF("Simulated time: %" PRIu64, (unsigned long long)simulated_time);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        test_ctx->qserver->server_busy = 0;
+
+        if (test_ctx->cnx_server != NULL) {
+            picoquic_delete_cnx(test_ctx->cnx_server);
+            test_ctx->cnx_server = NULL;
+        }
+        if (test_ctx->cnx_client != NULL) {
+            picoquic_delete_cnx(test_ctx->cnx_client);
+            test_ctx->cnx_client = NULL;
+        }
+
+        /* Create a new client connection */
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+            picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, simulated_time,
+            0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
+        } else {
+            ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Initial close test. Check what happens when the client closes a connection without waiting for the full establishment
+ */
+
+int initial_close_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    int was_active = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        /* Send the initial packet, but no more than that */
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+
+        if (ret == 0) {
+            test_ctx->cnx_client->cnx_state = picoquic_state_handshake_failure;
+            test_ctx->cnx_client->local_error = 0xDEAD;
+            picoquic_reinsert_by_wake_time(test_ctx->qclient, test_ctx->cnx_client, simulated_time);
+        }
+    }
+
+    if (ret == 0) {
+        for (int i = 0; i < 128; i++) {
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+            if (test_ctx->cnx_server != NULL) {
+                break;
+            }
+        }
+        if (ret == 0) {
+            ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+        }
+
+        if (ret == 0) {
+            if (test_ctx->cnx_server == NULL) {
+                DBG_PRINTF("%s", "Server connection deleted, cannot verify error code.\n");
+                ret = -1;
+            }
+            else if (test_ctx->cnx_server->cnx_state != picoquic_state_disconnected ||
+                test_ctx->cnx_server->remote_error != 0xDEAD) {
+                DBG_PRINTF("Server state: %d, remote error: %x\n", test_ctx->cnx_server->cnx_state, test_ctx->cnx_server->remote_error);
+                ret = -1;
+            }
+            else if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
+                DBG_PRINTF("Client state: %d, local error: %x", test_ctx->cnx_client->cnx_state, test_ctx->cnx_client->local_error);
+                ret = -1;
+            }
+            else if (simulated_time > 50000ull) {
+                DBG_PRINTF("Simulated time: %llu", (unsigned long long)simulated_time);
+                ret = -1;
+            }
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Check what happens if the server detects an error in the client's initial
+ * message. Verify that the client receives the error code.
+ */
+
+int initial_server_close_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    int was_active = 0;
+    int nb_trials = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    /* Set the connection on the server side, but not on the client side */
+    while (ret == 0 && nb_trials < 32 ) {
+        nb_trials++;
+
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+
+        if (test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state == picoquic_state_server_almost_ready) {
+            break;
+        }
+    }
+
+    if (test_ctx->cnx_server == NULL || test_ctx->cnx_server->cnx_state != picoquic_state_server_almost_ready) {
+        DBG_PRINTF("Server state: %d\n", (test_ctx->cnx_server == NULL) ?
+            -1 : test_ctx->cnx_server->cnx_state);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        test_ctx->cnx_server->cnx_state = picoquic_state_handshake_failure;
+        test_ctx->cnx_server->local_error = 0xDEAD;
+        picoquic_reinsert_by_wake_time(test_ctx->qserver, test_ctx->cnx_server, simulated_time);
+    }
+
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        if (test_ctx->cnx_server != NULL &&
+            test_ctx->cnx_server->cnx_state != picoquic_state_disconnected) {
+            DBG_PRINTF("Server state: %d, remote error: %x\n", test_ctx->cnx_server->cnx_state, test_ctx->cnx_server->remote_error);
+            ret = -1;
+        }
+        else if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected ||
+            test_ctx->cnx_client->remote_error != 0xDEAD) {
+            DBG_PRINTF("Client state: %d, local error: %x", test_ctx->cnx_client->cnx_state, test_ctx->cnx_client->local_error);
+            ret = -1;
+        }
+        else if (simulated_time > 50000ull) {
+            DBG_PRINTF("Simulated time: %llu", (unsigned long long)simulated_time);
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Test that rotated keys are computed in a compatible way on client and server.
+ */
+
+static int aead_iv_check(void * aead1, void * aead2)
+{
+    int ret = 0;
+#if 0
+    ptls_aead_context_t *ctx1 = (ptls_aead_context_t *)aead1;
+    ptls_aead_context_t *ctx2 = (ptls_aead_context_t *)aead2;
+
+    if (memcmp(ctx1->static_iv, ctx2->static_iv, ctx1->algo->iv_size) != 0) {
+        ret = -1;
+    }
+#else
+    /* TODO: find a replacement for this test */
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(aead1);
+    UNREFERENCED_PARAMETER(aead2);
+#endif
+#endif
+    return ret;
+}
+
+#if 0
+static int pn_enc_check(void * pn1, void * pn2)
+{
+    int ret = 0;
+    uint8_t seed[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    uint8_t pn[4] = { 0, 1, 2 ,3 };
+    uint8_t pn_enc[4];
+    uint8_t pn_dec[4];
+
+    picoquic_pn_encrypt(pn1, seed, pn_enc, pn, 4);
+    picoquic_pn_encrypt(pn2, seed, pn_dec, pn_enc, 4);
+
+    if (memcmp(pn_dec, pn, 4) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+#endif
+
+int new_rotated_key_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = wait_application_aead_ready(test_ctx, &simulated_time);
+    }
+
+
+    for (int i = 1; ret == 0 && i <= 3; i++) {
+        
+        /* Try to compute rotated keys on server */
+        ret = picoquic_compute_new_rotated_keys(test_ctx->cnx_server);
+        if (ret != 0) {
+            DBG_PRINTF("Could not rotate server key, ret: %x\n", ret);
+        } else {
+            /* Try to compute rotated keys on client */
+            ret = picoquic_compute_new_rotated_keys(test_ctx->cnx_client);
+            if (ret != 0) {
+                DBG_PRINTF("Could not rotate client key, round %d, ret: %x\n", i, ret);
+            }
+        }
+
+        if (ret == 0)
+        {
+            /* Compare server encryption and client decryption */
+            size_t key_size = picoquic_get_app_secret_size(test_ctx->cnx_client);
+
+            if (key_size != picoquic_get_app_secret_size(test_ctx->cnx_server)) {
+                DBG_PRINTF("Round %d. Key sizes dont match, client: %d, server: %d\n", i, key_size, picoquic_get_app_secret_size(test_ctx->cnx_server));
+                ret = -1;
+            }
+            else if (memcmp(picoquic_get_app_secret(test_ctx->cnx_server, 1), picoquic_get_app_secret(test_ctx->cnx_client, 0), key_size) != 0) {
+                DBG_PRINTF("Round %d. Server encryption secret does not match client decryption secret\n", i);
+                ret = -1;
+            }
+            else if (memcmp(picoquic_get_app_secret(test_ctx->cnx_server, 0), picoquic_get_app_secret(test_ctx->cnx_client, 1), key_size) != 0) {
+                DBG_PRINTF("Round %d. Server decryption secret does not match client encryption secret\n", i);
+                ret = -1;
+            }
+            else if (aead_iv_check(test_ctx->cnx_server->crypto_context_new.aead_encrypt, test_ctx->cnx_client->crypto_context_new.aead_decrypt) != 0) {
+                DBG_PRINTF("Round %d. Client AEAD decryption does not match server AEAD encryption.\n", i);
+                ret = -1;
+            }
+            else if (aead_iv_check(test_ctx->cnx_client->crypto_context_new.aead_encrypt, test_ctx->cnx_server->crypto_context_new.aead_decrypt) != 0) {
+                DBG_PRINTF("Round %d. Server AEAD decryption does not match cliens AEAD encryption.\n", i);
+                ret = -1;
+            }
+#if 0
+            else if (pn_enc_check(test_ctx->cnx_server->crypto_context_new.pn_enc, test_ctx->cnx_client->crypto_context_new.pn_dec) != 0) {
+                DBG_PRINTF("Round %d. Client PN decryption does not match server PN encryption.\n", i);
+                ret = -1;
+            }
+            else if (pn_enc_check(test_ctx->cnx_client->crypto_context_new.pn_enc, test_ctx->cnx_server->crypto_context_new.pn_dec) != 0) {
+                DBG_PRINTF("Round %d. Server PN decryption does not match client PN encryption.\n", i);
+                ret = -1;
+            }
+#endif
+        }
+
+        picoquic_crypto_context_free(&test_ctx->cnx_server->crypto_context_new);
+        picoquic_crypto_context_free(&test_ctx->cnx_client->crypto_context_new);
     }
 
     if (test_ctx != NULL) {
@@ -6473,191 +7472,165 @@ int rebinding_stress_test()
 }
 
 
-
-/* Connection ID renewal test.
- * The client starts using a new server CID.
- * We expect the server to switch to using a new client CID
+/*
+ * Key rotation tests
  */
 
-int cnxid_renewal_test()
+static int inject_false_rotation(picoquic_test_tls_api_ctx_t* test_ctx, int target_client, uint64_t simulated_time)
 {
-    uint64_t simulated_time = 0;
-    uint64_t next_time = 0;
-    uint64_t loss_mask = 0;
-    picoquic_connection_id_t target_id = picoquic_null_connection_id;
-    picoquic_connection_id_t previous_local_id = picoquic_null_connection_id;
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
-
-    if (ret == 0 && test_ctx == NULL) {
-        ret = PICOQUIC_ERROR_MEMORY;
-    }
-
-    if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
-    }
-
-    /* run a receive loop until no outstanding data */
-    if (ret == 0) {
-        ret = tls_api_synch_to_empty_loop(test_ctx, &simulated_time, 2048, PICOQUIC_NB_PATH_TARGET, 1);
-    }
-
-    /* Renew the connection ID */
-    if (ret == 0) {
-        ret = picoquic_renew_connection_id(test_ctx->cnx_client, 0);
-        if (ret == 0) {
-            target_id = test_ctx->cnx_client->path[0]->p_remote_cnxid->cnx_id;
-            previous_local_id = test_ctx->cnx_client->path[0]->p_local_cnxid->cnx_id;
-        }
-    }
-
-    /* Prepare to send data */
-    if (ret == 0) {
-        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q_and_r, sizeof(test_scenario_q_and_r));
-    }
+    /* In order to test robustness of key rotation against attacks, we inject a
+     * random packet with properly set header indication transition */
+    int ret = 0;
+    picoquic_cnx_t * cnx = (target_client) ? test_ctx->cnx_client : test_ctx->cnx_server;
+    picoquictest_sim_link_t* target_link = (target_client) ? test_ctx->s_to_c_link : test_ctx->c_to_s_link;
+    picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
 
-    /* Perform a data sending loop */
-    if (ret == 0) {
-        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    if (packet == NULL || cnx == NULL) {
+        ret = -1;
     }
+    else {
+        uint64_t random_context = (0x123456789ABCDEF0ull)|cnx->pkt_ctx[picoquic_packet_context_application].send_sequence;
+        size_t byte_index = 1;
 
-    /* Add a time loop of 7 seconds to give some time for the probes to be repeated,
-     * and to ensure that the demotion timers expire. */
-    next_time = simulated_time + 7000000;
-    loss_mask = 0;
-    while (ret == 0 && simulated_time < next_time && TEST_CLIENT_READY
-        && TEST_SERVER_READY) {
-        int was_active = 0;
-
-        ret = tls_api_one_sim_round(test_ctx, &simulated_time, next_time, &was_active);
-    }
+        packet->bytes[0] = 0x3F | ((cnx->key_phase_dec) ? 0 : 0x40); /* Set phase to opposite of expected value */
 
-    /* verify that path[0] was not demoted */
-    if (ret == 0) {
-        if (test_ctx->cnx_client->path[0]->path_is_demoted) {
-            DBG_PRINTF("%s", "The default client path is demoted");
-            ret = -1;
-        }
-        if (test_ctx->cnx_server != NULL && test_ctx->cnx_server->path[0]->path_is_demoted) {
-            DBG_PRINTF("%s", "The default server path is demoted");
-            ret = -1;
+        for (uint8_t i = 0; i < cnx->path[0]->p_local_cnxid->cnx_id.id_len; i++) {
+            packet->bytes[byte_index++] = cnx->path[0]->p_local_cnxid->cnx_id.id[i];
         }
-    }
+        picoquic_test_random_bytes(&random_context, packet->bytes + byte_index, 128u - byte_index);
+        packet->length = 128;
 
-    /* Verify that the connection ID are what we expect */
-    if (ret == 0) {
-        if (picoquic_compare_connection_id(&test_ctx->cnx_client->path[0]->p_remote_cnxid->cnx_id, &target_id) != 0) {
-            DBG_PRINTF("%s", "The remote CNX ID migrated from the selected value");
-            ret = -1;
+        if (target_client) {
+            picoquic_store_addr(&packet->addr_from, (struct sockaddr *)&test_ctx->server_addr);
+            picoquic_store_addr(&packet->addr_to, (struct sockaddr *)&test_ctx->client_addr);
         }
-        else if (picoquic_compare_connection_id(&test_ctx->cnx_client->path[0]->p_local_cnxid->cnx_id, &previous_local_id) == 0) {
-            DBG_PRINTF("%s", "The local CNX ID did not change to a new value");
-            ret = -1;
+        else {
+            picoquic_store_addr(&packet->addr_from, (struct sockaddr *)&test_ctx->client_addr);
+            picoquic_store_addr(&packet->addr_to, (struct sockaddr *)&test_ctx->server_addr);
         }
-    }
 
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
+        picoquictest_sim_link_submit(target_link, packet, simulated_time);
     }
 
     return ret;
 }
 
-
-/*
- * Perform a test of the "retire connection id" function.
- * The test will artificially retire connection ID on the client,
- * and verify that the server will refill the stash of 
- * connection ID.
- */
-int retire_cnxid_test()
+static int key_rotation_test_one(int inject_bad_packet)
 {
     uint64_t simulated_time = 0;
     uint64_t loss_mask = 0;
+    int nb_trials = 0;
+    int nb_inactive = 0;
+    int max_trials = 100000;
+    int nb_rotation = 0;
+    uint64_t rotation_sequence = 100;
+    uint64_t injection_sequence = 50;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
     int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
         PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
 
-    if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
     }
 
-    /* run a receive loop until no outstanding data */
     if (ret == 0) {
-        ret = tls_api_synch_to_empty_loop(test_ctx, &simulated_time, 2048, PICOQUIC_NB_PATH_TARGET, 0);
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
     }
 
+    /* Prepare to send data */
     if (ret == 0) {
-        if (test_ctx->cnx_client->nb_local_cnxid < PICOQUIC_NB_PATH_TARGET) {
-            DBG_PRINTF("Only %d paths created on client.\n", test_ctx->cnx_client->nb_paths);
-            ret = -1;
-        }
-        else if (test_ctx->cnx_server->nb_local_cnxid < PICOQUIC_NB_PATH_TARGET) {
-            DBG_PRINTF("Only %d paths created on server.\n", test_ctx->cnx_server->nb_paths);
-            ret = -1;
-        }
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
     }
 
-    /* Delete several connection ID */
-    for (int i = 2; ret == 0 && i < PICOQUIC_NB_PATH_TARGET; i++) {
-        picoquic_remote_cnxid_t * stashed = picoquic_obtain_stashed_cnxid(test_ctx->cnx_client);
-
-        if (stashed == NULL) {
-            DBG_PRINTF("Could not retrieve cnx ID #%d.\n", i-1);
-            ret = -1;
-        } else {
-            ret = picoquic_queue_retire_connection_id_frame(test_ctx->cnx_client, stashed->sequence);
-            (void)picoquic_remove_stashed_cnxid(test_ctx->cnx_client, stashed, NULL, 0);
-        }
-    }
+    /* Perform a data sending loop, during which various key rotations are tried
+     * every 100 packets or so. To test robustness, inject bogus packets that
+     * mimic a transition trigger */
 
-    /* run the loop again until no outstanding data */
-    if (ret == 0) {
-        uint64_t time_out = simulated_time + 8000000;
-        int nb_rounds = 0;
-        int success = 0;
+    while (ret == 0 && nb_trials < max_trials && nb_inactive < 256 && TEST_CLIENT_READY && TEST_SERVER_READY) {
+        int was_active = 0;
 
-        while (ret == 0 && simulated_time < time_out &&
-            nb_rounds < 2048 && test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
-            int was_active = 0; 
+        nb_trials++;
 
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, time_out, &was_active);
-            nb_rounds++;
+        if (inject_bad_packet &&
+            test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence > injection_sequence) {
+            ret = inject_false_rotation(test_ctx, inject_bad_packet >> 1, simulated_time);
+            if (ret != 0) {
+                DBG_PRINTF("Could not inject bad packet, ret = %d\n", ret);
+                break;
+            }
+            else {
+                injection_sequence += 50;
+            }
+        }
 
-            if (test_ctx->cnx_client->nb_local_cnxid >= PICOQUIC_NB_PATH_TARGET &&
-                test_ctx->cnx_server->nb_local_cnxid >= PICOQUIC_NB_PATH_TARGET &&
-                test_ctx->cnx_client->first_misc_frame == NULL &&
-                test_cnxid_count_stash(test_ctx->cnx_client) >= (PICOQUIC_NB_PATH_TARGET - 1) &&
-                picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) &&
-                picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
-                success = 1;
+        if (test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence > rotation_sequence &&
+            picoquic_sack_list_last(&test_ctx->cnx_server->ack_ctx[picoquic_packet_context_application].sack_list) >
+            test_ctx->cnx_server->crypto_epoch_sequence &&
+            picoquic_sack_list_last(&test_ctx->cnx_client->ack_ctx[picoquic_packet_context_application].sack_list) >
+            test_ctx->cnx_client->crypto_epoch_sequence &&
+            test_ctx->cnx_server->key_phase_enc == test_ctx->cnx_server->key_phase_dec &&
+            test_ctx->cnx_client->key_phase_enc == test_ctx->cnx_client->key_phase_dec) {
+            rotation_sequence = test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence + 100;
+            injection_sequence = test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence + 50;
+            nb_rotation++;
+            switch (nb_rotation) {
+            case 1: /* Key rotation at the client */
+                ret = picoquic_start_key_rotation(test_ctx->cnx_client);
+                break;
+            case 2: /* Key rotation at the server */
+                ret = picoquic_start_key_rotation(test_ctx->cnx_server);
+                break;
+            case 3: /* Simultaneous key rotation at the client */
+                rotation_sequence += 1000000000;
+                ret = picoquic_start_key_rotation(test_ctx->cnx_client);
+                if (ret == 0) {
+                    ret = picoquic_start_key_rotation(test_ctx->cnx_server);
+                }
                 break;
+            default:
+                break;
+            }
+
+            if (ret != 0) {
+                DBG_PRINTF("Could not start rotation #%d, ret = %x\n", nb_rotation, ret);
             }
         }
 
-        if (ret == 0 && success == 0) {
-            DBG_PRINTF("Exit synch loop after %d rounds, backlog or not enough paths (%d & %d).\n",
-                nb_rounds, test_ctx->cnx_client->nb_paths, test_ctx->cnx_server->nb_paths);
+        if (ret == 0) {
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
         }
-    }
 
-    /* Check */
+        if (ret < 0)
+        {
+            break;
+        }
 
-    if (ret == 0) {
-        if (test_ctx->cnx_server->nb_local_cnxid != PICOQUIC_NB_PATH_TARGET) {
-            DBG_PRINTF("Found %d paths active on server instead of %d.\n", test_ctx->cnx_server->nb_paths, PICOQUIC_NB_PATH_TARGET);
-            ret = -1;
+        if (was_active) {
+            nb_inactive = 0;
+        }
+        else {
+            nb_inactive++;
+        }
+
+        if (test_ctx->test_finished) {
+            if (picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) && picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
+                break;
+            }
         }
     }
 
-    if (ret == 0) {
-        ret = transmit_cnxid_test_stash(test_ctx->cnx_client, test_ctx->cnx_server, "client");
+    if (ret == 0 && nb_rotation < 3) {
+        DBG_PRINTF("Only %d key rotations completed out of 3\n", nb_rotation);
+        ret = -1;
     }
 
     if (ret == 0) {
-        ret = transmit_cnxid_test_stash(test_ctx->cnx_server, test_ctx->cnx_client, "server");
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+
+        if (ret != 0)
+        {
+            DBG_PRINTF("Connection close returns %d\n", ret);
+        }
     }
 
     if (test_ctx != NULL) {
@@ -6668,87 +7641,131 @@ int retire_cnxid_test()
     return ret;
 }
 
+int key_rotation_test()
+{
+    int ret = key_rotation_test_one(0);
+
+    if (ret == 0) {
+        /* test rotation with injection of bad packets on client */
+        ret = key_rotation_test_one(2);
+        if (ret != 0) {
+            DBG_PRINTF("%s", "Packet injection on client defeats rotation.\n", ret);
+        }
+    }
+
+    if (ret == 0) {
+        /* test rotation with injection of bad packets on server */
+        ret = key_rotation_test_one(1);
+        if (ret != 0) {
+            DBG_PRINTF("%s", "Packet injection on server defeats rotation.\n", ret);
+        }
+    }
+
+    return ret;
+}
 
 /*
- * Perform a test of the "not before" CNXID function.
- * The test will artificially simulate receiving a "not before"
- * parameter in a new connection ID test, to check that the
- * old connection ID are removed and successfully replaced.
+ * Key rotation precomputation. Verify that the keys of the next generation
+ * are available before the rotation starts, that they are derived again
+ * after the rotation completes, and that the old decryption keys are
+ * retired after the rotation time guard.
  */
-int not_before_cnxid_test()
+
+int key_rotation_precompute_test()
 {
     uint64_t simulated_time = 0;
     uint64_t loss_mask = 0;
-    uint64_t not_before;
+    int nb_trials = 0;
+    int nb_inactive = 0;
+    int max_trials = 100000;
+    int is_precomputed = 0;
+    int is_rotation_started = 0;
+    int is_rotated = 0;
+    int is_next_precomputed = 0;
+    int is_old_retired = 0;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
     int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
         PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
 
-    if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
     }
 
-    /* run a receive loop until no outstanding data */
     if (ret == 0) {
-        ret = tls_api_synch_to_empty_loop(test_ctx, &simulated_time, 2048, PICOQUIC_NB_PATH_TARGET, 0);
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
     }
 
-    /* find a plausible "not before" value,and apply it */
     if (ret == 0) {
-        not_before = test_ctx->cnx_server->local_cnxid_sequence_next - 1;
-        ret = picoquic_remove_not_before_cid(test_ctx->cnx_client, not_before, simulated_time);
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
     }
 
-    /* run the loop again until no outstanding data */
-    if (ret == 0) {
-        uint64_t time_out = simulated_time + 8000000;
-        int nb_rounds = 0;
-        int success = 0;
-
-        while (ret == 0 && simulated_time < time_out &&
-            nb_rounds < 2048 && test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
-            int was_active = 0;
+    while (ret == 0 && nb_trials < max_trials && nb_inactive < 256 && TEST_CLIENT_READY && TEST_SERVER_READY) {
+        int was_active = 0;
 
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, time_out, &was_active);
-            nb_rounds++;
+        nb_trials++;
 
-            if (nb_rounds == 30) {
-                ret = 0;
-            }
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
 
-            if (test_ctx->cnx_client->nb_local_cnxid >= PICOQUIC_NB_PATH_TARGET &&
-                test_ctx->cnx_server->nb_local_cnxid >= PICOQUIC_NB_PATH_TARGET &&
-                test_ctx->cnx_client->first_misc_frame == NULL &&
-                test_cnxid_count_stash(test_ctx->cnx_client) >= (PICOQUIC_NB_PATH_TARGET - 1) &&
-                test_cnxid_count_stash(test_ctx->cnx_server) >= (PICOQUIC_NB_PATH_TARGET - 1) &&
-                picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) &&
-                picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
-                success = 1;
-                break;
-            }
+        if (ret < 0) {
+            break;
         }
 
-        if (ret == 0 && success == 0) {
-            DBG_PRINTF("Exit synch loop after %d rounds, backlog or not enough cid (%d & %d).\n",
-                nb_rounds, test_ctx->cnx_client->nb_local_cnxid, test_ctx->cnx_server->nb_local_cnxid);
+        if (was_active) {
+            nb_inactive = 0;
+        }
+        else {
+            nb_inactive++;
         }
-    }
 
-    /* Check */
+        if (!is_precomputed) {
+            is_precomputed = test_ctx->cnx_client->crypto_context_new.aead_encrypt != NULL &&
+                test_ctx->cnx_client->crypto_context_new.aead_decrypt != NULL &&
+                test_ctx->cnx_server->crypto_context_new.aead_encrypt != NULL &&
+                test_ctx->cnx_server->crypto_context_new.aead_decrypt != NULL;
+        }
+        else if (!is_rotation_started) {
+            if (picoquic_sack_list_last(&test_ctx->cnx_client->ack_ctx[picoquic_packet_context_application].sack_list) >
+                test_ctx->cnx_client->crypto_epoch_sequence) {
+                ret = picoquic_start_key_rotation(test_ctx->cnx_client);
+                if (ret != 0) {
+                    DBG_PRINTF("Could not start rotation, ret = %x\n", ret);
+                }
+                is_rotation_started = 1;
+            }
+        }
+        else if (!is_rotated) {
+            is_rotated = test_ctx->cnx_server->nb_crypto_key_rotations > 0;
+        }
+        else {
+            if (test_ctx->cnx_server->crypto_context_new.aead_encrypt != NULL &&
+                test_ctx->cnx_server->crypto_context_new.aead_decrypt != NULL) {
+                is_next_precomputed = 1;
+            }
+            if (simulated_time > test_ctx->cnx_server->crypto_rotation_time_guard &&
+                test_ctx->cnx_server->crypto_context_old.aead_decrypt == NULL) {
+                is_old_retired = 1;
+            }
+        }
 
-    if (ret == 0) {
-        if (test_ctx->cnx_server->nb_local_cnxid != PICOQUIC_NB_PATH_TARGET) {
-            DBG_PRINTF("Found %d cid active on server instead of %d.\n", test_ctx->cnx_server->nb_local_cnxid, PICOQUIC_NB_PATH_TARGET + 1);
-            ret = -1;
+        if (test_ctx->test_finished) {
+            if (picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) && picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
+                break;
+            }
         }
     }
 
-    if (ret == 0) {
-        ret = transmit_cnxid_test_stash(test_ctx->cnx_client, test_ctx->cnx_server, "client");
+    if (ret == 0 && (!is_precomputed || !is_rotated || !is_next_precomputed || !is_old_retired)) {
+        DBG_PRINTF("Precomputed: %d, rotated: %d, next precomputed: %d, old retired: %d\n",
+            is_precomputed, is_rotated, is_next_precomputed, is_old_retired);
+        ret = -1;
     }
 
     if (ret == 0) {
-        ret = transmit_cnxid_test_stash(test_ctx->cnx_server, test_ctx->cnx_client, "server");
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+
+        if (ret != 0) {
+            DBG_PRINTF("Connection close returns %d\n", ret);
+        }
     }
 
     if (test_ctx != NULL) {
@@ -6759,68 +7776,50 @@ int not_before_cnxid_test()
     return ret;
 }
 
-/*
- * Server busy. Verify that the connection fails with the proper error code, and then that once the server is not busy the next connection succeeds.
- */
-
-int server_busy_test()
+static int key_rotation_auto_one(uint64_t epoch_length, int client_test)
 {
-    uint64_t loss_mask = 0;
     uint64_t simulated_time = 0;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
-
-    if (ret == 0) {
-        test_ctx->qserver->server_busy = 1;
-        (void) tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
 
-        if (test_ctx->cnx_server != NULL &&
-            test_ctx->cnx_server->cnx_state != picoquic_state_disconnected) {
-            DBG_PRINTF("Server state: %d, local error: %" PRIx64, test_ctx->cnx_server->cnx_state, test_ctx->cnx_server->local_error);
-            ret = -1;
-        }
-        else if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected ||
-            test_ctx->cnx_client->remote_error != PICOQUIC_TRANSPORT_SERVER_BUSY) {
-            DBG_PRINTF("Client state: %d, remote error: %" PRIx64, test_ctx->cnx_client->cnx_state, test_ctx->cnx_client->remote_error);
-            ret = -1;
-        }
-        else if (simulated_time > 50000ull) {
-            DBG_PRINTF("Simulated time: %" PRIu64, (unsigned long long)simulated_time);
-            ret = -1;
-        }
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
     }
 
     if (ret == 0) {
-        test_ctx->qserver->server_busy = 0;
-
-        if (test_ctx->cnx_server != NULL) {
-            picoquic_delete_cnx(test_ctx->cnx_server);
-            test_ctx->cnx_server = NULL;
+        if (client_test) {
+            picoquic_set_crypto_epoch_length(test_ctx->cnx_client, epoch_length);
         }
-        if (test_ctx->cnx_client != NULL) {
-            picoquic_delete_cnx(test_ctx->cnx_client);
-            test_ctx->cnx_client = NULL;
+        else {
+            picoquic_set_default_crypto_epoch_length(test_ctx->qserver, epoch_length);
         }
+        /* Run a basic test scenario */
 
-        /* Create a new client connection */
-        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
-            picoquic_null_connection_id, picoquic_null_connection_id,
-            (struct sockaddr*)&test_ctx->server_addr, simulated_time,
-            0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
-
-        if (test_ctx->cnx_client == NULL) {
-            ret = -1;
-        } else {
-            ret = picoquic_start_client_cnx(test_ctx->cnx_client);
-        }
+        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+            test_scenario_key_rotation, sizeof(test_scenario_key_rotation), 0, 0, 0, 0, 2000000);
     }
 
     if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
-    }
+        uint64_t nb_rotation_expected;
+        uint64_t nb_rotation_max;
+        uint64_t nb_packets;
+        picoquic_cnx_t* cnx = (client_test) ? test_ctx->cnx_server : test_ctx->cnx_client;
 
-    if (ret == 0) {
-        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+        nb_packets = cnx->pkt_ctx[picoquic_packet_context_application].send_sequence;
+        nb_rotation_expected = nb_packets / (epoch_length + 10);
+        nb_rotation_max = nb_packets / (epoch_length - 10);
+
+        if (nb_rotation_expected > cnx->nb_crypto_key_rotations) {
+            DBG_PRINTF("Only %" PRIu64 " key rotations completed instead of at least %" PRIu64 "\n",
+                cnx->nb_crypto_key_rotations, nb_rotation_expected);
+            ret = -1;
+        }
+        else if (nb_rotation_max < cnx->nb_crypto_key_rotations) {
+            DBG_PRINTF("Over %" PRIu64 " key rotations completed instead of at most %" PRIu64 "\n",
+                cnx->nb_crypto_key_rotations, nb_rotation_expected);
+            ret = -1;
+        }
     }
 
     if (test_ctx != NULL) {
@@ -6831,59 +7830,119 @@ int server_busy_test()
     return ret;
 }
 
+int key_rotation_auto_server()
+{
+    return key_rotation_auto_one(300, 0);
+}
+
+int key_rotation_auto_client()
+{
+    return key_rotation_auto_one(400, 1);
+}
+
 /*
- * Initial close test. Check what happens when the client closes a connection without waiting for the full establishment
+ * Key rotation stress: mimic a client that rotates its keys very rapidly.
+ * Expected results: the server should survive. The server connection should be
+ * deleted or closed.
  */
 
-int initial_close_test()
+static int key_rotation_stress_test_one(int nb_packets)
 {
-    uint64_t loss_mask = 0;
     uint64_t simulated_time = 0;
-    int was_active = 0;
+    uint64_t closing_time = 0;
+    uint64_t loss_mask = 0;
+    int nb_trials = 0;
+    int nb_inactive = 0;
+    int max_trials = 100000;
+    int max_rotations = 100;
+    int nb_rotation = 0;
+    uint64_t rotation_sequence = 100;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
 
     if (ret == 0) {
-        /* Send the initial packet, but no more than that */
-        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    /* Prepare to send data */
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
+    }
+
+    /* Perform a data sending loop, during which various key rotations are tried
+     * every "nb_packets". */
+
+    while (ret == 0 && nb_trials < max_trials && nb_inactive < 256 && TEST_CLIENT_READY && TEST_SERVER_READY) {
+        int was_active = 0;
+
+        nb_trials++;
+
+        if (test_ctx->cnx_client->pkt_ctx[picoquic_packet_context_application].send_sequence > rotation_sequence &&
+            test_ctx->cnx_client->key_phase_enc == test_ctx->cnx_client->key_phase_dec) {
+            rotation_sequence = test_ctx->cnx_client->pkt_ctx[picoquic_packet_context_application].send_sequence + nb_packets;
+            nb_rotation++;
+            if (nb_rotation > max_rotations) {
+                break;
+            }
+            else {
+                ret = picoquic_start_key_rotation(test_ctx->cnx_client);
+                if (ret != 0) {
+                    DBG_PRINTF("Start key rotation returns %d\n", ret);
+                }
+            }
+        }
 
         if (ret == 0) {
-            test_ctx->cnx_client->cnx_state = picoquic_state_handshake_failure;
-            test_ctx->cnx_client->local_error = 0xDEAD;
-            picoquic_reinsert_by_wake_time(test_ctx->qclient, test_ctx->cnx_client, simulated_time);
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
         }
-    }
 
-    if (ret == 0) {
-        for (int i = 0; i < 128; i++) {
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
-            if (test_ctx->cnx_server != NULL) {
+        if (ret != 0)
+        {
+            break;
+        }
+
+        if (was_active) {
+            nb_inactive = 0;
+        }
+        else {
+            nb_inactive++;
+        }
+
+        if (test_ctx->test_finished) {
+            if (picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) && picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
                 break;
             }
         }
-        if (ret == 0) {
-            ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0 && TEST_CLIENT_READY) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+
+        if (ret != 0) {
+            DBG_PRINTF("Connection close returns %d\n", ret);
         }
+    }
 
-        if (ret == 0) {
-            if (test_ctx->cnx_server == NULL) {
-                DBG_PRINTF("%s", "Server connection deleted, cannot verify error code.\n");
-                ret = -1;
-            }
-            else if (test_ctx->cnx_server->cnx_state != picoquic_state_disconnected ||
-                test_ctx->cnx_server->remote_error != 0xDEAD) {
-                DBG_PRINTF("Server state: %d, remote error: %x\n", test_ctx->cnx_server->cnx_state, test_ctx->cnx_server->remote_error);
-                ret = -1;
-            }
-            else if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
-                DBG_PRINTF("Client state: %d, local error: %x", test_ctx->cnx_client->cnx_state, test_ctx->cnx_client->local_error);
-                ret = -1;
-            }
-            else if (simulated_time > 50000ull) {
-                DBG_PRINTF("Simulated time: %llu", (unsigned long long)simulated_time);
-                ret = -1;
-            }
+    /*
+     * Allow for some time for the server connection to close.
+     */
+    closing_time = simulated_time + 4000000;
+    while (ret == 0 && simulated_time < closing_time) {
+        int was_active = 0; 
+        if (test_ctx->cnx_server == NULL) {
+            ret = -1;
+            break;
+        }
+        if (test_ctx->qserver->cnx_list == NULL || test_ctx->cnx_server->cnx_state == picoquic_state_disconnected) {
+            break;
         }
+
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
     }
 
     if (test_ctx != NULL) {
@@ -6894,65 +7953,68 @@ int initial_close_test()
     return ret;
 }
 
+int key_rotation_stress_test()
+{
+    return key_rotation_stress_test_one(10);
+}
+
 /*
- * Check what happens if the server detects an error in the client's initial
- * message. Verify that the client receives the error code.
+ * AEAD limit test. The confidentiality limit of the connections is scaled
+ * down to a few hundred packets, so that a 10MB transfer goes through as many
+ * key rotations as a transfer of several hundred GB with the AES-GCM limit.
+ * The transfer shall complete without hitting the limit, and the keys shall
+ * be rotated at least once per limit worth of packets.
  */
 
-int initial_server_close_test()
+int key_rotation_aead_limit_test()
 {
-    uint64_t loss_mask = 0;
     uint64_t simulated_time = 0;
-    int was_active = 0;
-    int nb_trials = 0;
+    uint64_t loss_mask = 0;
+    const uint64_t test_limit = 512;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
-
-    /* Set the connection on the server side, but not on the client side */
-    while (ret == 0 && nb_trials < 32 ) {
-        nb_trials++;
-
-        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
 
-        if (test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state == picoquic_state_server_almost_ready) {
-            break;
-        }
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
     }
 
-    if (test_ctx->cnx_server == NULL || test_ctx->cnx_server->cnx_state != picoquic_state_server_almost_ready) {
-        DBG_PRINTF("Server state: %d\n", (test_ctx->cnx_server == NULL) ?
-            -1 : test_ctx->cnx_server->cnx_state);
-        ret = -1;
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 0);
     }
 
     if (ret == 0) {
-        test_ctx->cnx_server->cnx_state = picoquic_state_handshake_failure;
-        test_ctx->cnx_server->local_error = 0xDEAD;
-        picoquic_reinsert_by_wake_time(test_ctx->qserver, test_ctx->cnx_server, simulated_time);
+        test_ctx->cnx_client->crypto_key_confidentiality_limit = test_limit;
+        test_ctx->cnx_server->crypto_key_confidentiality_limit = test_limit;
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_10mb, sizeof(test_scenario_10mb));
     }
 
-
     if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+        if (ret != 0) {
+            DBG_PRINTF("Data sending loop returns %d\n", ret);
+        }
     }
 
     if (ret == 0) {
-        if (test_ctx->cnx_server != NULL &&
-            test_ctx->cnx_server->cnx_state != picoquic_state_disconnected) {
-            DBG_PRINTF("Server state: %d, remote error: %x\n", test_ctx->cnx_server->cnx_state, test_ctx->cnx_server->remote_error);
-            ret = -1;
-        }
-        else if (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected ||
-            test_ctx->cnx_client->remote_error != 0xDEAD) {
-            DBG_PRINTF("Client state: %d, local error: %x", test_ctx->cnx_client->cnx_state, test_ctx->cnx_client->local_error);
+        uint64_t nb_packets = test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence;
+
+        if (test_ctx->cnx_server->local_error == PICOQUIC_TRANSPORT_AEAD_LIMIT_REACHED ||
+            test_ctx->cnx_client->local_error == PICOQUIC_TRANSPORT_AEAD_LIMIT_REACHED) {
+            DBG_PRINTF("%s", "AEAD limit reached\n");
             ret = -1;
         }
-        else if (simulated_time > 50000ull) {
-            DBG_PRINTF("Simulated time: %llu", (unsigned long long)simulated_time);
+        else if (test_ctx->cnx_server->nb_crypto_key_rotations < nb_packets / test_limit) {
+            DBG_PRINTF("Only %" PRIu64 " rotations for %" PRIu64 " packets\n",
+                test_ctx->cnx_server->nb_crypto_key_rotations, nb_packets);
             ret = -1;
         }
     }
 
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 0);
+    }
+
     if (test_ctx != NULL) {
         tls_api_delete_ctx(test_ctx);
         test_ctx = NULL;
@@ -6963,503 +8025,475 @@ int initial_server_close_test()
 
 
 /*
- * Test that rotated keys are computed in a compatible way on client and server.
+ * Stage statistics. Run a short transfer, and check that the stage counters
+ * of client and server are consistent with the traffic. When the counters are
+ * not compiled in, check that the API reports so.
  */
-
-static int aead_iv_check(void * aead1, void * aead2)
+int stage_stats_test()
 {
-    int ret = 0;
-#if 0
-    ptls_aead_context_t *ctx1 = (ptls_aead_context_t *)aead1;
-    ptls_aead_context_t *ctx2 = (ptls_aead_context_t *)aead2;
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
 
-    if (memcmp(ctx1->static_iv, ctx2->static_iv, ctx1->algo->iv_size) != 0) {
-        ret = -1;
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
     }
-#else
-    /* TODO: find a replacement for this test */
-#ifdef _WINDOWS
-    UNREFERENCED_PARAMETER(aead1);
-    UNREFERENCED_PARAMETER(aead2);
-#endif
-#endif
-    return ret;
-}
-
-#if 0
-static int pn_enc_check(void * pn1, void * pn2)
-{
-    int ret = 0;
-    uint8_t seed[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
-    uint8_t pn[4] = { 0, 1, 2 ,3 };
-    uint8_t pn_enc[4];
-    uint8_t pn_dec[4];
 
-    picoquic_pn_encrypt(pn1, seed, pn_enc, pn, 4);
-    picoquic_pn_encrypt(pn2, seed, pn_dec, pn_enc, 4);
-
-    if (memcmp(pn_dec, pn, 4) != 0) {
-        ret = -1;
+    if (ret == 0) {
+        picoquic_reset_stage_stats(test_ctx->qclient);
+        picoquic_reset_stage_stats(test_ctx->qserver);
+        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 0);
     }
-    return ret;
-}
-#endif
-
-int new_rotated_key_test()
-{
-    uint64_t loss_mask = 0;
-    uint64_t simulated_time = 0;
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
 
     if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q_and_r, sizeof(test_scenario_q_and_r));
     }
 
     if (ret == 0) {
-        ret = wait_application_aead_ready(test_ctx, &simulated_time);
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
     }
 
+    for (int is_server = 0; ret == 0 && is_server < 2; is_server++) {
+        picoquic_quic_t* quic = (is_server) ? test_ctx->qserver : test_ctx->qclient;
+        picoquic_stage_stats_t stats[picoquic_stage_max];
+        int is_compiled = 1;
 
-    for (int i = 1; ret == 0 && i <= 3; i++) {
-        
-        /* Try to compute rotated keys on server */
-        ret = picoquic_compute_new_rotated_keys(test_ctx->cnx_server);
-        if (ret != 0) {
-            DBG_PRINTF("Could not rotate server key, ret: %x\n", ret);
-        } else {
-            /* Try to compute rotated keys on client */
-            ret = picoquic_compute_new_rotated_keys(test_ctx->cnx_client);
-            if (ret != 0) {
-                DBG_PRINTF("Could not rotate client key, round %d, ret: %x\n", i, ret);
-            }
-        }
-
-        if (ret == 0)
-        {
-            /* Compare server encryption and client decryption */
-            size_t key_size = picoquic_get_app_secret_size(test_ctx->cnx_client);
+        for (int stage = 0; ret == 0 && stage < picoquic_stage_max; stage++) {
+            int stage_ret = picoquic_get_stage_stats(quic, (picoquic_stage_enum)stage, &stats[stage]);
 
-            if (key_size != picoquic_get_app_secret_size(test_ctx->cnx_server)) {
-                DBG_PRINTF("Round %d. Key sizes dont match, client: %d, server: %d\n", i, key_size, picoquic_get_app_secret_size(test_ctx->cnx_server));
-                ret = -1;
-            }
-            else if (memcmp(picoquic_get_app_secret(test_ctx->cnx_server, 1), picoquic_get_app_secret(test_ctx->cnx_client, 0), key_size) != 0) {
-                DBG_PRINTF("Round %d. Server encryption secret does not match client decryption secret\n", i);
+            if (strcmp(picoquic_stage_name((picoquic_stage_enum)stage), "unknown") == 0) {
+                DBG_PRINTF("No name for stage %d\n", stage);
                 ret = -1;
             }
-            else if (memcmp(picoquic_get_app_secret(test_ctx->cnx_server, 0), picoquic_get_app_secret(test_ctx->cnx_client, 1), key_size) != 0) {
-                DBG_PRINTF("Round %d. Server decryption secret does not match client encryption secret\n", i);
-                ret = -1;
+            else if (stage == 0) {
+                is_compiled = (stage_ret == 0);
             }
-            else if (aead_iv_check(test_ctx->cnx_server->crypto_context_new.aead_encrypt, test_ctx->cnx_client->crypto_context_new.aead_decrypt) != 0) {
-                DBG_PRINTF("Round %d. Client AEAD decryption does not match server AEAD encryption.\n", i);
+            else if ((stage_ret == 0) != is_compiled) {
+                DBG_PRINTF("Stage %d returns %d\n", stage, stage_ret);
                 ret = -1;
             }
-            else if (aead_iv_check(test_ctx->cnx_client->crypto_context_new.aead_encrypt, test_ctx->cnx_server->crypto_context_new.aead_decrypt) != 0) {
-                DBG_PRINTF("Round %d. Server AEAD decryption does not match cliens AEAD encryption.\n", i);
+            if (ret == 0 && !is_compiled && (stats[stage].nb_calls != 0 || stats[stage].nb_cycles != 0)) {
+                DBG_PRINTF("Stage %d reports data but is not compiled\n", stage);
                 ret = -1;
             }
-#if 0
-            else if (pn_enc_check(test_ctx->cnx_server->crypto_context_new.pn_enc, test_ctx->cnx_client->crypto_context_new.pn_dec) != 0) {
-                DBG_PRINTF("Round %d. Client PN decryption does not match server PN encryption.\n", i);
+        }
+
+        if (ret == 0 && is_compiled) {
+            if (stats[picoquic_stage_receive_parse].nb_calls == 0 ||
+                stats[picoquic_stage_decrypt].nb_calls == 0 ||
+                stats[picoquic_stage_frame_decode].nb_calls == 0 ||
+                stats[picoquic_stage_ack_process].nb_calls == 0 ||
+                stats[picoquic_stage_packet_format].nb_calls == 0 ||
+                stats[picoquic_stage_stream_select].nb_calls == 0 ||
+                stats[picoquic_stage_encrypt].nb_calls == 0) {
+                DBG_PRINTF("Missing stage counts for %s\n", (is_server) ? "server" : "client");
                 ret = -1;
             }
-            else if (pn_enc_check(test_ctx->cnx_client->crypto_context_new.pn_enc, test_ctx->cnx_server->crypto_context_new.pn_dec) != 0) {
-                DBG_PRINTF("Round %d. Server PN decryption does not match client PN encryption.\n", i);
+            else if (stats[picoquic_stage_frame_decode].nb_calls > stats[picoquic_stage_decrypt].nb_calls ||
+                stats[picoquic_stage_socket_send].nb_calls != 0) {
+                DBG_PRINTF("Inconsistent stage counts for %s\n", (is_server) ? "server" : "client");
                 ret = -1;
             }
-#endif
         }
-
-        picoquic_crypto_context_free(&test_ctx->cnx_server->crypto_context_new);
-        picoquic_crypto_context_free(&test_ctx->cnx_client->crypto_context_new);
-    }
-
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
     }
 
-    return ret;
-}
-
-
-/*
- * Key rotation tests
- */
-
-static int inject_false_rotation(picoquic_test_tls_api_ctx_t* test_ctx, int target_client, uint64_t simulated_time)
-{
-    /* In order to test robustness of key rotation against attacks, we inject a
-     * random packet with properly set header indication transition */
-    int ret = 0;
-    picoquic_cnx_t * cnx = (target_client) ? test_ctx->cnx_client : test_ctx->cnx_server;
-    picoquictest_sim_link_t* target_link = (target_client) ? test_ctx->s_to_c_link : test_ctx->c_to_s_link;
-    picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
-
-    if (packet == NULL || cnx == NULL) {
-        ret = -1;
-    }
-    else {
-        uint64_t random_context = (0x123456789ABCDEF0ull)|cnx->pkt_ctx[picoquic_packet_context_application].send_sequence;
-        size_t byte_index = 1;
-
-        packet->bytes[0] = 0x3F | ((cnx->key_phase_dec) ? 0 : 0x40); /* Set phase to opposite of expected value */
-
-        for (uint8_t i = 0; i < cnx->path[0]->p_local_cnxid->cnx_id.id_len; i++) {
-            packet->bytes[byte_index++] = cnx->path[0]->p_local_cnxid->cnx_id.id[i];
-        }
-        picoquic_test_random_bytes(&random_context, packet->bytes + byte_index, 128u - byte_index);
-        packet->length = 128;
+    if (ret == 0) {
+        picoquic_stage_stats_t stats;
 
-        if (target_client) {
-            picoquic_store_addr(&packet->addr_from, (struct sockaddr *)&test_ctx->server_addr);
-            picoquic_store_addr(&packet->addr_to, (struct sockaddr *)&test_ctx->client_addr);
+        picoquic_reset_stage_stats(test_ctx->qserver);
+        if (picoquic_get_stage_stats(test_ctx->qserver, picoquic_stage_max, &stats) == 0) {
+            DBG_PRINTF("%s", "Stage out of range is accepted\n");
+            ret = -1;
         }
-        else {
-            picoquic_store_addr(&packet->addr_from, (struct sockaddr *)&test_ctx->client_addr);
-            picoquic_store_addr(&packet->addr_to, (struct sockaddr *)&test_ctx->server_addr);
+        else if (picoquic_get_stage_stats(test_ctx->qserver, picoquic_stage_decrypt, &stats) == 0 &&
+            stats.nb_calls != 0) {
+            DBG_PRINTF("%s", "Stage stats not reset\n");
+            ret = -1;
         }
+    }
 
-        picoquictest_sim_link_submit(target_link, packet, simulated_time);
+    if (ret == 0) {
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 0);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
     }
 
     return ret;
 }
 
-static int key_rotation_test_one(int inject_bad_packet)
+/*
+ * Null AEAD. Run the same scenario with real keys and with the null AEAD,
+ * and verify that the transport behavior is identical: same completion
+ * time, same number of packets and same amount of data on both sides.
+ */
+typedef struct st_null_aead_test_result_t {
+    uint64_t completion_time;
+    uint64_t nb_packets_sent[2];
+    uint64_t nb_retransmission_total[2];
+    uint64_t data_sent[2];
+    uint64_t data_received[2];
+} null_aead_test_result_t;
+
+static int null_aead_test_one(int use_null_aead, null_aead_test_result_t* result)
 {
     uint64_t simulated_time = 0;
-    uint64_t loss_mask = 0;
-    int nb_trials = 0;
-    int nb_inactive = 0;
-    int max_trials = 100000;
-    int nb_rotation = 0;
-    uint64_t rotation_sequence = 100;
-    uint64_t injection_sequence = 50;
+    uint64_t loss_mask = 0x00004281;
+    picoquic_connection_id_t initial_cid = { {0x0a, 0xea, 0xd0, 1, 2, 3, 4, 5}, 8 };
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
+    int ret = tls_api_one_scenario_init_ex(&test_ctx, &simulated_time, 0, NULL, NULL, &initial_cid, 0);
 
-    if (ret == 0 && test_ctx == NULL) {
-        ret = PICOQUIC_ERROR_MEMORY;
-    }
+    memset(result, 0, sizeof(null_aead_test_result_t));
 
     if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+        picoquic_set_null_aead(test_ctx->qclient, use_null_aead);
+        picoquic_set_null_aead(test_ctx->qserver, use_null_aead);
+        /* Re-create the client connection, so the initial keys use the selected AEAD */
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+            initial_cid, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, 0,
+            PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
+        }
     }
 
-    /* Prepare to send data */
     if (ret == 0) {
-        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
+        picoquic_public_random_seed_64(RANDOM_PUBLIC_TEST_SEED, 1);
+        ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 0);
     }
 
-    /* Perform a data sending loop, during which various key rotations are tried
-     * every 100 packets or so. To test robustness, inject bogus packets that
-     * mimic a transition trigger */
-
-    while (ret == 0 && nb_trials < max_trials && nb_inactive < 256 && TEST_CLIENT_READY && TEST_SERVER_READY) {
-        int was_active = 0;
-
-        nb_trials++;
-
-        if (inject_bad_packet &&
-            test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence > injection_sequence) {
-            ret = inject_false_rotation(test_ctx, inject_bad_packet >> 1, simulated_time);
-            if (ret != 0) {
-                DBG_PRINTF("Could not inject bad packet, ret = %d\n", ret);
-                break;
-            }
-            else {
-                injection_sequence += 50;
-            }
-        }
-
-        if (test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence > rotation_sequence &&
-            picoquic_sack_list_last(&test_ctx->cnx_server->ack_ctx[picoquic_packet_context_application].sack_list) >
-            test_ctx->cnx_server->crypto_epoch_sequence &&
-            picoquic_sack_list_last(&test_ctx->cnx_client->ack_ctx[picoquic_packet_context_application].sack_list) >
-            test_ctx->cnx_client->crypto_epoch_sequence &&
-            test_ctx->cnx_server->key_phase_enc == test_ctx->cnx_server->key_phase_dec &&
-            test_ctx->cnx_client->key_phase_enc == test_ctx->cnx_client->key_phase_dec) {
-            rotation_sequence = test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence + 100;
-            injection_sequence = test_ctx->cnx_server->pkt_ctx[picoquic_packet_context_application].send_sequence + 50;
-            nb_rotation++;
-            switch (nb_rotation) {
-            case 1: /* Key rotation at the client */
-                ret = picoquic_start_key_rotation(test_ctx->cnx_client);
-                break;
-            case 2: /* Key rotation at the server */
-                ret = picoquic_start_key_rotation(test_ctx->cnx_server);
-                break;
-            case 3: /* Simultaneous key rotation at the client */
-                rotation_sequence += 1000000000;
-                ret = picoquic_start_key_rotation(test_ctx->cnx_client);
-                if (ret == 0) {
-                    ret = picoquic_start_key_rotation(test_ctx->cnx_server);
-                }
-                break;
-            default:
-                break;
-            }
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2));
+    }
 
-            if (ret != 0) {
-                DBG_PRINTF("Could not start rotation #%d, ret = %x\n", nb_rotation, ret);
-            }
-        }
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
 
-        if (ret == 0) {
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
-        }
+    if (ret == 0) {
+        uint64_t limit = picoquic_aead_confidentiality_limit(test_ctx->cnx_client->crypto_context[picoquic_epoch_1rtt].aead_encrypt);
 
-        if (ret < 0)
-        {
-            break;
+        if ((limit == UINT64_MAX) != (use_null_aead != 0)) {
+            DBG_PRINTF("Null AEAD = %d, but confidentiality limit = %" PRIu64 "\n", use_null_aead, limit);
+            ret = -1;
         }
-
-        if (was_active) {
-            nb_inactive = 0;
+        else if (test_ctx->cnx_server == NULL) {
+            ret = -1;
         }
         else {
-            nb_inactive++;
-        }
+            result->completion_time = simulated_time;
+            for (int is_server = 0; is_server < 2; is_server++) {
+                picoquic_cnx_t* cnx = (is_server) ? test_ctx->cnx_server : test_ctx->cnx_client;
 
-        if (test_ctx->test_finished) {
-            if (picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) && picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
-                break;
+                result->nb_packets_sent[is_server] = cnx->nb_packets_sent;
+                result->nb_retransmission_total[is_server] = cnx->nb_retransmission_total;
+                result->data_sent[is_server] = cnx->data_sent;
+                result->data_received[is_server] = cnx->data_received;
             }
         }
     }
 
-    if (ret == 0 && nb_rotation < 3) {
-        DBG_PRINTF("Only %d key rotations completed out of 3\n", nb_rotation);
-        ret = -1;
-    }
-
     if (ret == 0) {
-        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
-
-        if (ret != 0)
-        {
-            DBG_PRINTF("Connection close returns %d\n", ret);
-        }
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 0);
     }
 
     if (test_ctx != NULL) {
         tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
     }
 
     return ret;
 }
 
-int key_rotation_test()
+int null_aead_test()
 {
-    int ret = key_rotation_test_one(0);
+    null_aead_test_result_t real_result;
+    null_aead_test_result_t null_result;
+    int ret = null_aead_test_one(0, &real_result);
 
     if (ret == 0) {
-        /* test rotation with injection of bad packets on client */
-        ret = key_rotation_test_one(2);
-        if (ret != 0) {
-            DBG_PRINTF("%s", "Packet injection on client defeats rotation.\n", ret);
-        }
+        ret = null_aead_test_one(1, &null_result);
     }
 
-    if (ret == 0) {
-        /* test rotation with injection of bad packets on server */
-        ret = key_rotation_test_one(1);
-        if (ret != 0) {
-            DBG_PRINTF("%s", "Packet injection on server defeats rotation.\n", ret);
-        }
+    if (ret == 0 && memcmp(&real_result, &null_result, sizeof(null_aead_test_result_t)) != 0) {
+        DBG_PRINTF("Null AEAD run differs: time %" PRIu64 " vs %" PRIu64 ", client packets %" PRIu64 " vs %" PRIu64 ", server packets %" PRIu64 " vs %" PRIu64 "\n",
+            real_result.completion_time, null_result.completion_time,
+            real_result.nb_packets_sent[0], null_result.nb_packets_sent[0],
+            real_result.nb_packets_sent[1], null_result.nb_packets_sent[1]);
+        ret = -1;
     }
 
     return ret;
 }
 
-static int key_rotation_auto_one(uint64_t epoch_length, int client_test)
+/*
+ * Handshake packing. Run the same scenario with and without packing, and
+ * compare the number of datagrams carrying Initial or Handshake packets,
+ * the bytes in these datagrams and the padding bytes on both sides.
+ * Packing shall not increase the number of datagrams, and shall reduce
+ * the padding. Every datagram that carries an Initial packet shall still be
+ * at least PICOQUIC_ENFORCED_INITIAL_MTU bytes long.
+ */
+typedef struct st_handshake_packing_test_result_t {
+    uint64_t nb_datagrams;
+    uint64_t nb_bytes;
+    uint64_t nb_padding_bytes;
+    uint64_t nb_initial_datagrams;
+    size_t min_initial_datagram;
+} handshake_packing_test_result_t;
+
+/* Check the datagrams in transit on a link. Initial packets are always
+ * the first segment of a datagram, so only the first header is parsed. */
+static void handshake_packing_check_link(picoquictest_sim_link_t* link, handshake_packing_test_result_t* result)
+{
+    picoquictest_sim_packet_t* packet = link->first_packet;
+
+    while (packet != NULL) {
+        if (packet->length > 5 && (packet->bytes[0] & 0x80) != 0) {
+            int version_index = picoquic_get_version_index(PICOPARSE_32(packet->bytes + 1));
+
+            if (version_index >= 0 &&
+                picoquic_parse_long_packet_type(packet->bytes[0], version_index) == picoquic_packet_initial) {
+                result->nb_initial_datagrams++;
+                if (packet->length < result->min_initial_datagram) {
+                    result->min_initial_datagram = packet->length;
+                }
+            }
+        }
+        packet = packet->next_packet;
+    }
+}
+
+static int handshake_packing_test_one(int enable_packing, handshake_packing_test_result_t* result)
 {
     uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+    int ret = tls_api_one_scenario_init_ex(&test_ctx, &simulated_time, 0, NULL, NULL, NULL, 0);
 
-    if (ret == 0 && test_ctx == NULL) {
-        ret = PICOQUIC_ERROR_MEMORY;
-    }
+    memset(result, 0, sizeof(handshake_packing_test_result_t));
+    result->min_initial_datagram = SIZE_MAX;
 
     if (ret == 0) {
-        if (client_test) {
-            picoquic_set_crypto_epoch_length(test_ctx->cnx_client, epoch_length);
+        int nb_trials = 0;
+
+        picoquic_set_handshake_packing(test_ctx->qclient, enable_packing);
+        picoquic_set_handshake_packing(test_ctx->qserver, enable_packing);
+        test_ctx->c_to_s_link->loss_mask = &loss_mask;
+        test_ctx->s_to_c_link->loss_mask = &loss_mask;
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+        /* Each round submits at most one datagram, which stays on the link
+         * for at least one more round, so all datagrams are checked. */
+        while (ret == 0 && nb_trials < 1024 && (!TEST_CLIENT_READY || !TEST_SERVER_READY)) {
+            int was_active = 0;
+            nb_trials++;
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+            handshake_packing_check_link(test_ctx->c_to_s_link, result);
+            handshake_packing_check_link(test_ctx->s_to_c_link, result);
         }
-        else {
-            picoquic_set_default_crypto_epoch_length(test_ctx->qserver, epoch_length);
+        if (ret == 0 && (!TEST_CLIENT_READY || !TEST_SERVER_READY)) {
+            DBG_PRINTF("%s", "Handshake packing, connection not established\n");
+            ret = -1;
         }
-        /* Run a basic test scenario */
+    }
 
-        ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
-            test_scenario_key_rotation, sizeof(test_scenario_key_rotation), 0, 0, 0, 0, 2000000);
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2));
     }
 
     if (ret == 0) {
-        uint64_t nb_rotation_expected;
-        uint64_t nb_rotation_max;
-        uint64_t nb_packets;
-        picoquic_cnx_t* cnx = (client_test) ? test_ctx->cnx_server : test_ctx->cnx_client;
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
 
-        nb_packets = cnx->pkt_ctx[picoquic_packet_context_application].send_sequence;
-        nb_rotation_expected = nb_packets / (epoch_length + 10);
-        nb_rotation_max = nb_packets / (epoch_length - 10);
+    if (ret == 0 && test_ctx->cnx_server == NULL) {
+        ret = -1;
+    }
 
-        if (nb_rotation_expected > cnx->nb_crypto_key_rotations) {
-            DBG_PRINTF("Only %" PRIu64 " key rotations completed instead of at least %" PRIu64 "\n",
-                cnx->nb_crypto_key_rotations, nb_rotation_expected);
-            ret = -1;
-        }
-        else if (nb_rotation_max < cnx->nb_crypto_key_rotations) {
-            DBG_PRINTF("Over %" PRIu64 " key rotations completed instead of at most %" PRIu64 "\n",
-                cnx->nb_crypto_key_rotations, nb_rotation_expected);
-            ret = -1;
+    if (ret == 0) {
+        for (int is_server = 0; is_server < 2; is_server++) {
+            picoquic_cnx_t* cnx = (is_server) ? test_ctx->cnx_server : test_ctx->cnx_client;
+
+            result->nb_datagrams += cnx->nb_handshake_datagrams_sent;
+            result->nb_bytes += cnx->nb_handshake_bytes_sent;
+            result->nb_padding_bytes += cnx->nb_handshake_padding_bytes;
         }
+        ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 0);
     }
 
     if (test_ctx != NULL) {
         tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
     }
 
     return ret;
 }
 
-int key_rotation_auto_server()
+int handshake_packing_test()
 {
-    return key_rotation_auto_one(300, 0);
-}
+    handshake_packing_test_result_t default_result;
+    handshake_packing_test_result_t packed_result;
+    int ret = handshake_packing_test_one(0, &default_result);
 
-int key_rotation_auto_client()
-{
-    return key_rotation_auto_one(400, 1);
+    if (ret == 0) {
+        ret = handshake_packing_test_one(1, &packed_result);
+    }
+
+    if (ret == 0) {
+        DBG_PRINTF("Handshake datagrams %" PRIu64 " vs %" PRIu64 ", bytes %" PRIu64 " vs %" PRIu64 ", padding %" PRIu64 " vs %" PRIu64 "\n",
+            default_result.nb_datagrams, packed_result.nb_datagrams,
+            default_result.nb_bytes, packed_result.nb_bytes,
+            default_result.nb_padding_bytes, packed_result.nb_padding_bytes);
+        if (default_result.nb_datagrams == 0 ||
+            packed_result.nb_datagrams > default_result.nb_datagrams ||
+            packed_result.nb_padding_bytes >= default_result.nb_padding_bytes) {
+            ret = -1;
+        }
+        else if (default_result.nb_initial_datagrams == 0 || packed_result.nb_initial_datagrams == 0 ||
+            default_result.min_initial_datagram < PICOQUIC_ENFORCED_INITIAL_MTU ||
+            packed_result.min_initial_datagram < PICOQUIC_ENFORCED_INITIAL_MTU) {
+            DBG_PRINTF("Initial datagrams %" PRIu64 " vs %" PRIu64 ", shortest %zu vs %zu bytes\n",
+                default_result.nb_initial_datagrams, packed_result.nb_initial_datagrams,
+                default_result.min_initial_datagram, packed_result.min_initial_datagram);
+            ret = -1;
+        }
+    }
+
+    return ret;
 }
 
 /*
- * Key rotation stress: mimic a client that rotates its keys very rapidly.
- * Expected results: the server should survive. The server connection should be
- * deleted or closed.
+ * Early data test. Resume a session and measure the time to receive the
+ * response to a query queued before the handshake, with 0-RTT enabled,
+ * disabled by a zero budget, limited by a small budget, restricted to
+ * another stream, or rejected by the server.
  */
+typedef struct st_early_data_test_result_t {
+    uint64_t response_time;
+    picoquic_early_data_stats_t stats;
+} early_data_test_result_t;
 
-static int key_rotation_stress_test_one(int nb_packets)
+static int early_data_test_one(uint64_t budget, int mark_other_stream, int use_badcrypt,
+    early_data_test_result_t* result)
 {
     uint64_t simulated_time = 0;
-    uint64_t closing_time = 0;
     uint64_t loss_mask = 0;
-    int nb_trials = 0;
-    int nb_inactive = 0;
-    int max_trials = 100000;
-    int max_rotations = 100;
-    int nb_rotation = 0;
-    uint64_t rotation_sequence = 100;
-    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
-    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
-        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 0, 0);
-
-    if (ret == 0 && test_ctx == NULL) {
-        ret = PICOQUIC_ERROR_MEMORY;
-    }
-
-    if (ret == 0) {
-        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
-    }
-
-    /* Prepare to send data */
-    if (ret == 0) {
-        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
-    }
-
-    /* Perform a data sending loop, during which various key rotations are tried
-     * every "nb_packets". */
-
-    while (ret == 0 && nb_trials < max_trials && nb_inactive < 256 && TEST_CLIENT_READY && TEST_SERVER_READY) {
-        int was_active = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = picoquic_save_tickets(NULL, simulated_time, ticket_file_name);
 
-        nb_trials++;
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time,
+            ticket_file_name, NULL, 0, 1, (i == 0) ? 0 : use_badcrypt);
 
-        if (test_ctx->cnx_client->pkt_ctx[picoquic_packet_context_application].send_sequence > rotation_sequence &&
-            test_ctx->cnx_client->key_phase_enc == test_ctx->cnx_client->key_phase_dec) {
-            rotation_sequence = test_ctx->cnx_client->pkt_ctx[picoquic_packet_context_application].send_sequence + nb_packets;
-            nb_rotation++;
-            if (nb_rotation > max_rotations) {
-                break;
+        if (ret == 0 && i == 0) {
+            picoquic_start_client_cnx(test_ctx->cnx_client);
+            ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+            if (ret == 0) {
+                ret = session_resume_wait_for_ticket(test_ctx, &simulated_time);
             }
-            else {
-                ret = picoquic_start_key_rotation(test_ctx->cnx_client);
-                if (ret != 0) {
-                    DBG_PRINTF("Start key rotation returns %d\n", ret);
-                }
+            if (ret == 0) {
+                ret = picoquic_save_tickets(test_ctx->qclient->p_first_ticket, simulated_time, ticket_file_name);
             }
         }
+        else if (ret == 0) {
+            uint64_t start_time = simulated_time;
+            int nb_trials = 0;
 
-        if (ret == 0) {
-            ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
-        }
+            test_ctx->c_to_s_link->microsec_latency = 50000ull;
+            test_ctx->s_to_c_link->microsec_latency = 50000ull;
+            picoquic_set_early_data_budget(test_ctx->cnx_client, budget);
+            if (mark_other_stream) {
+                ret = picoquic_set_stream_early_data(test_ctx->cnx_client, 8, 1);
+            }
+            if (ret == 0) {
+                picoquic_start_client_cnx(test_ctx->cnx_client);
+                ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q_and_r, sizeof(test_scenario_q_and_r));
+            }
 
-        if (ret != 0)
-        {
-            break;
-        }
+            while (ret == 0 && !test_ctx->test_finished && nb_trials < 100000) {
+                int was_active = 0;
+                nb_trials++;
+                ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
+                if (test_ctx->cnx_client->cnx_state == picoquic_state_disconnected) {
+                    break;
+                }
+            }
 
-        if (was_active) {
-            nb_inactive = 0;
-        }
-        else {
-            nb_inactive++;
+            if (ret == 0 && !test_ctx->test_finished) {
+                DBG_PRINTF("Early data test, budget %" PRIu64 ", response not received\n", budget);
+                ret = -1;
+            }
+            else if (ret == 0) {
+                result->response_time = simulated_time - start_time;
+                picoquic_get_early_data_stats(test_ctx->cnx_client, &result->stats);
+            }
         }
 
-        if (test_ctx->test_finished) {
-            if (picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) && picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
-                break;
-            }
+        if (test_ctx != NULL) {
+            tls_api_delete_ctx(test_ctx);
+            test_ctx = NULL;
         }
     }
 
-    if (ret == 0 && TEST_CLIENT_READY) {
-        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    return ret;
+}
 
-        if (ret != 0) {
-            DBG_PRINTF("Connection close returns %d\n", ret);
-        }
+int early_data_test()
+{
+    early_data_test_result_t full_result;
+    early_data_test_result_t no_result;
+    early_data_test_result_t small_result;
+    early_data_test_result_t other_result;
+    early_data_test_result_t rejected_result;
+    int ret = early_data_test_one(UINT64_MAX, 0, 0, &full_result);
+
+    if (ret == 0) {
+        ret = early_data_test_one(0, 0, 0, &no_result);
+    }
+    if (ret == 0) {
+        ret = early_data_test_one(100, 0, 0, &small_result);
+    }
+    if (ret == 0) {
+        ret = early_data_test_one(UINT64_MAX, 1, 0, &other_result);
+    }
+    if (ret == 0) {
+        ret = early_data_test_one(UINT64_MAX, 0, 1, &rejected_result);
     }
 
-    /*
-     * Allow for some time for the server connection to close.
-     */
-    closing_time = simulated_time + 4000000;
-    while (ret == 0 && simulated_time < closing_time) {
-        int was_active = 0; 
-        if (test_ctx->cnx_server == NULL) {
+    if (ret == 0) {
+        DBG_PRINTF("Response time with 0-RTT: %" PRIu64 ", without: %" PRIu64 "\n",
+            full_result.response_time, no_result.response_time);
+        if (!full_result.stats.is_accepted || full_result.stats.data_sent == 0 ||
+            full_result.stats.nb_packets_rejected != 0) {
+            DBG_PRINTF("0-RTT accepted: %d, sent %" PRIu64 ", rejected %u\n", full_result.stats.is_accepted,
+                full_result.stats.data_sent, full_result.stats.nb_packets_rejected);
             ret = -1;
-            break;
         }
-        if (test_ctx->qserver->cnx_list == NULL || test_ctx->cnx_server->cnx_state == picoquic_state_disconnected) {
-            break;
+        else if (no_result.stats.data_sent != 0 || full_result.response_time >= no_result.response_time) {
+            DBG_PRINTF("No 0-RTT sent %" PRIu64 "\n", no_result.stats.data_sent);
+            ret = -1;
+        }
+        else if (small_result.stats.data_sent == 0 || small_result.stats.data_sent > 100) {
+            DBG_PRINTF("Budget 100, 0-RTT sent %" PRIu64 "\n", small_result.stats.data_sent);
+            ret = -1;
+        }
+        else if (other_result.stats.data_sent != 0) {
+            DBG_PRINTF("Unmarked stream, 0-RTT sent %" PRIu64 "\n", other_result.stats.data_sent);
+            ret = -1;
+        }
+        else if (rejected_result.stats.is_accepted || rejected_result.stats.nb_packets_rejected == 0 ||
+            rejected_result.stats.data_replayed == 0) {
+            DBG_PRINTF("Rejected 0-RTT, %u packets replayed\n", rejected_result.stats.nb_packets_rejected);
+            ret = -1;
         }
-
-        ret = tls_api_one_sim_round(test_ctx, &simulated_time, 0, &was_active);
-    }
-
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
     }
 
     return ret;
 }
 
-int key_rotation_stress_test()
-{
-    return key_rotation_stress_test_one(10);
-}
-
-
 /*
  * False migration. Test that the client server connection resists injection of
  * some packets sent from a wrong address. The "false migration inject" acts as
@@ -8226,6 +9260,9 @@ int qlog_trace_test_one(int auto_qlog, int keep_binlog, uint8_t recv_ecn)
         test_ctx->recv_ecn_server = recv_ecn;
         if (auto_qlog) {
             picoquic_set_qlog(test_ctx->qserver, ".");
+            if (auto_qlog > 1) {
+                picoquic_set_qlog_background(test_ctx->qserver, 0);
+            }
         }
         if (keep_binlog) {
             picoquic_set_binlog(test_ctx->qserver, ".");
@@ -8304,34 +9341,275 @@ int qlog_trace_test_one(int auto_qlog, int keep_binlog, uint8_t recv_ecn)
         if (ret != 0) {
             DBG_PRINTF("%s", "Cannot set the qlog trace test ref file name.\n");
         }
-        else {
-            ret = picoquic_test_compare_text_files(qlog_target, qlog_trace_test_ref);
+        else {
+            ret = picoquic_test_compare_text_files(qlog_target, qlog_trace_test_ref);
+        }
+    }
+
+    return ret;
+}
+
+int qlog_trace_test()
+{
+    return qlog_trace_test_one(0, 1, 0);
+}
+
+int qlog_trace_only_test()
+{
+    return qlog_trace_test_one(1, 0, 0);
+}
+
+int qlog_trace_auto_test()
+{
+    return qlog_trace_test_one(1, 1, 0);
+}
+
+int qlog_trace_sync_test()
+{
+    return qlog_trace_test_one(2, 0, 0);
+}
+
+int qlog_trace_ecn_test()
+{
+    return qlog_trace_test_one(0, 1, 0x02);
+}
+
+/*
+ * Test the replay of binary logs. Run a connection with some losses and a
+ * server side binary log, then replay the server side of the connection
+ * and verify that the received packets are decoded without errors, that
+ * the replayed congestion control does not diverge from the log, and that
+ * every 1-RTT loss recorded in the log is found by the replay.
+ */
+#define BINLOG_REPLAY_BIN "be9a020304050607.server.log"
+
+/* Count the 1-RTT packets declared lost in the binary log, as a reference
+ * for the number of losses found by the replay. */
+static int binlog_lost_count_start(uint64_t time, const picoquic_connection_id_t* cid, int client_mode,
+    uint32_t proposed_version, const picoquic_connection_id_t* remote_cnxid, void* ptr)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(time);
+    UNREFERENCED_PARAMETER(cid);
+    UNREFERENCED_PARAMETER(client_mode);
+    UNREFERENCED_PARAMETER(proposed_version);
+    UNREFERENCED_PARAMETER(remote_cnxid);
+    UNREFERENCED_PARAMETER(ptr);
+#endif
+    return 0;
+}
+
+static int binlog_lost_count_ignore(uint64_t time, bytestream* s, void* ptr)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(time);
+    UNREFERENCED_PARAMETER(s);
+    UNREFERENCED_PARAMETER(ptr);
+#endif
+    return 0;
+}
+
+static int binlog_lost_count_ignore_path(uint64_t time, uint64_t path_id, bytestream* s, void* ptr)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(time);
+    UNREFERENCED_PARAMETER(path_id);
+    UNREFERENCED_PARAMETER(s);
+    UNREFERENCED_PARAMETER(ptr);
+#endif
+    return 0;
+}
+
+static int binlog_lost_count_pdu(uint64_t time, int rxtx, bytestream* s, void* ptr)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(time);
+    UNREFERENCED_PARAMETER(rxtx);
+    UNREFERENCED_PARAMETER(s);
+    UNREFERENCED_PARAMETER(ptr);
+#endif
+    return 0;
+}
+
+static int binlog_lost_count_packet_start(uint64_t time, uint64_t path_id, uint64_t size,
+    const picoquic_packet_header* ph, int rxtx, void* ptr)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(time);
+    UNREFERENCED_PARAMETER(path_id);
+    UNREFERENCED_PARAMETER(size);
+    UNREFERENCED_PARAMETER(ph);
+    UNREFERENCED_PARAMETER(rxtx);
+    UNREFERENCED_PARAMETER(ptr);
+#endif
+    return 0;
+}
+
+static int binlog_lost_count_frame(bytestream* s, void* ptr)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(s);
+    UNREFERENCED_PARAMETER(ptr);
+#endif
+    return 0;
+}
+
+static int binlog_lost_count_end(void* ptr)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(ptr);
+#endif
+    return 0;
+}
+
+static int binlog_lost_count_cnx_end(uint64_t time, void* ptr)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(time);
+    UNREFERENCED_PARAMETER(ptr);
+#endif
+    return 0;
+}
+
+static int binlog_lost_count_lost(uint64_t time, uint64_t path_id, bytestream* s, void* ptr)
+{
+    uint64_t ptype = 0;
+    int ret = byteread_vint(s, &ptype);
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(time);
+    UNREFERENCED_PARAMETER(path_id);
+#endif
+
+    if (ret == 0 && ptype == picoquic_packet_1rtt_protected) {
+        (*(uint64_t*)ptr)++;
+    }
+
+    return ret;
+}
+
+static int binlog_lost_count(char const* binlog_name, const picoquic_connection_id_t* cid, uint64_t* nb_lost)
+{
+    int ret = 0;
+    uint64_t log_time = 0;
+    uint16_t flags;
+    FILE* f_binlog = picoquic_open_cc_log_file_for_read(binlog_name, &flags, &log_time);
+
+    *nb_lost = 0;
+
+    if (f_binlog == NULL) {
+        ret = -1;
+    }
+    else {
+        binlog_convert_cb_t callbacks;
+
+        callbacks.connection_start = binlog_lost_count_start;
+        callbacks.connection_end = binlog_lost_count_cnx_end;
+        callbacks.alpn_update = binlog_lost_count_ignore;
+        callbacks.param_update = binlog_lost_count_ignore;
+        callbacks.pdu = binlog_lost_count_pdu;
+        callbacks.packet_start = binlog_lost_count_packet_start;
+        callbacks.packet_frame = binlog_lost_count_frame;
+        callbacks.packet_end = binlog_lost_count_end;
+        callbacks.packet_lost = binlog_lost_count_lost;
+        callbacks.packet_dropped = binlog_lost_count_ignore_path;
+        callbacks.packet_buffered = binlog_lost_count_ignore_path;
+        callbacks.cc_update = binlog_lost_count_ignore_path;
+        callbacks.info_message = binlog_lost_count_ignore;
+        callbacks.ptr = nb_lost;
+
+        ret = binlog_convert(f_binlog, cid, &callbacks);
+        picoquic_file_close(f_binlog);
+    }
+
+    return ret;
+}
+
+int binlog_replay_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_connection_id_t initial_cid = { {0xbe, 0x9a, 2, 3, 4, 5, 6, 7}, 8 };
+    picoquic_replay_stats_t stats;
+    uint64_t nb_lost_logged = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = -1;
+    }
+
+    (void)picoquic_file_delete(BINLOG_REPLAY_BIN, NULL);
+
+    if (ret == 0) {
+        picoquic_set_binlog(test_ctx->qserver, ".");
+        /* Re-create the client connection, using the required initial connection ID */
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+            initial_cid, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, 0,
+            PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+        if (test_ctx->cnx_client == NULL) {
+            ret = -1;
+        }
+        else {
+            ret = tls_api_one_scenario_body(test_ctx, &simulated_time,
+                test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2), 0, 0x00004281, 0, 20000, 2000000);
+        }
+    }
+
+    /* Free the resource, which will close the log file. */
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    if (ret == 0) {
+        uint64_t log_time = 0;
+        uint16_t flags;
+        FILE* f_binlog = picoquic_open_cc_log_file_for_read(BINLOG_REPLAY_BIN, &flags, &log_time);
+        if (f_binlog == NULL) {
+            ret = -1;
+        }
+        else {
+            ret = picoquic_binlog_replay(f_binlog, &initial_cid, NULL, &stats);
+            picoquic_file_close(f_binlog);
+            if (ret != 0) {
+                DBG_PRINTF("Replay returns %d\n", ret);
+            }
+        }
+    }
+
+    if (ret == 0 && (ret = binlog_lost_count(BINLOG_REPLAY_BIN, &initial_cid, &nb_lost_logged)) != 0) {
+        DBG_PRINTF("Cannot count the losses in the log, ret = %d\n", ret);
+    }
+
+    if (ret == 0) {
+        if (stats.nb_packets_received == 0 || stats.nb_packets_sent == 0 || stats.nb_packets_skipped == 0) {
+            DBG_PRINTF("Replayed %" PRIu64 " received, %" PRIu64 " sent, %" PRIu64 " skipped\n",
+                stats.nb_packets_received, stats.nb_packets_sent, stats.nb_packets_skipped);
+            ret = -1;
+        }
+        else if (stats.nb_decode_errors != 0) {
+            DBG_PRINTF("Replay finds %" PRIu64 " decode errors\n", stats.nb_decode_errors);
+            ret = -1;
+        }
+        else if (stats.nb_cc_updates == 0 || stats.nb_cc_divergences * 2 > stats.nb_cc_updates) {
+            /* Observed: 13 divergences in 31 updates. The first ones happen before the
+             * first replayed RTT sample, the others when the original sender was
+             * application limited and did not grow the window. */
+            DBG_PRINTF("Replay finds %" PRIu64 " divergences in %" PRIu64 " updates, first at %" PRIu64 "\n",
+                stats.nb_cc_divergences, stats.nb_cc_updates, stats.first_divergence_time);
+            ret = -1;
+        }
+        else if (nb_lost_logged == 0 || stats.nb_packets_lost != nb_lost_logged) {
+            DBG_PRINTF("Replay finds %" PRIu64 " lost packets, log has %" PRIu64 "\n",
+                stats.nb_packets_lost, nb_lost_logged);
+            ret = -1;
         }
     }
 
     return ret;
 }
 
-int qlog_trace_test()
-{
-    return qlog_trace_test_one(0, 1, 0);
-}
-
-int qlog_trace_only_test()
-{
-    return qlog_trace_test_one(1, 0, 0);
-}
-
-int qlog_trace_auto_test()
-{
-    return qlog_trace_test_one(1, 1, 0);
-}
-
-int qlog_trace_ecn_test()
-{
-    return qlog_trace_test_one(0, 1, 0x02);
-}
-
 /*
  * Test of the performance log production
  */
@@ -10461,108 +11739,454 @@ int initial_race_test()
         ret = tls_api_one_scenario_verify(test_ctx);
     }
 
-    if (ret == 0) {
-        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+
+        if (ret != 0)
+        {
+            DBG_PRINTF("Connection close returns %d\n", ret);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/* Test of the pacing functions.
+ */
+
+int pacing_test()
+{
+    /* Create a connection so as to instantiate the pacing context */
+    int ret = 0;
+    uint64_t current_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in saddr;
+    const uint64_t test_byte_per_sec = 1250000;
+    const uint64_t test_quantum = 0x4000;
+    int nb_sent = 0;
+    int nb_round = 0;
+    const int nb_target = 10000;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            current_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Set pacing parameters to specified value */
+        picoquic_update_pacing_rate(cnx, cnx->path[0], (double)test_byte_per_sec, test_quantum);
+        /* Run a loop of N tests based on next wake time. */
+        while (ret == 0 && nb_sent < nb_target) {
+            nb_round++;
+            if (nb_round > 4 * nb_target) {
+                DBG_PRINTF("Pacing needs more that %d rounds for %d packets", nb_round, nb_target);
+                ret = -1;
+            }
+            else {
+                uint64_t next_time = current_time + 10000000;
+                if (picoquic_is_sending_authorized_by_pacing(cnx, cnx->path[0], current_time, &next_time)) {
+                    nb_sent++;
+                    picoquic_update_pacing_after_send(cnx->path[0], current_time);
+                }
+                else {
+                    if (current_time < next_time) {
+                        current_time = next_time;
+                    }
+                    else {
+                        DBG_PRINTF("Pacing next = %" PRIu64", current = %d" PRIu64, next_time, current_time);
+                        ret = -1;
+                    }
+                }
+            }
+        }
+
+        /* Verify that the total send time matches expectations */
+        if (ret == 0) {
+            uint64_t volume_sent = ((uint64_t)nb_target) * cnx->path[0]->send_mtu;
+            uint64_t time_max = ((volume_sent * 1000000) / test_byte_per_sec) + 1;
+            uint64_t time_min = (((volume_sent - test_quantum) * 1000000) / test_byte_per_sec) + 1;
+
+            if (current_time > time_max) {
+                DBG_PRINTF("Pacing used = %" PRIu64", expected max = %d" PRIu64, current_time, time_max);
+                ret = -1;
+            }
+            else if (current_time < time_min) {
+                DBG_PRINTF("Pacing used = %" PRIu64", expected min = %d" PRIu64, current_time, time_min);
+                ret = -1;
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/* Test of the pacing precision at high data rates.
+ * The loop sends packets as soon as pacing authorizes them, and otherwise
+ * jumps to the next wake time. The average inter-packet gap is compared to
+ * the packet transmission time at the target rate, and the number of
+ * wakeups is checked against the coalescing slack if one is set. Precise
+ * wait times are enabled by setting a busy poll threshold.
+ */
+
+static int pacing_gap_test_one(uint64_t test_byte_per_sec, uint64_t slack)
+{
+    int ret = 0;
+    uint64_t current_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in saddr;
+    const int nb_target = 100000;
+    int nb_sent = 0;
+    int nb_wakes = 0;
+    int nb_burst = 0;
+    int max_burst = 0;
+    uint64_t first_send_time = 0;
+    uint64_t last_send_time = 0;
+
+    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = 1000;
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        picoquic_set_wake_coalescing_slack(quic, slack);
+        picoquic_set_busy_poll_threshold(quic, 50);
+        cnx = picoquic_create_cnx(quic,
+            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
+            current_time, 0, "test-sni", "test-alpn", 1);
+
+        if (cnx == NULL) {
+            DBG_PRINTF("%s", "Cannot create connection\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_path_t* path_x = cnx->path[0];
+        uint64_t quantum = 16 * (uint64_t)path_x->send_mtu;
+
+        picoquic_update_pacing_rate(cnx, path_x, (double)test_byte_per_sec, quantum);
+
+        while (ret == 0 && nb_sent < nb_target) {
+            uint64_t next_time = current_time + 10000000;
+            if (picoquic_is_sending_authorized_by_pacing(cnx, path_x, current_time, &next_time)) {
+                if (nb_sent == 0) {
+                    first_send_time = current_time;
+                }
+                last_send_time = current_time;
+                nb_sent++;
+                nb_burst++;
+                picoquic_update_pacing_after_send(path_x, current_time);
+            }
+            else if (current_time < next_time) {
+                current_time = next_time;
+                nb_wakes++;
+                if (nb_burst > max_burst) {
+                    max_burst = nb_burst;
+                }
+                nb_burst = 0;
+            }
+            else {
+                DBG_PRINTF("Pacing next = %" PRIu64 ", current = %" PRIu64 "\n", next_time, current_time);
+                ret = -1;
+            }
+        }
+
+        if (ret == 0) {
+            /* Average gap in nanoseconds, versus packet time at the target rate */
+            double gap = ((double)(last_send_time - first_send_time) * 1000.0) / (double)(nb_sent - 1);
+            double target_gap = ((double)path_x->send_mtu * 1000000000.0) / (double)test_byte_per_sec;
+            int64_t slack_nanosec = (int64_t)slack * 1000;
+            int burst_max = (int)((path_x->pacing_bucket_max + slack_nanosec) / path_x->pacing_packet_time_nanosec) + 2;
+
+            if (gap > target_gap * 1.01 || gap < target_gap * 0.99) {
+                DBG_PRINTF("Rate %" PRIu64 ", average gap %f ns, expected %f ns\n", test_byte_per_sec, gap, target_gap);
+                ret = -1;
+            }
+            else if (max_burst > burst_max) {
+                DBG_PRINTF("Rate %" PRIu64 ", burst of %d packets, expected max %d\n", test_byte_per_sec, max_burst, burst_max);
+                ret = -1;
+            }
+            else if (slack > 0 && (uint64_t)nb_wakes > (last_send_time - first_send_time) / slack + 1) {
+                DBG_PRINTF("Rate %" PRIu64 ", %d wakeups in %" PRIu64 " us with slack %" PRIu64 "\n",
+                    test_byte_per_sec, nb_wakes, last_send_time - first_send_time, slack);
+                ret = -1;
+            }
+        }
+    }
+
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+int pacing_gap_test()
+{
+    /* 1, 10 and 40 Gbps */
+    const uint64_t test_rates[] = { 125000000ull, 1250000000ull, 5000000000ull };
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < sizeof(test_rates) / sizeof(uint64_t); i++) {
+        ret = pacing_gap_test_one(test_rates[i], 0);
+    }
+
+    return ret;
+}
+
+int pacing_coalescing_test()
+{
+    const uint64_t test_rates[] = { 125000000ull, 1250000000ull, 5000000000ull };
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < sizeof(test_rates) / sizeof(uint64_t); i++) {
+        ret = pacing_gap_test_one(test_rates[i], 20);
+    }
+
+    return ret;
+}
+
+/* Simulation of coalesced wakeups. A set of client connections is started
+ * with wake times spread a few microseconds apart. The loop wakes at the
+ * earliest wake time, and prepares packets until no connection is due
+ * within the slack. Each connection must be served no later than its wake
+ * time and no more than the slack ahead of it, and the number of wakeups
+ * must reflect the coalescing.
+ */
+
+#define WAKE_COALESCING_TEST_NB_CNX 10
+#define WAKE_COALESCING_TEST_STEP 5
+#define WAKE_COALESCING_TEST_SLACK 20
+
+int wake_coalescing_test()
+{
+    int ret = 0;
+    uint64_t current_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx[WAKE_COALESCING_TEST_NB_CNX];
+    uint64_t wake_time[WAKE_COALESCING_TEST_NB_CNX];
+    int is_served[WAKE_COALESCING_TEST_NB_CNX];
+    struct sockaddr_in saddr;
+    uint8_t send_buffer[PICOQUIC_MAX_PACKET_SIZE];
+    int nb_served = 0;
+    int nb_wakes = 0;
+
+    memset(cnx, 0, sizeof(cnx));
+    memset(is_served, 0, sizeof(is_served));
+    memset(&saddr, 0, sizeof(struct sockaddr_in));
+    saddr.sin_family = AF_INET;
+
+    quic = picoquic_create(WAKE_COALESCING_TEST_NB_CNX, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
+    if (quic == NULL) {
+        DBG_PRINTF("%s", "Cannot create QUIC context\n");
+        ret = -1;
+    }
+    else {
+        picoquic_set_wake_coalescing_slack(quic, WAKE_COALESCING_TEST_SLACK);
+        for (int i = 0; ret == 0 && i < WAKE_COALESCING_TEST_NB_CNX; i++) {
+            saddr.sin_port = (uint16_t)(1000 + i);
+            cnx[i] = picoquic_create_cnx(quic,
+                picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*)&saddr,
+                current_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+            if (cnx[i] == NULL || picoquic_start_client_cnx(cnx[i]) != 0) {
+                DBG_PRINTF("Cannot start connection %d\n", i);
+                ret = -1;
+            }
+            else {
+                wake_time[i] = 1000 + i * WAKE_COALESCING_TEST_STEP;
+                picoquic_reinsert_by_wake_time(quic, cnx[i], wake_time[i]);
+            }
+        }
+    }
+
+    while (ret == 0 && nb_served < WAKE_COALESCING_TEST_NB_CNX && nb_wakes < 2 * WAKE_COALESCING_TEST_NB_CNX) {
+        current_time = picoquic_get_next_wake_time(quic, current_time);
+        nb_wakes++;
+        while (ret == 0) {
+            size_t send_length = 0;
+            struct sockaddr_storage addr_to;
+            struct sockaddr_storage addr_from;
+            int if_index = 0;
+            picoquic_cnx_t* last_cnx = NULL;
+
+            ret = picoquic_prepare_next_packet_ex(quic, current_time, send_buffer, sizeof(send_buffer), &send_length,
+                &addr_to, &addr_from, &if_index, NULL, &last_cnx, NULL);
+            if (ret != 0 || send_length == 0) {
+                break;
+            }
+            for (int i = 0; i < WAKE_COALESCING_TEST_NB_CNX; i++) {
+                if (cnx[i] == last_cnx && !is_served[i]) {
+                    is_served[i] = 1;
+                    nb_served++;
+                    if (wake_time[i] < current_time || wake_time[i] > current_time + WAKE_COALESCING_TEST_SLACK) {
+                        DBG_PRINTF("Connection %d due at %" PRIu64 ", served at %" PRIu64 "\n",
+                            i, wake_time[i], current_time);
+                        ret = -1;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    if (ret == 0 && nb_served != WAKE_COALESCING_TEST_NB_CNX) {
+        DBG_PRINTF("Only %d connections served in %d wakeups\n", nb_served, nb_wakes);
+        ret = -1;
+    }
 
-        if (ret != 0)
-        {
-            DBG_PRINTF("Connection close returns %d\n", ret);
-        }
+    if (ret == 0 && nb_wakes > ((WAKE_COALESCING_TEST_NB_CNX - 1) * WAKE_COALESCING_TEST_STEP) / WAKE_COALESCING_TEST_SLACK + 1) {
+        DBG_PRINTF("%d wakeups for %d connections\n", nb_wakes, WAKE_COALESCING_TEST_NB_CNX);
+        ret = -1;
     }
 
-    if (test_ctx != NULL) {
-        tls_api_delete_ctx(test_ctx);
-        test_ctx = NULL;
+    if (quic != NULL) {
+        picoquic_free(quic);
     }
 
     return ret;
 }
 
-/* Test of the pacing functions.
+/* Test of batched wakeups. Start a set of client connections at the same
+ * time, so they are all due in the first wakeup, and verify that each batch
+ * stays within the packet budget, that the first batch serves distinct
+ * connections, and that all connections are back in the wake tree once
+ * their initial packets are sent.
  */
 
-int pacing_test()
+#define WAKE_BATCH_TEST_NB_CNX 10
+#define WAKE_BATCH_TEST_BUDGET 4
+
+int wake_batch_test()
 {
-    /* Create a connection so as to instantiate the pacing context */
     int ret = 0;
     uint64_t current_time = 0;
     picoquic_quic_t* quic = NULL;
-    picoquic_cnx_t* cnx = NULL;
+    picoquic_cnx_t* cnx[WAKE_BATCH_TEST_NB_CNX];
     struct sockaddr_in saddr;
-    const uint64_t test_byte_per_sec = 1250000;
-    const uint64_t test_quantum = 0x4000;
-    int nb_sent = 0;
-    int nb_round = 0;
-    const int nb_target = 10000;
-
-    quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL,
-        NULL, NULL, NULL, NULL, current_time,
-        &current_time, NULL, NULL, 0);
+    uint8_t send_buffer[PICOQUIC_MAX_PACKET_SIZE];
+    int nb_batches = 0;
 
+    memset(cnx, 0, sizeof(cnx));
     memset(&saddr, 0, sizeof(struct sockaddr_in));
     saddr.sin_family = AF_INET;
     saddr.sin_port = 1000;
 
+    quic = picoquic_create(WAKE_BATCH_TEST_NB_CNX, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, current_time,
+        &current_time, NULL, NULL, 0);
+
     if (quic == NULL) {
         DBG_PRINTF("%s", "Cannot create QUIC context\n");
         ret = -1;
     }
     else {
-        cnx = picoquic_create_cnx(quic,
-            picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*) & saddr,
-            current_time, 0, "test-sni", "test-alpn", 1);
-
-        if (cnx == NULL) {
-            DBG_PRINTF("%s", "Cannot create connection\n");
-            ret = -1;
+        picoquic_set_wake_batch_budget(quic, 0, WAKE_BATCH_TEST_BUDGET);
+        for (int i = 0; ret == 0 && i < WAKE_BATCH_TEST_NB_CNX; i++) {
+            saddr.sin_port = (uint16_t)(1000 + i);
+            cnx[i] = picoquic_create_cnx(quic,
+                picoquic_null_connection_id, picoquic_null_connection_id, (struct sockaddr*)&saddr,
+                current_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+            if (cnx[i] == NULL || picoquic_start_client_cnx(cnx[i]) != 0) {
+                DBG_PRINTF("Cannot start connection %d\n", i);
+                ret = -1;
+            }
         }
     }
 
-    if (ret == 0) {
-        /* Set pacing parameters to specified value */
-        picoquic_update_pacing_rate(cnx, cnx->path[0], (double)test_byte_per_sec, test_quantum);
-        /* Run a loop of N tests based on next wake time. */
-        while (ret == 0 && nb_sent < nb_target) {
-            nb_round++;
-            if (nb_round > 4 * nb_target) {
-                DBG_PRINTF("Pacing needs more that %d rounds for %d packets", nb_round, nb_target);
+    while (ret == 0 && nb_batches < 64) {
+        picoquic_cnx_t* served[WAKE_BATCH_TEST_BUDGET + 1];
+        int nb_sent = 0;
+
+        nb_batches++;
+        while (ret == 0) {
+            size_t send_length = 0;
+            struct sockaddr_storage addr_to;
+            struct sockaddr_storage addr_from;
+            int if_index = 0;
+            picoquic_cnx_t* last_cnx = NULL;
+
+            ret = picoquic_prepare_next_packet_ex(quic, current_time, send_buffer, sizeof(send_buffer), &send_length,
+                &addr_to, &addr_from, &if_index, NULL, &last_cnx, NULL);
+            if (ret != 0 || send_length == 0) {
+                break;
+            }
+            if (nb_sent >= WAKE_BATCH_TEST_BUDGET) {
+                DBG_PRINTF("Batch %d exceeds budget of %d packets\n", nb_batches, WAKE_BATCH_TEST_BUDGET);
                 ret = -1;
             }
             else {
-                uint64_t next_time = current_time + 10000000;
-                if (picoquic_is_sending_authorized_by_pacing(cnx, cnx->path[0], current_time, &next_time)) {
-                    nb_sent++;
-                    picoquic_update_pacing_after_send(cnx->path[0], current_time);
-                }
-                else {
-                    if (current_time < next_time) {
-                        current_time = next_time;
-                    }
-                    else {
-                        DBG_PRINTF("Pacing next = %" PRIu64", current = %d" PRIu64, next_time, current_time);
+                served[nb_sent] = last_cnx;
+                for (int j = 0; nb_batches == 1 && j < nb_sent; j++) {
+                    if (served[j] == last_cnx) {
+                        DBG_PRINTF("%s", "Connection served twice in first batch\n");
                         ret = -1;
                     }
                 }
+                nb_sent++;
             }
         }
+        if (nb_sent == 0) {
+            break;
+        }
+    }
 
-        /* Verify that the total send time matches expectations */
-        if (ret == 0) {
-            uint64_t volume_sent = ((uint64_t)nb_target) * cnx->path[0]->send_mtu;
-            uint64_t time_max = ((volume_sent * 1000000) / test_byte_per_sec) + 1;
-            uint64_t time_min = (((volume_sent - test_quantum) * 1000000) / test_byte_per_sec) + 1;
-
-            if (current_time > time_max) {
-                DBG_PRINTF("Pacing used = %" PRIu64", expected max = %d" PRIu64, current_time, time_max);
-                ret = -1;
-            }
-            else if (current_time < time_min) {
-                DBG_PRINTF("Pacing used = %" PRIu64", expected min = %d" PRIu64, current_time, time_min);
-                ret = -1;
-            }
+    for (int i = 0; ret == 0 && i < WAKE_BATCH_TEST_NB_CNX; i++) {
+        if (cnx[i]->nb_packets_sent == 0 || cnx[i]->is_in_wake_batch) {
+            DBG_PRINTF("Connection %d, sent %" PRIu64 ", in batch: %d\n", i,
+                cnx[i]->nb_packets_sent, cnx[i]->is_in_wake_batch);
+            ret = -1;
         }
     }
 
+    if (ret == 0 && nb_batches < (WAKE_BATCH_TEST_NB_CNX + WAKE_BATCH_TEST_BUDGET - 1) / WAKE_BATCH_TEST_BUDGET) {
+        DBG_PRINTF("Only %d batches\n", nb_batches);
+        ret = -1;
+    }
+
+    if (ret == 0 && picoquic_get_next_wake_time(quic, current_time) <= current_time) {
+        DBG_PRINTF("%s", "Connections still due after the last batch\n");
+        ret = -1;
+    }
+
     if (quic != NULL) {
         picoquic_free(quic);
     }
@@ -11881,7 +13505,9 @@ typedef enum {
     bdp_test_option_ip,
     bdp_test_option_delay,
     bdp_test_option_reno,
-    bdp_test_option_cubic
+    bdp_test_option_cubic,
+    bdp_test_option_prague,
+    bdp_test_option_hystart_pp
 } bdp_test_option_enum;
 
 int bdp_option_test_one(bdp_test_option_enum bdp_test_option)
@@ -11955,6 +13581,15 @@ int bdp_option_test_one(bdp_test_option_enum bdp_test_option)
                 ccalgo = picoquic_cubic_algorithm;
                 max_completion_time = 10000000;
             }
+            else if (bdp_test_option == bdp_test_option_prague) {
+                ccalgo = picoquic_prague_algorithm;
+                max_completion_time = 10000000;
+            }
+            else if (bdp_test_option == bdp_test_option_hystart_pp) {
+                ccalgo = picoquic_newreno_algorithm;
+                max_completion_time = 8000000;
+                picoquic_set_default_hystart_pp(test_ctx->qserver, 1);
+            }
             picoquic_set_default_congestion_algorithm(test_ctx->qserver, ccalgo);
             picoquic_set_congestion_algorithm(test_ctx->cnx_client, ccalgo);
             picoquic_set_default_bdp_frame_option(test_ctx->qclient, 1);
@@ -11996,6 +13631,7 @@ int bdp_option_test_one(bdp_test_option_enum bdp_test_option)
                     if (test_ctx->cnx_server->nb_retransmission_total * 10 >
                         test_ctx->cnx_server->nb_packets_sent &&
                         bdp_test_option != bdp_test_option_cubic &&
+                        bdp_test_option != bdp_test_option_prague &&
                         bdp_test_option != bdp_test_option_delay &&
                         bdp_test_option != bdp_test_option_ip) {
                         DBG_PRINTF("BDP RTT test (bdp test: %d), cnx %d, too many losses, %"PRIu64"/%"PRIu64".\n",
@@ -12012,7 +13648,9 @@ int bdp_option_test_one(bdp_test_option_enum bdp_test_option)
                     }
                     else if (bdp_test_option == bdp_test_option_basic ||
                         bdp_test_option == bdp_test_option_reno ||
-                        bdp_test_option == bdp_test_option_cubic) {
+                        bdp_test_option == bdp_test_option_cubic ||
+                        bdp_test_option == bdp_test_option_prague ||
+                        bdp_test_option == bdp_test_option_hystart_pp) {
                         if (!test_ctx->cnx_server->cwin_notified_from_seed) {
                             DBG_PRINTF("BDP RTT test (bdp test: %d), cnx %d, cwin not seed on server.\n",
                                 bdp_test_option, i);
@@ -12079,11 +13717,265 @@ int bdp_reno_test()
     return bdp_option_test_one(bdp_test_option_reno);
 }
 
+int bdp_prague_test()
+{
+    return bdp_option_test_one(bdp_test_option_prague);
+}
+
+int bdp_hystart_pp_test()
+{
+    return bdp_option_test_one(bdp_test_option_hystart_pp);
+}
+
 int bdp_cubic_test()
 {
     return bdp_option_test_one(bdp_test_option_cubic);
 }
 
+/* Time to first megabyte on a resumed connection.
+ * Each run primes the ticket store with a first connection, then measures
+ * how long a resumed connection takes to download 1 MB over a 20 Mbps,
+ * 600 ms RTT path. The seeded run uses the BDP frame with HyStart++ and
+ * careful resume, the reference run leaves the BDP option off and starts
+ * from the initial window. The seeded run must save at least a quarter
+ * of the reference time; the analytical estimate is about half, since
+ * the reference needs 7 slow start rounds to move 1 MB.
+ */
+
+static int resume_first_mb_one(int use_seed, uint64_t* first_mb_time)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint64_t latency = 300000ull;
+    picoquic_connection_id_t initial_cid = { {0x1f, 0x3b, 0, 0, 0, 0, 0, 0}, 8 };
+    picoquic_tp_t server_parameters;
+    picoquic_tp_t client_parameters;
+    int ret = picoquic_save_tickets(NULL, simulated_time, ticket_file_name);
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        initial_cid.id[2] = i;
+        initial_cid.id[3] = (uint8_t)use_seed;
+        ret = tls_api_init_ctx_ex(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time,
+            ticket_file_name, NULL, 0, 1, 0, &initial_cid);
+        if (ret == 0) {
+            test_ctx->c_to_s_link->microsec_latency = latency;
+            test_ctx->s_to_c_link->microsec_latency = latency;
+            test_ctx->c_to_s_link->picosec_per_byte = (1000000ull * 8) / 20;
+            test_ctx->s_to_c_link->picosec_per_byte = (1000000ull * 8) / 20;
+            picoquic_set_default_congestion_algorithm(test_ctx->qserver, picoquic_newreno_algorithm);
+            picoquic_set_congestion_algorithm(test_ctx->cnx_client, picoquic_newreno_algorithm);
+            picoquic_set_default_bdp_frame_option(test_ctx->qclient, use_seed);
+            picoquic_set_default_bdp_frame_option(test_ctx->qserver, use_seed);
+            if (use_seed) {
+                picoquic_set_default_hystart_pp(test_ctx->qserver, 1);
+            }
+            picoquic_init_transport_parameters(&server_parameters, 0);
+            picoquic_init_transport_parameters(&client_parameters, 1);
+            server_parameters.enable_bdp_frame = use_seed;
+            client_parameters.enable_bdp_frame = use_seed;
+            client_parameters.initial_max_stream_data_bidi_remote = 1000000;
+            client_parameters.initial_max_data = 10000000;
+            picoquic_set_transport_parameters(test_ctx->cnx_client, &client_parameters);
+            ret = picoquic_set_default_tp(test_ctx->qserver, &server_parameters);
+        }
+
+        if (ret == 0) {
+            ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 2 * latency);
+        }
+        if (ret == 0) {
+            ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
+        }
+        if (ret == 0) {
+            ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+        }
+        if (ret == 0 && i == 1) {
+            *first_mb_time = simulated_time - test_ctx->cnx_client->start_time;
+            if (use_seed && !test_ctx->cnx_server->cwin_notified_from_seed) {
+                DBG_PRINTF("%s", "Resumed connection did not seed the cwin.\n");
+                ret = -1;
+            }
+            else if (!use_seed && test_ctx->cnx_server->cwin_notified_from_seed) {
+                DBG_PRINTF("%s", "Unexpected cwin seed without BDP option.\n");
+                ret = -1;
+            }
+        }
+        if (ret == 0) {
+            ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 10000000);
+        }
+        if (ret == 0) {
+            if (test_ctx->qclient->p_first_ticket == NULL) {
+                DBG_PRINTF("Resume first MB test, cnx %d, no ticket received.\n", i);
+                ret = -1;
+            }
+            else {
+                ret = picoquic_save_tickets(test_ctx->qclient->p_first_ticket, simulated_time, ticket_file_name);
+            }
+        }
+        if (test_ctx != NULL) {
+            tls_api_delete_ctx(test_ctx);
+            test_ctx = NULL;
+        }
+    }
+
+    return ret;
+}
+
+int resume_first_mb_test()
+{
+    uint64_t seeded_time = 0;
+    uint64_t reference_time = 0;
+    int ret = resume_first_mb_one(0, &reference_time);
+
+    if (ret == 0) {
+        ret = resume_first_mb_one(1, &seeded_time);
+    }
+
+    if (ret == 0 && seeded_time * 4 > reference_time * 3) {
+        DBG_PRINTF("First MB in %" PRIu64 " us with seed, %" PRIu64 " us without.\n",
+            seeded_time, reference_time);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Upload time on a new origin, with and without the client path cache.
+ * A first connection uploads 4 MB over a 20 Mbps, 600 ms RTT path, long
+ * enough for the client to exit slow start and fill the cache. The client
+ * tickets are then dropped, so the second connection is handled as a fetch
+ * from a new origin: it cannot be seeded from a ticket or a BDP frame. The
+ * time to upload 1 MB on that connection is measured. The path cache only
+ * seeds the congestion window of the client, so only the upload direction
+ * benefits; the seeded run must save at least a quarter of the reference
+ * time.
+ */
+
+static test_api_stream_desc_t test_scenario_upload_4mb[] = {
+    { 4, 0, 1000000, 257 },
+    { 8, 0, 1000000, 257 },
+    { 12, 0, 1000000, 257 },
+    { 16, 0, 1000000, 257 }
+};
+
+static test_api_stream_desc_t test_scenario_upload_1mb[] = {
+    { 4, 0, 1000000, 257 }
+};
+
+static int path_bdp_upload_one(int use_cache, uint64_t* upload_time)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint64_t latency = 300000ull;
+    picoquic_connection_id_t initial_cid = { {0x9b, 0xd9, 0, 0, 0, 0, 0, 0}, 8 };
+    picoquic_tp_t server_parameters;
+    picoquic_tp_t client_parameters;
+    int ret;
+
+    initial_cid.id[2] = (uint8_t)use_cache;
+    ret = tls_api_init_ctx_ex(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time,
+        NULL, NULL, 0, 1, 0, &initial_cid);
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        if (i == 1) {
+            /* Start a connection to a new origin: no ticket, same network path */
+            while (test_ctx->qclient->cnx_list != NULL) {
+                picoquic_delete_cnx(test_ctx->qclient->cnx_list);
+            }
+            test_ctx->cnx_server = NULL;
+            picoquic_free_tickets(&test_ctx->qclient->p_first_ticket);
+            initial_cid.id[3] = 1;
+            test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient, initial_cid, picoquic_null_connection_id,
+                (struct sockaddr*)&test_ctx->server_addr, simulated_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+            if (test_ctx->cnx_client == NULL) {
+                ret = -1;
+                break;
+            }
+        }
+        else {
+            test_ctx->c_to_s_link->microsec_latency = latency;
+            test_ctx->s_to_c_link->microsec_latency = latency;
+            test_ctx->c_to_s_link->picosec_per_byte = (1000000ull * 8) / 20;
+            test_ctx->s_to_c_link->picosec_per_byte = (1000000ull * 8) / 20;
+            picoquic_set_default_congestion_algorithm(test_ctx->qserver, picoquic_newreno_algorithm);
+            picoquic_set_default_congestion_algorithm(test_ctx->qclient, picoquic_newreno_algorithm);
+            if (use_cache) {
+                ret = picoquic_set_path_bdp_cache(test_ctx->qclient, PICOQUIC_PATH_BDP_CACHE_LIFETIME_DEFAULT);
+            }
+            picoquic_init_transport_parameters(&server_parameters, 0);
+            server_parameters.initial_max_stream_data_bidi_remote = 4000000;
+            server_parameters.initial_max_data = 20000000;
+            if (ret == 0) {
+                ret = picoquic_set_default_tp(test_ctx->qserver, &server_parameters);
+            }
+        }
+        if (ret == 0) {
+            picoquic_init_transport_parameters(&client_parameters, 1);
+            picoquic_set_transport_parameters(test_ctx->cnx_client, &client_parameters);
+            picoquic_set_congestion_algorithm(test_ctx->cnx_client, picoquic_newreno_algorithm);
+            ret = tls_api_one_scenario_body_connect(test_ctx, &simulated_time, 0, 0, 2 * latency);
+        }
+        if (ret == 0) {
+            if (i == 0) {
+                ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_upload_4mb, sizeof(test_scenario_upload_4mb));
+            }
+            else {
+                ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_upload_1mb, sizeof(test_scenario_upload_1mb));
+            }
+        }
+        if (ret == 0) {
+            ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+        }
+        if (ret == 0 && i == 1) {
+            *upload_time = simulated_time - test_ctx->cnx_client->start_time;
+            if (use_cache && !test_ctx->cnx_client->cwin_notified_from_seed) {
+                DBG_PRINTF("%s", "New origin connection did not seed the client cwin.\n");
+                ret = -1;
+            }
+            else if (!use_cache && test_ctx->cnx_client->cwin_notified_from_seed) {
+                DBG_PRINTF("%s", "Unexpected client cwin seed without path cache.\n");
+                ret = -1;
+            }
+            else if (test_ctx->cnx_server->cwin_notified_from_seed) {
+                DBG_PRINTF("%s", "Unexpected server cwin seed.\n");
+                ret = -1;
+            }
+        }
+        if (ret == 0) {
+            ret = tls_api_one_scenario_body_verify(test_ctx, &simulated_time, 20000000);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int path_bdp_upload_test()
+{
+    uint64_t seeded_time = 0;
+    uint64_t reference_time = 0;
+    int ret = path_bdp_upload_one(0, &reference_time);
+
+    if (ret == 0) {
+        ret = path_bdp_upload_one(1, &seeded_time);
+    }
+
+    if (ret == 0) {
+        DBG_PRINTF("Upload of 1 MB in %" PRIu64 " us with path cache, %" PRIu64 " us without.\n",
+            seeded_time, reference_time);
+        if (seeded_time * 4 > reference_time * 3) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
 /* Test closing a connection with a specific error message.
  */
 
@@ -208,6 +208,7 @@ static int picowt_baton_test_one(
         tls_api_delete_ctx(test_ctx);
         test_ctx = NULL;
     }
+    h3zero_server_parameters_release(&server_param);
 
     return ret;
 }